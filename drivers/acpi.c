@@ -0,0 +1,263 @@
+#include "acpi.h"
+#include "paging.h"
+#include "types.h"
+
+/* Where the RSDP may be: the first KB of the EBDA and the BIOS ROM */
+#define BDA_EBDA_SEGMENT    0x040E
+#define BIOS_ROM_START      0x000E0000
+#define BIOS_ROM_END        0x00100000
+#define RSDP_ALIGN          16
+
+/* Tables of the RSDT that acpi_init maps and keeps */
+#define ACPI_MAX_TABLES     32
+
+/* MADT entry types */
+#define MADT_LOCAL_APIC     0
+#define MADT_IO_APIC        1
+#define MADT_OVERRIDE       2
+
+#define MADT_CPU_ENABLED    0x01
+#define MADT_PCAT_COMPAT    0x01
+
+/* MPS INTI flags: polarity in bits 0-1, trigger mode in bits 2-3 */
+#define MPS_POLARITY_LOW    0x03
+#define MPS_TRIGGER_LEVEL   0x0C
+
+struct acpi_rsdp {
+    char signature[8];
+    u8int checksum;
+    char oem_id[6];
+    u8int revision;
+    u32int rsdt_address;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    u32int lapic_address;
+    u32int flags;
+} __attribute__((packed));
+
+struct madt_entry {
+    u8int type;
+    u8int length;
+} __attribute__((packed));
+
+struct madt_local_apic {
+    struct madt_entry entry;
+    u8int processor_id;
+    u8int apic_id;
+    u32int flags;
+} __attribute__((packed));
+
+struct madt_io_apic {
+    struct madt_entry entry;
+    u8int id;
+    u8int reserved;
+    u32int address;
+    u32int gsi_base;
+} __attribute__((packed));
+
+struct madt_override {
+    struct madt_entry entry;
+    u8int bus;
+    u8int source;
+    u32int gsi;
+    u16int flags;
+} __attribute__((packed));
+
+static const struct acpi_sdt_header *rsdt = 0;
+static const struct acpi_sdt_header *tables[ACPI_MAX_TABLES];
+static u32int table_count = 0;
+static struct acpi_madt_info madt_info;
+static u8int madt_found = 0;
+
+static u8int acpi_checksum(const void *data, u32int len)
+{
+    const u8int *bytes = (const u8int *) data;
+    u8int sum = 0;
+    u32int i;
+
+    for (i = 0; i < len; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static u8int acpi_match(const char *a, const char *b, u32int len)
+{
+    u32int i;
+
+    for (i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** acpi_scan_rsdp:
+ * Looks for "RSD PTR " with a valid checksum on 16 byte boundaries
+ */
+static const struct acpi_rsdp *acpi_scan_rsdp(u32int start, u32int end)
+{
+    u32int addr;
+
+    for (addr = start; addr + sizeof(struct acpi_rsdp) <= end; addr += RSDP_ALIGN) {
+        const struct acpi_rsdp *rsdp = (const struct acpi_rsdp *) addr;
+
+        if (acpi_match(rsdp->signature, "RSD PTR ", 8) &&
+            acpi_checksum(rsdp, sizeof(*rsdp)) == 0) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+/** acpi_map_table:
+ * Maps a table header, then the whole table if it runs past the pages the
+ * header mapping covers. The mapping window is never reused, so each table
+ * is mapped once, by acpi_init.
+ */
+static const struct acpi_sdt_header *acpi_map_table(u32int phys)
+{
+    const struct acpi_sdt_header *header;
+    u32int mapped_end = (phys + sizeof(*header) + PAGING_PAGE_SIZE - 1) & ~(PAGING_PAGE_SIZE - 1);
+
+    header = (const struct acpi_sdt_header *) paging_map_physical(phys, sizeof(*header), PAGING_PRESENT);
+    if (header == 0 || header->length < sizeof(*header)) {
+        return 0;
+    }
+    if (phys + header->length > mapped_end) {
+        header = (const struct acpi_sdt_header *) paging_map_physical(phys, header->length, PAGING_PRESENT);
+    }
+    if (header == 0 || acpi_checksum(header, header->length) != 0) {
+        return 0;
+    }
+    return header;
+}
+
+/** acpi_map_tables:
+ * Maps every table the RSDT lists and keeps those with a valid checksum
+ */
+static void acpi_map_tables(void)
+{
+    const u32int *entries = (const u32int *) (rsdt + 1);
+    u32int count = (rsdt->length - sizeof(*rsdt)) / sizeof(u32int);
+    u32int i;
+
+    for (i = 0; i < count && table_count < ACPI_MAX_TABLES; i++) {
+        const struct acpi_sdt_header *table = acpi_map_table(entries[i]);
+
+        if (table != 0) {
+            tables[table_count++] = table;
+        }
+    }
+}
+
+const struct acpi_sdt_header *acpi_find_table(const char *signature)
+{
+    u32int i;
+
+    for (i = 0; i < table_count; i++) {
+        if (acpi_match(tables[i]->signature, signature, 4)) {
+            return tables[i];
+        }
+    }
+    return 0;
+}
+
+/** acpi_parse_madt:
+ * Collects processors, the first I/O APIC and the ISA IRQ overrides
+ */
+static void acpi_parse_madt(const struct acpi_madt *madt)
+{
+    u32int addr = (u32int) (madt + 1);
+    u32int end = (u32int) madt + madt->header.length;
+    u32int i;
+
+    madt_info.lapic_address = madt->lapic_address;
+    madt_info.has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+    // Identity mapped, edge triggered, active high unless overridden
+    for (i = 0; i < ACPI_ISA_IRQS; i++) {
+        madt_info.isa_gsi[i] = i;
+        madt_info.isa_flags[i] = 0;
+    }
+
+    while (addr + sizeof(struct madt_entry) <= end) {
+        const struct madt_entry *entry = (const struct madt_entry *) addr;
+
+        if (entry->length < sizeof(struct madt_entry) || addr + entry->length > end) {
+            break;
+        }
+        if (entry->type == MADT_LOCAL_APIC) {
+            const struct madt_local_apic *cpu = (const struct madt_local_apic *) entry;
+
+            if ((cpu->flags & MADT_CPU_ENABLED) && madt_info.cpu_count < ACPI_MAX_CPUS) {
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = cpu->apic_id;
+            }
+        } else if (entry->type == MADT_IO_APIC) {
+            const struct madt_io_apic *ioapic = (const struct madt_io_apic *) entry;
+
+            if (madt_info.ioapic_address == 0) {
+                madt_info.ioapic_address = ioapic->address;
+                madt_info.ioapic_id = ioapic->id;
+                madt_info.ioapic_gsi_base = ioapic->gsi_base;
+            }
+        } else if (entry->type == MADT_OVERRIDE) {
+            const struct madt_override *override = (const struct madt_override *) entry;
+
+            if (override->bus == 0 && override->source < ACPI_ISA_IRQS) {
+                u8int flags = 0;
+
+                if ((override->flags & MPS_POLARITY_LOW) == MPS_POLARITY_LOW) {
+                    flags |= ACPI_IRQ_ACTIVE_LOW;
+                }
+                if ((override->flags & MPS_TRIGGER_LEVEL) == MPS_TRIGGER_LEVEL) {
+                    flags |= ACPI_IRQ_LEVEL;
+                }
+                madt_info.isa_gsi[override->source] = override->gsi;
+                madt_info.isa_flags[override->source] = flags;
+            }
+        }
+        addr += entry->length;
+    }
+}
+
+u8int acpi_init(void)
+{
+    const struct acpi_rsdp *rsdp;
+    const struct acpi_sdt_header *madt;
+    u32int ebda = (u32int) *(volatile u16int *) BDA_EBDA_SEGMENT << 4;
+
+    rsdp = 0;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    if (rsdp == 0) {
+        rsdp = acpi_scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    }
+    if (rsdp == 0) {
+        return 0;
+    }
+
+    // The 32-bit RSDT is enough for a 32-bit kernel; ACPI 2.0 keeps it
+    rsdt = acpi_map_table(rsdp->rsdt_address);
+    if (rsdt == 0 || !acpi_match(rsdt->signature, "RSDT", 4)) {
+        rsdt = 0;
+        return 0;
+    }
+    acpi_map_tables();
+
+    madt = acpi_find_table("APIC");
+    if (madt == 0 || madt->length < sizeof(struct acpi_madt)) {
+        return 0;
+    }
+    acpi_parse_madt((const struct acpi_madt *) madt);
+    madt_found = 1;
+    return 1;
+}
+
+const struct acpi_madt_info *acpi_get_madt(void)
+{
+    return madt_found ? &madt_info : 0;
+}
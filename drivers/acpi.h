@@ -0,0 +1,63 @@
+#ifndef INCLUDE_ACPI_H
+#define INCLUDE_ACPI_H
+
+#include "types.h"
+
+#define ACPI_MAX_CPUS       16
+#define ACPI_ISA_IRQS       16
+
+/* Polarity and trigger bits of an interrupt source override */
+#define ACPI_IRQ_ACTIVE_LOW     0x01
+#define ACPI_IRQ_LEVEL          0x02
+
+/** Common header of every ACPI system description table */
+struct acpi_sdt_header {
+    char signature[4];
+    u32int length;
+    u8int revision;
+    u8int checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32int oem_revision;
+    u32int creator_id;
+    u32int creator_revision;
+} __attribute__((packed));
+
+/** What the MADT says about interrupt delivery */
+struct acpi_madt_info {
+    u32int lapic_address;
+    u32int cpu_count;                       /* enabled processors */
+    u8int cpu_apic_ids[ACPI_MAX_CPUS];
+    u32int ioapic_address;                  /* first I/O APIC, 0 if none */
+    u8int ioapic_id;
+    u32int ioapic_gsi_base;
+    u8int has_8259;                         /* PCAT_COMPAT: legacy PICs present */
+    u32int isa_gsi[ACPI_ISA_IRQS];          /* GSI each ISA IRQ is wired to */
+    u8int isa_flags[ACPI_ISA_IRQS];         /* ACPI_IRQ_* of each ISA IRQ */
+};
+
+/** acpi_init:
+ * Finds the RSDP in the BIOS areas, checks the RSDT, maps the tables it
+ * lists and parses the MADT. Call after paging_init.
+ *
+ * @return 1 if a valid MADT was found
+ */
+u8int acpi_init(void);
+
+/** acpi_find_table:
+ * Looks up a table in the RSDT. The tables are mapped once by acpi_init,
+ * so lookups map nothing.
+ *
+ * @param signature The four character signature, e.g. "APIC"
+ * @return The mapped table with a valid checksum, or 0
+ */
+const struct acpi_sdt_header *acpi_find_table(const char *signature);
+
+/** acpi_get_madt:
+ * Returns the parsed MADT
+ *
+ * @return The information, or 0 if acpi_init found none
+ */
+const struct acpi_madt_info *acpi_get_madt(void);
+
+#endif /* INCLUDE_ACPI_H */
@@ -0,0 +1,61 @@
+#ifndef INCLUDE_ATOMIC_H
+#define INCLUDE_ATOMIC_H
+
+#include "types.h"
+
+/** atomic_xchg:
+ * Stores value and returns what was there before, in one locked step.
+ * xchg with memory is always locked and is a full barrier.
+ *
+ * @param address The word to swap
+ * @param value   The new value
+ * @return The old value
+ */
+ALWAYS_INLINE u32int atomic_xchg(volatile u32int *address, u32int value)
+{
+    __asm__ volatile("xchgl %0, %1" : "+r"(value), "+m"(*address) : : "memory");
+    return value;
+}
+
+/** atomic_fetch_add:
+ * Adds to a word with lock xadd
+ *
+ * @param address The word to add to
+ * @param value   The amount to add
+ * @return The value before the addition
+ */
+ALWAYS_INLINE u32int atomic_fetch_add(volatile u32int *address, u32int value)
+{
+    __asm__ volatile("lock; xaddl %0, %1" : "+r"(value), "+m"(*address) : : "memory", "cc");
+    return value;
+}
+
+/** atomic_inc:
+ * Adds one to a word with a locked add
+ *
+ * @param address The word to increment
+ */
+ALWAYS_INLINE void atomic_inc(volatile u32int *address)
+{
+    __asm__ volatile("lock; incl %0" : "+m"(*address) : : "memory", "cc");
+}
+
+/** smp_mb:
+ * Full memory barrier. x86 may let a load pass an earlier store to a
+ * different address; a locked instruction orders both. mfence would need
+ * SSE2.
+ */
+ALWAYS_INLINE void smp_mb(void)
+{
+    __asm__ volatile("lock; addl $0, (%%esp)" : : : "memory", "cc");
+}
+
+/** cpu_relax:
+ * Spin-wait hint. pause is a plain nop before the Pentium 4.
+ */
+ALWAYS_INLINE void cpu_relax(void)
+{
+    __asm__ volatile("pause" : : : "memory");
+}
+
+#endif /* INCLUDE_ATOMIC_H */
@@ -0,0 +1,768 @@
+#include "bench.h"
+#include "atomic.h"
+#include "clock.h"
+#include "frame_buffer.h"
+#include "input_buffer.h"
+#include "io.h"
+#include "irq.h"
+#include "lapic.h"
+#include "pic.h"
+#include "keyboard.h"
+#include "kheap.h"
+#include "klib.h"
+#include "paging.h"
+#include "math64.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "terminal.h"
+#include "thread.h"
+#include "user.h"
+#include "vbe_console.h"
+#include "types.h"
+
+/* Port 0x80 is the POST diagnostic port; writes to it have no effect */
+#define BENCH_IO_PORT 0x80
+
+#define BENCH_LINE_LEN 64
+
+/* Mixed allocation workload: a window of live blocks, one replaced per step */
+#define BENCH_ALLOC_SLOTS 32
+#define BENCH_ARENA_SIZE  (64 * 1024)
+
+/* TLB walk: one read per 4 KB page over 16 MB of identity mapped RAM,
+ * 4096 pages with 4 KB paging against 4 with PSE */
+#define BENCH_TLB_START   0x400000
+#define BENCH_TLB_SPAN    (16 * 1024 * 1024)
+
+/* Block size for the mem/str library cases, one page */
+#define BENCH_COPY_SIZE   4096
+
+static char fb_line[FB_WIDTH + 1];
+static volatile u8int sink;
+
+static void bench_fb_putc(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        fb_putc('x');
+    }
+}
+
+static void bench_fb_puts_line(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        fb_puts(fb_line);
+    }
+}
+
+static void bench_fb_clear(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        fb_clear();
+    }
+}
+
+static void bench_fb_move_cursor(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        fb_move_cursor(i % (FB_WIDTH * FB_HEIGHT));
+    }
+}
+
+static void bench_outb_inline(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        outb(BENCH_IO_PORT, 0);
+    }
+}
+
+static void bench_outb_asm(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        outb_asm(BENCH_IO_PORT, 0);
+    }
+}
+
+/* Includes the producer side input_buffer_put */
+static void bench_getc(u32int n)
+{
+    u32int i;
+    for (i = 0; i < n; i++) {
+        input_buffer_put('x');
+        sink = getc();
+    }
+}
+
+/* Includes filling the buffer with a line of BENCH_LINE_LEN bytes */
+static void bench_readline(u32int n)
+{
+    char line[BENCH_LINE_LEN + 1];
+    u32int i;
+    u32int j;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < BENCH_LINE_LEN - 1; j++) {
+            input_buffer_put('a' + (j % 26));
+        }
+        input_buffer_put('\n');
+        readline(line, sizeof(line));
+    }
+}
+
+/* One iteration translates all 256 scan codes with the old switch */
+static void bench_scan_code_to_ascii(u32int n)
+{
+    u32int i;
+    u32int code;
+    for (i = 0; i < n; i++) {
+        for (code = 0; code < 256; code++) {
+            sink = keyboard_scan_code_to_ascii((u8int) code);
+        }
+    }
+}
+
+/* The same 256 scan codes through the keymap tables */
+static void bench_keymap_translate(u32int n)
+{
+    u32int i;
+    u32int code;
+    for (i = 0; i < n; i++) {
+        for (code = 0; code < 256; code++) {
+            sink = keyboard_translate((u8int) code);
+        }
+    }
+}
+
+/** Header of a block in the first-fit arena */
+struct firstfit_block {
+    u32int size;                /* bytes after the header */
+    u32int free;
+};
+
+/* Naive first-fit allocator over a static arena, only here to compare
+ * against kmalloc */
+static u8int firstfit_arena[BENCH_ARENA_SIZE] __attribute__((aligned(16)));
+
+static void firstfit_reset(void)
+{
+    struct firstfit_block *block = (struct firstfit_block *) firstfit_arena;
+
+    block->size = BENCH_ARENA_SIZE - sizeof(*block);
+    block->free = 1;
+}
+
+static void *firstfit_alloc(u32int size)
+{
+    u8int *p = firstfit_arena;
+
+    size = (size + 7) & ~7u;
+    while (p < firstfit_arena + BENCH_ARENA_SIZE) {
+        struct firstfit_block *block = (struct firstfit_block *) p;
+
+        if (block->free && block->size >= size) {
+            // Split off the rest if it can hold a header and some data
+            if (block->size >= size + sizeof(*block) + 8) {
+                struct firstfit_block *rest = (struct firstfit_block *) (p + sizeof(*block) + size);
+                rest->size = block->size - size - sizeof(*block);
+                rest->free = 1;
+                block->size = size;
+            }
+            block->free = 0;
+            return block + 1;
+        }
+        p += sizeof(*block) + block->size;
+    }
+    return 0;
+}
+
+static void firstfit_free(void *ptr)
+{
+    struct firstfit_block *block = (struct firstfit_block *) ptr - 1;
+    u8int *end = firstfit_arena + BENCH_ARENA_SIZE;
+
+    block->free = 1;
+    // Merge with the following free blocks
+    while ((u8int *) block + sizeof(*block) + block->size < end) {
+        struct firstfit_block *next = (struct firstfit_block *) ((u8int *) block + sizeof(*block) + block->size);
+        if (!next->free) {
+            break;
+        }
+        block->size += sizeof(*next) + next->size;
+    }
+}
+
+#define ALLOC_NONE     0
+#define ALLOC_KMALLOC  1
+#define ALLOC_FIRSTFIT 2
+
+static void *alloc_slots[BENCH_ALLOC_SLOTS];
+static u32int alloc_seed;
+static u8int alloc_owner = ALLOC_NONE;
+
+/** bench_alloc_switch:
+ * Empties the window when another allocator takes over, so each case
+ * starts from the same sizes and an empty window
+ */
+static void bench_alloc_switch(u8int owner)
+{
+    u32int i;
+
+    if (owner == alloc_owner) {
+        return;
+    }
+    for (i = 0; i < BENCH_ALLOC_SLOTS; i++) {
+        if (alloc_owner == ALLOC_KMALLOC) {
+            kfree(alloc_slots[i]);
+        }
+        alloc_slots[i] = 0;
+    }
+    if (owner == ALLOC_FIRSTFIT) {
+        firstfit_reset();
+    }
+    alloc_seed = 1;
+    alloc_owner = owner;
+}
+
+/** bench_next_size:
+ * Sizes for the mixed workload: mostly small, some up to 1 KB
+ */
+static u32int bench_next_size(void)
+{
+    alloc_seed = alloc_seed * 1103515245 + 12345;
+    if ((alloc_seed >> 24) < 200) {
+        return 8 + ((alloc_seed >> 8) & 0x7F);
+    }
+    return 128 + ((alloc_seed >> 8) & 0x37F);
+}
+
+/* One iteration frees one block of the window and allocates another */
+static void bench_kmalloc_mixed(u32int n)
+{
+    u32int i;
+
+    bench_alloc_switch(ALLOC_KMALLOC);
+    for (i = 0; i < n; i++) {
+        u32int slot = i % BENCH_ALLOC_SLOTS;
+        kfree(alloc_slots[slot]);
+        alloc_slots[slot] = kmalloc(bench_next_size());
+    }
+}
+
+static void bench_firstfit_mixed(u32int n)
+{
+    u32int i;
+
+    bench_alloc_switch(ALLOC_FIRSTFIT);
+    for (i = 0; i < n; i++) {
+        u32int slot = i % BENCH_ALLOC_SLOTS;
+        if (alloc_slots[slot] != 0) {
+            firstfit_free(alloc_slots[slot]);
+        }
+        alloc_slots[slot] = firstfit_alloc(bench_next_size());
+    }
+}
+
+static void bench_tlb_walk(u32int n)
+{
+    u32int end = paging_identity_limit();
+    u32int i;
+    u32int addr;
+
+    if (end > BENCH_TLB_START + BENCH_TLB_SPAN) {
+        end = BENCH_TLB_START + BENCH_TLB_SPAN;
+    }
+    for (i = 0; i < n; i++) {
+        for (addr = BENCH_TLB_START; addr < end; addr += PAGING_PAGE_SIZE) {
+            sink = *(volatile u8int *) addr;
+        }
+    }
+}
+
+static void bench_tlb_walk_pse(u32int n)
+{
+    paging_use_pse(1);
+    bench_tlb_walk(n);
+}
+
+static void bench_tlb_walk_4k(u32int n)
+{
+    paging_use_pse(0);
+    bench_tlb_walk(n);
+}
+
+/* The same page-sized copies and fills through each klib implementation.
+ * Cases the CPU cannot run only measure an empty call. */
+static u8int copy_src[BENCH_COPY_SIZE] __attribute__((aligned(16)));
+static u8int copy_dst[BENCH_COPY_SIZE] __attribute__((aligned(16)));
+
+static void bench_memcpy(u8int impl, u32int n)
+{
+    u8int previous = klib_get_impl();
+
+    if (klib_select(impl)) {
+        while (n--) {
+            memcpy(copy_dst, copy_src, BENCH_COPY_SIZE);
+        }
+    }
+    klib_select(previous);
+}
+
+static void bench_memset(u8int impl, u32int n)
+{
+    u8int previous = klib_get_impl();
+
+    if (klib_select(impl)) {
+        while (n--) {
+            memset(copy_dst, n, BENCH_COPY_SIZE);
+        }
+    }
+    klib_select(previous);
+}
+
+static void bench_memcpy_rep(u32int n)
+{
+    bench_memcpy(KLIB_IMPL_REP, n);
+}
+
+static void bench_memcpy_sse2(u32int n)
+{
+    bench_memcpy(KLIB_IMPL_SSE2, n);
+}
+
+static void bench_memcpy_erms(u32int n)
+{
+    bench_memcpy(KLIB_IMPL_ERMS, n);
+}
+
+static void bench_memset_rep(u32int n)
+{
+    bench_memset(KLIB_IMPL_REP, n);
+}
+
+static void bench_memset_sse2(u32int n)
+{
+    bench_memset(KLIB_IMPL_SSE2, n);
+}
+
+static void bench_memset_erms(u32int n)
+{
+    bench_memset(KLIB_IMPL_ERMS, n);
+}
+
+/* Glyph blits and full redraws of the VBE console. The fb_clear before the
+ * results are printed draws the console again. Without a framebuffer they
+ * only measure an empty call. */
+static u16int vbe_cells[FB_WIDTH * FB_HEIGHT];
+
+static void bench_vbe_fill(void)
+{
+    u32int i;
+
+    for (i = 0; i < FB_WIDTH * FB_HEIGHT; i++) {
+        vbe_cells[i] = (u16int) (0x0700 | (0x21 + i % 94));
+    }
+}
+
+static void bench_vbe_glyph(u32int n)
+{
+    if (!vbe_console_active()) {
+        return;
+    }
+    bench_vbe_fill();
+    while (n--) {
+        vbe_console_invalidate();
+        vbe_console_draw(0, vbe_cells, FB_WIDTH);
+    }
+}
+
+static void bench_vbe_redraw(u32int n)
+{
+    u32int y;
+
+    if (!vbe_console_active()) {
+        return;
+    }
+    bench_vbe_fill();
+    while (n--) {
+        vbe_console_invalidate();
+        for (y = 0; y < FB_HEIGHT; y++) {
+            vbe_console_draw(y * FB_WIDTH, vbe_cells + y * FB_WIDTH, FB_WIDTH);
+        }
+        vbe_console_present();
+    }
+}
+
+/** bench_user_loop:
+ * Runs a user program that makes n system calls. Entering and leaving
+ * ring 3 is counted too, but spread over the n calls.
+ */
+static void bench_user_loop(const char *name, u32int n)
+{
+    const struct user_program *program = user_find(name);
+    char count[11];
+    char *argv[2];
+    u32int i = sizeof(count) - 1;
+
+    if (program == 0) {
+        return;
+    }
+    count[i] = '\0';
+    do {
+        count[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    argv[0] = (char *) name;
+    argv[1] = &count[i];
+    user_run(program, 2, argv);
+}
+
+static void bench_syscall_int80(u32int n)
+{
+    bench_user_loop("sysnull_int80", n);
+}
+
+static void bench_syscall_sysenter(u32int n)
+{
+    // Without SEP the case only measures an empty call
+    user_prepare();
+    if (syscall_has_sysenter()) {
+        bench_user_loop("sysnull_sysenter", n);
+    }
+}
+
+/* EOIs with nothing in service, which both controllers ignore */
+static void bench_eoi_pic(u32int n)
+{
+    u32int i;
+
+    for (i = 0; i < n; i++) {
+        outb(PIC_1_COMMAND, PIC_ACKNOWLEDGE);
+    }
+}
+
+static void bench_eoi_lapic(u32int n)
+{
+    u32int i;
+
+    if (!lapic_present()) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        lapic_eoi();
+    }
+}
+
+static void bench_dispatch(u32int n)
+{
+    char input[8];
+    u32int i;
+
+    for (i = 0; i < n; i++) {
+        // Commands may tokenize their input in place, so start fresh
+        input[0] = 't';
+        input[1] = 'r';
+        input[2] = 'u';
+        input[3] = 'e';
+        input[4] = '\0';
+        terminal_execute_command(input);
+    }
+}
+
+static void bench_empty(u32int n)
+{
+    (void) n;
+}
+
+/* Uncontended lock round trips, the cost every critical section pays */
+static struct spinlock bench_lock = SPINLOCK_INIT("bench");
+
+static void bench_irq_save_restore(u32int n)
+{
+    while (n--) {
+        irq_restore(irq_save());
+    }
+}
+
+static void bench_spin_lock(u32int n)
+{
+    while (n--) {
+        spin_lock(&bench_lock);
+        spin_unlock(&bench_lock);
+    }
+}
+
+static void bench_spin_lock_irqsave(u32int n)
+{
+    while (n--) {
+        spin_unlock_irqrestore(&bench_lock, spin_lock_irqsave(&bench_lock));
+    }
+}
+
+static const struct bench_case cases[] = {
+    {"fb_putc", bench_fb_putc, 16},
+    {"fb_puts_line", bench_fb_puts_line, 1},
+    {"fb_clear", bench_fb_clear, 1},
+    {"fb_move_cursor", bench_fb_move_cursor, 16},
+    {"outb_inline", bench_outb_inline, 16},
+    {"outb_asm", bench_outb_asm, 16},
+    {"getc", bench_getc, 16},
+    {"readline_64", bench_readline, 1},
+    {"scan_code_to_ascii_x256", bench_scan_code_to_ascii, 1},
+    {"keymap_translate_x256", bench_keymap_translate, 1},
+    {"command_dispatch", bench_dispatch, 16},
+    {"kmalloc_mixed", bench_kmalloc_mixed, 64},
+    {"firstfit_mixed", bench_firstfit_mixed, 64},
+    {"tlb_walk_16m_pse", bench_tlb_walk_pse, 1},
+    {"tlb_walk_16m_4k", bench_tlb_walk_4k, 1},
+    {"memcpy_4k_rep", bench_memcpy_rep, 4},
+    {"memcpy_4k_sse2", bench_memcpy_sse2, 4},
+    {"memcpy_4k_erms", bench_memcpy_erms, 4},
+    {"memset_4k_rep", bench_memset_rep, 4},
+    {"memset_4k_sse2", bench_memset_sse2, 4},
+    {"memset_4k_erms", bench_memset_erms, 4},
+    {"vbe_glyph_x80", bench_vbe_glyph, 1},
+    {"vbe_redraw_full", bench_vbe_redraw, 1},
+    {"syscall_int80", bench_syscall_int80, 256},
+    {"syscall_sysenter", bench_syscall_sysenter, 256},
+    {"eoi_pic", bench_eoi_pic, 16},
+    {"eoi_lapic", bench_eoi_lapic, 16},
+    {"irq_save_restore", bench_irq_save_restore, 16},
+    {"spin_lock", bench_spin_lock, 16},
+    {"spin_lock_irqsave", bench_spin_lock_irqsave, 16},
+    {0, 0, 0}  // End marker
+};
+
+#define BENCH_CASE_COUNT (sizeof(cases) / sizeof(cases[0]) - 1)
+
+/** bench_sort:
+ * Insertion sort, the sample arrays are small
+ */
+static void bench_sort(u32int *values, u32int count)
+{
+    u32int i;
+    for (i = 1; i < count; i++) {
+        u32int value = values[i];
+        u32int j = i;
+        while (j > 0 && values[j - 1] > value) {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = value;
+    }
+}
+
+/** bench_sample:
+ * Times one sample of a case in TSC cycles
+ */
+static u64int bench_sample(const struct bench_case *bench)
+{
+    u64int start = clock_cycles();
+    bench->run(bench->iterations);
+    return clock_cycles() - start;
+}
+
+/** bench_measure:
+ * Times a case and reduces the samples to cycles per iteration
+ */
+void bench_measure(const struct bench_case *bench, struct bench_result *result)
+{
+    static const struct bench_case empty = {"empty", bench_empty, 1};
+    u32int samples[BENCH_SAMPLES];
+    u64int overhead = 0;
+    u32int i;
+
+    // Cost of the timing itself and the indirect call
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        u64int cycles = bench_sample(&empty);
+        if (i == 0 || cycles < overhead) {
+            overhead = cycles;
+        }
+    }
+
+    for (i = 0; i < BENCH_WARMUP; i++) {
+        bench_sample(bench);
+    }
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        u64int cycles = bench_sample(bench);
+        cycles = (cycles > overhead) ? cycles - overhead : 0;
+        cycles = div64_u32(cycles, bench->iterations, 0);
+        samples[i] = (cycles > 0xFFFFFFFF) ? 0xFFFFFFFF : (u32int) cycles;
+    }
+
+    bench_sort(samples, BENCH_SAMPLES);
+    result->min = samples[0];
+    result->median = samples[BENCH_SAMPLES / 2];
+    result->p99 = samples[(BENCH_SAMPLES * 99) / 100];
+}
+
+/** bench_matches:
+ * Checks whether name starts with filter
+ */
+static u8int bench_matches(const char *name, const char *filter)
+{
+    u32int i = 0;
+    while (filter[i] != '\0') {
+        if (name[i] != filter[i]) {
+            return 0;
+        }
+        i++;
+    }
+    return 1;
+}
+
+/** bench_run:
+ * Runs the built-in suite and prints one line per case
+ */
+void bench_run(char *filter)
+{
+    struct bench_result results[BENCH_CASE_COUNT];
+    u8int ran[BENCH_CASE_COUNT];
+    u32int i;
+
+    for (i = 0; i < FB_WIDTH; i++) {
+        fb_line[i] = 'A' + (i % 26);
+    }
+    fb_line[FB_WIDTH] = '\0';
+
+    // The framebuffer cases scribble over the screen, so print afterwards
+    for (i = 0; i < BENCH_CASE_COUNT; i++) {
+        ran[i] = bench_matches(cases[i].name, filter);
+        if (ran[i]) {
+            bench_measure(&cases[i], &results[i]);
+        }
+    }
+    bench_alloc_switch(ALLOC_NONE);
+    paging_use_pse(1);
+
+    fb_clear();
+    fb_puts("bench begin tsc_khz=");
+    fb_put_uint(clock_tsc_khz());
+    fb_puts(" samples=");
+    fb_put_uint(BENCH_SAMPLES);
+    fb_putc('\n');
+    for (i = 0; i < BENCH_CASE_COUNT; i++) {
+        if (!ran[i]) {
+            continue;
+        }
+        fb_puts("bench name=");
+        fb_puts((char *) cases[i].name);
+        fb_puts(" iters=");
+        fb_put_uint(cases[i].iterations);
+        fb_puts(" min=");
+        fb_put_uint(results[i].min);
+        fb_puts(" median=");
+        fb_put_uint(results[i].median);
+        fb_puts(" p99=");
+        fb_put_uint(results[i].p99);
+        fb_puts(" unit=cycles\n");
+    }
+    fb_puts("bench end\n");
+}
+
+/* Shared state of a bench_parallel run */
+static volatile u32int parallel_next;       /* next chunk to claim */
+static volatile u32int parallel_running;    /* workers not finished */
+static volatile u32int parallel_result;
+static struct wait_queue parallel_done = WAIT_QUEUE_INIT;
+
+/** bench_parallel_chunk:
+ * One chunk of CPU-bound work: a xorshift generator, which touches no
+ * memory so the CPUs do not compete for anything but their own cycles
+ */
+static u32int bench_parallel_chunk(u32int seed)
+{
+    u32int x = seed * 2654435761u + 1;
+    u32int i;
+
+    for (i = 0; i < BENCH_PARALLEL_ROUNDS; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return x;
+}
+
+static void bench_parallel_worker(u32int arg)
+{
+    u32int sum = 0;
+    u32int chunk;
+
+    (void) arg;
+    while ((chunk = atomic_fetch_add(&parallel_next, 1)) < BENCH_PARALLEL_CHUNKS) {
+        sum += bench_parallel_chunk(chunk);
+    }
+    atomic_fetch_add(&parallel_result, sum);
+    if (atomic_fetch_add(&parallel_running, (u32int) -1) == 1) {
+        wait_queue_wake(&parallel_done);
+    }
+}
+
+/** bench_parallel_time:
+ * Runs the job on workers threads and returns the wall time in TSC cycles
+ */
+static u64int bench_parallel_time(u32int workers)
+{
+    u64int start;
+    u32int i;
+
+    parallel_next = 0;
+    parallel_running = workers;
+    parallel_result = 0;
+    start = clock_cycles();
+    // Queued here; the reschedule IPIs send the idle CPUs to steal them
+    for (i = 0; i < workers; i++) {
+        if (thread_create("pbench", bench_parallel_worker, i) == 0) {
+            atomic_fetch_add(&parallel_running, (u32int) -1);
+        }
+    }
+    while (parallel_running != 0) {
+        u32int ticket = wait_queue_prepare(&parallel_done);
+
+        if (parallel_running != 0) {
+            wait_queue_sleep(&parallel_done, ticket);
+        }
+    }
+    return clock_cycles() - start;
+}
+
+void bench_parallel(u32int max_cpus)
+{
+    u32int base_us = 0;
+    u32int n;
+
+    fb_puts("pbench begin chunks=");
+    fb_put_uint(BENCH_PARALLEL_CHUNKS);
+    fb_puts(" rounds=");
+    fb_put_uint(BENCH_PARALLEL_ROUNDS);
+    fb_putc('\n');
+    for (n = 1; n <= max_cpus; n++) {
+        u32int us = (u32int) div64_u32(clock_cycles_to_ns(bench_parallel_time(n)), 1000, 0);
+        u32int speedup;
+
+        if (us == 0) {
+            us = 1;
+        }
+        if (n == 1) {
+            base_us = us;
+        }
+        speedup = (u32int) div64_u32((u64int) base_us * 100, us, 0);
+        fb_puts("pbench cpus=");
+        fb_put_uint(n);
+        fb_puts(" time_us=");
+        fb_put_uint(us);
+        fb_puts(" speedup=");
+        fb_put_uint(speedup / 100);
+        fb_putc('.');
+        fb_putc('0' + (speedup / 10) % 10);
+        fb_putc('0' + speedup % 10);
+        fb_puts(" efficiency=");
+        fb_put_uint(speedup / n);
+        fb_puts("%\n");
+    }
+    fb_puts("pbench end\n");
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDE_BENCH_H
+#define INCLUDE_BENCH_H
+
+#include "types.h"
+
+/* Timed samples per case, after BENCH_WARMUP untimed ones */
+#define BENCH_SAMPLES 101
+#define BENCH_WARMUP  8
+
+/** Benchmark case */
+struct bench_case {
+    const char *name;
+    void (*run)(u32int iterations);  /* the code under test, run n times */
+    u32int iterations;               /* calls timed together per sample */
+};
+
+/** Results of one case, in TSC cycles per iteration */
+struct bench_result {
+    u32int min;
+    u32int median;
+    u32int p99;
+};
+
+/** bench_measure:
+ * Times a case: warms it up, takes BENCH_SAMPLES rdtsc-timed samples and
+ * reduces them to min/median/p99 cycles per iteration with the rdtsc
+ * overhead removed.
+ *
+ * @param bench  The case to run
+ * @param result Where to store the results
+ */
+void bench_measure(const struct bench_case *bench, struct bench_result *result);
+
+/** bench_run:
+ * Runs the built-in suite and prints one line per case:
+ *   bench name=<case> iters=<n> min=<c> median=<c> p99=<c> unit=cycles
+ *
+ * @param filter Only run cases whose name starts with this, "" for all
+ */
+void bench_run(char *filter);
+
+/* The parallel benchmark: a fixed amount of CPU-bound work split into
+ * chunks that worker threads claim until none are left */
+#define BENCH_PARALLEL_CHUNKS   64
+#define BENCH_PARALLEL_ROUNDS   100000
+
+/** bench_parallel:
+ * Runs the parallel job with 1, 2, ... max_cpus worker threads, one per
+ * CPU, letting idle CPUs steal the workers, and prints one line per run:
+ *   pbench cpus=<n> time_us=<t> speedup=<x.yy> efficiency=<pct>
+ *
+ * @param max_cpus The largest number of workers, at most the CPUs online
+ */
+void bench_parallel(u32int max_cpus);
+
+#endif /* INCLUDE_BENCH_H */
@@ -0,0 +1,291 @@
+#include "clock.h"
+#include "interrupts.h"
+#include "io.h"
+#include "lapic.h"
+#include "math64.h"
+#include "irq.h"
+#include "smp.h"
+#include "thread.h"
+#include "timer.h"
+#include "types.h"
+
+/* PIT I/O ports */
+#define PIT_CHANNEL_0_PORT      0x40
+#define PIT_CHANNEL_2_PORT      0x42
+#define PIT_COMMAND_PORT        0x43
+#define PIT_CONTROL_PORT        0x61    /* Channel 2 gate and output */
+
+/* PIT commands: channel, lobyte/hibyte access, mode */
+#define PIT_CHANNEL_0_RATE      0x34    /* Channel 0, mode 2 rate generator */
+#define PIT_CHANNEL_2_ONESHOT   0xB0    /* Channel 2, mode 0 one-shot */
+
+#define PIT_GATE_2              0x01
+#define PIT_SPEAKER             0x02
+#define PIT_OUTPUT_2            0x20
+
+/* TSC calibration: best of several 10 ms windows */
+#define CALIBRATE_HZ            100
+#define CALIBRATE_RUNS          3
+
+#define CLOCK_IRQ               0
+
+static volatile u32int ticks = 0;
+static u32int tick_hz = 0;
+static u32int tsc_khz = 0;
+static u64int tsc_boot = 0;
+static u64int cycles_per_tick = 0;
+
+/* Tickless idle: the PIT is masked while the idle thread sleeps and the
+ * local APIC timer is armed for the next software timer, if any */
+static u8int tickless = 0;
+static u8int lapic_handler_installed = 0;
+static volatile u8int idle_sleeping = 0;
+static u8int idle_armed = 0;
+static u64int idle_deadline = 0;
+static u64int idle_start = 0;
+static u32int tick_carry = 0;
+static struct clock_idle_stats idle_stats;
+
+/* Nanoseconds per TSC cycle as a 32.32 fixed-point number */
+static u64int ns_per_cycle = 0;
+
+static void clock_handle_tick(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack);
+static void clock_handle_lapic_timer(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack);
+
+/** clock_measure_window:
+ * Counts TSC cycles while PIT channel 2 counts down the given value
+ */
+static u64int clock_measure_window(u16int count)
+{
+    u8int control = inb(PIT_CONTROL_PORT) & ~PIT_SPEAKER;
+    u64int start;
+
+    outb(PIT_CONTROL_PORT, control & ~PIT_GATE_2);
+    outb(PIT_COMMAND_PORT, PIT_CHANNEL_2_ONESHOT);
+    outb(PIT_CHANNEL_2_PORT, count & 0xFF);
+    outb(PIT_CHANNEL_2_PORT, (count >> 8) & 0xFF);
+
+    // Raising the gate starts the countdown; OUT goes high when it ends
+    outb(PIT_CONTROL_PORT, control | PIT_GATE_2);
+    start = clock_cycles();
+    while (!(inb(PIT_CONTROL_PORT) & PIT_OUTPUT_2)) {
+    }
+    return clock_cycles() - start;
+}
+
+/** clock_calibrate_tsc:
+ * Measures the TSC frequency against PIT channel 2
+ */
+static void clock_calibrate_tsc(void)
+{
+    u16int count = CLOCK_PIT_FREQUENCY / CALIBRATE_HZ;
+    u64int best = 0;
+    u32int i;
+
+    for (i = 0; i < CALIBRATE_RUNS; i++) {
+        u64int cycles = clock_measure_window(count);
+        // The shortest window had the fewest interruptions
+        if (best == 0 || cycles < best) {
+            best = cycles;
+        }
+    }
+
+    // cycles / (count / PIT frequency) / 1000
+    tsc_khz = (u32int) div64_u32(best * CLOCK_PIT_FREQUENCY,
+                                 (u32int) count * 1000, 0);
+    if (tsc_khz == 0) {
+        tsc_khz = 1;
+    }
+    ns_per_cycle = div64_u32((u64int) 1000000 << 32, tsc_khz, 0);
+}
+
+/** clock_init:
+ * Programs PIT channel 0 and calibrates the TSC
+ */
+void clock_init(u32int hz)
+{
+    u32int divisor;
+
+    if (hz == 0) {
+        hz = CLOCK_DEFAULT_HZ;
+    }
+    divisor = CLOCK_PIT_FREQUENCY / hz;
+    if (divisor == 0) {
+        divisor = 1;
+    }
+    if (divisor > 0xFFFF) {
+        divisor = 0xFFFF;
+    }
+
+    clock_calibrate_tsc();
+
+    outb(PIT_COMMAND_PORT, PIT_CHANNEL_0_RATE);
+    outb(PIT_CHANNEL_0_PORT, divisor & 0xFF);
+    outb(PIT_CHANNEL_0_PORT, (divisor >> 8) & 0xFF);
+    tick_hz = CLOCK_PIT_FREQUENCY / divisor;
+
+    ticks = 0;
+    tsc_boot = clock_cycles();
+    cycles_per_tick = div64_u32((u64int) tsc_khz * 1000, tick_hz, 0);
+
+    register_interrupt_handler(INTERRUPTS_TIMER, clock_handle_tick);
+    irq_unmask(CLOCK_IRQ);
+}
+
+/** clock_cycles_to_ns:
+ * Converts a TSC delta to nanoseconds
+ */
+u64int clock_cycles_to_ns(u64int cycles)
+{
+    return mul64_shr32(cycles, ns_per_cycle);
+}
+
+/** clock_now_ns:
+ * Returns nanoseconds since clock_init
+ */
+u64int clock_now_ns(void)
+{
+    return clock_cycles_to_ns(clock_cycles() - tsc_boot);
+}
+
+/** clock_ticks:
+ * Returns the number of IRQ0 ticks since clock_init
+ */
+u32int clock_ticks(void)
+{
+    return ticks;
+}
+
+/** clock_hz:
+ * Returns the actual IRQ0 rate
+ */
+u32int clock_hz(void)
+{
+    return tick_hz;
+}
+
+/** clock_tsc_khz:
+ * Returns the calibrated TSC frequency in kHz
+ */
+u32int clock_tsc_khz(void)
+{
+    return tsc_khz;
+}
+
+/** clock_handle_tick:
+ * IRQ0 handler, counts one tick
+ */
+static void clock_handle_tick(__attribute__((unused)) struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, __attribute__((unused)) struct stack_state *stack)
+{
+    ticks++;
+    timer_run(clock_cycles());
+    thread_tick();
+}
+
+/** clock_handle_lapic_timer:
+ * Local APIC timer interrupt, only armed by clock_idle_enter
+ */
+static void clock_handle_lapic_timer(__attribute__((unused)) struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, __attribute__((unused)) struct stack_state *stack)
+{
+    lapic_eoi();
+    timer_run(clock_cycles());
+}
+
+/** clock_set_tickless:
+ * Turns tickless idle on or off
+ */
+u8int clock_set_tickless(u8int enable)
+{
+    if (enable && !lapic_present()) {
+        return 0;
+    }
+    if (enable && !lapic_handler_installed) {
+        register_interrupt_handler(LAPIC_TIMER_VECTOR, clock_handle_lapic_timer);
+        lapic_handler_installed = 1;
+    }
+    tickless = enable;
+    return 1;
+}
+
+u8int clock_get_tickless(void)
+{
+    return tickless;
+}
+
+/** clock_idle_enter:
+ * Stops the periodic tick before the idle thread halts
+ */
+void clock_idle_enter(void)
+{
+    if (!tickless) {
+        return;
+    }
+    irq_mask(CLOCK_IRQ);
+    idle_armed = timer_next(&idle_deadline);
+    if (idle_armed) {
+        lapic_timer_arm(idle_deadline);
+    }
+    idle_stats.sleeps++;
+    idle_start = clock_cycles();
+    idle_sleeping = 1;
+}
+
+/** clock_idle_exit:
+ * Restarts the periodic tick and accounts for the ticks slept through
+ */
+void clock_idle_exit(u32int interrupt)
+{
+    u64int now;
+    u32int skipped;
+    u32int rem;
+
+    // Only the boot CPU stops its tick
+    if (!idle_sleeping || cpu_read(index) != 0) {
+        return;
+    }
+    now = clock_cycles();
+    idle_sleeping = 0;
+
+    if (idle_armed && interrupt == LAPIC_TIMER_VECTOR) {
+        idle_stats.timer_wakeups++;
+        if (now >= idle_deadline) {
+            u32int latency = (u32int) (now - idle_deadline);
+
+            if (idle_stats.latency_count == 0 || latency < idle_stats.latency_min) {
+                idle_stats.latency_min = latency;
+            }
+            if (latency > idle_stats.latency_max) {
+                idle_stats.latency_max = latency;
+            }
+            idle_stats.latency_total += latency;
+            idle_stats.latency_count++;
+        }
+    } else {
+        idle_stats.other_wakeups++;
+        if (idle_armed) {
+            lapic_timer_disarm();
+        }
+    }
+
+    // Credit the ticks the PIT would have raised meanwhile
+    skipped = (u32int) div64_u32(now - idle_start + tick_carry, (u32int) cycles_per_tick, &rem);
+    tick_carry = rem;
+    ticks += skipped;
+    if (skipped > 1) {
+        idle_stats.avoided += skipped - 1;
+    }
+    irq_unmask(CLOCK_IRQ);
+}
+
+const struct clock_idle_stats *clock_get_idle_stats(void)
+{
+    u32int i;
+
+    idle_stats.ap_sleeps = 0;
+    idle_stats.ap_avoided = 0;
+    for (i = 1; i < smp_cpu_count(); i++) {
+        idle_stats.ap_sleeps += smp_get_cpu(i)->tick_stops;
+        idle_stats.ap_avoided += smp_get_cpu(i)->ticks_avoided;
+    }
+    return &idle_stats;
+}
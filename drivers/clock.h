@@ -0,0 +1,118 @@
+#ifndef INCLUDE_CLOCK_H
+#define INCLUDE_CLOCK_H
+
+#include "types.h"
+
+/* Input frequency of the 8253/8254 PIT */
+#define CLOCK_PIT_FREQUENCY 1193182
+
+/* Default IRQ0 rate */
+#define CLOCK_DEFAULT_HZ 1000
+
+/** clock_init:
+ * Programs PIT channel 0 to raise IRQ0 at the given rate, installs the IRQ0
+ * handler and calibrates the TSC against PIT channel 2. Call with
+ * interrupts disabled, after interrupts_install_idt.
+ *
+ * @param hz The tick rate in Hz (19..1193182)
+ */
+void clock_init(u32int hz);
+
+/** clock_cycles:
+ * Reads the time stamp counter. Inline so it is a single rdtsc on hot
+ * paths.
+ *
+ * @return The TSC value
+ */
+ALWAYS_INLINE u64int clock_cycles(void)
+{
+    u32int low;
+    u32int high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((u64int) high << 32) | low;
+}
+
+/** clock_now_ns:
+ * Returns nanoseconds since clock_init, derived from the calibrated TSC
+ *
+ * @return Monotonic time in nanoseconds
+ */
+u64int clock_now_ns(void);
+
+/** clock_cycles_to_ns:
+ * Converts a TSC delta to nanoseconds
+ *
+ * @param cycles The number of TSC cycles
+ * @return The same interval in nanoseconds
+ */
+u64int clock_cycles_to_ns(u64int cycles);
+
+/** clock_ticks:
+ * Returns the number of IRQ0 ticks since clock_init
+ *
+ * @return The tick count
+ */
+u32int clock_ticks(void);
+
+/** clock_hz:
+ * Returns the actual IRQ0 rate after rounding the PIT divisor
+ *
+ * @return The tick rate in Hz
+ */
+u32int clock_hz(void);
+
+/** clock_tsc_khz:
+ * Returns the calibrated TSC frequency
+ *
+ * @return The TSC frequency in kHz
+ */
+u32int clock_tsc_khz(void);
+
+/** Tickless idle counters */
+struct clock_idle_stats {
+    u32int sleeps;              /* times the idle thread stopped the tick */
+    u32int timer_wakeups;       /* sleeps ended by the local APIC timer */
+    u32int other_wakeups;       /* sleeps ended by another interrupt */
+    u64int avoided;             /* periodic ticks that did not wake the CPU */
+    u32int latency_count;       /* timer wakeups at or after the deadline */
+    u64int latency_total;       /* TSC cycles from deadline to handler */
+    u32int latency_min;
+    u32int latency_max;
+    u32int ap_sleeps;           /* idle halts of the APs with their timer off */
+    u32int ap_avoided;          /* AP ticks that did not wake the CPU */
+};
+
+/** clock_set_tickless:
+ * Turns tickless idle on or off. When on, the idle thread masks the PIT
+ * and arms the local APIC timer for the next software timer instead.
+ *
+ * @param enable 1 for tickless idle, 0 for a periodic tick
+ * @return 1 on success, 0 if there is no local APIC timer
+ */
+u8int clock_set_tickless(u8int enable);
+
+/** clock_get_tickless:
+ * Returns whether tickless idle is on
+ */
+u8int clock_get_tickless(void);
+
+/** clock_idle_enter:
+ * Called by the idle thread with interrupts disabled, just before hlt
+ */
+void clock_idle_enter(void);
+
+/** clock_idle_exit:
+ * Called at the start of every interrupt. Restarts the tick if the idle
+ * thread was sleeping without it; otherwise returns at once.
+ *
+ * @param interrupt The vector that woke the CPU
+ */
+void clock_idle_exit(u32int interrupt);
+
+/** clock_get_idle_stats:
+ * Returns the tickless idle counters, with the AP counters summed over
+ * the CPUs
+ */
+const struct clock_idle_stats *clock_get_idle_stats(void);
+
+#endif /* INCLUDE_CLOCK_H */
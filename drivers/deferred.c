@@ -0,0 +1,77 @@
+#include "deferred.h"
+#include "types.h"
+
+#define DEFERRED_QUEUE_MASK (DEFERRED_QUEUE_SIZE - 1)
+
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+struct deferred_work {
+    deferred_fn fn;
+    u32int arg;
+};
+
+/* Single-producer/single-consumer ring like the input buffer: interrupt
+ * handlers advance head, deferred_run advances tail */
+static struct deferred_work queue[DEFERRED_QUEUE_SIZE];
+static volatile u32int head = 0;
+static volatile u32int tail = 0;
+
+static struct deferred_stats stats;
+
+/** deferred_queue:
+ * Queues work from an interrupt handler
+ */
+u8int deferred_queue(deferred_fn fn, u32int arg)
+{
+    u32int h = head;
+    u32int depth = h - tail;
+
+    if (depth >= DEFERRED_QUEUE_SIZE) {
+        stats.dropped++;
+        return 0;
+    }
+    queue[h & DEFERRED_QUEUE_MASK].fn = fn;
+    queue[h & DEFERRED_QUEUE_MASK].arg = arg;
+    compiler_barrier();
+    head = h + 1;
+
+    stats.queued++;
+    if (depth + 1 > stats.max_depth) {
+        stats.max_depth = depth + 1;
+    }
+    return 1;
+}
+
+/** deferred_pending:
+ * Checks whether work is waiting
+ */
+u8int deferred_pending(void)
+{
+    return head != tail;
+}
+
+/** deferred_run:
+ * Runs all queued work
+ */
+void deferred_run(void)
+{
+    while (tail != head) {
+        struct deferred_work work;
+
+        compiler_barrier();
+        work = queue[tail & DEFERRED_QUEUE_MASK];
+        compiler_barrier();
+        tail = tail + 1;
+
+        work.fn(work.arg);
+        stats.run++;
+    }
+}
+
+/** deferred_get_stats:
+ * Returns the work queue counters
+ */
+const struct deferred_stats *deferred_get_stats(void)
+{
+    return &stats;
+}
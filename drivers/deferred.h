@@ -0,0 +1,50 @@
+#ifndef INCLUDE_DEFERRED_H
+#define INCLUDE_DEFERRED_H
+
+#include "types.h"
+
+/* Work queue entries, must be a power of two */
+#define DEFERRED_QUEUE_SIZE 64
+
+/** Work function, called with the argument it was queued with */
+typedef void (*deferred_fn)(u32int arg);
+
+/** Deferred work counters */
+struct deferred_stats {
+    u32int queued;      /* items queued by interrupt handlers */
+    u32int run;         /* items run by deferred_run */
+    u32int dropped;     /* items lost because the queue was full */
+    u32int max_depth;   /* deepest the queue has been */
+};
+
+/** deferred_queue:
+ * Queues work to run outside interrupt context. Only called from interrupt
+ * handlers, which never nest, so the queue has a single producer.
+ *
+ * @param fn  The work function
+ * @param arg Its argument
+ * @return 1 if queued, 0 if the queue was full
+ */
+u8int deferred_queue(deferred_fn fn, u32int arg);
+
+/** deferred_pending:
+ * Checks whether work is waiting
+ *
+ * @return 1 if deferred_run has something to do, 0 otherwise
+ */
+u8int deferred_pending(void);
+
+/** deferred_run:
+ * Runs all queued work with interrupts enabled. Called by readline and the
+ * terminal loop.
+ */
+void deferred_run(void);
+
+/** deferred_get_stats:
+ * Returns the work queue counters
+ *
+ * @return Pointer to the counters
+ */
+const struct deferred_stats *deferred_get_stats(void);
+
+#endif /* INCLUDE_DEFERRED_H */
@@ -0,0 +1,24 @@
+#ifndef INCLUDE_FONT_H
+#define INCLUDE_FONT_H
+
+#include "types.h"
+
+/* Glyphs are 8 pixels wide and 8 rows tall, one byte per row with the
+ * leftmost pixel in bit 0 */
+#define FONT_WIDTH  8
+#define FONT_ROWS   8
+
+/* Printable ASCII is all the console writes */
+#define FONT_FIRST  0x20
+#define FONT_LAST   0x7E
+
+/** font_glyph:
+ * Returns the rows of the glyph for a character. Characters outside
+ * FONT_FIRST..FONT_LAST get a hollow box, except 0 which is blank.
+ *
+ * @param c The character
+ * @return FONT_ROWS bytes
+ */
+const u8int *font_glyph(u8int c);
+
+#endif /* INCLUDE_FONT_H */
@@ -1,25 +1,400 @@
 #include "frame_buffer.h"
 #include "io.h"
+#include "klib.h"
+#include "vbe_console.h"
 
 /* The I/O ports */
 #define FB_COMMAND_PORT         0x3D4
 #define FB_DATA_PORT            0x3D5
 
 /* The I/O port commands */
+#define FB_START_HIGH_COMMAND   12
+#define FB_START_LOW_COMMAND    13
 #define FB_HIGH_BYTE_COMMAND    14
 #define FB_LOW_BYTE_COMMAND     15
 
+/* Port writes needed to program the cursor once */
+#define FB_CURSOR_PORT_WRITES   4
+
 /* Framebuffer memory address and dimensions */
 #define FB_ADDRESS              0x000B8000
 #define FB_WIDTH                80
 #define FB_HEIGHT               25
+#define FB_CELLS                (FB_WIDTH * FB_HEIGHT)
+
+/* What fb_clear fills the screen with: a space, black on black */
+#define FB_BLANK_CELL           (' ' | (((FB_BLACK << 4) | FB_BLACK) << 8))
+
+/* The 32 KB of text memory at FB_ADDRESS, counted in whole rows */
+#define FB_VGA_CELLS            (32768 / 2)
+#define FB_VGA_ROWS             (FB_VGA_CELLS / FB_WIDTH)
 
 /* Current cursor position */
 static unsigned short cursor_x = 0;
 static unsigned short cursor_y = 0;
 
 /* Pointer to framebuffer memory */
-static char *fb = (char *) FB_ADDRESS;
+static unsigned short *fb = (unsigned short *) FB_ADDRESS;
+
+/* In-RAM copy of the screen, one character/attribute pair per cell. The rows
+ * form a ring: screen row r lives in shadow row (shadow_top + r) % FB_HEIGHT,
+ * so scrolling never moves the other rows. */
+static unsigned short fb_shadow[FB_CELLS];
+static unsigned int shadow_top = 0;
+
+/* Dirty span [dirty_start, dirty_end) of cells not yet copied to VGA memory */
+static unsigned int dirty_start = FB_CELLS;
+static unsigned int dirty_end = 0;
+
+/* VGA row the live screen starts at, and the lowest VGA row above it that
+ * still holds scrolled-off output */
+static unsigned int origin_row = 0;
+static unsigned int resident_row = 0;
+
+/* Start address last programmed into the CRTC */
+static unsigned short flushed_start = 0;
+
+/* Lines scrolled off the top, oldest overwritten first */
+static unsigned short scrollback[FB_SCROLLBACK_LINES][FB_WIDTH];
+static unsigned int scrollback_head = 0;
+static unsigned int scrollback_count = 0;
+
+/* Rows the view is scrolled back from the live screen */
+static unsigned int view_back = 0;
+
+/* Cursor position last programmed into the CRTC, and whether it is stale */
+static unsigned short flushed_cursor = 0xFFFF;
+static unsigned char cursor_dirty = 0;
+
+/* Nesting depth of fb_batch_begin; the flush happens when it drops to 0 */
+static unsigned int batch_depth = 0;
+
+static struct fb_stats stats;
+
+/* Second console sink that gets a copy of everything written */
+static void (*mirror)(char c) = 0;
+
+/* Set once fb_init_graphics hands the cells to the VBE console; VGA
+ * memory and the CRTC are left alone from then on */
+static unsigned char graphics = 0;
+
+/* view_back of the rows the VBE console shows */
+static unsigned int graphics_view = 0;
+
+/** fb_shadow_row:
+ * Returns the shadow buffer row holding screen row y
+ */
+static unsigned short *fb_shadow_row(unsigned int y)
+{
+    return &fb_shadow[((shadow_top + y) % FB_HEIGHT) * FB_WIDTH];
+}
+
+/** fb_mark_dirty:
+ * Grows the dirty span to include cell i
+ */
+static void fb_mark_dirty(unsigned int i)
+{
+    if (i < dirty_start) {
+        dirty_start = i;
+    }
+    if (i + 1 > dirty_end) {
+        dirty_end = i + 1;
+    }
+}
+
+/** fb_set_start:
+ * Points the CRTC at the given VGA row
+ */
+static void fb_set_start(unsigned int row)
+{
+    unsigned short start = row * FB_WIDTH;
+
+    if (start == flushed_start) {
+        return;
+    }
+    outb(FB_COMMAND_PORT, FB_START_HIGH_COMMAND);
+    outb(FB_DATA_PORT, ((start >> 8) & 0x00FF));
+    outb(FB_COMMAND_PORT, FB_START_LOW_COMMAND);
+    outb(FB_DATA_PORT, start & 0x00FF);
+    flushed_start = start;
+    stats.start_writes++;
+}
+
+/** fb_flush_cells:
+ * Copies the dirty span of the shadow buffer into the live VGA window, or
+ * renders it into the VBE console's back buffer
+ */
+static void fb_flush_cells(void)
+{
+    unsigned short *vga = &fb[origin_row * FB_WIDTH];
+    unsigned int i = dirty_start;
+
+    if (dirty_start >= dirty_end) {
+        return;
+    }
+    while (i < dirty_end) {
+        unsigned short *row = fb_shadow_row(i / FB_WIDTH);
+        unsigned int x = i % FB_WIDTH;
+        unsigned int end = i - x + FB_WIDTH;
+
+        if (end > dirty_end) {
+            end = dirty_end;
+        }
+        if (graphics) {
+            vbe_console_draw(i, &row[x], end - i);
+        } else {
+            memcpy(&vga[i], &row[x], (end - i) * sizeof(*vga));
+        }
+        i = end;
+    }
+    stats.cells_flushed += dirty_end - dirty_start;
+    dirty_start = FB_CELLS;
+    dirty_end = 0;
+}
+
+/** fb_scroll:
+ * Scrolls the live screen up by one line. The top line goes to the
+ * scrollback ring and the CRTC start address moves down one row; VGA memory
+ * is only rewritten in full when the window reaches its end.
+ */
+static void fb_scroll(void)
+{
+    unsigned short *top;
+
+    /* The departing row must reach VGA memory so it can be paged back to */
+    fb_flush_cells();
+
+    top = fb_shadow_row(0);
+    memcpy(scrollback[scrollback_head], top, sizeof(scrollback[0]));
+    memset16(top, ' ', FB_WIDTH);
+    scrollback_head = (scrollback_head + 1) % FB_SCROLLBACK_LINES;
+    if (scrollback_count < FB_SCROLLBACK_LINES) {
+        scrollback_count++;
+    }
+    shadow_top = (shadow_top + 1) % FB_HEIGHT;
+    stats.scrolls++;
+
+    if (graphics) {
+        /* Move the pixels instead of drawing every row again */
+        vbe_console_scroll();
+        fb_mark_dirty((FB_HEIGHT - 1) * FB_WIDTH);
+        fb_mark_dirty(FB_CELLS - 1);
+        return;
+    }
+
+    origin_row++;
+    if (origin_row + FB_HEIGHT > FB_VGA_ROWS) {
+        /* Out of text memory: copy the screen back to the start once */
+        origin_row = 0;
+        resident_row = 0;
+        fb_mark_dirty(0);
+        fb_mark_dirty(FB_CELLS - 1);
+        stats.wraps++;
+    } else {
+        fb_mark_dirty((FB_HEIGHT - 1) * FB_WIDTH);
+        fb_mark_dirty(FB_CELLS - 1);
+    }
+}
+
+/** fb_view_row:
+ * Returns the cells of screen row y as it was view_back lines ago
+ */
+static unsigned short *fb_view_row(unsigned int y)
+{
+    if (y < view_back) {
+        return scrollback[(scrollback_head + FB_SCROLLBACK_LINES -
+                           view_back + y) % FB_SCROLLBACK_LINES];
+    }
+    return fb_shadow_row(y - view_back);
+}
+
+/** fb_render_view:
+ * Draws the screen as it was view_back lines ago into spare VGA rows and
+ * returns the row it was drawn at. Only used when the lines are no longer
+ * resident above the live window.
+ */
+static unsigned int fb_render_view(void)
+{
+    unsigned int row;
+    unsigned int y;
+
+    if (origin_row + 2 * FB_HEIGHT <= FB_VGA_ROWS) {
+        row = origin_row + FB_HEIGHT;
+    } else {
+        row = 0;
+        resident_row = FB_HEIGHT;
+    }
+    for (y = 0; y < FB_HEIGHT; y++) {
+        memcpy(&fb[(row + y) * FB_WIDTH], fb_view_row(y), FB_WIDTH * sizeof(*fb));
+    }
+    stats.view_redraws++;
+    return row;
+}
+
+/** fb_graphics_view:
+ * Draws the rows view_back selects on the VBE console. Only cells that
+ * differ from what it shows are blitted. The cursor is hidden while the
+ * view is scrolled back.
+ */
+static void fb_graphics_view(void)
+{
+    unsigned int y;
+
+    for (y = 0; y < FB_HEIGHT; y++) {
+        vbe_console_draw(y * FB_WIDTH, fb_view_row(y), FB_WIDTH);
+    }
+    if (view_back == 0) {
+        flushed_cursor = cursor_y * FB_WIDTH + cursor_x;
+        vbe_console_set_cursor(flushed_cursor);
+    } else {
+        flushed_cursor = 0xFFFF;
+        vbe_console_set_cursor(VBE_NO_CURSOR);
+    }
+    graphics_view = view_back;
+}
+
+/** fb_flush_graphics:
+ * fb_flush for the VBE console: renders the dirty span, moves the cursor
+ * and copies the changed rectangles to the screen
+ */
+static void fb_flush_graphics(void)
+{
+    if (graphics_view != view_back) {
+        fb_graphics_view();
+    }
+    fb_flush_cells();
+
+    if (cursor_dirty) {
+        unsigned short pos = cursor_y * FB_WIDTH + cursor_x;
+        cursor_dirty = 0;
+        if (pos != flushed_cursor) {
+            vbe_console_set_cursor(pos);
+            flushed_cursor = pos;
+            stats.cursor_writes++;
+        }
+    }
+    vbe_console_present();
+    stats.flushes++;
+}
+
+/** fb_batch_begin:
+ * Starts a batch of framebuffer updates
+ */
+void fb_batch_begin(void)
+{
+    batch_depth++;
+}
+
+/** fb_batch_end:
+ * Ends a batch and flushes once the outermost batch is closed
+ */
+void fb_batch_end(void)
+{
+    if (batch_depth > 0) {
+        batch_depth--;
+    }
+    if (batch_depth == 0) {
+        fb_flush();
+    }
+}
+
+/** fb_flush:
+ * Copies the dirty span to VGA memory and programs the cursor once
+ */
+void fb_flush(void)
+{
+    if (dirty_start < dirty_end || cursor_dirty) {
+        /* New output snaps the view back to the live screen */
+        view_back = 0;
+    }
+    if (graphics) {
+        fb_flush_graphics();
+        return;
+    }
+
+    fb_flush_cells();
+    if (view_back == 0) {
+        fb_set_start(origin_row);
+    }
+
+    if (cursor_dirty) {
+        unsigned short pos = (origin_row + cursor_y) * FB_WIDTH + cursor_x;
+        cursor_dirty = 0;
+        if (pos != flushed_cursor) {
+            fb_move_cursor(pos);
+            flushed_cursor = pos;
+        }
+    }
+    stats.flushes++;
+}
+
+/** fb_scroll_view:
+ * Pages the view through the scrollback ring
+ */
+void fb_scroll_view(int lines)
+{
+    int back = (int) view_back + lines;
+
+    if (back < 0) {
+        back = 0;
+    }
+    if (back > (int) scrollback_count) {
+        back = (int) scrollback_count;
+    }
+    view_back = (unsigned int) back;
+
+    if (graphics) {
+        fb_graphics_view();
+        vbe_console_present();
+        stats.view_redraws++;
+        return;
+    }
+    if (view_back <= origin_row - resident_row) {
+        /* Still in VGA memory above the live window: just move the start */
+        fb_set_start(origin_row - view_back);
+    } else {
+        fb_set_start(fb_render_view());
+    }
+}
+
+/** fb_init_graphics:
+ * Moves the console to the VBE framebuffer if the boot loader set one up,
+ * drawing what is already on the text screen
+ */
+unsigned char fb_init_graphics(const struct multiboot_info *mbi)
+{
+    if (graphics || !vbe_console_init(mbi)) {
+        return graphics;
+    }
+    graphics = 1;
+    view_back = 0;
+    graphics_view = 0;
+    fb_mark_dirty(0);
+    fb_mark_dirty(FB_CELLS - 1);
+    flushed_cursor = 0xFFFF;
+    cursor_dirty = 1;
+    fb_flush();
+    return 1;
+}
+
+/** fb_set_mirror:
+ * Sets the sink that receives a copy of the console output
+ */
+void fb_set_mirror(void (*sink)(char c))
+{
+    mirror = sink;
+}
+
+/** fb_get_stats:
+ * Returns the shadow buffer counters. Without batching every cursor move
+ * would cost FB_CURSOR_PORT_WRITES outb calls.
+ */
+const struct fb_stats *fb_get_stats(void)
+{
+    stats.port_writes_saved = (stats.cursor_requests - stats.cursor_writes) *
+                              FB_CURSOR_PORT_WRITES;
+    return &stats;
+}
 
 /** fb_write_cell:
  * Writes a character with the given foreground and background to position i
@@ -27,8 +402,22 @@ static char *fb = (char *) FB_ADDRESS;
  */
 void fb_write_cell(unsigned int i, char c, unsigned char fg, unsigned char bg)
 {
-    fb[i * 2] = c;
-    fb[i * 2 + 1] = ((fg & 0x0F) << 4) | (bg & 0x0F);
+    unsigned short cell = (unsigned char) c |
+                          ((((fg & 0x0F) << 4) | (bg & 0x0F)) << 8);
+    unsigned short *row;
+
+    if (i >= FB_CELLS) {
+        return;
+    }
+    stats.cells_written++;
+    row = fb_shadow_row(i / FB_WIDTH);
+    if (row[i % FB_WIDTH] != cell) {
+        row[i % FB_WIDTH] = cell;
+        fb_mark_dirty(i);
+    }
+    if (batch_depth == 0) {
+        fb_flush();
+    }
 }
 
 /** fb_move_cursor:
@@ -40,6 +429,7 @@ void fb_move_cursor(unsigned short pos)
     outb(FB_DATA_PORT, ((pos >> 8) & 0x00FF));
     outb(FB_COMMAND_PORT, FB_LOW_BYTE_COMMAND);
     outb(FB_DATA_PORT, pos & 0x00FF);
+    stats.cursor_writes++;
 }
 
 /** fb_move:
@@ -49,20 +439,29 @@ void fb_move(unsigned short x, unsigned short y)
 {
     cursor_x = x;
     cursor_y = y;
-    unsigned short pos = y * FB_WIDTH + x;
-    fb_move_cursor(pos);
+    stats.cursor_requests++;
+    cursor_dirty = 1;
+    if (batch_depth == 0) {
+        fb_flush();
+    }
 }
 
 /** fb_clear:
- * Clears the entire framebuffer
+ * Clears the entire framebuffer to blanks on black, in one fill of the
+ * shadow buffer
  */
 void fb_clear(void)
 {
-    unsigned int i;
-    for (i = 0; i < FB_WIDTH * FB_HEIGHT; i++) {
-        fb_write_cell(i, ' ', FB_BLACK, FB_BLACK);
+    if (mirror) {
+        mirror('\f');
     }
+    fb_batch_begin();
+    memset16(fb_shadow, FB_BLANK_CELL, FB_CELLS);
+    stats.cells_written += FB_CELLS;
+    fb_mark_dirty(0);
+    fb_mark_dirty(FB_CELLS - 1);
     fb_move(0, 0);
+    fb_batch_end();
 }
 
 /** fb_putc:
@@ -70,10 +469,14 @@ void fb_clear(void)
  */
 void fb_putc(char c)
 {
+    fb_batch_begin();
     if (c == '\n') {
         fb_newline();
     } else {
         unsigned short pos = cursor_y * FB_WIDTH + cursor_x;
+        if (mirror) {
+            mirror(c);
+        }
         fb_write_cell(pos, c, FB_WHITE, FB_BLACK);
         cursor_x++;
         if (cursor_x >= FB_WIDTH) {
@@ -81,12 +484,14 @@ void fb_putc(char c)
             cursor_y++;
         }
     }
-    
+
     if (cursor_y >= FB_HEIGHT) {
-        cursor_y = 0;
+        fb_scroll();
+        cursor_y = FB_HEIGHT - 1;
     }
-    
+
     fb_move(cursor_x, cursor_y);
+    fb_batch_end();
 }
 
 /** fb_write_char:
@@ -103,10 +508,13 @@ void fb_write_char(char c)
 void fb_puts(char *str)
 {
     unsigned int i = 0;
+
+    fb_batch_begin();
     while (str[i] != '\0') {
         fb_putc(str[i]);
         i++;
     }
+    fb_batch_end();
 }
 
 /** fb_write:
@@ -115,12 +523,51 @@ void fb_puts(char *str)
 int fb_write(char *buf, unsigned int len)
 {
     unsigned int i;
+
+    fb_batch_begin();
     for (i = 0; i < len; i++) {
         fb_putc(buf[i]);
     }
+    fb_batch_end();
     return 0;
 }
 
+/** fb_put_uint:
+ * Writes an unsigned integer in decimal
+ */
+void fb_put_uint(unsigned int value)
+{
+    char digits[10];
+    unsigned int n = 0;
+
+    fb_batch_begin();
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        fb_putc(digits[--n]);
+    }
+    fb_batch_end();
+}
+
+/** fb_put_hex:
+ * Writes an unsigned integer as 0x-prefixed hexadecimal
+ */
+void fb_put_hex(unsigned int value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    int shift;
+
+    fb_batch_begin();
+    fb_putc('0');
+    fb_putc('x');
+    for (shift = 28; shift >= 0; shift -= 4) {
+        fb_putc(hex[(value >> shift) & 0x0F]);
+    }
+    fb_batch_end();
+}
+
 /** fb_backspace:
  * Removes the last character from the screen
  */
@@ -135,11 +582,17 @@ void fb_backspace(void)
         // Already at start of screen, do nothing
         return;
     }
-    
+
+    if (mirror) {
+        mirror('\b');
+    }
+
     // Clear the character at current position
+    fb_batch_begin();
     unsigned short pos = cursor_y * FB_WIDTH + cursor_x;
     fb_write_cell(pos, ' ', FB_BLACK, FB_BLACK);
     fb_move(cursor_x, cursor_y);
+    fb_batch_end();
 }
 
 /** fb_newline:
@@ -147,10 +600,16 @@ void fb_backspace(void)
  */
 void fb_newline(void)
 {
+    if (mirror) {
+        mirror('\n');
+    }
+    fb_batch_begin();
     cursor_x = 0;
     cursor_y++;
     if (cursor_y >= FB_HEIGHT) {
-        cursor_y = 0;
+        fb_scroll();
+        cursor_y = FB_HEIGHT - 1;
     }
     fb_move(cursor_x, cursor_y);
+    fb_batch_end();
 }
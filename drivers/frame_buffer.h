@@ -1,6 +1,8 @@
 #ifndef INCLUDE_FB_H
 #define INCLUDE_FB_H
 
+struct multiboot_info;
+
 /* Framebuffer colors */
 #define FB_BLACK         0
 #define FB_BLUE          1
@@ -23,6 +25,23 @@
 #define FB_WIDTH  80
 #define FB_HEIGHT 25
 
+/* Lines kept for Shift+PgUp/PgDn once they scroll off the top */
+#define FB_SCROLLBACK_LINES 128
+
+/** Shadow buffer counters */
+struct fb_stats {
+    unsigned int cells_written;     /* fb_write_cell calls */
+    unsigned int cells_flushed;     /* cells copied to VGA memory */
+    unsigned int flushes;           /* fb_flush calls */
+    unsigned int cursor_requests;   /* fb_move calls */
+    unsigned int cursor_writes;     /* times the CRTC cursor was programmed */
+    unsigned int port_writes_saved; /* outb calls avoided by batching */
+    unsigned int scrolls;           /* lines scrolled by moving the start */
+    unsigned int wraps;             /* times the screen was copied back */
+    unsigned int start_writes;      /* times the CRTC start was programmed */
+    unsigned int view_redraws;      /* scrollback views drawn from the ring */
+};
+
 /** fb_write_cell:
  * Writes a character with the given foreground and background to position i
  * in the framebuffer.
@@ -94,4 +113,69 @@ void fb_newline(void);
  */
 void fb_write_char(char c);
 
+/** fb_put_uint:
+ * Writes an unsigned integer in decimal at the current cursor position
+ *
+ * @param value The value to write
+ */
+void fb_put_uint(unsigned int value);
+
+/** fb_put_hex:
+ * Writes an unsigned integer as 0x-prefixed hexadecimal
+ *
+ * @param value The value to write
+ */
+void fb_put_hex(unsigned int value);
+
+/** fb_batch_begin:
+ * Starts a batch of framebuffer updates. Cell writes and cursor moves are
+ * kept in the shadow buffer until the outermost fb_batch_end. Batches nest.
+ */
+void fb_batch_begin(void);
+
+/** fb_batch_end:
+ * Ends a batch started by fb_batch_begin, flushing if it was the outermost
+ */
+void fb_batch_end(void);
+
+/** fb_flush:
+ * Copies the changed cells of the shadow buffer to VGA memory and programs
+ * the hardware cursor once if it moved
+ */
+void fb_flush(void);
+
+/** fb_scroll_view:
+ * Pages the view through the scrollback. The view returns to the live
+ * screen as soon as anything new is written.
+ *
+ * @param lines Lines to move back (positive) or forward (negative)
+ */
+void fb_scroll_view(int lines);
+
+/** fb_init_graphics:
+ * Switches the console to the linear framebuffer the boot loader set up,
+ * if it did (see vbe_console_init). The fb_* calls then draw text with a
+ * bitmap font instead of writing VGA text memory; the text grid, the
+ * scrollback and the counters stay the same. Call after paging_init.
+ *
+ * @param mbi The multiboot information
+ * @return 1 if the console is on the framebuffer
+ */
+unsigned char fb_init_graphics(const struct multiboot_info *mbi);
+
+/** fb_set_mirror:
+ * Sets a second console sink. It receives every character written, '\n'
+ * for new lines, '\b' for fb_backspace and '\f' for fb_clear.
+ *
+ * @param sink The sink, or 0 to stop mirroring
+ */
+void fb_set_mirror(void (*sink)(char c));
+
+/** fb_get_stats:
+ * Returns the shadow buffer counters
+ *
+ * @return Pointer to the counters
+ */
+const struct fb_stats *fb_get_stats(void);
+
 #endif /* INCLUDE_FB_H */
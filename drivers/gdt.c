@@ -0,0 +1,70 @@
+#include "gdt.h"
+#include "smp.h"
+#include "types.h"
+
+/* Access byte: present, DPL, code/data, type */
+#define GDT_ACCESS_KERNEL_CODE  0x9A
+#define GDT_ACCESS_KERNEL_DATA  0x92
+#define GDT_ACCESS_USER_CODE    0xFA
+#define GDT_ACCESS_USER_DATA    0xF2
+#define GDT_ACCESS_TSS          0x89    /* present, DPL 0, 32-bit TSS available */
+
+/* 4 KB granularity, 32-bit */
+#define GDT_FLAT_GRANULARITY    0xCF
+/* Byte granularity, 32-bit */
+#define GDT_BYTE_GRANULARITY    0x40
+
+static struct GDTDescriptor gdt_descriptors[GDT_ENTRIES];
+static struct GDT gdt;
+static struct tss tss[SMP_MAX_CPUS];
+
+static void gdt_set_descriptor(u32int index, u32int base, u32int limit, u8int access, u8int granularity)
+{
+    gdt_descriptors[index].limit_low = limit & 0xFFFF;
+    gdt_descriptors[index].base_low = base & 0xFFFF;
+    gdt_descriptors[index].base_middle = (base >> 16) & 0xFF;
+    gdt_descriptors[index].access = access;
+    gdt_descriptors[index].granularity = (granularity & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt_descriptors[index].base_high = (base >> 24) & 0xFF;
+}
+
+void gdt_init(void)
+{
+    u32int i;
+
+    gdt_set_descriptor(0, 0, 0, 0, 0);
+    gdt_set_descriptor(GDT_KERNEL_CODE >> 3, 0, 0xFFFFF, GDT_ACCESS_KERNEL_CODE, GDT_FLAT_GRANULARITY);
+    gdt_set_descriptor(GDT_KERNEL_DATA >> 3, 0, 0xFFFFF, GDT_ACCESS_KERNEL_DATA, GDT_FLAT_GRANULARITY);
+    gdt_set_descriptor(GDT_USER_CODE >> 3, 0, 0xFFFFF, GDT_ACCESS_USER_CODE, GDT_FLAT_GRANULARITY);
+    gdt_set_descriptor(GDT_USER_DATA >> 3, 0, 0xFFFFF, GDT_ACCESS_USER_DATA, GDT_FLAT_GRANULARITY);
+
+    for (i = 0; i < SMP_MAX_CPUS; i++) {
+        struct cpu *cpu = smp_get_cpu(i);
+
+        tss[i].ss0 = GDT_KERNEL_DATA;
+        // No I/O permission bitmap: the offset points past the end
+        tss[i].iomap_base = sizeof(tss[i]);
+        gdt_set_descriptor(GDT_CPU_TSS(i) >> 3, (u32int) &tss[i], sizeof(tss[i]) - 1, GDT_ACCESS_TSS, 0x00);
+        gdt_set_descriptor(GDT_CPU_AREA(i) >> 3, (u32int) cpu, sizeof(*cpu) - 1, GDT_ACCESS_KERNEL_DATA, GDT_BYTE_GRANULARITY);
+    }
+
+    gdt.address = (u32int) &gdt_descriptors;
+    gdt.size = sizeof(gdt_descriptors) - 1;
+    load_gdt((u32int) &gdt);
+}
+
+void gdt_load(void)
+{
+    load_gdt((u32int) &gdt);
+}
+
+void gdt_load_cpu(u32int cpu)
+{
+    load_tss(GDT_CPU_TSS(cpu));
+    __asm__ volatile("movw %0, %%gs" : : "r"((u16int) GDT_CPU_AREA(cpu)) : "memory");
+}
+
+void gdt_set_kernel_stack(u32int esp0)
+{
+    tss[cpu_read(index)].esp0 = esp0;
+}
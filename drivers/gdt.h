@@ -0,0 +1,100 @@
+#ifndef INCLUDE_GDT_H
+#define INCLUDE_GDT_H
+
+#include "smp.h"
+#include "types.h"
+
+/* Segment selectors. SYSENTER/SYSEXIT require this order: kernel code,
+ * kernel data, user code, user data. */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x1B    /* index 3, RPL 3 */
+#define GDT_USER_DATA   0x23    /* index 4, RPL 3 */
+
+/* Each CPU then has a pair of entries: its TSS, and a data segment based
+ * at its struct cpu that it keeps in gs. The interrupt entry code relies
+ * on the pair being adjacent to find gs from the task register. */
+#define GDT_CPU_TSS(cpu)    (0x28 + (cpu) * 16)
+#define GDT_CPU_AREA(cpu)   (GDT_CPU_TSS(cpu) + 8)
+#define GDT_TSS             GDT_CPU_TSS(0)
+
+#define GDT_ENTRIES     (5 + 2 * SMP_MAX_CPUS)
+
+struct GDT {
+    u16int size;
+    u32int address;
+} __attribute__((packed));
+
+struct GDTDescriptor {
+    u16int limit_low;       // limit bits 0..15
+    u16int base_low;        // base bits 0..15
+    u8int base_middle;      // base bits 16..23
+    u8int access;           // present, DPL, type
+    u8int granularity;      // flags and limit bits 16..19
+    u8int base_high;        // base bits 24..31
+} __attribute__((packed));
+
+/** 32-bit task state segment. Only esp0/ss0, the stack used when an
+ * interrupt arrives in ring 3, are used; there is no hardware task
+ * switching. */
+struct tss {
+    u32int prev_tss;
+    u32int esp0;
+    u32int ss0;
+    u32int esp1;
+    u32int ss1;
+    u32int esp2;
+    u32int ss2;
+    u32int cr3;
+    u32int eip;
+    u32int eflags;
+    u32int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    u32int es, cs, ss, ds, fs, gs;
+    u32int ldt;
+    u16int trap;
+    u16int iomap_base;
+} __attribute__((packed));
+
+/** gdt_init:
+ * Replaces the GDT left by GRUB with flat kernel and user segments and the
+ * per-CPU entries, and reloads every segment register. Call first thing
+ * in kmain.
+ */
+void gdt_init(void);
+
+/** gdt_load:
+ * Loads the GDT built by gdt_init on an application processor
+ */
+void gdt_load(void);
+
+/** gdt_load_cpu:
+ * Loads the running CPU's TSS and points gs at its per-CPU area
+ *
+ * @param cpu Index of the running CPU
+ */
+void gdt_load_cpu(u32int cpu);
+
+/** gdt_set_kernel_stack:
+ * Sets the stack the running CPU switches to when an interrupt or int 0x80
+ * arrives from ring 3. The other CPUs keep theirs, so a kernel stack is
+ * never shared between CPUs.
+ *
+ * @param esp0 Top of the kernel stack
+ */
+void gdt_set_kernel_stack(u32int esp0);
+
+/** load_gdt:
+ * Loads the GDT and reloads the segment registers. Defined in gdt_asm.s.
+ *
+ * @param gdt Address of the struct GDT
+ */
+void load_gdt(u32int gdt);
+
+/** load_tss:
+ * Loads the task register. Defined in gdt_asm.s.
+ *
+ * @param selector The TSS selector
+ */
+void load_tss(u16int selector);
+
+#endif /* INCLUDE_GDT_H */
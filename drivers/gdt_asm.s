@@ -0,0 +1,27 @@
+global load_gdt
+global load_tss
+
+; load_gdt - Loads the global descriptor table and reloads every segment
+; register, so nothing keeps using descriptors from GRUB's table.
+; stack: [esp + 4] the address of the GDT pointer
+;        [esp    ] the return address
+load_gdt:
+    mov eax, [esp + 4]
+    lgdt [eax]
+    mov ax, 0x10          ; GDT_KERNEL_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    jmp 0x08:.reload_cs   ; GDT_KERNEL_CODE, a far jump reloads cs
+.reload_cs:
+    ret
+
+; load_tss - Loads the task register.
+; stack: [esp + 4] the TSS selector
+;        [esp    ] the return address
+load_tss:
+    mov ax, [esp + 4]
+    ltr ax
+    ret
@@ -0,0 +1,76 @@
+#include "initcall.h"
+#include "clock.h"
+#include "spinlock.h"
+#include "types.h"
+
+/* Defined in link.ld around the initcall sections, sorted by level */
+extern struct initcall *const __start_initcalls[];
+extern struct initcall *const __stop_initcalls[];
+
+/* Written by loader.asm before anything else runs */
+extern u64int boot_tsc;
+
+static SPINLOCK_DEFINE(initcall_lock, "initcalls");
+static u64int prompt_tsc = 0;
+
+static void initcall_call(struct initcall *call)
+{
+    call->started = clock_cycles();
+    call->function();
+    call->cycles = clock_cycles() - call->started;
+    __asm__ volatile("" : : : "memory");
+    call->done = 1;
+}
+
+void initcall_run(void)
+{
+    struct initcall *const *entry;
+
+    for (entry = __start_initcalls; entry < __stop_initcalls; entry++) {
+        if (!((*entry)->flags & INITCALL_LAZY)) {
+            initcall_call(*entry);
+        }
+    }
+}
+
+/** initcall_require:
+ * done is only set once the phase has finished, so a caller that sees it
+ * set can use the driver without taking the lock
+ */
+void initcall_require(struct initcall *call)
+{
+    u32int flags;
+
+    if (call->done) {
+        return;
+    }
+    flags = spin_lock_irqsave(&initcall_lock);
+    if (!call->done) {
+        initcall_call(call);
+    }
+    spin_unlock_irqrestore(&initcall_lock, flags);
+}
+
+const struct initcall *initcall_get(u32int index)
+{
+    u32int count = (u32int) (__stop_initcalls - __start_initcalls);
+
+    return index < count ? __start_initcalls[index] : 0;
+}
+
+u64int initcall_boot_tsc(void)
+{
+    return boot_tsc;
+}
+
+void initcall_mark_prompt(void)
+{
+    if (prompt_tsc == 0) {
+        prompt_tsc = clock_cycles();
+    }
+}
+
+u64int initcall_prompt_tsc(void)
+{
+    return prompt_tsc;
+}
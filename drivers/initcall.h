@@ -0,0 +1,78 @@
+#ifndef INCLUDE_INITCALL_H
+#define INCLUDE_INITCALL_H
+
+#include "types.h"
+
+/* Not run at boot; initcall_require runs it on first use */
+#define INITCALL_LAZY 0x01
+
+/** A boot phase. The times are TSC cycles, so they are valid before the
+ * clock is calibrated. */
+struct initcall {
+    const char *name;
+    void (*function)(void);
+    u8int flags;
+    volatile u8int done;
+    u64int started;             /* TSC when it was called, 0 if not yet */
+    u64int cycles;              /* how long it took */
+};
+
+/** INITCALL:
+ * Defines a boot phase and lists it at link time, the same way
+ * TERMINAL_COMMAND registers commands. initcall_run calls the phases in
+ * order of level, which must be two digits; phases with the same level
+ * run in link order. Prefix with static as needed; the phase's variable is
+ * initcall_<function>.
+ *
+ * @param level         Two-digit position in the boot sequence
+ * @param call_name     Name shown by boottime
+ * @param call_function The function to run
+ * @param call_flags    0 or INITCALL_LAZY
+ */
+#define INITCALL(level, call_name, call_function, call_flags)           \
+    struct initcall initcall_##call_function =                          \
+        { call_name, call_function, call_flags, 0, 0, 0 };              \
+    static struct initcall *const initcall_entry_##call_function        \
+    __attribute__((used, section("initcall" #level), aligned(4))) =     \
+        &initcall_##call_function
+
+/** initcall_run:
+ * Runs every phase that is not lazy, in level order, timing each. Called
+ * once by kmain with interrupts disabled.
+ */
+void initcall_run(void);
+
+/** initcall_require:
+ * Runs a lazy phase if it has not run yet; otherwise returns at once.
+ * Safe from any CPU and from interrupt handlers. The phase runs with
+ * interrupts disabled and must not require another lazy phase.
+ *
+ * @param call The phase
+ */
+void initcall_require(struct initcall *call);
+
+/** initcall_get:
+ * Returns a phase, in the order initcall_run calls them
+ *
+ * @param index 0 upwards
+ * @return The phase, or 0 past the end
+ */
+const struct initcall *initcall_get(u32int index);
+
+/** initcall_boot_tsc:
+ * Returns the TSC read by the first instruction of loader
+ */
+u64int initcall_boot_tsc(void);
+
+/** initcall_mark_prompt:
+ * Records when the terminal first shows its prompt. Later calls do
+ * nothing.
+ */
+void initcall_mark_prompt(void);
+
+/** initcall_prompt_tsc:
+ * Returns the TSC when the first prompt was shown, 0 if it has not been
+ */
+u64int initcall_prompt_tsc(void);
+
+#endif /* INCLUDE_INITCALL_H */
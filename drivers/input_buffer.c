@@ -1,13 +1,41 @@
 #include "input_buffer.h"
+#include "deferred.h"
+#include "thread.h"
 #include "types.h"
 
-// External buffer variables from interrupts.c
-extern u8int input_buffer[];
-extern u8int buffer_index;
-extern u8int buffer_read_index;
-extern u8int buffer_count;
+/* Stops the compiler from moving memory accesses across this point. On a
+ * single x86 CPU stores are seen in program order, so this is all the
+ * ordering the ring needs between the interrupt handler and the reader. */
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
 
-#define INPUT_BUFFER_SIZE 256
+#define READLINE_CHUNK 32
+
+static struct input_ring ring;
+
+static readline_complete_fn readline_complete = 0;
+
+/* Threads blocked in readline */
+static struct wait_queue input_waiters = WAIT_QUEUE_INIT;
+
+/** input_buffer_put:
+ * Appends a byte to the input buffer. Producer side, called from interrupt
+ * handlers.
+ *
+ * @return 1 if stored, 0 if the buffer was full and the byte was dropped
+ */
+u8int input_buffer_put(u8int c)
+{
+    u32int head = ring.head;
+
+    if (head - ring.tail >= INPUT_BUFFER_SIZE) {
+        return 0;
+    }
+    ring.data[head & INPUT_BUFFER_MASK] = c;
+    // Publish the byte before the new head
+    compiler_barrier();
+    ring.head = head + 1;
+    return 1;
+}
 
 /** getc:
  * Gets a single character from the input buffer.
@@ -17,24 +45,66 @@ extern u8int buffer_count;
  */
 u8int getc(void)
 {
-    u8int character = 0;
-    
-    // Disable interrupts while reading from buffer
-    __asm__ volatile("cli");
-    
-    // Check if buffer has characters
-    if (buffer_count > 0) {
-        // Read from buffer_index (start of valid data)
-        character = input_buffer[buffer_index];
-        // Move buffer_index forward and decrease count
-        buffer_index = (buffer_index + 1) % INPUT_BUFFER_SIZE;
-        buffer_count--;
+    u8int c;
+
+    if (input_buffer_read(&c, 1) == 0) {
+        return 0;
+    }
+    return c;
+}
+
+/** input_buffer_copy:
+ * Consumer side of both bulk reads. Copies up to n bytes, stopping after an
+ * end-of-line byte when stop_at_eol is set.
+ */
+static u32int input_buffer_copy(u8int *buf, u32int n, u8int stop_at_eol)
+{
+    u32int tail = ring.tail;
+    u32int head = ring.head;
+    u32int i = 0;
+
+    // Read head before the bytes it covers
+    compiler_barrier();
+    while (i < n && tail != head) {
+        u8int c = ring.data[tail & INPUT_BUFFER_MASK];
+        buf[i++] = c;
+        tail++;
+        if (stop_at_eol && (c == '\n' || c == '\r')) {
+            break;
+        }
     }
-    
-    // Re-enable interrupts
-    __asm__ volatile("sti");
-    
-    return character;
+    // Finish reading the bytes before handing the slots back
+    compiler_barrier();
+    ring.tail = tail;
+    return i;
+}
+
+/** input_buffer_read:
+ * Moves up to n bytes out of the input buffer in one call.
+ *
+ * @return Number of bytes read, 0 if the buffer was empty
+ */
+u32int input_buffer_read(u8int *buf, u32int n)
+{
+    return input_buffer_copy(buf, n, 0);
+}
+
+/** input_buffer_read_line:
+ * Like input_buffer_read, but stops after the first '\n' or '\r'.
+ *
+ * @return Number of bytes read, including the line end if one was found
+ */
+u32int input_buffer_read_line(u8int *buf, u32int n)
+{
+    return input_buffer_copy(buf, n, 1);
+}
+
+/** input_buffer_count:
+ * Returns the number of bytes waiting in the input buffer
+ */
+u32int input_buffer_count(void)
+{
+    return ring.head - ring.tail;
 }
 
 /** input_buffer_available:
@@ -44,7 +114,36 @@ u8int getc(void)
  */
 u8int input_buffer_available(void)
 {
-    return (buffer_count > 0) ? 1 : 0;
+    return (ring.head != ring.tail) ? 1 : 0;
+}
+
+/** input_buffer_wake:
+ * Wakes readline after an interrupt queued input
+ */
+void input_buffer_wake(void)
+{
+    wait_queue_wake(&input_waiters);
+}
+
+/** input_buffer_wait:
+ * Blocks until there is input or input work to run
+ */
+static void input_buffer_wait(void)
+{
+    // Taken before the check so a wakeup in between is not lost
+    u32int ticket = wait_queue_prepare(&input_waiters);
+
+    if (!input_buffer_available() && !deferred_pending()) {
+        wait_queue_sleep(&input_waiters, ticket);
+    }
+}
+
+/** readline_set_completion:
+ * Sets the function readline calls when Tab is pressed
+ */
+void readline_set_completion(readline_complete_fn complete)
+{
+    readline_complete = complete;
 }
 
 /** readline:
@@ -57,36 +156,57 @@ u8int input_buffer_available(void)
  */
 s32int readline(char *buffer, u32int max_len)
 {
+    u8int chunk[READLINE_CHUNK];
     u32int i = 0;
-    u8int c;
-    
+
     if (buffer == 0 || max_len == 0) {
         return -1;
     }
-    
+
     // Read characters until newline or buffer full
     while (i < (max_len - 1)) {
-        // Wait for characters to be available
-        while (buffer_count == 0) {
-            __asm__ volatile("hlt");
+        u32int want = max_len - 1 - i;
+        u32int got;
+        u32int j;
+
+        // Block until the keyboard or serial handler wakes us, running
+        // the input bottom half each time
+        deferred_run();
+        while (!input_buffer_available()) {
+            input_buffer_wait();
+            deferred_run();
         }
-        
-        c = getc();
-        
-        // If we got a character
-        if (c != 0) {
+
+        if (want > READLINE_CHUNK) {
+            want = READLINE_CHUNK;
+        }
+        got = input_buffer_read_line(chunk, want);
+
+        for (j = 0; j < got; j++) {
+            u8int c = chunk[j];
+
             // Check for newline
             if (c == '\n' || c == '\r') {
                 buffer[i] = '\0';
                 return (s32int)i;
             }
-            
-            // Add character to buffer
-            buffer[i] = c;
-            i++;
+
+            if (c == '\b') {
+                if (i > 0) {
+                    i--;
+                }
+            } else if (c == '\t') {
+                if (readline_complete != 0) {
+                    i = readline_complete(buffer, i, max_len - 1);
+                }
+            } else {
+                // Add character to buffer
+                buffer[i] = c;
+                i++;
+            }
         }
     }
-    
+
     // Buffer full, null terminate
     buffer[max_len - 1] = '\0';
     return (s32int)(max_len - 1);
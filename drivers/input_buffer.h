@@ -3,6 +3,30 @@
 
 #include "types.h"
 
+/* Ring size, must be a power of two */
+#define INPUT_BUFFER_SIZE 256
+#define INPUT_BUFFER_MASK (INPUT_BUFFER_SIZE - 1)
+
+/** Single-producer/single-consumer byte ring.
+ * head is only written by the producer (interrupt handlers) and tail only by
+ * the consumer. Both count up forever; head - tail is the number of bytes
+ * stored and the array index is the counter masked by INPUT_BUFFER_MASK.
+ */
+struct input_ring {
+    u8int data[INPUT_BUFFER_SIZE];
+    volatile u32int head;
+    volatile u32int tail;
+};
+
+/** input_buffer_put:
+ * Appends a byte to the input buffer. Producer side, called from interrupt
+ * handlers.
+ *
+ * @param c The byte to store
+ * @return 1 if stored, 0 if the buffer was full and the byte was dropped
+ */
+u8int input_buffer_put(u8int c);
+
 /** getc:
  * Gets a single character from the input buffer.
  * Returns 0 if buffer is empty.
@@ -11,9 +35,48 @@
  */
 u8int getc(void);
 
+/** input_buffer_read:
+ * Moves up to n bytes out of the input buffer in one call.
+ *
+ * @param buf The destination
+ * @param n   Maximum number of bytes to read
+ * @return Number of bytes read, 0 if the buffer was empty
+ */
+u32int input_buffer_read(u8int *buf, u32int n);
+
+/** input_buffer_read_line:
+ * Like input_buffer_read, but stops after the first '\n' or '\r' so bytes
+ * of the next line stay in the buffer.
+ *
+ * @param buf The destination
+ * @param n   Maximum number of bytes to read
+ * @return Number of bytes read, including the line end if one was found
+ */
+u32int input_buffer_read_line(u8int *buf, u32int n);
+
+/** input_buffer_wake:
+ * Wakes a thread blocked in readline. Called by the input interrupt
+ * handlers once they have queued a byte or work that produces one.
+ */
+void input_buffer_wake(void);
+
+/** Completion hook: given the line typed so far, may append to it (and
+ * echo what it adds) and returns the new length, at most max_len */
+typedef u32int (*readline_complete_fn)(char *line, u32int len, u32int max_len);
+
+/** readline_set_completion:
+ * Sets the function readline calls when Tab is pressed
+ *
+ * @param complete The completion hook, 0 to ignore Tab
+ */
+void readline_set_completion(readline_complete_fn complete);
+
 /** readline:
  * Reads a line from the input buffer until a newline is encountered.
  * The line (without the newline) is stored in the provided buffer.
+ * A '\b' in the input removes the previous character of the line and a
+ * '\t' runs the completion hook. The calling thread blocks while there is
+ * no input.
  *
  * @param buffer The buffer to store the line
  * @param max_len Maximum length to read (including null terminator)
@@ -28,4 +91,11 @@ s32int readline(char *buffer, u32int max_len);
  */
 u8int input_buffer_available(void);
 
+/** input_buffer_count:
+ * Returns the number of bytes waiting in the input buffer
+ *
+ * @return The number of bytes stored
+ */
+u32int input_buffer_count(void);
+
 #endif /* INCLUDE_INPUT_BUFFER_H */
@@ -27,6 +27,15 @@ common_interrupt_handler:  ; the common parts of the generic interrupt handler
     push esi
     push edi
 
+    ; Coming from ring 3, gs holds the user data segment. The CPU's area
+    ; selector follows its TSS selector in the GDT (GDT_CPU_AREA).
+    test dword [esp + 40], 3  ; cs of the interrupted code
+    jz .kernel_gs
+    str ax
+    add ax, 8
+    mov gs, ax
+.kernel_gs:
+
     ; call the C function
     call interrupt_handler
 
@@ -45,9 +54,25 @@ common_interrupt_handler:  ; the common parts of the generic interrupt handler
     ; return to the code that got interrupted
     iret
 
-; Create handler for interrupt 33 (keyboard)
-no_error_code_interrupt_handler 33
-
-; Create handler for interrupt 14 (page fault - example)
-error_code_interrupt_handler 14
+; Create handlers for all 256 vectors. The CPU pushes an error code itself
+; for exceptions 8, 10-14, 17, 21, 29 and 30; every other stub pushes a 0
+; so the stack looks the same to interrupt_handler.
+%assign vector 0
+%rep 256
+%if vector == 8 || (vector >= 10 && vector <= 14) || vector == 17 || vector == 21 || vector == 29 || vector == 30
+error_code_interrupt_handler %[vector]
+%else
+no_error_code_interrupt_handler %[vector]
+%endif
+%assign vector vector + 1
+%endrep
 
+section .rodata
+; Table of the stub addresses, indexed by vector
+global interrupt_stub_table
+interrupt_stub_table:
+%assign vector 0
+%rep 256
+    dd interrupt_handler_%[vector]
+%assign vector vector + 1
+%endrep
@@ -1,27 +1,58 @@
 #include "interrupts.h"
 #include "pic.h"
+#include "irq.h"
 #include "io.h"
 #include "frame_buffer.h"
 #include "keyboard.h"
+#include "input_buffer.h"
+#include "clock.h"
+#include "serial.h"
+#include "math64.h"
+#include "deferred.h"
+#include "gdt.h"
+#include "user.h"
+#include "smp.h"
+#include "thread.h"
 #include "types.h"
 
-#define INTERRUPTS_DESCRIPTOR_COUNT 256
-#define INTERRUPTS_KEYBOARD 33
-#define INPUT_BUFFER_SIZE 256
-
-u8int input_buffer[INPUT_BUFFER_SIZE];
-u8int buffer_index = 0;
-u8int buffer_read_index = 0;
-u8int buffer_count = 0;
-
 struct IDTDescriptor idt_descriptors[INTERRUPTS_DESCRIPTOR_COUNT];
 struct IDT idt;
 
+/* Registered handlers, indexed by vector; 0 means unhandled */
+static interrupt_handler_t handlers[INTERRUPTS_DESCRIPTOR_COUNT];
+
+static const char *exception_names[INTERRUPTS_EXCEPTION_COUNT] = {
+    "divide error", "debug", "NMI", "breakpoint",
+    "overflow", "bound range", "invalid opcode", "device not available",
+    "double fault", "coprocessor overrun", "invalid TSS", "segment not present",
+    "stack fault", "general protection", "page fault", "reserved",
+    "x87 FPU error", "alignment check", "machine check", "SIMD exception",
+    "virtualization", "control protection", "reserved", "reserved",
+    "reserved", "reserved", "reserved", "reserved",
+    "hypervisor injection", "VMM communication", "security", "reserved"
+};
+
+#define INTERRUPTS_TRACE_MASK (INTERRUPTS_TRACE_SIZE - 1)
+
+static u8int trace_enabled = 0;
+static struct trace_event trace_ring[INTERRUPTS_TRACE_SIZE];
+static u32int trace_head = 0;
+static u32int trace_histogram[INTERRUPTS_TRACE_BUCKETS];
+
+/* Scan code read by the keyboard handler during the current interrupt */
+static u8int trace_scan_code = 0;
+
+/* Whether input processing runs as deferred work or inside the handler */
+static u8int defer_input = 1;
+
+/* Keyboard handler cost, [0] with inline processing, [1] deferred */
+static struct isr_stats keyboard_isr_stats[2];
+
 void interrupts_init_descriptor(s32int index, u32int address)
 {
     idt_descriptors[index].offset_high = (address >> 16) & 0xFFFF;  // offset bits 0..15
     idt_descriptors[index].offset_low = (address & 0xFFFF);  // offset bits 16..31
-    idt_descriptors[index].segment_selector = 0x08;  // The second (code) segment selector in GDT: one segment is 64b.
+    idt_descriptors[index].segment_selector = GDT_KERNEL_CODE;
     idt_descriptors[index].reserved = 0x00;  // Reserved.
     /*
      * Bit:     | 31              16 | 15 | 14 13 | 12 | 11    10 9 8 | 7 6 | 5 4 3 2 1 0 |
@@ -36,75 +67,317 @@ void interrupts_init_descriptor(s32int index, u32int address)
                                            0xe;  // 0b1110 = 0xE 32-bit interrupt gate
 }
 
+void interrupts_set_gate_dpl(u8int vector, u8int dpl)
+{
+    idt_descriptors[vector].type_and_attr = (idt_descriptors[vector].type_and_attr & 0x9F) | ((dpl & 3) << 5);
+}
+
+static void interrupts_keyboard_handler(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack);
+
 void interrupts_install_idt()
 {
-    interrupts_init_descriptor(INTERRUPTS_KEYBOARD, (u32int) interrupt_handler_33);
-    
+    s32int i;
+
+    for (i = 0; i < INTERRUPTS_DESCRIPTOR_COUNT; i++) {
+        interrupts_init_descriptor(i, interrupt_stub_table[i]);
+    }
+
     idt.address = (s32int) &idt_descriptors;
     idt.size = sizeof(struct IDTDescriptor) * INTERRUPTS_DESCRIPTOR_COUNT;
     load_idt((s32int) &idt);
     
     pic_remap(PIC_1_OFFSET, PIC_2_OFFSET);
-    
-    // Unmask keyboard interrupt (IRQ1)
-    outb(0x21, inb(0x21) & ~(1 << 1));
+
+    register_interrupt_handler(INTERRUPTS_KEYBOARD, interrupts_keyboard_handler);
+    irq_unmask(1);
+}
+
+void interrupts_load_idt(void)
+{
+    load_idt((u32int) &idt);
+}
+
+void register_interrupt_handler(u8int vector, interrupt_handler_t handler)
+{
+    handlers[vector] = handler;
+}
+
+interrupt_handler_t interrupts_get_handler(u8int vector)
+{
+    return handlers[vector];
+}
+
+/** interrupts_get_count:
+ * Adds up the per-CPU hit counters of a vector
+ */
+u32int interrupts_get_count(u8int vector)
+{
+    u32int count = 0;
+    u32int i;
+
+    for (i = 0; i < smp_cpu_count(); i++) {
+        count += smp_get_cpu(i)->interrupts[vector];
+    }
+    return count;
+}
+
+const char *interrupts_vector_name(u8int vector)
+{
+    if (vector < INTERRUPTS_EXCEPTION_COUNT) {
+        return exception_names[vector];
+    }
+    if (vector >= PIC_1_OFFSET && vector <= PIC_2_END) {
+        return "irq";
+    }
+    return "software";
 }
 
 /* Interrupt handlers ********************************************************/
 
-void interrupt_handler(__attribute__((unused)) struct cpu_state cpu, u32int interrupt, __attribute__((unused)) struct stack_state stack) {
+void interrupts_receive_char(u8int ascii)
+{
+    // Echo the key; readline applies '\b' to its own line
+    if (ascii == '\b') {
+        fb_backspace();
+    } else if (ascii == '\n') {
+        fb_newline();
+    } else if (ascii >= ' ') {
+        fb_write_char(ascii);
+    }
+    input_buffer_put(ascii);
+}
+
+/** interrupts_trace_record:
+ * Appends one event to the trace ring and the histogram
+ */
+static void interrupts_trace_record(u32int interrupt, u64int entry, u8int scan_code)
+{
+    struct trace_event *event = &trace_ring[trace_head & INTERRUPTS_TRACE_MASK];
+    u32int cycles = (u32int) (clock_cycles() - entry);
+    u32int bucket = 0;
+
+    event->entry_tsc = entry;
+    event->cycles = cycles;
+    event->vector = (u8int) interrupt;
+    event->scan_code = scan_code;
+    event->occupancy = (u16int) input_buffer_count();
+    trace_head++;
+
+    if (cycles != 0) {
+        __asm__("bsrl %1, %0" : "=r"(bucket) : "rm"(cycles));
+    }
+    trace_histogram[bucket]++;
+}
+
+void interrupts_trace_enable(u8int enable)
+{
+    trace_enabled = enable;
+}
+
+void interrupts_trace_clear(void)
+{
+    u32int i;
+
+    trace_head = 0;
+    for (i = 0; i < INTERRUPTS_TRACE_BUCKETS; i++) {
+        trace_histogram[i] = 0;
+    }
+}
+
+void interrupts_trace_dump(void)
+{
+    u8int was_enabled = trace_enabled;
+    u32int head;
+    u32int count;
+    u32int first;
+    u64int base;
+    u32int i;
+
+    // Stop recording so printing does not overwrite the ring under us
+    trace_enabled = 0;
+    head = trace_head;
+    count = head < INTERRUPTS_TRACE_SIZE ? head : INTERRUPTS_TRACE_SIZE;
+    first = head - count;
+    base = trace_ring[first & INTERRUPTS_TRACE_MASK].entry_tsc;
+
+    fb_puts("trace events=");
+    fb_put_uint(count);
+    fb_puts(was_enabled ? " state=on\n" : " state=off\n");
+    for (i = first; i != head; i++) {
+        struct trace_event *event = &trace_ring[i & INTERRUPTS_TRACE_MASK];
+        u64int since = clock_cycles_to_ns(event->entry_tsc - base);
+
+        fb_puts("irq vec=");
+        fb_put_uint(event->vector);
+        fb_puts(" t_us=");
+        fb_put_uint((u32int) div64_u32(since, 1000, 0));
+        fb_puts(" cycles=");
+        fb_put_uint(event->cycles);
+        fb_puts(" sc=");
+        fb_put_hex(event->scan_code);
+        fb_puts(" occ=");
+        fb_put_uint(event->occupancy);
+        fb_putc('\n');
+    }
+
+    fb_puts("histogram cycles\n");
+    for (i = 0; i < INTERRUPTS_TRACE_BUCKETS; i++) {
+        if (trace_histogram[i] == 0) {
+            continue;
+        }
+        fb_puts("hist lo=");
+        fb_put_uint(1u << i);
+        fb_puts(" count=");
+        fb_put_uint(trace_histogram[i]);
+        fb_putc('\n');
+    }
+    trace_enabled = was_enabled;
+}
+
+/** interrupts_receive_work:
+ * Deferred half of interrupts_queue_char
+ */
+static void interrupts_receive_work(u32int ascii)
+{
+    interrupts_receive_char((u8int) ascii);
+}
+
+void interrupts_queue_char(u8int ascii)
+{
+    if (defer_input) {
+        deferred_queue(interrupts_receive_work, ascii);
+    } else {
+        interrupts_receive_char(ascii);
+    }
+    input_buffer_wake();
+}
+
+void interrupts_set_deferred(u8int enable)
+{
+    defer_input = enable;
+}
+
+u8int interrupts_get_deferred(void)
+{
+    return defer_input;
+}
+
+const struct isr_stats *interrupts_get_keyboard_stats(u8int deferred)
+{
+    return &keyboard_isr_stats[deferred ? 1 : 0];
+}
+
+/** interrupts_keyboard_work:
+ * Bottom half of IRQ1: translates the scan code, echoes it and queues the
+ * character for readline
+ */
+static void interrupts_keyboard_work(u32int scan_code)
+{
+    u8int key = keyboard_process_scan_code((u8int) scan_code);
+
+    // Shift+PgUp/PgDn page through the scrollback
+    if ((key == KEYBOARD_KEY_PAGE_UP || key == KEYBOARD_KEY_PAGE_DOWN) &&
+        (keyboard_modifiers() & KEYBOARD_MOD_SHIFT)) {
+        fb_scroll_view(key == KEYBOARD_KEY_PAGE_UP ? FB_HEIGHT : -FB_HEIGHT);
+        return;
+    }
+
+    // Other keys without an ASCII code have no use yet
+    if (key != 0 && key < 0x80) {
+        interrupts_receive_char(key);
+    }
+}
+
+/** interrupts_keyboard_handler:
+ * IRQ1: reads the scan code and, unless deferral is off, leaves the rest
+ * to interrupts_keyboard_work outside interrupt context
+ */
+static void interrupts_keyboard_handler(__attribute__((unused)) struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, __attribute__((unused)) struct stack_state *stack)
+{
+    u64int start = clock_cycles();
+    u8int deferred = defer_input;
+    struct isr_stats *isr = &keyboard_isr_stats[deferred];
     u8int input;
-    u8int ascii;
-    
-    switch (interrupt) {
-        case INTERRUPTS_KEYBOARD:
-            // Read scan code from keyboard data port
-            input = keyboard_read_scan_code();
-            
-            // Only process if it's not a break code (key release)
-            if (!(input & 0x80)) {
-                ascii = keyboard_scan_code_to_ascii(input);
-                if (ascii != 0) {
-                    // We have detected a backspace
-                    if (ascii == '\b') {
-                        // Remove the last character from display
-                        fb_backspace();
-                        // Also remove from buffer if there's something in it
-                        if (buffer_count > 0) {
-                            buffer_count--;
-                            if (buffer_read_index > 0) {
-                                buffer_read_index--;
-                            } else {
-                                buffer_read_index = INPUT_BUFFER_SIZE - 1;
-                            }
-                        }
-                    }
-                    // We have detected a newline
-                    else if (ascii == '\n') {
-                        // Move our position to a newline
-                        fb_newline();
-                        // Add newline to buffer
-                        if (buffer_count < INPUT_BUFFER_SIZE - 1) {
-                            u8int write_pos = (buffer_index + buffer_count) % INPUT_BUFFER_SIZE;
-                            input_buffer[write_pos] = ascii;
-                            buffer_count++;
-                        }
-                    }
-                    // We have detected a regular character
-                    else {
-                        // Add the new character to the display
-                        fb_write_char(ascii);
-                        // Add to buffer
-                        if (buffer_count < INPUT_BUFFER_SIZE - 1) {
-                            u8int write_pos = (buffer_index + buffer_count) % INPUT_BUFFER_SIZE;
-                            input_buffer[write_pos] = ascii;
-                            buffer_count++;
-                        }
-                    }
-                }
-            }
-            // Acknowledge the interrupt
-            pic_acknowledge(interrupt);
-            break;
+    u32int cycles;
+
+    // Read scan code from keyboard data port
+    input = keyboard_read_scan_code();
+    trace_scan_code = input;
+
+    if (deferred) {
+        deferred_queue(interrupts_keyboard_work, input);
+    } else {
+        interrupts_keyboard_work(input);
+    }
+    input_buffer_wake();
+
+    cycles = (u32int) (clock_cycles() - start);
+    isr->count++;
+    isr->total_cycles += cycles;
+    if (cycles > isr->max_cycles) {
+        isr->max_cycles = cycles;
+    }
+}
+
+/** interrupts_unhandled_exception:
+ * Reports a CPU exception nobody registered for and stops the machine,
+ * instead of letting it escalate into a silent triple fault. Exceptions
+ * raised by user code kill the user program instead.
+ */
+static void interrupts_unhandled_exception(u32int interrupt, struct stack_state *stack)
+{
+    // A fault in ring 3 only ends the program
+    if (stack->cs & 3) {
+        user_kill(exception_names[interrupt], stack->eip);
     }
+    fb_puts("\nUnhandled exception ");
+    fb_put_uint(interrupt);
+    fb_puts(" (");
+    fb_puts((char *) exception_names[interrupt]);
+    fb_puts(") error=");
+    fb_put_hex(stack->error_code);
+    fb_puts(" eip=");
+    fb_put_hex(stack->eip);
+    fb_puts(" cs=");
+    fb_put_hex(stack->cs);
+    fb_puts(" eflags=");
+    fb_put_hex(stack->eflags);
+    fb_puts("\nSystem halted.\n");
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+void interrupt_handler(struct cpu_state cpu, u32int interrupt, struct stack_state stack) {
+    interrupt_handler_t handler = handlers[interrupt];
+    u64int entry = 0;
+
+    // Restart the periodic tick if this woke the CPU from tickless idle
+    clock_idle_exit(interrupt);
+
+    // The trace ring has a single writer: the boot CPU, which takes the
+    // device interrupts
+    if (trace_enabled && cpu_read(index) == 0) {
+        entry = clock_cycles();
+        trace_scan_code = 0;
+    }
+
+    // Per CPU, so CPUs taking the same vector never share a line
+    cpu_this()->interrupts[interrupt]++;
+
+    if (handler != 0) {
+        handler(&cpu, interrupt, &stack);
+    } else if (interrupt < INTERRUPTS_EXCEPTION_COUNT) {
+        interrupts_unhandled_exception(interrupt, &stack);
+    }
+
+    // Acknowledge hardware interrupts, handled or not
+    irq_acknowledge(interrupt);
+
+    if (trace_enabled && entry != 0) {
+        interrupts_trace_record(interrupt, entry, trace_scan_code);
+    }
+
+    // Last, as this may switch to another thread's stack
+    thread_preempt();
 }
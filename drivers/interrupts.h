@@ -3,6 +3,17 @@
 
 #include "types.h"
 
+#define INTERRUPTS_DESCRIPTOR_COUNT 256
+
+/* Vectors 0-31 are CPU exceptions */
+#define INTERRUPTS_EXCEPTION_COUNT 32
+#define INTERRUPTS_PAGE_FAULT 14
+
+/* Hardware interrupts, after pic_remap */
+#define INTERRUPTS_TIMER 32
+#define INTERRUPTS_KEYBOARD 33
+#define INTERRUPTS_COM1 36
+
 struct IDT
 {
     u16int size;
@@ -19,16 +30,33 @@ struct IDTDescriptor {
     u16int offset_high;      // offset bits 16..31
 } __attribute__((packed));
 
+/** Registers saved by common_interrupt_handler, lowest address first.
+ * A handler may change them; the stub pops them back before iret. */
 struct cpu_state {
-    u32int eax;
-    u32int ebx;
-    u32int ecx;
-    u32int edx;
-    u32int ebp;
-    u32int esi;
     u32int edi;
+    u32int esi;
+    u32int ebp;
+    u32int edx;
+    u32int ecx;
+    u32int ebx;
+    u32int eax;
+} __attribute__((packed));
+
+/** Interrupt trace record, 16 bytes */
+struct trace_event {
+    u64int entry_tsc;   // TSC when interrupt_handler was entered
+    u32int cycles;      // TSC cycles until it returned
+    u8int vector;       // interrupt number
+    u8int scan_code;    // scan code read, keyboard only
+    u16int occupancy;   // input buffer bytes on exit
 } __attribute__((packed));
 
+/* Trace ring entries, must be a power of two */
+#define INTERRUPTS_TRACE_SIZE 256
+
+/* Log2 buckets of the ISR duration histogram */
+#define INTERRUPTS_TRACE_BUCKETS 32
+
 struct stack_state {
     u32int error_code;
     u32int eip;
@@ -36,12 +64,131 @@ struct stack_state {
     u32int eflags;
 } __attribute__((packed));
 
+/** Handler for one vector. cpu and stack point at the state saved on entry. */
+typedef void (*interrupt_handler_t)(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack);
+
 void interrupt_handler(struct cpu_state cpu, u32int interrupt, struct stack_state stack);
 void interrupts_install_idt();
 
+/** interrupts_load_idt:
+ * Loads the IDT built by interrupts_install_idt on an application
+ * processor
+ */
+void interrupts_load_idt(void);
+
+/** register_interrupt_handler:
+ * Installs the handler called for a vector, replacing any previous one.
+ * Hardware interrupts are acknowledged after the handler returns.
+ *
+ * @param vector  The interrupt vector (0-255)
+ * @param handler The handler, or 0 to remove it
+ */
+void register_interrupt_handler(u8int vector, interrupt_handler_t handler);
+
+/** interrupts_get_handler:
+ * Returns the handler installed for a vector
+ *
+ * @param vector The interrupt vector (0-255)
+ * @return The handler, 0 if there is none
+ */
+interrupt_handler_t interrupts_get_handler(u8int vector);
+
+/** interrupts_set_gate_dpl:
+ * Sets the privilege level needed to raise a vector with int. Gates are
+ * installed with DPL 0, so int from ring 3 faults unless this is changed.
+ *
+ * @param vector The interrupt vector
+ * @param dpl    The lowest privileged ring allowed, 0-3
+ */
+void interrupts_set_gate_dpl(u8int vector, u8int dpl);
+
+/** interrupts_get_count:
+ * Returns how many times a vector has fired, on all CPUs together
+ *
+ * @param vector The interrupt vector
+ * @return The hit count
+ */
+u32int interrupts_get_count(u8int vector);
+
+/** interrupts_vector_name:
+ * Returns a short description of a vector
+ *
+ * @param vector The interrupt vector
+ * @return The exception name, "irq" or "software"
+ */
+const char *interrupts_vector_name(u8int vector);
+
+/** Time spent in one interrupt handler */
+struct isr_stats {
+    u32int count;
+    u64int total_cycles;
+    u32int max_cycles;
+};
+
+/** interrupts_receive_char:
+ * Common input path for characters arriving from the keyboard or a serial
+ * line: echoes the character and queues it for readline. Runs as deferred
+ * work, or inside the handler when deferral is off.
+ *
+ * @param ascii The character received
+ */
+void interrupts_receive_char(u8int ascii);
+
+/** interrupts_queue_char:
+ * Called by interrupt handlers with a received character. Hands it to
+ * interrupts_receive_char through the deferred work queue and wakes a
+ * blocked readline.
+ *
+ * @param ascii The character received
+ */
+void interrupts_queue_char(u8int ascii);
+
+/** interrupts_set_deferred:
+ * Chooses whether input echo and buffering run as deferred work (the
+ * default) or inside the interrupt handlers, for comparing handler time
+ *
+ * @param enable 1 to defer, 0 to process inside the handler
+ */
+void interrupts_set_deferred(u8int enable);
+
+/** interrupts_get_deferred:
+ * Returns whether input processing is deferred
+ *
+ * @return 1 if deferred, 0 otherwise
+ */
+u8int interrupts_get_deferred(void);
+
+/** interrupts_get_keyboard_stats:
+ * Returns the keyboard handler timings for one of the two modes
+ *
+ * @param deferred 1 for the deferred mode, 0 for inline processing
+ * @return Pointer to the timings
+ */
+const struct isr_stats *interrupts_get_keyboard_stats(u8int deferred);
+
+/** interrupts_trace_enable:
+ * Turns interrupt tracing on or off. When off, the only cost per interrupt
+ * is testing a flag.
+ *
+ * @param enable 1 to record events, 0 to stop
+ */
+void interrupts_trace_enable(u8int enable);
+
+/** interrupts_trace_clear:
+ * Empties the trace ring and the duration histogram
+ */
+void interrupts_trace_clear(void);
+
+/** interrupts_trace_dump:
+ * Prints the recorded events, oldest first, followed by the histogram of
+ * handler durations
+ */
+void interrupts_trace_dump(void);
+
 // Wrappers around ASM.
 void load_idt(u32int idt_address);
-void interrupt_handler_33();
-void interrupt_handler_14();
+
+/* Addresses of the 256 stubs in interrupt_asm.s, indexed by vector */
+extern u32int interrupt_stub_table[INTERRUPTS_DESCRIPTOR_COUNT];
 
 #endif /* INCLUDE_INTERRUPTS */
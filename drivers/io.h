@@ -1,13 +1,25 @@
 #ifndef INCLUDE_IO_H
 #define INCLUDE_IO_H
 
+#include "types.h"
+
+#if HOST_BUILD
+/* make host-test builds drivers as Linux programs, where the ports are
+ * simulated by host/stubs.c */
+void outb(unsigned short port, unsigned char data);
+unsigned char inb(unsigned short port);
+#else
 /** outb:
- * Sends the given data to the given I/O port. Defined in io.s
+ * Sends the given data to the given I/O port. Inlined so each port access
+ * is a single out instruction instead of a call into io.s.
  *
  * @param port The I/O port to send the data to
  * @param data The data to send to the I/O port
  */
-void outb(unsigned short port, unsigned char data);
+ALWAYS_INLINE void outb(unsigned short port, unsigned char data)
+{
+    __asm__ volatile("outb %0, %1" : : "a"(data), "Nd"(port));
+}
 
 /** inb:
  * Read a byte from an I/O port.
@@ -15,6 +27,176 @@ void outb(unsigned short port, unsigned char data);
  * @param port The address of the I/O port
  * @return The read byte
  */
-unsigned char inb(unsigned short port);
+ALWAYS_INLINE unsigned char inb(unsigned short port)
+{
+    unsigned char data;
+    __asm__ volatile("inb %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+#endif
+
+/** outw:
+ * Sends a 16-bit word to an I/O port.
+ *
+ * @param port The I/O port to send the data to
+ * @param data The data to send to the I/O port
+ */
+ALWAYS_INLINE void outw(unsigned short port, unsigned short data)
+{
+    __asm__ volatile("outw %0, %1" : : "a"(data), "Nd"(port));
+}
+
+/** inw:
+ * Reads a 16-bit word from an I/O port.
+ *
+ * @param port The address of the I/O port
+ * @return The read word
+ */
+ALWAYS_INLINE unsigned short inw(unsigned short port)
+{
+    unsigned short data;
+    __asm__ volatile("inw %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+/** outl:
+ * Sends a 32-bit double word to an I/O port.
+ *
+ * @param port The I/O port to send the data to
+ * @param data The data to send to the I/O port
+ */
+ALWAYS_INLINE void outl(unsigned short port, unsigned int data)
+{
+    __asm__ volatile("outl %0, %1" : : "a"(data), "Nd"(port));
+}
+
+/** inl:
+ * Reads a 32-bit double word from an I/O port.
+ *
+ * @param port The address of the I/O port
+ * @return The read double word
+ */
+ALWAYS_INLINE unsigned int inl(unsigned short port)
+{
+    unsigned int data;
+    __asm__ volatile("inl %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+/** insb:
+ * Reads count bytes from an I/O port into buf with a single rep insb.
+ *
+ * @param port  The address of the I/O port
+ * @param buf   The destination buffer
+ * @param count The number of bytes to read
+ */
+ALWAYS_INLINE void insb(unsigned short port, void *buf, unsigned int count)
+{
+    __asm__ volatile("cld; rep insb"
+                     : "+D"(buf), "+c"(count)
+                     : "d"(port)
+                     : "memory");
+}
+
+/** insw:
+ * Reads count 16-bit words from an I/O port into buf with rep insw.
+ *
+ * @param port  The address of the I/O port
+ * @param buf   The destination buffer
+ * @param count The number of words to read
+ */
+ALWAYS_INLINE void insw(unsigned short port, void *buf, unsigned int count)
+{
+    __asm__ volatile("cld; rep insw"
+                     : "+D"(buf), "+c"(count)
+                     : "d"(port)
+                     : "memory");
+}
+
+/** insl:
+ * Reads count 32-bit double words from an I/O port into buf with rep insl.
+ *
+ * @param port  The address of the I/O port
+ * @param buf   The destination buffer
+ * @param count The number of double words to read
+ */
+ALWAYS_INLINE void insl(unsigned short port, void *buf, unsigned int count)
+{
+    __asm__ volatile("cld; rep insl"
+                     : "+D"(buf), "+c"(count)
+                     : "d"(port)
+                     : "memory");
+}
+
+/** outsb:
+ * Writes count bytes from buf to an I/O port with a single rep outsb.
+ *
+ * @param port  The I/O port to send the data to
+ * @param buf   The source buffer
+ * @param count The number of bytes to write
+ */
+ALWAYS_INLINE void outsb(unsigned short port, const void *buf, unsigned int count)
+{
+    __asm__ volatile("cld; rep outsb"
+                     : "+S"(buf), "+c"(count)
+                     : "d"(port)
+                     : "memory");
+}
+
+/** outsw:
+ * Writes count 16-bit words from buf to an I/O port with rep outsw.
+ *
+ * @param port  The I/O port to send the data to
+ * @param buf   The source buffer
+ * @param count The number of words to write
+ */
+ALWAYS_INLINE void outsw(unsigned short port, const void *buf, unsigned int count)
+{
+    __asm__ volatile("cld; rep outsw"
+                     : "+S"(buf), "+c"(count)
+                     : "d"(port)
+                     : "memory");
+}
+
+/** outsl:
+ * Writes count 32-bit double words from buf to an I/O port with rep outsl.
+ *
+ * @param port  The I/O port to send the data to
+ * @param buf   The source buffer
+ * @param count The number of double words to write
+ */
+ALWAYS_INLINE void outsl(unsigned short port, const void *buf, unsigned int count)
+{
+    __asm__ volatile("cld; rep outsl"
+                     : "+S"(buf), "+c"(count)
+                     : "d"(port)
+                     : "memory");
+}
+
+/** io_wait:
+ * Gives slow devices time to settle by writing to the unused port 0x80.
+ */
+ALWAYS_INLINE void io_wait(void)
+{
+    outb(0x80, 0);
+}
+
+/** outb_asm:
+ * Out-of-line version of outb. Defined in io.s, kept for comparison with
+ * the inline version.
+ *
+ * @param port The I/O port to send the data to
+ * @param data The data to send to the I/O port
+ */
+void outb_asm(unsigned short port, unsigned char data);
+
+/** inb_asm:
+ * Out-of-line version of inb. Defined in io.s, kept for comparison with
+ * the inline version.
+ *
+ * @param port The address of the I/O port
+ * @return The read byte
+ */
+unsigned char inb_asm(unsigned short port);
 
 #endif /* INCLUDE_IO_H */
@@ -0,0 +1,82 @@
+#include "ioapic.h"
+#include "paging.h"
+#include "types.h"
+
+/* The registers are reached through an index and a data window */
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+
+#define IOAPIC_VERSION      0x01
+#define IOAPIC_REDIRECTION  0x10    /* two registers per input */
+
+static volatile u32int *ioapic = 0;
+static u32int base_gsi = 0;
+static u32int pins = 0;
+
+static u32int ioapic_read(u32int reg)
+{
+    ioapic[IOAPIC_REGSEL >> 2] = reg;
+    return ioapic[IOAPIC_WINDOW >> 2];
+}
+
+static void ioapic_write(u32int reg, u32int value)
+{
+    ioapic[IOAPIC_REGSEL >> 2] = reg;
+    ioapic[IOAPIC_WINDOW >> 2] = value;
+}
+
+u8int ioapic_init(u32int phys, u32int gsi_base)
+{
+    u32int virt = paging_map_physical(phys, PAGING_PAGE_SIZE, PAGING_WRITABLE | PAGING_CACHE_DISABLE);
+    u32int i;
+
+    if (virt == 0) {
+        return 0;
+    }
+    ioapic = (volatile u32int *) virt;
+    base_gsi = gsi_base;
+    pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    for (i = 0; i < pins; i++) {
+        ioapic_write(IOAPIC_REDIRECTION + 2 * i, IOAPIC_MASKED);
+        ioapic_write(IOAPIC_REDIRECTION + 2 * i + 1, 0);
+    }
+    return 1;
+}
+
+u8int ioapic_route(u32int gsi, u8int vector, u32int flags, u8int apic_id)
+{
+    u32int pin = gsi - base_gsi;
+
+    if (ioapic == 0 || gsi < base_gsi || pin >= pins) {
+        return 0;
+    }
+    // Write the destination first so the entry is never live half set up
+    ioapic_write(IOAPIC_REDIRECTION + 2 * pin, IOAPIC_MASKED);
+    ioapic_write(IOAPIC_REDIRECTION + 2 * pin + 1, (u32int) apic_id << 24);
+    ioapic_write(IOAPIC_REDIRECTION + 2 * pin,
+                 IOAPIC_MASKED | (flags & (IOAPIC_ACTIVE_LOW | IOAPIC_LEVEL)) | vector);
+    return 1;
+}
+
+void ioapic_mask(u32int gsi)
+{
+    u32int pin = gsi - base_gsi;
+
+    if (ioapic != 0 && gsi >= base_gsi && pin < pins) {
+        ioapic_write(IOAPIC_REDIRECTION + 2 * pin, ioapic_read(IOAPIC_REDIRECTION + 2 * pin) | IOAPIC_MASKED);
+    }
+}
+
+void ioapic_unmask(u32int gsi)
+{
+    u32int pin = gsi - base_gsi;
+
+    if (ioapic != 0 && gsi >= base_gsi && pin < pins) {
+        ioapic_write(IOAPIC_REDIRECTION + 2 * pin, ioapic_read(IOAPIC_REDIRECTION + 2 * pin) & ~IOAPIC_MASKED);
+    }
+}
+
+u32int ioapic_pins(void)
+{
+    return pins;
+}
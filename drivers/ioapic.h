@@ -0,0 +1,51 @@
+#ifndef INCLUDE_IOAPIC_H
+#define INCLUDE_IOAPIC_H
+
+#include "types.h"
+
+/* Redirection entry bits, low dword */
+#define IOAPIC_ACTIVE_LOW   0x00002000
+#define IOAPIC_LEVEL        0x00008000
+#define IOAPIC_MASKED       0x00010000
+
+/** ioapic_init:
+ * Maps an I/O APIC and masks all of its inputs
+ *
+ * @param phys     Physical address of its registers
+ * @param gsi_base First global system interrupt it serves
+ * @return 1 on success
+ */
+u8int ioapic_init(u32int phys, u32int gsi_base);
+
+/** ioapic_route:
+ * Points an input at a vector on one local APIC, fixed delivery. The
+ * entry is left masked.
+ *
+ * @param gsi    Global system interrupt number
+ * @param vector IDT vector to raise
+ * @param flags  IOAPIC_ACTIVE_LOW and/or IOAPIC_LEVEL
+ * @param apic_id Destination local APIC
+ * @return 1 if the GSI belongs to this I/O APIC
+ */
+u8int ioapic_route(u32int gsi, u8int vector, u32int flags, u8int apic_id);
+
+/** ioapic_mask:
+ * Stops delivery from an input
+ *
+ * @param gsi Global system interrupt number
+ */
+void ioapic_mask(u32int gsi);
+
+/** ioapic_unmask:
+ * Enables delivery from an input
+ *
+ * @param gsi Global system interrupt number
+ */
+void ioapic_unmask(u32int gsi);
+
+/** ioapic_pins:
+ * Returns the number of inputs, 0 if there is no I/O APIC
+ */
+u32int ioapic_pins(void);
+
+#endif /* INCLUDE_IOAPIC_H */
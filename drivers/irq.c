@@ -0,0 +1,267 @@
+#include "irq.h"
+#include "acpi.h"
+#include "clock.h"
+#include "interrupts.h"
+#include "io.h"
+#include "ioapic.h"
+#include "lapic.h"
+#include "pic.h"
+#include "types.h"
+
+/* i8042 keyboard controller */
+#define I8042_DATA              0x60
+#define I8042_STATUS            0x64
+#define I8042_COMMAND           0x64
+#define I8042_INPUT_FULL        0x02
+#define I8042_WRITE_OUTPUT      0xD2    /* next data byte comes back as keyboard input */
+
+#define KEYBOARD_IRQ            1
+#define EOI_LOOPS               64
+#define EOI_RUNS                8
+
+/* Longest wait for the controller or the probe interrupt */
+#define PROBE_TIMEOUT_MS        10
+
+static u8int mode = IRQ_MODE_PIC;
+static u8int apic_ready = 0;
+static u16int enabled = 0;          /* lines unmasked by drivers */
+static u32int gsi[IRQ_COUNT];
+
+static volatile u8int probe_hit = 0;
+static volatile u64int probe_sent = 0;
+static volatile u64int probe_cycles = 0;
+
+/** irq_route_isa:
+ * Programs the I/O APIC entries for the ISA IRQs, all masked
+ */
+static u8int irq_route_isa(const struct acpi_madt_info *madt)
+{
+    u8int dest = lapic_id();
+    u32int irq;
+
+    for (irq = 0; irq < IRQ_COUNT; irq++) {
+        u32int flags = 0;
+
+        gsi[irq] = madt->isa_gsi[irq];
+        if (irq == IRQ_CASCADE) {
+            continue;
+        }
+        if (madt->isa_flags[irq] & ACPI_IRQ_ACTIVE_LOW) {
+            flags |= IOAPIC_ACTIVE_LOW;
+        }
+        if (madt->isa_flags[irq] & ACPI_IRQ_LEVEL) {
+            flags |= IOAPIC_LEVEL;
+        }
+        if (!ioapic_route(gsi[irq], IRQ_VECTOR(irq), flags, dest)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+u8int irq_init(void)
+{
+    const struct acpi_madt_info *madt;
+    u32int irq;
+
+    for (irq = 0; irq < IRQ_COUNT; irq++) {
+        gsi[irq] = irq;
+    }
+    if (!lapic_present() || !acpi_init()) {
+        return mode;
+    }
+    madt = acpi_get_madt();
+    if (madt->ioapic_address == 0 ||
+        !ioapic_init(madt->ioapic_address, madt->ioapic_gsi_base) ||
+        !irq_route_isa(madt)) {
+        return mode;
+    }
+    apic_ready = 1;
+    irq_set_mode(IRQ_MODE_APIC);
+    return mode;
+}
+
+u8int irq_set_mode(u8int new_mode)
+{
+    u32int flags;
+    u32int irq;
+
+    if (new_mode == IRQ_MODE_APIC && !apic_ready) {
+        return 0;
+    }
+    flags = irq_save();
+    // Mask everything on the old controller, then open the same lines on
+    // the new one
+    for (irq = 0; irq < IRQ_COUNT; irq++) {
+        if (mode == IRQ_MODE_APIC) {
+            ioapic_mask(gsi[irq]);
+        } else {
+            pic_mask(irq);
+        }
+    }
+    mode = new_mode;
+    for (irq = 0; irq < IRQ_COUNT; irq++) {
+        if (enabled & (1 << irq)) {
+            irq_unmask(irq);
+        }
+    }
+    irq_restore(flags);
+    return 1;
+}
+
+u8int irq_get_mode(void)
+{
+    return mode;
+}
+
+void irq_unmask(u8int irq)
+{
+    enabled |= 1 << irq;
+    if (mode == IRQ_MODE_APIC) {
+        ioapic_unmask(gsi[irq]);
+    } else {
+        pic_unmask(irq);
+    }
+}
+
+void irq_mask(u8int irq)
+{
+    enabled &= ~(1 << irq);
+    if (mode == IRQ_MODE_APIC) {
+        ioapic_mask(gsi[irq]);
+    } else {
+        pic_mask(irq);
+    }
+}
+
+void irq_acknowledge(u32int vector)
+{
+    if (vector < IRQ_VECTOR(0) || vector >= IRQ_VECTOR(IRQ_COUNT)) {
+        return;
+    }
+    if (mode == IRQ_MODE_APIC) {
+        lapic_eoi();
+    } else {
+        pic_acknowledge(vector);
+    }
+}
+
+u32int irq_gsi(u8int irq)
+{
+    return gsi[irq];
+}
+
+/** irq_measure_eoi:
+ * Best of EOI_RUNS loops of EOI_LOOPS writes. Nothing is in service, so
+ * both controllers ignore the EOI itself.
+ */
+u32int irq_measure_eoi(u8int eoi_mode)
+{
+    u32int best = 0;
+    u32int run;
+
+    if (eoi_mode == IRQ_MODE_APIC && !lapic_present()) {
+        return 0;
+    }
+    for (run = 0; run < EOI_RUNS; run++) {
+        u64int start = clock_cycles();
+        u32int cycles;
+        u32int i;
+
+        for (i = 0; i < EOI_LOOPS; i++) {
+            if (eoi_mode == IRQ_MODE_APIC) {
+                lapic_eoi();
+            } else {
+                outb(PIC_1_COMMAND, PIC_ACKNOWLEDGE);
+            }
+        }
+        cycles = (u32int) (clock_cycles() - start) / EOI_LOOPS;
+        if (run == 0 || cycles < best) {
+            best = cycles;
+        }
+    }
+    return best;
+}
+
+/** irq_probe_handler:
+ * Stands in for the keyboard handler while latency is measured
+ */
+static void irq_probe_handler(__attribute__((unused)) struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, __attribute__((unused)) struct stack_state *stack)
+{
+    u64int now = clock_cycles();
+
+    inb(I8042_DATA);
+    if (!probe_hit) {
+        probe_cycles = now - probe_sent;
+        probe_hit = 1;
+    }
+}
+
+/** irq_i8042_wait:
+ * Waits until the controller takes another byte
+ */
+static u8int irq_i8042_wait(void)
+{
+    u64int start = clock_cycles();
+    u64int timeout = (u64int) clock_tsc_khz() * PROBE_TIMEOUT_MS;
+
+    while (inb(I8042_STATUS) & I8042_INPUT_FULL) {
+        if (clock_cycles() - start > timeout) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+u8int irq_measure_latency(u32int samples, struct irq_latency *result)
+{
+    interrupt_handler_t keyboard = interrupts_get_handler(IRQ_VECTOR(KEYBOARD_IRQ));
+    u64int timeout = (u64int) clock_tsc_khz() * PROBE_TIMEOUT_MS;
+    u8int ok = 1;
+    u32int i;
+
+    result->samples = 0;
+    result->min = 0;
+    result->max = 0;
+    result->total = 0;
+
+    register_interrupt_handler(IRQ_VECTOR(KEYBOARD_IRQ), irq_probe_handler);
+    for (i = 0; i < samples && ok; i++) {
+        u64int start;
+
+        ok = irq_i8042_wait();
+        if (!ok) {
+            break;
+        }
+        outb(I8042_COMMAND, I8042_WRITE_OUTPUT);
+        ok = irq_i8042_wait();
+        if (!ok) {
+            break;
+        }
+        probe_hit = 0;
+        probe_sent = clock_cycles();
+        outb(I8042_DATA, 0);
+
+        start = clock_cycles();
+        while (!probe_hit) {
+            if (clock_cycles() - start > timeout) {
+                ok = 0;
+                break;
+            }
+        }
+        if (ok) {
+            u32int cycles = (u32int) probe_cycles;
+
+            if (result->samples == 0 || cycles < result->min) {
+                result->min = cycles;
+            }
+            if (cycles > result->max) {
+                result->max = cycles;
+            }
+            result->total += cycles;
+            result->samples++;
+        }
+    }
+    register_interrupt_handler(IRQ_VECTOR(KEYBOARD_IRQ), keyboard);
+    return ok;
+}
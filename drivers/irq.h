@@ -0,0 +1,161 @@
+#ifndef INCLUDE_IRQ_H
+#define INCLUDE_IRQ_H
+
+#include "types.h"
+
+/* ISA IRQ lines. IRQ n raises vector IRQ_VECTOR(n) whichever controller
+ * delivers it. */
+#define IRQ_COUNT       16
+#define IRQ_VECTOR(irq) (0x20 + (irq))
+#define IRQ_CASCADE     2
+
+/* Interrupt enable flag in EFLAGS */
+#define IRQ_EFLAGS_IF   0x00000200
+
+/** irq_save:
+ * Disables interrupts on the running CPU and returns the EFLAGS they were
+ * disabled from. Critical sections nest: the inner irq_restore leaves
+ * interrupts off if the outer section had them off.
+ *
+ * @return The flags to pass to irq_restore
+ */
+ALWAYS_INLINE u32int irq_save(void)
+{
+    u32int flags;
+    __asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/** irq_restore:
+ * Puts back the interrupt flag saved by irq_save
+ *
+ * @param flags What irq_save returned
+ */
+ALWAYS_INLINE void irq_restore(u32int flags)
+{
+    __asm__ volatile("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+/** irq_enable:
+ * Enables interrupts unconditionally, for code that knows it is not
+ * nested in a critical section: boot, and a new thread's first run
+ */
+ALWAYS_INLINE void irq_enable(void)
+{
+    __asm__ volatile("sti" : : : "memory");
+}
+
+/** irq_disable:
+ * Disables interrupts unconditionally
+ */
+ALWAYS_INLINE void irq_disable(void)
+{
+    __asm__ volatile("cli" : : : "memory");
+}
+
+/** irq_wait:
+ * Called with interrupts disabled: halts until an interrupt has been
+ * handled and returns with interrupts disabled again. sti only takes
+ * effect after hlt has started, so an interrupt cannot slip in between a
+ * check made with interrupts off and the halt.
+ */
+ALWAYS_INLINE void irq_wait(void)
+{
+    __asm__ volatile("sti; hlt; cli" : : : "memory");
+}
+
+/** irq_enabled:
+ * Returns whether interrupts are enabled on the running CPU
+ */
+ALWAYS_INLINE u8int irq_enabled(void)
+{
+    u32int flags;
+    __asm__ volatile("pushfl; popl %0" : "=r"(flags));
+    return (flags & IRQ_EFLAGS_IF) != 0;
+}
+
+/* Interrupt controllers */
+#define IRQ_MODE_PIC    0   /* the two 8259s */
+#define IRQ_MODE_APIC   1   /* I/O APIC routing to the local APIC */
+
+/** IRQ delivery times, in TSC cycles */
+struct irq_latency {
+    u32int samples;
+    u32int min;
+    u32int max;
+    u64int total;
+};
+
+/** irq_init:
+ * Reads the MADT and, if there is a local APIC and an I/O APIC, routes
+ * the ISA IRQs through them and masks the 8259s. Otherwise the 8259s stay
+ * in charge. Call after lapic_init.
+ *
+ * @return The mode in use, IRQ_MODE_PIC or IRQ_MODE_APIC
+ */
+u8int irq_init(void);
+
+/** irq_set_mode:
+ * Moves IRQ delivery between the controllers. Lines that are unmasked
+ * stay unmasked.
+ *
+ * @param mode IRQ_MODE_PIC or IRQ_MODE_APIC
+ * @return 1 on success, 0 if the I/O APIC is not set up
+ */
+u8int irq_set_mode(u8int mode);
+
+/** irq_get_mode:
+ * Returns IRQ_MODE_PIC or IRQ_MODE_APIC
+ */
+u8int irq_get_mode(void);
+
+/** irq_unmask:
+ * Enables an IRQ line on the active controller
+ *
+ * @param irq The ISA IRQ (0-15)
+ */
+void irq_unmask(u8int irq);
+
+/** irq_mask:
+ * Disables an IRQ line on the active controller
+ *
+ * @param irq The ISA IRQ (0-15)
+ */
+void irq_mask(u8int irq);
+
+/** irq_acknowledge:
+ * Sends the end of interrupt for an IRQ vector: an outb to the 8259s or
+ * a store to the local APIC. Other vectors are ignored.
+ *
+ * @param vector The interrupt vector
+ */
+void irq_acknowledge(u32int vector);
+
+/** irq_gsi:
+ * Returns the I/O APIC input an ISA IRQ is wired to
+ *
+ * @param irq The ISA IRQ (0-15)
+ * @return The global system interrupt
+ */
+u32int irq_gsi(u8int irq);
+
+/** irq_measure_eoi:
+ * Times the end of interrupt write of a controller
+ *
+ * @param mode IRQ_MODE_PIC or IRQ_MODE_APIC
+ * @return Best cycles per EOI, 0 if the controller is not available
+ */
+u32int irq_measure_eoi(u8int mode);
+
+/** irq_measure_latency:
+ * Makes the keyboard controller raise IRQ1 and times how long it takes to
+ * reach a handler, on the active controller. The keyboard handler is
+ * replaced meanwhile. Call with interrupts enabled.
+ *
+ * @param samples Number of interrupts to raise
+ * @param result  Receives the timings
+ * @return 1 on success, 0 if the keyboard controller did not respond
+ */
+u8int irq_measure_latency(u32int samples, struct irq_latency *result);
+
+#endif /* INCLUDE_IRQ_H */
@@ -1,8 +1,31 @@
     #include "io.h"
+    #include "keyboard.h"
     #include "types.h"
 
     #define KEYBOARD_DATA_PORT 0x60
 
+    /* Modifier keys held down, left and right tracked separately */
+    #define HELD_LEFT_SHIFT  0x01
+    #define HELD_RIGHT_SHIFT 0x02
+    #define HELD_LEFT_CTRL   0x04
+    #define HELD_RIGHT_CTRL  0x08
+    #define HELD_LEFT_ALT    0x10
+    #define HELD_RIGHT_ALT   0x20
+
+    #define HELD_SHIFT (HELD_LEFT_SHIFT | HELD_RIGHT_SHIFT)
+    #define HELD_CTRL  (HELD_LEFT_CTRL | HELD_RIGHT_CTRL)
+    #define HELD_ALT   (HELD_LEFT_ALT | HELD_RIGHT_ALT)
+
+    static u8int held = 0;
+    static u8int caps_lock = 0;
+    static u8int caps_down = 0;    /* ignore typematic repeats of Caps Lock */
+    static u8int extended = 0;     /* last byte was the 0xE0 prefix */
+    static u8int skip = 0;         /* bytes of a Pause sequence still to come */
+
+    static const struct keymap *layout = &keymaps[0];
+    /* Layer of the current layout selected by the modifiers */
+    static const u8int *layer = keymaps[0].layers[KEYMAP_LAYER_PLAIN];
+
     /** read_scan_code:
     * Reads a scan code from the keyboard
     *
@@ -13,6 +36,129 @@
         return inb(KEYBOARD_DATA_PORT);
     }
 
+    /** keyboard_select_layer:
+    * Picks the layer for the current modifiers. Runs only when a modifier
+    * or the layout changes, so translating a key stays a single load.
+    */
+    static void keyboard_select_layer(void)
+    {
+        u32int index;
+
+        if (held & HELD_CTRL) {
+            index = KEYMAP_LAYER_CTRL;
+        } else {
+            index = (caps_lock ? KEYMAP_LAYER_CAPS : KEYMAP_LAYER_PLAIN) +
+                    ((held & HELD_SHIFT) ? KEYMAP_LAYER_SHIFT : 0);
+        }
+        layer = layout->layers[index];
+    }
+
+    /** keyboard_modifier_bit:
+    * Returns the held bit of a modifier key, 0 for other keys
+    */
+    static u8int keyboard_modifier_bit(u8int code, u8int is_extended)
+    {
+        switch (code) {
+            // With the prefix these are the fake Shifts around grey keys
+            case KEYBOARD_LEFT_SHIFT: return is_extended ? 0 : HELD_LEFT_SHIFT;
+            case KEYBOARD_RIGHT_SHIFT: return is_extended ? 0 : HELD_RIGHT_SHIFT;
+            case KEYBOARD_CTRL: return is_extended ? HELD_RIGHT_CTRL : HELD_LEFT_CTRL;
+            case KEYBOARD_ALT: return is_extended ? HELD_RIGHT_ALT : HELD_LEFT_ALT;
+            default: return 0;
+        }
+    }
+
+    u8int keyboard_process_scan_code(u8int scan_code)
+    {
+        u8int code = scan_code & ~KEYBOARD_RELEASE;
+        u8int released = scan_code & KEYBOARD_RELEASE;
+        u8int is_extended = extended;
+        u8int bit;
+
+        if (skip != 0) {
+            skip--;
+            return 0;
+        }
+        if (scan_code == KEYBOARD_EXTENDED) {
+            extended = 1;
+            return 0;
+        }
+        if (scan_code == KEYBOARD_PAUSE) {
+            skip = 5;
+            return 0;
+        }
+        extended = 0;
+
+        bit = keyboard_modifier_bit(code, is_extended);
+        if (bit != 0) {
+            if (released) {
+                held &= ~bit;
+            } else {
+                held |= bit;
+            }
+            keyboard_select_layer();
+            return 0;
+        }
+
+        if (code == KEYBOARD_CAPS_LOCK && !is_extended) {
+            if (!released && !caps_down) {
+                caps_lock = !caps_lock;
+                keyboard_select_layer();
+            }
+            caps_down = !released;
+            return 0;
+        }
+
+        if (released) {
+            return 0;
+        }
+        return is_extended ? keymap_extended[code] : layer[code];
+    }
+
+    u8int keyboard_translate(u8int scan_code)
+    {
+        if (scan_code & KEYBOARD_RELEASE) {
+            return 0;
+        }
+        return layer[scan_code];
+    }
+
+    u8int keyboard_modifiers(void)
+    {
+        u8int mods = 0;
+
+        if (held & HELD_SHIFT) {
+            mods |= KEYBOARD_MOD_SHIFT;
+        }
+        if (caps_lock) {
+            mods |= KEYBOARD_MOD_CAPS;
+        }
+        if (held & HELD_CTRL) {
+            mods |= KEYBOARD_MOD_CTRL;
+        }
+        if (held & HELD_ALT) {
+            mods |= KEYBOARD_MOD_ALT;
+        }
+        return mods;
+    }
+
+    u8int keyboard_set_layout(const char *name)
+    {
+        const struct keymap *map = keymap_find(name);
+
+        if (map == 0) {
+            return 0;
+        }
+        layout = map;
+        keyboard_select_layer();
+        return 1;
+    }
+
+    const struct keymap *keyboard_get_layout(void)
+    {
+        return layout;
+    }
+
     u8int keyboard_scan_code_to_ascii(u8int scan_code)
     {
         // Ignore key releases (scan codes with bit 7 set)
@@ -4,8 +4,87 @@
 #define KEYBOARD_MAX_ASCII 83
 
 #include "types.h"
+#include "keymap.h"
+
+/* Scan codes handled by the key state machine rather than the keymap */
+#define KEYBOARD_RELEASE       0x80
+#define KEYBOARD_LEFT_SHIFT    0x2A
+#define KEYBOARD_RIGHT_SHIFT   0x36
+#define KEYBOARD_CTRL          0x1D    /* Right Ctrl with the 0xE0 prefix */
+#define KEYBOARD_ALT           0x38    /* Right Alt with the 0xE0 prefix */
+#define KEYBOARD_CAPS_LOCK     0x3A
+#define KEYBOARD_EXTENDED      0xE0    /* Prefix of the extended keys */
+#define KEYBOARD_PAUSE         0xE1    /* Starts the 6 byte Pause sequence */
+
+/* Keys without an ASCII code, as returned by keyboard_process_scan_code */
+#define KEYBOARD_KEY_UP        0x80
+#define KEYBOARD_KEY_DOWN      0x81
+#define KEYBOARD_KEY_LEFT      0x82
+#define KEYBOARD_KEY_RIGHT     0x83
+#define KEYBOARD_KEY_HOME      0x84
+#define KEYBOARD_KEY_END       0x85
+#define KEYBOARD_KEY_PAGE_UP   0x86
+#define KEYBOARD_KEY_PAGE_DOWN 0x87
+#define KEYBOARD_KEY_INSERT    0x88
+#define KEYBOARD_KEY_DELETE    0x89
+
+/* Modifier bits returned by keyboard_modifiers */
+#define KEYBOARD_MOD_SHIFT     0x01
+#define KEYBOARD_MOD_CAPS      0x02
+#define KEYBOARD_MOD_CTRL      0x04
+#define KEYBOARD_MOD_ALT       0x08
 
 u8int keyboard_read_scan_code(void);
-u8int keyboard_scan_code_to_ascii(u8int);
+
+/** keyboard_scan_code_to_ascii:
+ * Original switch based translation, US layout without modifiers. Kept to
+ * compare against the keymap tables.
+ *
+ * @param scan_code The scan code
+ * @return The ASCII character, or 0 if the key has none
+ */
+u8int keyboard_scan_code_to_ascii(u8int scan_code);
+
+/** keyboard_process_scan_code:
+ * Feeds one byte from the keyboard into the key state machine. Tracks
+ * Shift, Ctrl, Alt, Caps Lock and the 0xE0 prefix and translates key
+ * presses with the current layout.
+ *
+ * @param scan_code The byte read from the keyboard
+ * @return The ASCII character or KEYBOARD_KEY_* code of a key press, 0 if
+ *         the byte produced no key
+ */
+u8int keyboard_process_scan_code(u8int scan_code);
+
+/** keyboard_translate:
+ * Translates a scan code with the current layout and modifier layer,
+ * without changing any state
+ *
+ * @param scan_code The scan code, without the 0xE0 prefix
+ * @return The key produced, 0 for releases and unmapped codes
+ */
+u8int keyboard_translate(u8int scan_code);
+
+/** keyboard_modifiers:
+ * Returns the modifiers currently in effect
+ *
+ * @return KEYBOARD_MOD_* bits
+ */
+u8int keyboard_modifiers(void);
+
+/** keyboard_set_layout:
+ * Switches to another built-in layout
+ *
+ * @param name The layout name
+ * @return 1 on success, 0 if there is no such layout
+ */
+u8int keyboard_set_layout(const char *name);
+
+/** keyboard_get_layout:
+ * Returns the layout in use
+ *
+ * @return The current layout
+ */
+const struct keymap *keyboard_get_layout(void);
 
 #endif /* INCLUDE_KEYBOARD_H */
@@ -0,0 +1,186 @@
+#include "keymap.h"
+#include "keyboard.h"
+#include "klib.h"
+#include "types.h"
+
+/* Layouts are written once as lists of K(scan code, plain, shifted) and
+ * expanded into every layer below, so all tables are built by the
+ * compiler and translating a key is a single load. */
+
+#define KEYMAP_IS_LETTER(c) ((c) >= 'a' && (c) <= 'z')
+
+#define KEYMAP_PLAIN(code, plain, shifted)      [code] = (plain),
+#define KEYMAP_SHIFT(code, plain, shifted)      [code] = (shifted),
+#define KEYMAP_CAPS(code, plain, shifted)       [code] = KEYMAP_IS_LETTER(plain) ? (shifted) : (plain),
+#define KEYMAP_CAPS_SHIFT(code, plain, shifted) [code] = KEYMAP_IS_LETTER(plain) ? (plain) : (shifted),
+#define KEYMAP_CTRL(code, plain, shifted)       [code] = KEYMAP_IS_LETTER(plain) ? (plain) - 'a' + 1 : (plain),
+
+#define KEYMAP_LAYOUT(layout_name, KEYS) {     \
+    layout_name,                               \
+    {                                          \
+        { KEYS(KEYMAP_PLAIN) },                \
+        { KEYS(KEYMAP_SHIFT) },                \
+        { KEYS(KEYMAP_CAPS) },                 \
+        { KEYS(KEYMAP_CAPS_SHIFT) },           \
+        { KEYS(KEYMAP_CTRL) },                 \
+    }                                          \
+}
+
+/* Keys that do not depend on the layout. With Shift the numpad gives the
+ * navigation keys, as it does with Num Lock off. */
+#define KEYMAP_COMMON_KEYS(K)                  \
+    K(0x01, 0x1B, 0x1B)        /* Escape */    \
+    K(0x0E, '\b', '\b')        /* Backspace */ \
+    K(0x0F, '\t', '\t')        /* Tab */       \
+    K(0x1C, '\n', '\n')        /* Enter */     \
+    K(0x39, ' ', ' ')                          \
+    K(0x37, '*', '*')                          \
+    K(0x47, '7', KEYBOARD_KEY_HOME)            \
+    K(0x48, '8', KEYBOARD_KEY_UP)              \
+    K(0x49, '9', KEYBOARD_KEY_PAGE_UP)         \
+    K(0x4A, '-', '-')                          \
+    K(0x4B, '4', KEYBOARD_KEY_LEFT)            \
+    K(0x4C, '5', '5')                          \
+    K(0x4D, '6', KEYBOARD_KEY_RIGHT)           \
+    K(0x4E, '+', '+')                          \
+    K(0x4F, '1', KEYBOARD_KEY_END)             \
+    K(0x50, '2', KEYBOARD_KEY_DOWN)            \
+    K(0x51, '3', KEYBOARD_KEY_PAGE_DOWN)       \
+    K(0x52, '0', KEYBOARD_KEY_INSERT)          \
+    K(0x53, '.', KEYBOARD_KEY_DELETE)
+
+/* Number row, shared by both layouts up to the last two keys */
+#define KEYMAP_DIGIT_KEYS(K)                   \
+    K(0x02, '1', '!')                          \
+    K(0x03, '2', '@')                          \
+    K(0x04, '3', '#')                          \
+    K(0x05, '4', '$')                          \
+    K(0x06, '5', '%')                          \
+    K(0x07, '6', '^')                          \
+    K(0x08, '7', '&')                          \
+    K(0x09, '8', '*')                          \
+    K(0x0A, '9', '(')                          \
+    K(0x0B, '0', ')')
+
+/* US QWERTY */
+#define KEYMAP_US_KEYS(K)                      \
+    KEYMAP_COMMON_KEYS(K)                      \
+    KEYMAP_DIGIT_KEYS(K)                       \
+    K(0x0C, '-', '_')                          \
+    K(0x0D, '=', '+')                          \
+    K(0x10, 'q', 'Q')                          \
+    K(0x11, 'w', 'W')                          \
+    K(0x12, 'e', 'E')                          \
+    K(0x13, 'r', 'R')                          \
+    K(0x14, 't', 'T')                          \
+    K(0x15, 'y', 'Y')                          \
+    K(0x16, 'u', 'U')                          \
+    K(0x17, 'i', 'I')                          \
+    K(0x18, 'o', 'O')                          \
+    K(0x19, 'p', 'P')                          \
+    K(0x1A, '[', '{')                          \
+    K(0x1B, ']', '}')                          \
+    K(0x1E, 'a', 'A')                          \
+    K(0x1F, 's', 'S')                          \
+    K(0x20, 'd', 'D')                          \
+    K(0x21, 'f', 'F')                          \
+    K(0x22, 'g', 'G')                          \
+    K(0x23, 'h', 'H')                          \
+    K(0x24, 'j', 'J')                          \
+    K(0x25, 'k', 'K')                          \
+    K(0x26, 'l', 'L')                          \
+    K(0x27, ';', ':')                          \
+    K(0x28, '\'', '"')                         \
+    K(0x29, '`', '~')                          \
+    K(0x2B, '\\', '|')                         \
+    K(0x2C, 'z', 'Z')                          \
+    K(0x2D, 'x', 'X')                          \
+    K(0x2E, 'c', 'C')                          \
+    K(0x2F, 'v', 'V')                          \
+    K(0x30, 'b', 'B')                          \
+    K(0x31, 'n', 'N')                          \
+    K(0x32, 'm', 'M')                          \
+    K(0x33, ',', '<')                          \
+    K(0x34, '.', '>')                          \
+    K(0x35, '/', '?')
+
+/* US Dvorak */
+#define KEYMAP_DVORAK_KEYS(K)                  \
+    KEYMAP_COMMON_KEYS(K)                      \
+    KEYMAP_DIGIT_KEYS(K)                       \
+    K(0x0C, '[', '{')                          \
+    K(0x0D, ']', '}')                          \
+    K(0x10, '\'', '"')                         \
+    K(0x11, ',', '<')                          \
+    K(0x12, '.', '>')                          \
+    K(0x13, 'p', 'P')                          \
+    K(0x14, 'y', 'Y')                          \
+    K(0x15, 'f', 'F')                          \
+    K(0x16, 'g', 'G')                          \
+    K(0x17, 'c', 'C')                          \
+    K(0x18, 'r', 'R')                          \
+    K(0x19, 'l', 'L')                          \
+    K(0x1A, '/', '?')                          \
+    K(0x1B, '=', '+')                          \
+    K(0x1E, 'a', 'A')                          \
+    K(0x1F, 'o', 'O')                          \
+    K(0x20, 'e', 'E')                          \
+    K(0x21, 'u', 'U')                          \
+    K(0x22, 'i', 'I')                          \
+    K(0x23, 'd', 'D')                          \
+    K(0x24, 'h', 'H')                          \
+    K(0x25, 't', 'T')                          \
+    K(0x26, 'n', 'N')                          \
+    K(0x27, 's', 'S')                          \
+    K(0x28, '-', '_')                          \
+    K(0x29, '`', '~')                          \
+    K(0x2B, '\\', '|')                         \
+    K(0x2C, ';', ':')                          \
+    K(0x2D, 'q', 'Q')                          \
+    K(0x2E, 'j', 'J')                          \
+    K(0x2F, 'k', 'K')                          \
+    K(0x30, 'x', 'X')                          \
+    K(0x31, 'b', 'B')                          \
+    K(0x32, 'm', 'M')                          \
+    K(0x33, 'w', 'W')                          \
+    K(0x34, 'v', 'V')                          \
+    K(0x35, 'z', 'Z')
+
+const struct keymap keymaps[] = {
+    KEYMAP_LAYOUT("us", KEYMAP_US_KEYS),
+    KEYMAP_LAYOUT("dvorak", KEYMAP_DVORAK_KEYS),
+};
+
+const u32int keymap_count = sizeof(keymaps) / sizeof(keymaps[0]);
+
+const u8int keymap_extended[KEYMAP_SIZE] = {
+    [0x1C] = '\n',                  /* Keypad Enter */
+    [0x35] = '/',                   /* Keypad / */
+    [0x47] = KEYBOARD_KEY_HOME,
+    [0x48] = KEYBOARD_KEY_UP,
+    [0x49] = KEYBOARD_KEY_PAGE_UP,
+    [0x4B] = KEYBOARD_KEY_LEFT,
+    [0x4D] = KEYBOARD_KEY_RIGHT,
+    [0x4F] = KEYBOARD_KEY_END,
+    [0x50] = KEYBOARD_KEY_DOWN,
+    [0x51] = KEYBOARD_KEY_PAGE_DOWN,
+    [0x52] = KEYBOARD_KEY_INSERT,
+    [0x53] = KEYBOARD_KEY_DELETE,
+};
+
+/** keymap_find:
+ * Looks up a built-in layout by name
+ *
+ * @return The layout, or 0 if there is none with that name
+ */
+const struct keymap *keymap_find(const char *name)
+{
+    u32int i;
+
+    for (i = 0; i < keymap_count; i++) {
+        if (strcmp(keymaps[i].name, name) == 0) {
+            return &keymaps[i];
+        }
+    }
+    return 0;
+}
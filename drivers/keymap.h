@@ -0,0 +1,41 @@
+#ifndef INCLUDE_KEYMAP_H
+#define INCLUDE_KEYMAP_H
+
+#include "types.h"
+
+/* One entry per scan code with the release bit clear */
+#define KEYMAP_SIZE 128
+
+/* Modifier layers of a layout */
+#define KEYMAP_LAYER_PLAIN      0
+#define KEYMAP_LAYER_SHIFT      1
+#define KEYMAP_LAYER_CAPS       2
+#define KEYMAP_LAYER_CAPS_SHIFT 3
+#define KEYMAP_LAYER_CTRL       4
+#define KEYMAP_LAYERS           5
+
+/** Keyboard layout: the key produced by each scan code, per modifier layer.
+ * Values below 0x80 are ASCII, the rest are KEYBOARD_KEY_* codes and 0
+ * means the key produces nothing.
+ */
+struct keymap {
+    const char *name;
+    u8int layers[KEYMAP_LAYERS][KEYMAP_SIZE];
+};
+
+/* Built-in layouts, the first one is the default */
+extern const struct keymap keymaps[];
+extern const u32int keymap_count;
+
+/* Keys sent with the 0xE0 prefix, the same for every layout */
+extern const u8int keymap_extended[KEYMAP_SIZE];
+
+/** keymap_find:
+ * Looks up a built-in layout by name
+ *
+ * @param name The layout name
+ * @return The layout, or 0 if there is none with that name
+ */
+const struct keymap *keymap_find(const char *name);
+
+#endif /* INCLUDE_KEYMAP_H */
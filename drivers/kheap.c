@@ -0,0 +1,390 @@
+#include "kheap.h"
+#include "frame_buffer.h"
+#include "initcall.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "types.h"
+
+#define SLAB_MAGIC       0x51AB51ABu
+#define LARGE_MAGIC      0x1A56E000u
+
+/* Slab header, at the start of the slab's page. kfree finds it by
+ * rounding the object address down to the page. */
+struct slab {
+    u32int magic;
+    struct kheap_cache *cache;
+    struct slab *next;          /* partial list */
+    struct slab *prev;
+    void *free;                 /* freed objects, linked through their first word */
+    u16int used;                /* objects handed out */
+    u16int fresh;               /* objects never handed out so far */
+};
+
+/* Header of a page-sized allocation; the memory follows it */
+struct large_block {
+    u32int magic;
+    u32int order;
+    u32int pad[2];
+};
+
+/* Objects start after the header, 16-byte aligned */
+#define SLAB_OBJECTS_OFFSET ((sizeof(struct slab) + 15) & ~15u)
+
+#if KHEAP_DEBUG
+/* Front redzone holds the requested size then a guard word; the tail
+ * redzone covers the unused end of the object plus KHEAP_REDZONE bytes */
+#define KHEAP_REDZONE    8
+#define REDZONE_BYTE     0xCC
+#define POISON_BYTE      0x6B
+#else
+#define KHEAP_REDZONE    0
+#endif
+
+struct kheap_cache {
+    u32int size;                /* usable bytes per object */
+    u32int slot;                /* bytes per object including redzones */
+    u32int per_slab;
+    struct slab *partial;       /* slabs with at least one free object */
+    u32int empty;               /* empty slabs kept on the partial list */
+};
+
+static struct kheap_cache caches[KHEAP_CLASSES];
+static struct kheap_stats stats;
+
+/* Guards the caches and the counters: threads are preempted and run on
+ * every CPU */
+static SPINLOCK_DEFINE(kheap_lock, "kheap");
+
+/** kheap_init:
+ * Sizes the caches. Run by the first allocation rather than at boot.
+ */
+static void kheap_init(void)
+{
+    u32int i;
+
+    for (i = 0; i < KHEAP_CLASSES; i++) {
+        caches[i].size = 1u << (i + KHEAP_MIN_SHIFT);
+        caches[i].slot = caches[i].size + 2 * KHEAP_REDZONE;
+        caches[i].per_slab = (PMM_FRAME_SIZE - SLAB_OBJECTS_OFFSET) / caches[i].slot;
+        stats.classes[i].size = caches[i].size;
+    }
+}
+static INITCALL(90, "kheap", kheap_init, INITCALL_LAZY);
+
+/** kheap_class:
+ * Maps a size to its class: the smallest power of two that holds it
+ */
+static u32int kheap_class(u32int size)
+{
+    if (size <= (1u << KHEAP_MIN_SHIFT)) {
+        return 0;
+    }
+    return (32 - __builtin_clz(size - 1)) - KHEAP_MIN_SHIFT;
+}
+
+static void kheap_partial_push(struct kheap_cache *cache, struct slab *slab)
+{
+    slab->prev = 0;
+    slab->next = cache->partial;
+    if (slab->next != 0) {
+        slab->next->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+static void kheap_partial_remove(struct kheap_cache *cache, struct slab *slab)
+{
+    if (slab->prev != 0) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial = slab->next;
+    }
+    if (slab->next != 0) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+#if KHEAP_DEBUG
+static void kheap_report(const char *what, void *ptr)
+{
+    stats.corruptions++;
+    fb_puts("kheap: ");
+    fb_puts((char *) what);
+    fb_puts(" at ");
+    fb_put_hex((u32int) ptr);
+    fb_putc('\n');
+}
+
+static void kheap_fill(u8int *p, u8int value, u32int n)
+{
+    while (n-- > 0) {
+        *p++ = value;
+    }
+}
+
+static u8int kheap_check(const u8int *p, u8int value, u32int n)
+{
+    while (n-- > 0) {
+        if (*p++ != value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** kheap_debug_alloc:
+ * Checks that a reused object still holds its poison, then sets up the
+ * redzones around the requested size
+ */
+static void *kheap_debug_alloc(struct kheap_cache *cache, u8int *slot, u32int size, u8int reused)
+{
+    u8int *object = slot + KHEAP_REDZONE;
+
+    // The first word held the free list link
+    if (reused && !kheap_check(object + sizeof(void *), POISON_BYTE, cache->size - sizeof(void *))) {
+        kheap_report("write after free", object);
+    }
+    *(u32int *) slot = size;
+    kheap_fill(slot + sizeof(u32int), REDZONE_BYTE, KHEAP_REDZONE - sizeof(u32int));
+    kheap_fill(object + size, REDZONE_BYTE, cache->size - size + KHEAP_REDZONE);
+    return object;
+}
+
+/** kheap_debug_free:
+ * Checks the redzones of an object being freed and poisons it
+ *
+ * @return 0 if the object looks already freed, so it must not be pushed
+ */
+static u8int kheap_debug_free(struct kheap_cache *cache, u8int *object)
+{
+    u8int *slot = object - KHEAP_REDZONE;
+    u32int size = *(u32int *) slot;
+
+    if (size > cache->size) {
+        kheap_report("double free", object);
+        return 0;
+    }
+    if (!kheap_check(slot + sizeof(u32int), REDZONE_BYTE, KHEAP_REDZONE - sizeof(u32int))) {
+        kheap_report("underrun", object);
+    }
+    if (!kheap_check(object + size, REDZONE_BYTE, cache->size - size + KHEAP_REDZONE)) {
+        kheap_report("overrun", object);
+    }
+    // An impossible size marks the slot as free
+    *(u32int *) slot = 0xFFFFFFFF;
+    kheap_fill(object, POISON_BYTE, cache->size);
+    return 1;
+}
+#endif
+
+/** kheap_slab_create:
+ * Takes a page from the frame allocator for a new slab. Objects are
+ * handed out from its untouched tail on demand, so creating one does not
+ * walk the page.
+ */
+static struct slab *kheap_slab_create(struct kheap_cache *cache, struct kheap_class_stats *class_stats)
+{
+    struct slab *slab = (struct slab *) pmm_alloc_frame();
+
+    if (slab == 0) {
+        return 0;
+    }
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->free = 0;
+    slab->used = 0;
+    slab->fresh = (u16int) cache->per_slab;
+    kheap_partial_push(cache, slab);
+    cache->empty++;
+    class_stats->slabs++;
+    return slab;
+}
+
+static void *kheap_alloc_large(u32int size)
+{
+    u32int pages = (size + sizeof(struct large_block) + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
+    u32int order = 0;
+    struct large_block *block;
+
+    while ((1u << order) < pages) {
+        order++;
+    }
+    block = (struct large_block *) pmm_alloc_pages(order);
+    if (block == 0) {
+        stats.failed++;
+        return 0;
+    }
+    block->magic = LARGE_MAGIC;
+    block->order = order;
+    stats.large.allocs++;
+    stats.large.slabs += 1u << order;
+    if (++stats.large.in_use > stats.large.peak) {
+        stats.large.peak = stats.large.in_use;
+    }
+    return block + 1;
+}
+
+/** kheap_alloc:
+ * kmalloc with kheap_lock held
+ */
+static void *kheap_alloc(u32int size)
+{
+    struct kheap_cache *cache;
+    struct kheap_class_stats *class_stats;
+    struct slab *slab;
+    u8int *slot;
+    u8int reused;
+    u32int index;
+
+    if (size == 0) {
+        return 0;
+    }
+    if (size > KHEAP_MAX_SLAB_SIZE) {
+        return kheap_alloc_large(size);
+    }
+    index = kheap_class(size);
+    cache = &caches[index];
+    class_stats = &stats.classes[index];
+
+    slab = cache->partial;
+    if (slab == 0) {
+        slab = kheap_slab_create(cache, class_stats);
+        if (slab == 0) {
+            stats.failed++;
+            return 0;
+        }
+    }
+    if (slab->used == 0) {
+        cache->empty--;
+    }
+
+    reused = (slab->free != 0);
+    if (reused) {
+        slot = (u8int *) slab->free - KHEAP_REDZONE;
+        slab->free = *(void **) slab->free;
+    } else {
+        slot = (u8int *) slab + SLAB_OBJECTS_OFFSET +
+               (cache->per_slab - slab->fresh) * cache->slot;
+        slab->fresh--;
+    }
+    slab->used++;
+    if (slab->free == 0 && slab->fresh == 0) {
+        kheap_partial_remove(cache, slab);
+    }
+
+    class_stats->allocs++;
+    if (++class_stats->in_use > class_stats->peak) {
+        class_stats->peak = class_stats->in_use;
+    }
+
+#if KHEAP_DEBUG
+    return kheap_debug_alloc(cache, slot, size, reused);
+#else
+    (void) reused;
+    return slot;
+#endif
+}
+
+/** kheap_free:
+ * kfree with kheap_lock held
+ */
+static void kheap_free(void *ptr)
+{
+    struct slab *slab = (struct slab *) ((u32int) ptr & ~(PMM_FRAME_SIZE - 1));
+    struct kheap_cache *cache;
+    struct kheap_class_stats *class_stats;
+    u8int was_full;
+
+    if (ptr == 0) {
+        return;
+    }
+
+    if (slab->magic == LARGE_MAGIC) {
+        struct large_block *block = (struct large_block *) slab;
+
+        if ((void *) (block + 1) != ptr) {
+            stats.bad_frees++;
+            return;
+        }
+        block->magic = 0;
+        stats.large.frees++;
+        stats.large.in_use--;
+        stats.large.slabs -= 1u << block->order;
+        pmm_free_pages((u32int) block, block->order);
+        return;
+    }
+    if (slab->magic != SLAB_MAGIC) {
+        stats.bad_frees++;
+        return;
+    }
+
+    cache = slab->cache;
+    class_stats = &stats.classes[cache - caches];
+#if KHEAP_DEBUG
+    if (!kheap_debug_free(cache, ptr)) {
+        return;
+    }
+#endif
+
+    was_full = (slab->free == 0 && slab->fresh == 0);
+    *(void **) ptr = slab->free;
+    slab->free = ptr;
+    slab->used--;
+    class_stats->frees++;
+    class_stats->in_use--;
+
+    if (was_full) {
+        kheap_partial_push(cache, slab);
+    }
+    if (slab->used == 0) {
+        // Keep one empty slab per class so alloc/free at a boundary
+        // does not bounce pages to the frame allocator
+        if (cache->empty > 0) {
+            kheap_partial_remove(cache, slab);
+            slab->magic = 0;
+            class_stats->slabs--;
+            pmm_free_frame((u32int) slab);
+        } else {
+            cache->empty++;
+        }
+    }
+}
+
+/** kmalloc:
+ * Allocates size bytes
+ */
+void *kmalloc(u32int size)
+{
+    void *ptr;
+    u32int flags;
+
+    initcall_require(&initcall_kheap_init);
+    flags = spin_lock_irqsave(&kheap_lock);
+    ptr = kheap_alloc(size);
+    spin_unlock_irqrestore(&kheap_lock, flags);
+    return ptr;
+}
+
+/** kfree:
+ * Frees memory from kmalloc
+ */
+void kfree(void *ptr)
+{
+    u32int flags;
+
+    if (ptr == 0) {
+        return;
+    }
+    flags = spin_lock_irqsave(&kheap_lock);
+    kheap_free(ptr);
+    spin_unlock_irqrestore(&kheap_lock, flags);
+}
+
+/** kheap_get_stats:
+ * Returns the heap counters
+ */
+const struct kheap_stats *kheap_get_stats(void)
+{
+    initcall_require(&initcall_kheap_init);
+    return &stats;
+}
@@ -0,0 +1,63 @@
+#ifndef INCLUDE_KHEAP_H
+#define INCLUDE_KHEAP_H
+
+#include "types.h"
+
+/* Build with KHEAP_DEBUG=1 (make KHEAP_DEBUG=1) to surround every object
+ * with redzones and poison freed memory */
+#ifndef KHEAP_DEBUG
+#define KHEAP_DEBUG 0
+#endif
+
+/* Size classes 16, 32, ... 1024 bytes are served from one-page slabs;
+ * bigger requests get whole pages from the frame allocator */
+#define KHEAP_MIN_SHIFT 4
+#define KHEAP_MAX_SHIFT 10
+#define KHEAP_CLASSES   (KHEAP_MAX_SHIFT - KHEAP_MIN_SHIFT + 1)
+#define KHEAP_MAX_SLAB_SIZE (1u << KHEAP_MAX_SHIFT)
+
+/** Counters of one size class, or of the page-sized allocations */
+struct kheap_class_stats {
+    u32int size;        /* class size in bytes, 0 for page allocations */
+    u32int allocs;
+    u32int frees;
+    u32int in_use;      /* objects currently allocated */
+    u32int peak;        /* highest in_use seen */
+    u32int slabs;       /* slabs (or page blocks) held */
+};
+
+/** Heap counters */
+struct kheap_stats {
+    struct kheap_class_stats classes[KHEAP_CLASSES];
+    struct kheap_class_stats large;
+    u32int failed;      /* allocations that found no memory */
+    u32int bad_frees;   /* pointers kfree did not recognise */
+    u32int corruptions; /* redzone or poison damage found (KHEAP_DEBUG) */
+};
+
+/** kmalloc:
+ * Allocates size bytes. Requests up to KHEAP_MAX_SLAB_SIZE pop an object
+ * off a per-class slab free list; larger ones take pages from the frame
+ * allocator. Safe from any thread on any CPU; not for use in interrupt
+ * handlers.
+ *
+ * @param size Number of bytes
+ * @return The memory, or 0 if size is 0 or memory ran out
+ */
+void *kmalloc(u32int size);
+
+/** kfree:
+ * Frees memory from kmalloc. kfree(0) does nothing.
+ *
+ * @param ptr The pointer kmalloc returned
+ */
+void kfree(void *ptr);
+
+/** kheap_get_stats:
+ * Returns the heap counters
+ *
+ * @return Pointer to the counters
+ */
+const struct kheap_stats *kheap_get_stats(void);
+
+#endif /* INCLUDE_KHEAP_H */
@@ -0,0 +1,631 @@
+#include "klib.h"
+#include "irq.h"
+#include "types.h"
+
+#define CR0_MP             0x00000002
+#define CR0_EM             0x00000004
+#define CR0_TS             0x00000008
+#define CR4_OSFXSR         0x00000200
+#define CR4_OSXMMEXCPT     0x00000400
+#define CPUID_EDX_FXSR     0x01000000
+#define CPUID_EDX_SSE      0x02000000
+#define CPUID_EDX_SSE2     0x04000000
+#define CPUID_7_EBX_ERMS   0x00000200
+
+/* Aligned 16-byte loads never cross a page, so the string routines may
+ * read past the terminator up to the next multiple of 16 */
+#define KLIB_PAGE_SIZE     4096
+
+#define KLIB_ADDR(p)       ((unsigned long) (p))
+
+#ifdef __SSE__
+#define KLIB_XMM_CLOBBERS  "xmm0", "xmm1", "xmm2", "xmm3",
+#else
+/* The kernel is built without -msse, so the compiler keeps nothing in
+ * the XMM registers and cannot even be told they are clobbered */
+#define KLIB_XMM_CLOBBERS
+#endif
+
+#if HOST_BUILD
+/* Linux saves the XMM registers of a process itself */
+#define klib_sse_begin()       0
+#define klib_sse_end(flags)    ((void) (flags))
+#else
+/* Interrupt handlers may use these routines too and nothing saves the
+ * XMM registers on entry, so the SSE2 loops run with interrupts off. That
+ * also keeps the thread from being switched out in the middle. */
+#define klib_sse_begin()       irq_save()
+#define klib_sse_end(flags)    irq_restore(flags)
+#endif
+
+struct klib_ops {
+    const char *name;
+    void *(*set)(void *dst, int c, u32int n);
+    void *(*set16)(u16int *dst, u16int value, u32int count);
+    void *(*copy)(void *dst, const void *src, u32int n);
+    void *(*move)(void *dst, const void *src, u32int n);
+    int (*compare)(const void *a, const void *b, u32int n);
+    u32int (*length)(const char *s);
+    int (*string_compare)(const char *a, const char *b);
+};
+
+/* Bit per KLIB_IMPL_* the CPU can run */
+static u8int supported = 1 << KLIB_IMPL_REP;
+
+// rep string instructions
+
+ALWAYS_INLINE void klib_rep_stosb(u8int *d, u32int fill, u32int n)
+{
+    __asm__ volatile("cld; rep stosb" : "+D"(d), "+c"(n) : "a"(fill) : "memory");
+}
+
+ALWAYS_INLINE void klib_rep_movsb(u8int *d, const u8int *s, u32int n)
+{
+    __asm__ volatile("cld; rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static void *klib_rep_memset(void *dst, int c, u32int n)
+{
+    u8int *d = dst;
+    u32int fill = (u8int) c * 0x01010101u;
+    u32int words = n >> 2;
+
+    __asm__ volatile("cld; rep stosl" : "+D"(d), "+c"(words) : "a"(fill) : "memory");
+    klib_rep_stosb(d, fill, n & 3);
+    return dst;
+}
+
+static void *klib_rep_memset16(u16int *dst, u16int value, u32int count)
+{
+    u16int *d = dst;
+    u32int fill = value | ((u32int) value << 16);
+    u32int words = count >> 1;
+
+    __asm__ volatile("cld; rep stosl" : "+D"(d), "+c"(words) : "a"(fill) : "memory");
+    if (count & 1) {
+        *d = value;
+    }
+    return dst;
+}
+
+static void *klib_rep_memcpy(void *dst, const void *src, u32int n)
+{
+    u8int *d = dst;
+    const u8int *s = src;
+    u32int words = n >> 2;
+
+    __asm__ volatile("cld; rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+    klib_rep_movsb(d, s, n & 3);
+    return dst;
+}
+
+/** klib_rep_memmove:
+ * Copies forwards unless dst is inside [src, src + n), in which case it
+ * copies backwards with the direction flag set: the odd bytes at the end
+ * first, then whole words
+ */
+static void *klib_rep_memmove(void *dst, const void *src, u32int n)
+{
+    u8int *d = dst;
+    const u8int *s = src;
+    u32int bytes = n & 3;
+    u32int words = n >> 2;
+
+    if (KLIB_ADDR(d) - KLIB_ADDR(s) >= n) {
+        return klib_rep_memcpy(dst, src, n);
+    }
+    d += n - 1;
+    s += n - 1;
+    __asm__ volatile("std\n\t"
+                     "rep movsb\n\t"
+                     "sub $3, %0\n\t"
+                     "sub $3, %1\n\t"
+                     "mov %3, %2\n\t"
+                     "rep movsl\n\t"
+                     "cld"
+                     : "+D"(d), "+S"(s), "+c"(bytes)
+                     : "r"(words)
+                     : "memory");
+    return dst;
+}
+
+static int klib_byte_memcmp(const void *a, const void *b, u32int n)
+{
+    const u8int *x = a;
+    const u8int *y = b;
+    u32int i;
+
+    for (i = 0; i < n; i++) {
+        if (x[i] != y[i]) {
+            return x[i] - y[i];
+        }
+    }
+    return 0;
+}
+
+static u32int klib_byte_strlen(const char *s)
+{
+    const char *p = s;
+
+    while (*p != '\0') {
+        p++;
+    }
+    return (u32int) (p - s);
+}
+
+static int klib_byte_strcmp(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return (u8int) *a - (u8int) *b;
+}
+
+static const struct klib_ops klib_rep = {
+    "rep",
+    klib_rep_memset,
+    klib_rep_memset16,
+    klib_rep_memcpy,
+    klib_rep_memmove,
+    klib_byte_memcmp,
+    klib_byte_strlen,
+    klib_byte_strcmp
+};
+
+// SSE2
+
+/** klib_sse2_fill:
+ * Stores 64-byte blocks of a repeated 32-bit pattern at a 16-byte aligned
+ * dst
+ */
+ALWAYS_INLINE void klib_sse2_fill(u8int *d, u32int fill, u32int blocks)
+{
+    __asm__ volatile("movd %k[fill], %%xmm0\n\t"
+                     "pshufd $0, %%xmm0, %%xmm0\n"
+                     "1:\n\t"
+                     "movdqa %%xmm0, (%[d])\n\t"
+                     "movdqa %%xmm0, 16(%[d])\n\t"
+                     "movdqa %%xmm0, 32(%[d])\n\t"
+                     "movdqa %%xmm0, 48(%[d])\n\t"
+                     "add $64, %[d]\n\t"
+                     "dec %[blocks]\n\t"
+                     "jnz 1b"
+                     : [d] "+r"(d), [blocks] "+r"(blocks)
+                     : [fill] "r"(fill)
+                     : KLIB_XMM_CLOBBERS "memory");
+}
+
+/** klib_sse2_copy_up:
+ * Copies 64-byte blocks to a 16-byte aligned dst, lowest first. Each block
+ * is loaded whole before it is stored, so dst may overlap src from below.
+ */
+ALWAYS_INLINE void klib_sse2_copy_up(u8int *d, const u8int *s, u32int blocks)
+{
+    __asm__ volatile("1:\n\t"
+                     "movdqu (%[s]), %%xmm0\n\t"
+                     "movdqu 16(%[s]), %%xmm1\n\t"
+                     "movdqu 32(%[s]), %%xmm2\n\t"
+                     "movdqu 48(%[s]), %%xmm3\n\t"
+                     "movdqa %%xmm0, (%[d])\n\t"
+                     "movdqa %%xmm1, 16(%[d])\n\t"
+                     "movdqa %%xmm2, 32(%[d])\n\t"
+                     "movdqa %%xmm3, 48(%[d])\n\t"
+                     "add $64, %[s]\n\t"
+                     "add $64, %[d]\n\t"
+                     "dec %[blocks]\n\t"
+                     "jnz 1b"
+                     : [d] "+r"(d), [s] "+r"(s), [blocks] "+r"(blocks)
+                     :
+                     : KLIB_XMM_CLOBBERS "memory");
+}
+
+/** klib_sse2_copy_down:
+ * Copies 64-byte blocks ending at the 16-byte aligned d_end, highest
+ * first, so dst may overlap src from above
+ */
+ALWAYS_INLINE void klib_sse2_copy_down(u8int *d_end, const u8int *s_end, u32int blocks)
+{
+    __asm__ volatile("1:\n\t"
+                     "sub $64, %[s]\n\t"
+                     "sub $64, %[d]\n\t"
+                     "movdqu (%[s]), %%xmm0\n\t"
+                     "movdqu 16(%[s]), %%xmm1\n\t"
+                     "movdqu 32(%[s]), %%xmm2\n\t"
+                     "movdqu 48(%[s]), %%xmm3\n\t"
+                     "movdqa %%xmm0, (%[d])\n\t"
+                     "movdqa %%xmm1, 16(%[d])\n\t"
+                     "movdqa %%xmm2, 32(%[d])\n\t"
+                     "movdqa %%xmm3, 48(%[d])\n\t"
+                     "dec %[blocks]\n\t"
+                     "jnz 1b"
+                     : [d] "+r"(d_end), [s] "+r"(s_end), [blocks] "+r"(blocks)
+                     :
+                     : KLIB_XMM_CLOBBERS "memory");
+}
+
+/** klib_sse2_equal16:
+ * Returns a bit per byte of the 16 at a and b, set where they are equal
+ */
+ALWAYS_INLINE u32int klib_sse2_equal16(const u8int *a, const u8int *b)
+{
+    u32int mask;
+
+    __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                     "movdqu (%2), %%xmm1\n\t"
+                     "pcmpeqb %%xmm1, %%xmm0\n\t"
+                     "pmovmskb %%xmm0, %0"
+                     : "=r"(mask)
+                     : "r"(a), "r"(b)
+                     : KLIB_XMM_CLOBBERS "memory");
+    return mask;
+}
+
+/** klib_sse2_zero16:
+ * Returns a bit per byte of the 16 at p, set where the byte is 0
+ */
+ALWAYS_INLINE u32int klib_sse2_zero16(const u8int *p)
+{
+    u32int mask;
+
+    __asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+                     "movdqu (%1), %%xmm1\n\t"
+                     "pcmpeqb %%xmm1, %%xmm0\n\t"
+                     "pmovmskb %%xmm0, %0"
+                     : "=r"(mask)
+                     : "r"(p)
+                     : KLIB_XMM_CLOBBERS "memory");
+    return mask;
+}
+
+static void *klib_sse2_memset(void *dst, int c, u32int n)
+{
+    u8int *d = dst;
+    u32int fill = (u8int) c * 0x01010101u;
+    u32int head;
+    u32int flags;
+
+    if (n < KLIB_SSE2_MIN) {
+        return klib_rep_memset(dst, c, n);
+    }
+    head = (u32int) -KLIB_ADDR(d) & 15;
+    klib_rep_stosb(d, fill, head);
+    d += head;
+    n -= head;
+
+    flags = klib_sse_begin();
+    klib_sse2_fill(d, fill, n >> 6);
+    klib_sse_end(flags);
+
+    klib_rep_memset(d + (n & ~63u), c, n & 63);
+    return dst;
+}
+
+static void *klib_sse2_memset16(u16int *dst, u16int value, u32int count)
+{
+    u16int *d = dst;
+    u32int fill = value | ((u32int) value << 16);
+    u32int head;
+    u32int flags;
+
+    // An odd address never reaches 16-byte alignment in whole words
+    if (count * 2 < KLIB_SSE2_MIN || (KLIB_ADDR(d) & 1)) {
+        return klib_rep_memset16(dst, value, count);
+    }
+    head = ((u32int) -KLIB_ADDR(d) & 15) >> 1;
+    klib_rep_memset16(d, value, head);
+    d += head;
+    count -= head;
+
+    flags = klib_sse_begin();
+    klib_sse2_fill((u8int *) d, fill, count >> 5);
+    klib_sse_end(flags);
+
+    klib_rep_memset16(d + (count & ~31u), value, count & 31);
+    return dst;
+}
+
+static void *klib_sse2_memcpy(void *dst, const void *src, u32int n)
+{
+    u8int *d = dst;
+    const u8int *s = src;
+    u32int head;
+    u32int flags;
+
+    if (n < KLIB_SSE2_MIN) {
+        return klib_rep_memcpy(dst, src, n);
+    }
+    head = (u32int) -KLIB_ADDR(d) & 15;
+    klib_rep_movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    flags = klib_sse_begin();
+    klib_sse2_copy_up(d, s, n >> 6);
+    klib_sse_end(flags);
+
+    klib_rep_memcpy(d + (n & ~63u), s + (n & ~63u), n & 63);
+    return dst;
+}
+
+/** klib_sse2_memmove:
+ * Backwards copies align the end of dst instead of the start and move the
+ * unaligned bytes at either end with the rep routine
+ */
+static void *klib_sse2_memmove(void *dst, const void *src, u32int n)
+{
+    u8int *d_end = (u8int *) dst + n;
+    const u8int *s_end = (const u8int *) src + n;
+    u32int tail;
+    u32int flags;
+
+    if (KLIB_ADDR(dst) - KLIB_ADDR(src) >= n) {
+        // dst below src or clear of it: forwards is safe
+        return klib_sse2_memcpy(dst, src, n);
+    }
+    if (n < KLIB_SSE2_MIN) {
+        return klib_rep_memmove(dst, src, n);
+    }
+    tail = KLIB_ADDR(d_end) & 15;
+    klib_rep_memmove(d_end - tail, s_end - tail, tail);
+    d_end -= tail;
+    s_end -= tail;
+    n -= tail;
+
+    flags = klib_sse_begin();
+    klib_sse2_copy_down(d_end, s_end, n >> 6);
+    klib_sse_end(flags);
+
+    klib_rep_memmove(dst, src, n & 63);
+    return dst;
+}
+
+static int klib_sse2_memcmp(const void *a, const void *b, u32int n)
+{
+    const u8int *x = a;
+    const u8int *y = b;
+    u32int i = 0;
+    u32int flags;
+
+    if (n < KLIB_SSE2_MIN) {
+        return klib_byte_memcmp(a, b, n);
+    }
+    flags = klib_sse_begin();
+    while (i + 16 <= n && klib_sse2_equal16(x + i, y + i) == 0xFFFF) {
+        i += 16;
+    }
+    klib_sse_end(flags);
+    return klib_byte_memcmp(x + i, y + i, n - i);
+}
+
+/** klib_sse2_strlen:
+ * Short strings, the usual case, end before the first 16-byte boundary
+ * and never pay for turning interrupts off
+ */
+static u32int klib_sse2_strlen(const char *s)
+{
+    const u8int *p = (const u8int *) s;
+    u32int mask;
+    u32int flags;
+
+    while (KLIB_ADDR(p) & 15) {
+        if (*p == '\0') {
+            return (u32int) (p - (const u8int *) s);
+        }
+        p++;
+    }
+    flags = klib_sse_begin();
+    while ((mask = klib_sse2_zero16(p)) == 0) {
+        p += 16;
+    }
+    klib_sse_end(flags);
+    return (u32int) (p - (const u8int *) s) + __builtin_ctz(mask);
+}
+
+/** klib_sse2_strcmp:
+ * Compares 16 bytes at a time while neither string is within 16 bytes of
+ * a page end, as the unaligned loads could otherwise fault past the
+ * terminator
+ */
+static int klib_sse2_strcmp(const char *a, const char *b)
+{
+    const u8int *x = (const u8int *) a;
+    const u8int *y = (const u8int *) b;
+    u32int i;
+    u32int flags;
+
+    for (i = 0; i < 16; i++) {
+        if (x[i] == '\0' || x[i] != y[i]) {
+            return x[i] - y[i];
+        }
+    }
+    x += 16;
+    y += 16;
+
+    flags = klib_sse_begin();
+    while (1) {
+        u32int stop;
+
+        if ((KLIB_ADDR(x) & (KLIB_PAGE_SIZE - 1)) > KLIB_PAGE_SIZE - 16 ||
+            (KLIB_ADDR(y) & (KLIB_PAGE_SIZE - 1)) > KLIB_PAGE_SIZE - 16) {
+            if (*x == '\0' || *x != *y) {
+                break;
+            }
+            x++;
+            y++;
+            continue;
+        }
+        // A byte that differs or ends x stops the scan
+        stop = ~klib_sse2_equal16(x, y) | klib_sse2_zero16(x);
+        if ((stop & 0xFFFF) != 0) {
+            i = __builtin_ctz(stop);
+            x += i;
+            y += i;
+            break;
+        }
+        x += 16;
+        y += 16;
+    }
+    klib_sse_end(flags);
+    return *x - *y;
+}
+
+static const struct klib_ops klib_sse2 = {
+    "sse2",
+    klib_sse2_memset,
+    klib_sse2_memset16,
+    klib_sse2_memcpy,
+    klib_sse2_memmove,
+    klib_sse2_memcmp,
+    klib_sse2_strlen,
+    klib_sse2_strcmp
+};
+
+// Enhanced rep movsb/stosb
+
+static void *klib_erms_memset(void *dst, int c, u32int n)
+{
+    klib_rep_stosb(dst, (u8int) c, n);
+    return dst;
+}
+
+static void *klib_erms_memcpy(void *dst, const void *src, u32int n)
+{
+    klib_rep_movsb(dst, src, n);
+    return dst;
+}
+
+/* With ERMS the microcode copies and fills faster than the SSE2 loops,
+ * whatever the alignment; backwards copies and the scans stay on SSE2 */
+static const struct klib_ops klib_erms = {
+    "erms",
+    klib_erms_memset,
+    klib_rep_memset16,
+    klib_erms_memcpy,
+    klib_sse2_memmove,
+    klib_sse2_memcmp,
+    klib_sse2_strlen,
+    klib_sse2_strcmp
+};
+
+/* Indexed by KLIB_IMPL_* */
+static const struct klib_ops *const impls[] = { &klib_rep, &klib_sse2, &klib_erms };
+
+static const struct klib_ops *ops = &klib_rep;
+
+// Public entry points
+
+void *memset(void *dst, int c, u32int n)
+{
+    return ops->set(dst, c, n);
+}
+
+void *memset16(u16int *dst, u16int value, u32int count)
+{
+    return ops->set16(dst, value, count);
+}
+
+void *memcpy(void *dst, const void *src, u32int n)
+{
+    return ops->copy(dst, src, n);
+}
+
+void *memmove(void *dst, const void *src, u32int n)
+{
+    return ops->move(dst, src, n);
+}
+
+int memcmp(const void *a, const void *b, u32int n)
+{
+    return ops->compare(a, b, n);
+}
+
+u32int strlen(const char *s)
+{
+    return ops->length(s);
+}
+
+int strcmp(const char *a, const char *b)
+{
+    return ops->string_compare(a, b);
+}
+
+static void klib_cpuid(u32int leaf, u32int *eax, u32int *ebx, u32int *edx)
+{
+    u32int ecx = 0;
+
+    *eax = leaf;
+    __asm__ volatile("cpuid" : "+a"(*eax), "=b"(*ebx), "+c"(ecx), "=d"(*edx));
+}
+
+/** klib_enable_sse:
+ * Lets SSE instructions run: no FPU emulation, no lazy FPU trap, and
+ * fxsave and SIMD exceptions enabled in CR4
+ */
+static void klib_enable_sse(void)
+{
+#if !HOST_BUILD
+    u32int cr0;
+    u32int cr4;
+
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP;
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+    __asm__ volatile("fninit");
+#endif
+}
+
+void klib_init(void)
+{
+    u32int need = CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2;
+    u32int max_leaf;
+    u32int eax;
+    u32int ebx;
+    u32int edx;
+
+    klib_cpuid(0, &max_leaf, &ebx, &edx);
+    klib_cpuid(1, &eax, &ebx, &edx);
+    if ((edx & need) != need) {
+        return;
+    }
+    klib_enable_sse();
+    supported |= 1 << KLIB_IMPL_SSE2;
+    ops = &klib_sse2;
+
+    if (max_leaf >= 7) {
+        klib_cpuid(7, &eax, &ebx, &edx);
+        if (ebx & CPUID_7_EBX_ERMS) {
+            supported |= 1 << KLIB_IMPL_ERMS;
+            ops = &klib_erms;
+        }
+    }
+}
+
+u8int klib_select(u8int impl)
+{
+    if (impl >= KLIB_IMPL_COUNT || !(supported & (1 << impl))) {
+        return 0;
+    }
+    ops = impls[impl];
+    return 1;
+}
+
+u8int klib_get_impl(void)
+{
+    u8int impl = 0;
+
+    while (impls[impl] != ops) {
+        impl++;
+    }
+    return impl;
+}
+
+const char *klib_impl_name(void)
+{
+    return ops->name;
+}
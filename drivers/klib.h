@@ -0,0 +1,101 @@
+#ifndef INCLUDE_KLIB_H
+#define INCLUDE_KLIB_H
+
+#include "types.h"
+
+#if HOST_BUILD
+/* make host-test links these next to the C library's own */
+#define memset   klib_memset
+#define memset16 klib_memset16
+#define memcpy   klib_memcpy
+#define memmove  klib_memmove
+#define memcmp   klib_memcmp
+#define strlen   klib_strlen
+#define strcmp   klib_strcmp
+#endif
+
+/* Implementations klib_select can switch between */
+#define KLIB_IMPL_REP   0       /* rep stos/movs, byte loops for the rest */
+#define KLIB_IMPL_SSE2  1       /* 16 bytes at a time in the XMM registers */
+#define KLIB_IMPL_ERMS  2       /* rep movsb/stosb copies, SSE2 for the rest */
+#define KLIB_IMPL_COUNT 3
+
+/* Below this many bytes the SSE2 routines use the rep ones, which do not
+ * have to turn interrupts off */
+#define KLIB_SSE2_MIN   256
+
+/** memset:
+ * Fills n bytes at dst with the byte c
+ *
+ * @return dst
+ */
+void *memset(void *dst, int c, u32int n);
+
+/** memset16:
+ * Fills count 16-bit words at dst, which must be 2-byte aligned, with
+ * value. Used for text mode cells.
+ *
+ * @return dst
+ */
+void *memset16(u16int *dst, u16int value, u32int count);
+
+/** memcpy:
+ * Copies n bytes from src to dst. The areas must not overlap.
+ *
+ * @return dst
+ */
+void *memcpy(void *dst, const void *src, u32int n);
+
+/** memmove:
+ * Copies n bytes from src to dst. The areas may overlap.
+ *
+ * @return dst
+ */
+void *memmove(void *dst, const void *src, u32int n);
+
+/** memcmp:
+ * Compares n bytes as unsigned chars
+ *
+ * @return <0, 0 or >0 as a is below, equal to or above b
+ */
+int memcmp(const void *a, const void *b, u32int n);
+
+/** strlen:
+ * Returns the length of a string, not counting the terminator
+ */
+u32int strlen(const char *s);
+
+/** strcmp:
+ * Compares two strings as unsigned chars
+ *
+ * @return <0, 0 or >0 as a is below, equal to or above b
+ */
+int strcmp(const char *a, const char *b);
+
+/** klib_init:
+ * Picks the fastest implementation the CPU supports: ERMS, else SSE2,
+ * else rep. With SSE2 it first turns on the FPU and SSE through CR0 and
+ * CR4; the other CPUs copy both from the boot CPU, so call it before
+ * smp_init. Until it runs the rep routines are used.
+ */
+void klib_init(void);
+
+/** klib_select:
+ * Switches implementation, for benchmarks
+ *
+ * @param impl One of the KLIB_IMPL_* values
+ * @return 1 on success, 0 if klib_init found the CPU cannot run it
+ */
+u8int klib_select(u8int impl);
+
+/** klib_get_impl:
+ * Returns the implementation in use
+ */
+u8int klib_get_impl(void);
+
+/** klib_impl_name:
+ * Returns the name of the implementation in use
+ */
+const char *klib_impl_name(void);
+
+#endif /* INCLUDE_KLIB_H */
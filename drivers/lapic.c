@@ -0,0 +1,206 @@
+#include "lapic.h"
+#include "clock.h"
+#include "math64.h"
+#include "paging.h"
+#include "types.h"
+
+#define MSR_APIC_BASE           0x1B
+#define MSR_TSC_DEADLINE        0x6E0
+
+#define APIC_BASE_ENABLE        0x00000800
+#define APIC_BASE_ADDRESS       0xFFFFF000
+
+#define CPUID_EDX_APIC          0x00000200
+#define CPUID_ECX_TSC_DEADLINE  0x01000000
+
+#define SPURIOUS_ENABLE         0x00000100
+
+#define LVT_MASKED              0x00010000
+#define LVT_TIMER_ONESHOT       0x00000000
+#define LVT_TIMER_PERIODIC      0x00020000
+#define LVT_TIMER_TSC_DEADLINE  0x00040000
+
+#define TIMER_DIVIDE_16         0x3
+
+/* Calibration window */
+#define CALIBRATE_MS            10
+
+static volatile u32int *lapic = 0;
+static u8int tsc_deadline = 0;
+static u32int timer_khz = 0;
+
+ALWAYS_INLINE u32int lapic_read(u32int reg)
+{
+    return lapic[reg >> 2];
+}
+
+ALWAYS_INLINE void lapic_write(u32int reg, u32int value)
+{
+    lapic[reg >> 2] = value;
+}
+
+static u64int lapic_rdmsr(u32int msr)
+{
+    u32int low;
+    u32int high;
+
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((u64int) high << 32) | low;
+}
+
+static void lapic_wrmsr(u32int msr, u64int value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((u32int) value), "d"((u32int) (value >> 32)));
+}
+
+/** lapic_calibrate:
+ * Lets the timer count down from its maximum for CALIBRATE_MS, timed with
+ * the TSC
+ *
+ * @return Timer counts per millisecond
+ */
+static u32int lapic_calibrate(void)
+{
+    u64int window = (u64int) clock_tsc_khz() * CALIBRATE_MS;
+    u64int start;
+
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    start = clock_cycles();
+    while (clock_cycles() - start < window) {
+    }
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    return (0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT)) / CALIBRATE_MS;
+}
+
+u8int lapic_init(void)
+{
+    u32int eax = 1;
+    u32int ebx;
+    u32int ecx = 0;
+    u32int edx;
+    u32int base;
+    u32int virt;
+
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    if (!(edx & CPUID_EDX_APIC) || clock_tsc_khz() == 0) {
+        return 0;
+    }
+
+    base = (u32int) lapic_rdmsr(MSR_APIC_BASE) & APIC_BASE_ADDRESS;
+    virt = paging_map_physical(base, PAGING_PAGE_SIZE, PAGING_WRITABLE | PAGING_CACHE_DISABLE);
+    if (virt == 0) {
+        return 0;
+    }
+    lapic_wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+    lapic = (volatile u32int *) virt;
+    lapic_write(LAPIC_SPURIOUS, SPURIOUS_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    // Calibrated even with TSC-deadline mode, for the periodic AP ticks
+    tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+    timer_khz = lapic_calibrate();
+    if (timer_khz == 0) {
+        lapic = 0;
+        return 0;
+    }
+    lapic_timer_disarm();
+    return 1;
+}
+
+void lapic_init_ap(void)
+{
+    lapic_write(LAPIC_SPURIOUS, SPURIOUS_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_timer_disarm();
+}
+
+u8int lapic_present(void)
+{
+    return lapic != 0;
+}
+
+u8int lapic_id(void)
+{
+    return (u8int) (lapic_read(LAPIC_ID) >> 24);
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/** lapic_send_ipi:
+ * Writes the destination, then the command, which sends the IPI
+ */
+void lapic_send_ipi(u8int apic_id, u32int command)
+{
+    lapic_write(LAPIC_ICR_HIGH, (u32int) apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+}
+
+void lapic_timer_periodic(u8int vector, u32int hz)
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | vector);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_khz * 1000 / hz);
+}
+
+/** lapic_timer_arm:
+ * Programs a single timer interrupt at deadline
+ */
+void lapic_timer_arm(u64int deadline)
+{
+    u64int now;
+    u64int count;
+
+    if (tsc_deadline) {
+        lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+        lapic_wrmsr(MSR_TSC_DEADLINE, deadline);
+        return;
+    }
+
+    now = clock_cycles();
+    count = 1;
+    if (deadline > now) {
+        // Anything this far off saturates the counter anyway, and the
+        // product below stays in 64 bits
+        u64int delta = deadline - now;
+        if (delta > 0xFFFFFFFFFFULL) {
+            delta = 0xFFFFFFFFFFULL;
+        }
+        count = div64_u32(delta * timer_khz, clock_tsc_khz(), 0);
+        if (count == 0) {
+            count = 1;
+        } else if (count > 0xFFFFFFFF) {
+            count = 0xFFFFFFFF;
+        }
+    }
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, (u32int) count);
+}
+
+void lapic_timer_disarm(void)
+{
+    if (tsc_deadline) {
+        lapic_wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+    // Stops a periodic or one-shot count; ignored in TSC-deadline mode
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR);
+}
+
+const char *lapic_timer_mode(void)
+{
+    if (lapic == 0) {
+        return "none";
+    }
+    return tsc_deadline ? "tsc-deadline" : "one-shot";
+}
+
+u32int lapic_timer_khz(void)
+{
+    return timer_khz;
+}
@@ -0,0 +1,108 @@
+#ifndef INCLUDE_LAPIC_H
+#define INCLUDE_LAPIC_H
+
+#include "types.h"
+
+/* Where the local APIC registers are after reset. They are mapped at the
+ * same virtual address with paging_map_physical. */
+#define LAPIC_DEFAULT_BASE      0xFEE00000
+
+/* Vectors, above the remapped PICs */
+#define LAPIC_TIMER_VECTOR      0x40
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+/* Register offsets */
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SPURIOUS          0x0F0
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_TIMER_INITIAL     0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIVIDE      0x3E0
+
+/* Interrupt command register, low word */
+#define LAPIC_ICR_FIXED         0x00000000
+#define LAPIC_ICR_INIT          0x00000500
+#define LAPIC_ICR_STARTUP       0x00000600
+#define LAPIC_ICR_PENDING       0x00001000  /* delivery status */
+#define LAPIC_ICR_ASSERT        0x00004000
+
+/** lapic_init:
+ * Maps and software-enables the local APIC and calibrates its timer
+ * against the TSC. Call after paging_init and clock_init.
+ *
+ * @return 1 if the CPU has a usable local APIC
+ */
+u8int lapic_init(void);
+
+/** lapic_init_ap:
+ * Software-enables the local APIC of an application processor. The
+ * registers are at the same address on every CPU.
+ */
+void lapic_init_ap(void);
+
+/** lapic_present:
+ * Returns whether lapic_init succeeded
+ */
+u8int lapic_present(void);
+
+/** lapic_id:
+ * Returns the APIC ID of the running CPU
+ */
+u8int lapic_id(void);
+
+/** lapic_eoi:
+ * Signals the end of an interrupt delivered by the local APIC
+ */
+void lapic_eoi(void);
+
+/** lapic_send_ipi:
+ * Sends an inter-processor interrupt and waits until the local APIC has
+ * accepted it
+ *
+ * @param apic_id Destination APIC ID
+ * @param command Delivery mode and vector, LAPIC_ICR_*
+ */
+void lapic_send_ipi(u8int apic_id, u32int command);
+
+/** lapic_timer_periodic:
+ * Makes the running CPU's timer raise vector at a fixed rate, using the
+ * count rate calibrated on the boot CPU
+ *
+ * @param vector The vector to raise
+ * @param hz     Interrupts per second
+ */
+void lapic_timer_periodic(u8int vector, u32int hz);
+
+/** lapic_timer_arm:
+ * Programs the timer to raise LAPIC_TIMER_VECTOR once, at the given TSC
+ * value. In one-shot mode a deadline too far away for the 32-bit counter
+ * fires early; the caller checks the time and arms again.
+ *
+ * @param deadline The TSC value to fire at
+ */
+void lapic_timer_arm(u64int deadline);
+
+/** lapic_timer_disarm:
+ * Cancels an armed timer, or stops a periodic one
+ */
+void lapic_timer_disarm(void);
+
+/** lapic_timer_mode:
+ * Returns how the timer is driven
+ *
+ * @return "tsc-deadline", "one-shot" or "none"
+ */
+const char *lapic_timer_mode(void);
+
+/** lapic_timer_khz:
+ * Returns the calibrated timer count rate
+ *
+ * @return Counts per millisecond
+ */
+u32int lapic_timer_khz(void);
+
+#endif /* INCLUDE_LAPIC_H */
@@ -0,0 +1,56 @@
+#ifndef INCLUDE_MATH64_H
+#define INCLUDE_MATH64_H
+
+#include "types.h"
+
+/** div64_u32:
+ * Divides a 64-bit value by a 32-bit one with two divl instructions. The
+ * kernel is linked without libgcc, so a plain 64-bit '/' does not link.
+ *
+ * @param n   The dividend
+ * @param d   The divisor, must not be 0
+ * @param rem Where to store the remainder, may be 0
+ * @return The quotient
+ */
+ALWAYS_INLINE
+u64int div64_u32(u64int n, u32int d, u32int *rem)
+{
+    u32int high = (u32int) (n >> 32);
+    u32int low = (u32int) n;
+    u32int q_high = high / d;
+    u32int q_low;
+    u32int r;
+
+    high = high % d;
+    __asm__("divl %4" : "=a"(q_low), "=d"(r) : "a"(low), "d"(high), "rm"(d));
+    if (rem != 0) {
+        *rem = r;
+    }
+    return ((u64int) q_high << 32) | q_low;
+}
+
+/** mul64_shr32:
+ * Returns the low 64 bits of (a * b) >> 32, computed from 32x32-bit
+ * products so the high half of the full product is not lost. Used for
+ * fixed-point unit conversions.
+ *
+ * @param a The first factor
+ * @param b The second factor
+ * @return The product shifted right by 32
+ */
+ALWAYS_INLINE
+u64int mul64_shr32(u64int a, u64int b)
+{
+    u32int a_low = (u32int) a;
+    u32int a_high = (u32int) (a >> 32);
+    u32int b_low = (u32int) b;
+    u32int b_high = (u32int) (b >> 32);
+    u64int low = (u64int) a_low * b_low;
+    u64int mid1 = (u64int) a_high * b_low;
+    u64int mid2 = (u64int) a_low * b_high;
+    u64int high = (u64int) a_high * b_high;
+
+    return (high << 32) + mid1 + mid2 + (low >> 32);
+}
+
+#endif /* INCLUDE_MATH64_H */
@@ -0,0 +1,107 @@
+#ifndef INCLUDE_MULTIBOOT_H
+#define INCLUDE_MULTIBOOT_H
+
+#include "types.h"
+
+/* Value left in eax by a multiboot compliant boot loader */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* Bits of multiboot_info.flags saying which fields are valid */
+#define MULTIBOOT_INFO_MEMORY   0x00000001
+#define MULTIBOOT_INFO_CMDLINE  0x00000004
+#define MULTIBOOT_INFO_MMAP     0x00000040
+#define MULTIBOOT_INFO_VBE      0x00000800
+#define MULTIBOOT_INFO_FRAMEBUFFER 0x00001000
+
+/* framebuffer_type values */
+#define MULTIBOOT_FRAMEBUFFER_RGB  1
+
+/** Boot information passed by GRUB in ebx */
+struct multiboot_info {
+    u32int flags;
+    u32int mem_lower;           /* KB of memory below 1 MB */
+    u32int mem_upper;           /* KB of memory above 1 MB */
+    u32int boot_device;
+    u32int cmdline;             /* physical address of the command line */
+    u32int mods_count;
+    u32int mods_addr;
+    u32int syms[4];
+    u32int mmap_length;         /* size of the memory map in bytes */
+    u32int mmap_addr;           /* physical address of the memory map */
+    u32int drives_length;
+    u32int drives_addr;
+    u32int config_table;
+    u32int boot_loader_name;
+    u32int apm_table;
+    u32int vbe_control_info;
+    u32int vbe_mode_info;
+    u16int vbe_mode;
+    u16int vbe_interface_seg;
+    u16int vbe_interface_off;
+    u16int vbe_interface_len;
+    u64int framebuffer_addr;    /* physical address of the framebuffer */
+    u32int framebuffer_pitch;   /* bytes per scan line */
+    u32int framebuffer_width;   /* in pixels */
+    u32int framebuffer_height;
+    u8int framebuffer_bpp;
+    u8int framebuffer_type;
+    u8int red_field_position;   /* colour fields, for MULTIBOOT_FRAMEBUFFER_RGB */
+    u8int red_mask_size;
+    u8int green_field_position;
+    u8int green_mask_size;
+    u8int blue_field_position;
+    u8int blue_mask_size;
+} __attribute__((packed));
+
+/* VBE memory model of direct colour modes */
+#define VBE_MEMORY_MODEL_DIRECT 6
+
+/** The VBE mode information block at vbe_mode_info, as far as the linear
+ * framebuffer fields. Loaders that predate the framebuffer fields above
+ * only pass this. */
+struct vbe_mode_info {
+    u16int attributes;
+    u8int window_a;
+    u8int window_b;
+    u16int granularity;
+    u16int window_size;
+    u16int segment_a;
+    u16int segment_b;
+    u32int window_function;
+    u16int pitch;               /* bytes per scan line */
+    u16int width;               /* in pixels */
+    u16int height;
+    u8int char_width;
+    u8int char_height;
+    u8int planes;
+    u8int bpp;
+    u8int banks;
+    u8int memory_model;
+    u8int bank_size;
+    u8int image_pages;
+    u8int reserved0;
+    u8int red_mask_size;
+    u8int red_position;
+    u8int green_mask_size;
+    u8int green_position;
+    u8int blue_mask_size;
+    u8int blue_position;
+    u8int reserved_mask_size;
+    u8int reserved_position;
+    u8int direct_color_attributes;
+    u32int framebuffer;         /* physical address of the framebuffer */
+} __attribute__((packed));
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+/** One entry of the memory map at mmap_addr. size does not count itself,
+ * so the next entry starts size + 4 bytes further on. */
+struct multiboot_mmap_entry {
+    u32int size;
+    u64int addr;
+    u64int len;
+    u32int type;
+} __attribute__((packed));
+
+#endif /* INCLUDE_MULTIBOOT_H */
@@ -0,0 +1,300 @@
+#include "paging.h"
+#include "frame_buffer.h"
+#include "interrupts.h"
+#include "pmm.h"
+#include "user.h"
+#include "types.h"
+
+#define CR0_WP             0x00010000
+#define CR0_PG             0x80000000
+#define CR4_PSE            0x00000010
+#define CPUID_EDX_PSE      0x00000008
+
+#define PAGING_ENTRIES     1024
+#define PDE_INDEX(addr)    ((addr) >> 22)
+#define PTE_INDEX(addr)    (((addr) >> 12) & 0x3FF)
+#define ENTRY_ADDR(entry)  ((entry) & 0xFFFFF000)
+
+/* Identity maps made of 4 MB pages and of 4 KB pages. Entries from
+ * PAGING_HIGHER_HALF up are kept the same in both. */
+static u32int directory_pse[PAGING_ENTRIES] __attribute__((aligned(PAGING_PAGE_SIZE)));
+static u32int directory_4k[PAGING_ENTRIES] __attribute__((aligned(PAGING_PAGE_SIZE)));
+
+static u32int *directory = 0;       /* the one in CR3 */
+static u8int pse_supported = 0;
+static u8int have_4k = 0;
+static u32int identity_limit = 0;
+static u8int user_ready = 0;
+static u32int window_next = PAGING_WINDOW;
+
+ALWAYS_INLINE void paging_load_directory(u32int *dir)
+{
+    __asm__ volatile("mov %0, %%cr3" : : "r"(dir) : "memory");
+}
+
+ALWAYS_INLINE void paging_invalidate(u32int virt)
+{
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static u8int paging_cpu_has_pse(void)
+{
+    u32int eax = 1;
+    u32int ebx;
+    u32int ecx = 0;
+    u32int edx;
+
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (edx & CPUID_EDX_PSE) != 0;
+}
+
+static void paging_zero(u32int *page)
+{
+    u32int i;
+
+    for (i = 0; i < PAGING_ENTRIES; i++) {
+        page[i] = 0;
+    }
+}
+
+/** paging_build_4k:
+ * Fills directory_4k with page tables for the identity map
+ *
+ * @return 1 on success, 0 if page tables could not be allocated
+ */
+static u8int paging_build_4k(void)
+{
+    u32int pde;
+
+    for (pde = 0; pde < PDE_INDEX(identity_limit - 1) + 1; pde++) {
+        u32int *table = (u32int *) pmm_alloc_frame();
+        u32int i;
+
+        if (table == 0) {
+            return 0;
+        }
+        for (i = 0; i < PAGING_ENTRIES; i++) {
+            table[i] = (pde << 22) + (i << 12) + PAGING_PRESENT + PAGING_WRITABLE;
+        }
+        directory_4k[pde] = (u32int) table | PAGING_PRESENT | PAGING_WRITABLE;
+    }
+    return 1;
+}
+
+/** paging_open_user:
+ * Lets ring 3 reach the user area, and nothing else, in both maps
+ */
+static void paging_open_user(void)
+{
+    u32int pde = PDE_INDEX(USER_BASE);
+    u32int i;
+
+    if (identity_limit <= USER_BASE) {
+        return;
+    }
+    if (pse_supported) {
+        directory_pse[pde] |= PAGING_USER;
+    }
+    if (have_4k) {
+        u32int *table = (u32int *) ENTRY_ADDR(directory_4k[pde]);
+
+        directory_4k[pde] |= PAGING_USER;
+        for (i = 0; i < PAGING_ENTRIES; i++) {
+            table[i] |= PAGING_USER;
+        }
+    }
+    user_ready = 1;
+}
+
+/** paging_fault_handler:
+ * Vector 14: reports the faulting address from CR2 and what the access
+ * was, then stops. Nothing is paged in on demand yet. A fault in user code
+ * kills the program instead.
+ */
+static void paging_fault_handler(__attribute__((unused)) struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, struct stack_state *stack)
+{
+    u32int error = stack->error_code;
+    u32int addr;
+
+    __asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+
+    if (stack->cs & 3) {
+        fb_puts("\nPage fault at ");
+        fb_put_hex(addr);
+        user_kill((error & PAGING_FAULT_PRESENT) ? "protection violation" : "page not present", stack->eip);
+    }
+
+    fb_puts("\nPage fault at ");
+    fb_put_hex(addr);
+    fb_puts(": ");
+    fb_puts((error & PAGING_FAULT_PRESENT) ? "protection violation" : "page not present");
+    fb_puts((error & PAGING_FAULT_FETCH) ? ", instruction fetch" :
+            (error & PAGING_FAULT_WRITE) ? ", write" : ", read");
+    fb_puts((error & PAGING_FAULT_USER) ? ", user mode" : ", kernel mode");
+    if (error & PAGING_FAULT_RESERVED) {
+        fb_puts(", reserved bit set");
+    }
+    fb_puts("\neip=");
+    fb_put_hex(stack->eip);
+    fb_puts(" error=");
+    fb_put_hex(error);
+    fb_puts("\nSystem halted.\n");
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+/** paging_init:
+ * Builds the identity maps and turns paging on
+ */
+void paging_init(void)
+{
+    u32int frames = pmm_frame_limit();
+    u32int pde;
+    u32int cr0;
+
+    pse_supported = paging_cpu_has_pse();
+
+    // Whole 4 MB pages covering all RAM, never less than the first one
+    identity_limit = PAGING_LARGE_SIZE;
+    if (frames > (PAGING_LARGE_SIZE >> 12)) {
+        u32int pages = (frames + 1023) >> 10;
+        identity_limit = pages >= PDE_INDEX(PAGING_HIGHER_HALF) ? PAGING_HIGHER_HALF : pages << 22;
+    }
+
+    paging_zero(directory_pse);
+    paging_zero(directory_4k);
+    if (pse_supported) {
+        for (pde = 0; pde < PDE_INDEX(identity_limit - 1) + 1; pde++) {
+            directory_pse[pde] = (pde << 22) | PAGING_PRESENT | PAGING_WRITABLE | PAGING_LARGE;
+        }
+    }
+    have_4k = paging_build_4k();
+    if (!pse_supported && !have_4k) {
+        fb_puts("paging: no memory for page tables, paging stays off\n");
+        return;
+    }
+
+    paging_open_user();
+    register_interrupt_handler(INTERRUPTS_PAGE_FAULT, paging_fault_handler);
+
+    if (pse_supported) {
+        u32int cr4;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+        directory = directory_pse;
+    } else {
+        directory = directory_4k;
+    }
+    paging_load_directory(directory);
+
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_PG | CR0_WP) : "memory");
+}
+
+/** paging_map:
+ * Maps one 4 KB page in the higher half
+ */
+u8int paging_map(u32int virt, u32int phys, u32int flags)
+{
+    u32int pde = PDE_INDEX(virt);
+    u32int *table;
+
+    if (directory == 0 || virt < PAGING_HIGHER_HALF) {
+        return 0;
+    }
+    if (!(directory[pde] & PAGING_PRESENT)) {
+        table = (u32int *) pmm_alloc_frame();
+        if (table == 0) {
+            return 0;
+        }
+        paging_zero(table);
+        // User access needs the bit at both levels; the PTE decides
+        directory_pse[pde] = (u32int) table | PAGING_PRESENT | PAGING_WRITABLE | PAGING_USER;
+        directory_4k[pde] = directory_pse[pde];
+    }
+    table = (u32int *) ENTRY_ADDR(directory[pde]);
+    table[PTE_INDEX(virt)] = (phys & 0xFFFFF000) | (flags & (PAGING_WRITABLE | PAGING_USER | PAGING_WRITE_THROUGH | PAGING_CACHE_DISABLE)) | PAGING_PRESENT;
+    paging_invalidate(virt);
+    return 1;
+}
+
+/** paging_map_physical:
+ * Returns a virtual address for a physical range, mapping it if needed
+ */
+u32int paging_map_physical(u32int phys, u32int len, u32int flags)
+{
+    u32int first = phys & ~(PAGING_PAGE_SIZE - 1);
+    u32int pages;
+    u32int virt;
+    u32int i;
+
+    if (len == 0 || phys + len - 1 < phys) {
+        return 0;
+    }
+    if (directory == 0 || phys + len <= identity_limit) {
+        return phys;
+    }
+    pages = (phys + len - first + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+    if (first >= PAGING_HIGHER_HALF) {
+        virt = first;
+    } else {
+        if (pages > (PAGING_WINDOW + PAGING_WINDOW_SIZE - window_next) / PAGING_PAGE_SIZE) {
+            return 0;
+        }
+        virt = window_next;
+        window_next += pages * PAGING_PAGE_SIZE;
+    }
+    for (i = 0; i < pages; i++) {
+        if (!paging_map(virt + i * PAGING_PAGE_SIZE, first + i * PAGING_PAGE_SIZE, flags)) {
+            return 0;
+        }
+    }
+    return virt + (phys - first);
+}
+
+/** paging_unmap:
+ * Removes a mapping made with paging_map
+ */
+void paging_unmap(u32int virt)
+{
+    u32int pde = PDE_INDEX(virt);
+
+    if (directory == 0 || virt < PAGING_HIGHER_HALF || !(directory[pde] & PAGING_PRESENT)) {
+        return;
+    }
+    ((u32int *) ENTRY_ADDR(directory[pde]))[PTE_INDEX(virt)] = 0;
+    paging_invalidate(virt);
+}
+
+u8int paging_has_pse(void)
+{
+    return pse_supported;
+}
+
+/** paging_use_pse:
+ * Switches between the PSE and the 4 KB identity map
+ */
+u8int paging_use_pse(u8int enable)
+{
+    u32int *wanted = enable ? directory_pse : directory_4k;
+
+    if (directory == 0 || (enable && !pse_supported) || (!enable && !have_4k)) {
+        return 0;
+    }
+    if (directory != wanted) {
+        directory = wanted;
+        paging_load_directory(directory);
+    }
+    return 1;
+}
+
+u8int paging_user_ready(void)
+{
+    return user_ready;
+}
+
+u32int paging_identity_limit(void)
+{
+    return identity_limit;
+}
@@ -0,0 +1,102 @@
+#ifndef INCLUDE_PAGING_H
+#define INCLUDE_PAGING_H
+
+#include "types.h"
+
+#define PAGING_PAGE_SIZE     4096
+#define PAGING_LARGE_SIZE    0x400000    /* one PSE page, 4 MB */
+
+/* Page table and directory entry bits */
+#define PAGING_PRESENT       0x001
+#define PAGING_WRITABLE      0x002
+#define PAGING_USER          0x004
+#define PAGING_WRITE_THROUGH 0x008
+#define PAGING_CACHE_DISABLE 0x010       /* for memory-mapped registers */
+#define PAGING_LARGE         0x080       /* PDE maps a 4 MB page */
+
+/* Start of the area kept for 4 KB mappings made with paging_map */
+#define PAGING_HIGHER_HALF   0xC0000000
+
+/* Where paging_map_physical puts memory that is neither identity mapped
+ * nor in the higher half itself (firmware tables above the end of RAM) */
+#define PAGING_WINDOW        0xD0000000
+#define PAGING_WINDOW_SIZE   0x01000000
+
+/* Page fault error code bits */
+#define PAGING_FAULT_PRESENT 0x01        /* protection violation, not a missing page */
+#define PAGING_FAULT_WRITE   0x02
+#define PAGING_FAULT_USER    0x04
+#define PAGING_FAULT_RESERVED 0x08       /* reserved bit set in an entry */
+#define PAGING_FAULT_FETCH   0x10        /* instruction fetch */
+
+/** paging_init:
+ * Identity maps physical memory (at least the first 4 MB, which hold the
+ * kernel and VGA text memory) and turns paging on. With PSE the map uses
+ * one 4 MB page per 4 MB of RAM; a second directory maps the same memory
+ * with 4 KB pages for comparison. Installs the page fault handler.
+ * Call after pmm_init and interrupts_install_idt.
+ */
+void paging_init(void);
+
+/** paging_map:
+ * Maps one 4 KB page at or above PAGING_HIGHER_HALF, allocating a page
+ * table if needed
+ *
+ * @param virt  Page aligned virtual address
+ * @param phys  Page aligned physical address
+ * @param flags PAGING_WRITABLE, PAGING_USER and the caching bits
+ * @return 1 on success, 0 if virt is outside the area or out of memory
+ */
+u8int paging_map(u32int virt, u32int phys, u32int flags);
+
+/** paging_map_physical:
+ * Makes a physical range accessible. Memory below the identity limit is
+ * returned as is, ranges in the higher half are mapped at the same
+ * address and anything else is mapped into the window at PAGING_WINDOW.
+ * Mappings are permanent.
+ *
+ * @param phys  Physical address
+ * @param len   Length in bytes
+ * @param flags Flags for paging_map
+ * @return The virtual address of phys, or 0 on failure
+ */
+u32int paging_map_physical(u32int phys, u32int len, u32int flags);
+
+/** paging_unmap:
+ * Removes a mapping made with paging_map
+ *
+ * @param virt Page aligned virtual address
+ */
+void paging_unmap(u32int virt);
+
+/** paging_has_pse:
+ * Returns whether the CPU supports 4 MB pages
+ *
+ * @return 1 if PSE is available
+ */
+u8int paging_has_pse(void);
+
+/** paging_use_pse:
+ * Switches between the PSE and the 4 KB identity map. Both map the same
+ * memory, this only changes how many TLB entries it takes.
+ *
+ * @param enable 1 for 4 MB pages, 0 for 4 KB pages
+ * @return 1 if the requested map is now active
+ */
+u8int paging_use_pse(u8int enable);
+
+/** paging_user_ready:
+ * Returns whether the user area is mapped for ring 3
+ *
+ * @return 1 if user programs can run
+ */
+u8int paging_user_ready(void);
+
+/** paging_identity_limit:
+ * Returns the end of the identity mapped memory
+ *
+ * @return The first address not identity mapped
+ */
+u32int paging_identity_limit(void);
+
+#endif /* INCLUDE_PAGING_H */
@@ -22,14 +22,12 @@ void pic_acknowledge(u32int interrupt)
     {
         return;
     }
-    if (interrupt < PIC2_START_INTERRUPT) 
-    {
-        outb(PIC1_PORT_A, PIC_ACK);
-    } 
-    else 
+    if (interrupt >= PIC2_START_INTERRUPT) 
     {
+        // IRQs from PIC 2 arrive through the cascade on PIC 1
         outb(PIC2_PORT_A, PIC_ACK);
     }
+    outb(PIC1_PORT_A, PIC_ACK);
 }
 
 void pic_remap(s32int offset1, s32int offset2) {
@@ -53,3 +51,33 @@ void pic_remap(s32int offset1, s32int offset2) {
     outb(0x21, 0xFF);  // Mask all IRQs on PIC1
     outb(0xA1, 0xFF);  // Mask all IRQs on PIC2
 }
+
+/** pic_unmask:
+ * Enables delivery of one IRQ line. Lines on PIC 2 also need the cascade
+ * line (IRQ 2) on PIC 1.
+ *
+ * @param irq The IRQ number (0-15)
+ */
+void pic_unmask(u8int irq)
+{
+    if (irq < 8) {
+        outb(PIC_1_DATA, inb(PIC_1_DATA) & ~(1 << irq));
+    } else {
+        outb(PIC_2_DATA, inb(PIC_2_DATA) & ~(1 << (irq - 8)));
+        outb(PIC_1_DATA, inb(PIC_1_DATA) & ~(1 << 2));
+    }
+}
+
+/** pic_mask:
+ * Stops delivery of one IRQ line. The cascade line is left alone.
+ *
+ * @param irq The IRQ number (0-15)
+ */
+void pic_mask(u8int irq)
+{
+    if (irq < 8) {
+        outb(PIC_1_DATA, inb(PIC_1_DATA) | (1 << irq));
+    } else {
+        outb(PIC_2_DATA, inb(PIC_2_DATA) | (1 << (irq - 8)));
+    }
+}
@@ -35,4 +35,18 @@
 void pic_remap(s32int offset1, s32int offset2);
 void pic_acknowledge(u32int interrupt);
 
+/** pic_unmask:
+ * Enables delivery of one IRQ line
+ *
+ * @param irq The IRQ number (0-15)
+ */
+void pic_unmask(u8int irq);
+
+/** pic_mask:
+ * Stops delivery of one IRQ line
+ *
+ * @param irq The IRQ number (0-15)
+ */
+void pic_mask(u8int irq);
+
 #endif /* INCLUDE_PIC_H */
@@ -0,0 +1,361 @@
+#include "pmm.h"
+#include "multiboot.h"
+#include "spinlock.h"
+#include "user.h"
+#include "types.h"
+
+/* Per-frame state. A free or allocated block is described by its first
+ * frame alone, which makes the buddy check when freeing a single load. */
+#define FRAME_RESERVED   0xFF    /* not managed */
+#define FRAME_AVAILABLE  0xFE    /* usable, not yet on a free list (init) */
+#define FRAME_TAIL       0xFD    /* inside a block, not its first frame */
+#define FRAME_FREE       0x40    /* | order: first frame of a free block */
+#define FRAME_ALLOCATED  0x80    /* | order: first frame of an allocated block */
+
+#define LOW_MEMORY_END   0x100000
+
+/* Defined in link.ld */
+extern u8int kernel_physical_start[];
+extern u8int kernel_physical_end[];
+
+/** Free list link, kept in the first frame of each free block. Physical
+ * memory is identity mapped, so frame addresses are usable pointers. */
+struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+};
+
+static struct free_block *free_lists[PMM_ORDERS];
+static u8int *frame_state = 0;
+static u32int frame_count = 0;
+static struct pmm_stats stats;
+
+/* Guards the free lists, frame states and stats. Threads exiting on any
+ * CPU free their stacks. */
+static SPINLOCK_DEFINE(pmm_lock, "pmm");
+
+#define FRAME_ADDR(frame) ((frame) << PMM_FRAME_SHIFT)
+
+static void pmm_list_push(u32int frame, u32int order)
+{
+    struct free_block *block = (struct free_block *) FRAME_ADDR(frame);
+
+    block->prev = 0;
+    block->next = free_lists[order];
+    if (block->next != 0) {
+        block->next->prev = block;
+    }
+    free_lists[order] = block;
+    frame_state[frame] = FRAME_FREE | order;
+    stats.free_blocks[order]++;
+}
+
+static void pmm_list_remove(u32int frame, u32int order)
+{
+    struct free_block *block = (struct free_block *) FRAME_ADDR(frame);
+
+    if (block->prev != 0) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next != 0) {
+        block->next->prev = block->prev;
+    }
+    stats.free_blocks[order]--;
+}
+
+/** pmm_mark:
+ * Sets the state of every frame overlapping [start, end)
+ */
+static void pmm_mark(u64int start, u64int end, u8int state)
+{
+    u64int frame = start >> PMM_FRAME_SHIFT;
+    u64int last = (end + PMM_FRAME_SIZE - 1) >> PMM_FRAME_SHIFT;
+
+    if (last > frame_count) {
+        last = frame_count;
+    }
+    for (; frame < last; frame++) {
+        frame_state[frame] = state;
+    }
+}
+
+/** pmm_add_available:
+ * Marks the whole frames inside [start, end) as usable, skipping low memory
+ */
+static void pmm_add_available(u64int start, u64int end)
+{
+    if (start < LOW_MEMORY_END) {
+        start = LOW_MEMORY_END;
+    }
+    // Only whole frames
+    start = (start + PMM_FRAME_SIZE - 1) & ~(u64int) (PMM_FRAME_SIZE - 1);
+    end &= ~(u64int) (PMM_FRAME_SIZE - 1);
+    if (start < end) {
+        pmm_mark(start, end, FRAME_AVAILABLE);
+    }
+}
+
+/** pmm_for_each_region:
+ * Calls fn for every available region in the boot information. Without a
+ * memory map, mem_upper gives a single region from 1 MB.
+ */
+static void pmm_for_each_region(struct multiboot_info *mbi, void (*fn)(u64int start, u64int end))
+{
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        u32int addr = mbi->mmap_addr;
+        u32int end = mbi->mmap_addr + mbi->mmap_length;
+
+        while (addr < end) {
+            struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *) addr;
+
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->len != 0) {
+                fn(entry->addr, entry->addr + entry->len);
+            }
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        fn(LOW_MEMORY_END, LOW_MEMORY_END + (u64int) mbi->mem_upper * 1024);
+    }
+}
+
+/* Highest usable address below 4 GB, found by the first pass */
+static u64int memory_top = 0;
+
+static void pmm_find_top(u64int start, u64int end)
+{
+    (void) start;
+    if (end > 0x100000000ULL) {
+        end = 0x100000000ULL;
+    }
+    if (end > memory_top) {
+        memory_top = end;
+    }
+}
+
+/* Where the frame table goes: the first fit above the kernel and boot data */
+static u64int table_floor = 0;
+static u64int table_size = 0;
+static u64int table_addr = 0;
+
+static void pmm_place_table(u64int start, u64int end)
+{
+    if (table_addr != 0) {
+        return;
+    }
+    if (start < table_floor) {
+        start = table_floor;
+    }
+    // Not inside the user area either
+    if (start < USER_BASE + USER_SIZE && start + table_size > USER_BASE) {
+        start = USER_BASE + USER_SIZE;
+    }
+    if (start + table_size <= end) {
+        table_addr = start;
+    }
+}
+
+/** pmm_raise_floor:
+ * Keeps the frame table clear of a block of boot data
+ */
+static void pmm_raise_floor(u32int start, u32int length)
+{
+    u64int end = ((u64int) start + length + PMM_FRAME_SIZE - 1) & ~(u64int) (PMM_FRAME_SIZE - 1);
+
+    if (end > table_floor) {
+        table_floor = end;
+    }
+}
+
+/** pmm_cmdline_length:
+ * Returns the size of the command line including its terminator
+ */
+static u32int pmm_cmdline_length(const char *cmdline)
+{
+    u32int length = 0;
+
+    while (cmdline[length] != '\0') {
+        length++;
+    }
+    return length + 1;
+}
+
+/** pmm_build_free_lists:
+ * Turns each run of available frames into the largest aligned blocks
+ * that fit
+ */
+static void pmm_build_free_lists(void)
+{
+    u32int frame = 0;
+
+    while (frame < frame_count) {
+        u32int end;
+
+        if (frame_state[frame] != FRAME_AVAILABLE) {
+            frame++;
+            continue;
+        }
+        for (end = frame; end < frame_count && frame_state[end] == FRAME_AVAILABLE; end++) {
+            frame_state[end] = FRAME_TAIL;
+        }
+        while (frame < end) {
+            u32int order = PMM_MAX_ORDER;
+
+            while ((frame & ((1u << order) - 1)) != 0 || frame + (1u << order) > end) {
+                order--;
+            }
+            pmm_list_push(frame, order);
+            stats.total_frames += 1u << order;
+            stats.free_frames += 1u << order;
+            frame += 1u << order;
+        }
+    }
+}
+
+/** pmm_init:
+ * Builds the free lists from the multiboot memory map
+ */
+u8int pmm_init(struct multiboot_info *mbi)
+{
+    u32int i;
+
+    if (mbi == 0 || !(mbi->flags & (MULTIBOOT_INFO_MMAP | MULTIBOOT_INFO_MEMORY))) {
+        return 0;
+    }
+
+    pmm_for_each_region(mbi, pmm_find_top);
+    frame_count = (u32int) (memory_top >> PMM_FRAME_SHIFT);
+    if (frame_count == 0) {
+        return 0;
+    }
+
+    // The frame table goes above the kernel and anything GRUB left there
+    table_size = frame_count;
+    pmm_raise_floor((u32int) kernel_physical_start,
+                    (u32int) (kernel_physical_end - kernel_physical_start));
+    pmm_raise_floor((u32int) mbi, sizeof(*mbi));
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        pmm_raise_floor(mbi->mmap_addr, mbi->mmap_length);
+    }
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+        pmm_raise_floor(mbi->cmdline, pmm_cmdline_length((const char *) mbi->cmdline));
+    }
+    pmm_for_each_region(mbi, pmm_place_table);
+    if (table_addr == 0) {
+        frame_count = 0;
+        return 0;
+    }
+    frame_state = (u8int *) (u32int) table_addr;
+
+    for (i = 0; i < frame_count; i++) {
+        frame_state[i] = FRAME_RESERVED;
+    }
+    pmm_for_each_region(mbi, pmm_add_available);
+
+    // Take back what is in use
+    pmm_mark((u32int) kernel_physical_start, (u32int) kernel_physical_end, FRAME_RESERVED);
+    pmm_mark(USER_BASE, USER_BASE + USER_SIZE, FRAME_RESERVED);
+    pmm_mark(table_addr, table_addr + table_size, FRAME_RESERVED);
+    pmm_mark((u32int) mbi, (u32int) mbi + sizeof(*mbi), FRAME_RESERVED);
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        pmm_mark(mbi->mmap_addr, (u64int) mbi->mmap_addr + mbi->mmap_length, FRAME_RESERVED);
+    }
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+        pmm_mark(mbi->cmdline, (u64int) mbi->cmdline + pmm_cmdline_length((const char *) mbi->cmdline),
+                 FRAME_RESERVED);
+    }
+
+    pmm_build_free_lists();
+    return 1;
+}
+
+/** pmm_alloc_pages:
+ * Takes the smallest free block that fits and splits it down to size
+ */
+u32int pmm_alloc_pages(u32int order)
+{
+    u32int k = order;
+    u32int frame;
+    u32int flags;
+
+    if (order > PMM_MAX_ORDER) {
+        stats.failed_allocs++;
+        return 0;
+    }
+    flags = spin_lock_irqsave(&pmm_lock);
+    while (k <= PMM_MAX_ORDER && free_lists[k] == 0) {
+        k++;
+    }
+    if (k > PMM_MAX_ORDER) {
+        stats.failed_allocs++;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+
+    frame = (u32int) free_lists[k] >> PMM_FRAME_SHIFT;
+    pmm_list_remove(frame, k);
+
+    // Hand the upper halves back until the block is the right size
+    while (k > order) {
+        k--;
+        pmm_list_push(frame + (1u << k), k);
+    }
+    frame_state[frame] = FRAME_ALLOCATED | order;
+    stats.free_frames -= 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return FRAME_ADDR(frame);
+}
+
+/** pmm_free_pages:
+ * Returns a block and merges it with its buddy for as long as the buddy is
+ * a free block of the same order
+ */
+void pmm_free_pages(u32int addr, u32int order)
+{
+    u32int frame = addr >> PMM_FRAME_SHIFT;
+    u32int flags = spin_lock_irqsave(&pmm_lock);
+
+    if ((addr & (PMM_FRAME_SIZE - 1)) != 0 || frame >= frame_count ||
+        order > PMM_MAX_ORDER || frame_state[frame] != (FRAME_ALLOCATED | order)) {
+        stats.bad_frees++;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return;
+    }
+    stats.free_frames += 1u << order;
+    frame_state[frame] = FRAME_TAIL;
+
+    while (order < PMM_MAX_ORDER) {
+        u32int buddy = frame ^ (1u << order);
+
+        if (buddy >= frame_count || frame_state[buddy] != (FRAME_FREE | order)) {
+            break;
+        }
+        pmm_list_remove(buddy, order);
+        frame_state[buddy] = FRAME_TAIL;
+        frame &= ~(1u << order);
+        order++;
+    }
+    pmm_list_push(frame, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+u32int pmm_alloc_frame(void)
+{
+    return pmm_alloc_pages(0);
+}
+
+void pmm_free_frame(u32int addr)
+{
+    pmm_free_pages(addr, 0);
+}
+
+u32int pmm_frame_limit(void)
+{
+    return frame_count;
+}
+
+const struct pmm_stats *pmm_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,79 @@
+#ifndef INCLUDE_PMM_H
+#define INCLUDE_PMM_H
+
+#include "types.h"
+#include "multiboot.h"
+
+/* Physical page frame size */
+#define PMM_FRAME_SIZE  4096
+#define PMM_FRAME_SHIFT 12
+
+/* Largest block is 2^PMM_MAX_ORDER frames (4 MB) */
+#define PMM_MAX_ORDER   10
+#define PMM_ORDERS      (PMM_MAX_ORDER + 1)
+
+/** Allocator counters, in frames unless noted */
+struct pmm_stats {
+    u32int total_frames;            /* frames the allocator manages */
+    u32int free_frames;
+    u32int free_blocks[PMM_ORDERS]; /* free blocks of each order */
+    u32int failed_allocs;           /* requests no block could satisfy */
+    u32int bad_frees;               /* frees of blocks that were not allocated */
+};
+
+/** pmm_init:
+ * Builds the free lists from the multiboot memory map, or from
+ * mem_upper if there is no map. Memory below 1 MB, the kernel image, the
+ * boot information and the allocator's own frame table stay reserved.
+ *
+ * @param mbi The multiboot information, 0 if the loader gave none
+ * @return 1 if memory was found, 0 otherwise
+ */
+u8int pmm_init(struct multiboot_info *mbi);
+
+/** pmm_alloc_pages:
+ * Allocates 2^order physically contiguous frames, aligned to their size
+ *
+ * @param order Block size as a power of two number of frames
+ * @return Physical address of the first frame, 0 if out of memory
+ */
+u32int pmm_alloc_pages(u32int order);
+
+/** pmm_free_pages:
+ * Returns a block from pmm_alloc_pages, merging it with free buddies
+ *
+ * @param addr  The address pmm_alloc_pages returned
+ * @param order The order it was allocated with
+ */
+void pmm_free_pages(u32int addr, u32int order);
+
+/** pmm_alloc_frame:
+ * Allocates one 4 KB frame
+ *
+ * @return Physical address of the frame, 0 if out of memory
+ */
+u32int pmm_alloc_frame(void);
+
+/** pmm_free_frame:
+ * Frees a frame from pmm_alloc_frame
+ *
+ * @param addr The frame address
+ */
+void pmm_free_frame(u32int addr);
+
+/** pmm_frame_limit:
+ * Returns the number of frames from address 0 to the end of the highest
+ * usable memory, which is how much an identity map has to cover
+ *
+ * @return Frame count, 0 before pmm_init
+ */
+u32int pmm_frame_limit(void);
+
+/** pmm_get_stats:
+ * Returns the allocator counters
+ *
+ * @return Pointer to the counters
+ */
+const struct pmm_stats *pmm_get_stats(void);
+
+#endif /* INCLUDE_PMM_H */
@@ -0,0 +1,244 @@
+#include "serial.h"
+#include "interrupts.h"
+#include "io.h"
+#include "irq.h"
+#include "types.h"
+
+/* UART registers, relative to the base port */
+#define SERIAL_DATA(base)           (base)
+#define SERIAL_INTERRUPT(base)      (base + 1)
+#define SERIAL_DIVISOR_LOW(base)    (base)
+#define SERIAL_DIVISOR_HIGH(base)   (base + 1)
+#define SERIAL_FIFO_COMMAND(base)   (base + 2)
+#define SERIAL_INTERRUPT_ID(base)   (base + 2)
+#define SERIAL_LINE_COMMAND(base)   (base + 3)
+#define SERIAL_MODEM_COMMAND(base)  (base + 4)
+#define SERIAL_LINE_STATUS(base)    (base + 5)
+#define SERIAL_MODEM_STATUS(base)   (base + 6)
+
+#define SERIAL_PORT                 SERIAL_COM1_BASE
+
+/* Line command: set DLAB to program the divisor, 8 data bits, no parity,
+ * one stop bit otherwise */
+#define SERIAL_LINE_ENABLE_DLAB     0x80
+#define SERIAL_LINE_8N1             0x03
+
+/* 115200 / divisor baud */
+#define SERIAL_BAUD_DIVISOR         1
+
+/* FIFO command: enable, clear both FIFOs, interrupt at 14 received bytes */
+#define SERIAL_FIFO_ENABLE          0xC7
+
+/* Modem command: DTR, RTS and OUT2 (routes the UART interrupt to the PIC) */
+#define SERIAL_MODEM_READY          0x0B
+#define SERIAL_MODEM_LOOPBACK       0x1E
+
+/* Interrupt enable bits */
+#define SERIAL_INT_RX               0x01
+#define SERIAL_INT_TX               0x02
+
+/* Line status bits */
+#define SERIAL_LSR_DATA_READY       0x01
+#define SERIAL_LSR_THR_EMPTY        0x20
+
+/* Interrupt identification */
+#define SERIAL_IIR_NONE             0x01
+#define SERIAL_IIR_MASK             0x0E
+#define SERIAL_IIR_MODEM            0x00
+#define SERIAL_IIR_TX               0x02
+#define SERIAL_IIR_RX               0x04
+#define SERIAL_IIR_LINE             0x06
+#define SERIAL_IIR_RX_TIMEOUT       0x0C
+
+/* Depth of the 16550 transmit FIFO */
+#define SERIAL_FIFO_DEPTH           16
+
+#define SERIAL_TX_MASK              (SERIAL_TX_BUFFER_SIZE - 1)
+
+static u8int present = 0;
+static u8int interrupt_enable = 0;
+
+/* Transmit ring; written from both normal code and interrupt handlers,
+ * so producers run with interrupts disabled */
+static u8int tx_buffer[SERIAL_TX_BUFFER_SIZE];
+static volatile u32int tx_head = 0;
+static volatile u32int tx_tail = 0;
+static volatile u8int tx_active = 0;
+static u32int dropped = 0;
+
+static void serial_handle_interrupt(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack);
+
+/** serial_fill_fifo:
+ * Moves up to one FIFO's worth of bytes from the ring to the UART. Only
+ * called when the transmit holding register is empty.
+ */
+static void serial_fill_fifo(void)
+{
+    u32int n = 0;
+
+    while (n < SERIAL_FIFO_DEPTH && tx_tail != tx_head) {
+        outb(SERIAL_DATA(SERIAL_PORT), tx_buffer[tx_tail & SERIAL_TX_MASK]);
+        tx_tail++;
+        n++;
+    }
+}
+
+/** serial_set_interrupts:
+ * Updates the UART interrupt enable register
+ */
+static void serial_set_interrupts(u8int enable)
+{
+    interrupt_enable = enable;
+    outb(SERIAL_INTERRUPT(SERIAL_PORT), enable);
+}
+
+/** serial_init:
+ * Sets up COM1 at 115200 8N1 with FIFOs and interrupts
+ */
+u8int serial_init(void)
+{
+    outb(SERIAL_INTERRUPT(SERIAL_PORT), 0x00);
+    outb(SERIAL_LINE_COMMAND(SERIAL_PORT), SERIAL_LINE_ENABLE_DLAB);
+    outb(SERIAL_DIVISOR_LOW(SERIAL_PORT), SERIAL_BAUD_DIVISOR & 0xFF);
+    outb(SERIAL_DIVISOR_HIGH(SERIAL_PORT), (SERIAL_BAUD_DIVISOR >> 8) & 0xFF);
+    outb(SERIAL_LINE_COMMAND(SERIAL_PORT), SERIAL_LINE_8N1);
+    outb(SERIAL_FIFO_COMMAND(SERIAL_PORT), SERIAL_FIFO_ENABLE);
+
+    // Check that a UART is there by looping a byte back through it
+    outb(SERIAL_MODEM_COMMAND(SERIAL_PORT), SERIAL_MODEM_LOOPBACK);
+    outb(SERIAL_DATA(SERIAL_PORT), 0xAE);
+    if (inb(SERIAL_DATA(SERIAL_PORT)) != 0xAE) {
+        return 0;
+    }
+
+    outb(SERIAL_MODEM_COMMAND(SERIAL_PORT), SERIAL_MODEM_READY);
+    serial_set_interrupts(SERIAL_INT_RX);
+    present = 1;
+
+    register_interrupt_handler(INTERRUPTS_COM1, serial_handle_interrupt);
+    irq_unmask(SERIAL_COM1_IRQ);
+    return 1;
+}
+
+/** serial_putc:
+ * Queues a byte for transmission
+ */
+void serial_putc(char c)
+{
+    u32int flags;
+
+    if (!present) {
+        return;
+    }
+
+    flags = irq_save();
+    while (tx_head - tx_tail >= SERIAL_TX_BUFFER_SIZE) {
+        if (!(flags & IRQ_EFLAGS_IF)) {
+            // Nothing can drain the ring until interrupts are back on
+            dropped++;
+            irq_restore(flags);
+            return;
+        }
+        irq_wait();
+    }
+
+    tx_buffer[tx_head & SERIAL_TX_MASK] = (u8int) c;
+    tx_head++;
+
+    if (!tx_active) {
+        tx_active = 1;
+        if (inb(SERIAL_LINE_STATUS(SERIAL_PORT)) & SERIAL_LSR_THR_EMPTY) {
+            serial_fill_fifo();
+        }
+        serial_set_interrupts(interrupt_enable | SERIAL_INT_TX);
+    }
+    irq_restore(flags);
+}
+
+/** serial_console_putc:
+ * Console sink with terminal translations
+ */
+void serial_console_putc(char c)
+{
+    switch (c) {
+        case '\n':
+            serial_putc('\r');
+            serial_putc('\n');
+            break;
+        case '\b':
+            serial_putc('\b');
+            serial_putc(' ');
+            serial_putc('\b');
+            break;
+        case '\f':
+            // ANSI: clear screen, cursor home
+            serial_putc(0x1B);
+            serial_putc('[');
+            serial_putc('2');
+            serial_putc('J');
+            serial_putc(0x1B);
+            serial_putc('[');
+            serial_putc('H');
+            break;
+        default:
+            serial_putc(c);
+            break;
+    }
+}
+
+/** serial_receive:
+ * Passes received bytes to the shared input path
+ */
+static void serial_receive(void)
+{
+    while (inb(SERIAL_LINE_STATUS(SERIAL_PORT)) & SERIAL_LSR_DATA_READY) {
+        u8int c = inb(SERIAL_DATA(SERIAL_PORT));
+
+        // Terminals send CR for Enter and DEL for Backspace
+        if (c == '\r') {
+            c = '\n';
+        } else if (c == 0x7F) {
+            c = '\b';
+        }
+        interrupts_queue_char(c);
+    }
+}
+
+/** serial_handle_interrupt:
+ * IRQ4 handler. Moves received bytes into the input path and refills the
+ * transmit FIFO.
+ */
+static void serial_handle_interrupt(__attribute__((unused)) struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, __attribute__((unused)) struct stack_state *stack)
+{
+    u8int id;
+
+    while (!((id = inb(SERIAL_INTERRUPT_ID(SERIAL_PORT))) & SERIAL_IIR_NONE)) {
+        switch (id & SERIAL_IIR_MASK) {
+            case SERIAL_IIR_RX:
+            case SERIAL_IIR_RX_TIMEOUT:
+                serial_receive();
+                break;
+            case SERIAL_IIR_TX:
+                serial_fill_fifo();
+                if (tx_tail == tx_head) {
+                    tx_active = 0;
+                    serial_set_interrupts(interrupt_enable & ~SERIAL_INT_TX);
+                }
+                break;
+            case SERIAL_IIR_LINE:
+                inb(SERIAL_LINE_STATUS(SERIAL_PORT));
+                break;
+            case SERIAL_IIR_MODEM:
+                inb(SERIAL_MODEM_STATUS(SERIAL_PORT));
+                break;
+        }
+    }
+}
+
+/** serial_dropped:
+ * Returns the number of bytes dropped with the ring full
+ */
+u32int serial_dropped(void)
+{
+    return dropped;
+}
@@ -0,0 +1,45 @@
+#ifndef INCLUDE_SERIAL_H
+#define INCLUDE_SERIAL_H
+
+#include "types.h"
+
+/* COM1 and its IRQ */
+#define SERIAL_COM1_BASE 0x3F8
+#define SERIAL_COM1_IRQ  4
+
+/* Transmit ring size, must be a power of two */
+#define SERIAL_TX_BUFFER_SIZE 1024
+
+/** serial_init:
+ * Sets up COM1 at 115200 8N1 with the 16550 FIFOs enabled and unmasks its
+ * IRQ. Does nothing if no UART answers.
+ *
+ * @return 1 if the UART is present, 0 otherwise
+ */
+u8int serial_init(void);
+
+/** serial_putc:
+ * Queues a byte for transmission. The transmit interrupt drains the queue
+ * into the FIFO, so this does not wait for the line.
+ *
+ * @param c The byte to send
+ */
+void serial_putc(char c);
+
+/** serial_console_putc:
+ * Console sink: like serial_putc, but turns '\n' into CRLF, '\b' into an
+ * erasing backspace and '\f' into an ANSI clear screen.
+ *
+ * @param c The character written to the console
+ */
+void serial_console_putc(char c);
+
+/** serial_dropped:
+ * Returns the number of bytes dropped because the transmit ring was full
+ * with interrupts disabled
+ *
+ * @return The number of dropped bytes
+ */
+u32int serial_dropped(void);
+
+#endif /* INCLUDE_SERIAL_H */
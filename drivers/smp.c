@@ -0,0 +1,192 @@
+#include "smp.h"
+#include "acpi.h"
+#include "atomic.h"
+#include "clock.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "klib.h"
+#include "lapic.h"
+#include "math64.h"
+#include "pmm.h"
+#include "thread.h"
+#include "types.h"
+
+/* The universal start-up algorithm's waits */
+#define SMP_INIT_DELAY_US       10000
+#define SMP_SIPI_DELAY_US       200
+#define SMP_ONLINE_TIMEOUT_US   100000
+
+static struct cpu cpus[SMP_MAX_CPUS];
+static volatile u32int cpus_online = 1;
+
+/* The AP currently being started; it learns its index from here */
+static struct cpu *volatile starting = 0;
+
+static void smp_delay_us(u32int us)
+{
+    u64int start = clock_cycles();
+    u64int wait = div64_u32((u64int) us * clock_tsc_khz(), 1000, 0);
+
+    while (clock_cycles() - start < wait) {
+        cpu_relax();
+    }
+}
+
+/** smp_handle_tick:
+ * Periodic local APIC timer of an AP: ends time slices
+ */
+static void smp_handle_tick(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack)
+{
+    (void) cpu;
+    (void) interrupt;
+    (void) stack;
+    lapic_eoi();
+    thread_tick();
+}
+
+/** smp_handle_reschedule:
+ * Another CPU queued work for us or wants us to steal; thread_preempt on
+ * the way out does the switch
+ */
+static void smp_handle_reschedule(struct cpu_state *cpu, u32int interrupt, struct stack_state *stack)
+{
+    struct cpu *this = cpu_this();
+
+    (void) cpu;
+    (void) interrupt;
+    (void) stack;
+    lapic_eoi();
+    this->kicks++;
+    this->need_resched = 1;
+}
+
+/** smp_ap_main:
+ * Where the trampoline jumps, on the AP's boot stack with paging on and
+ * interrupts off. The AP loads its own descriptor tables, becomes an idle
+ * thread and starts looking for work.
+ */
+static void smp_ap_main(void)
+{
+    struct cpu *cpu = starting;
+
+    gdt_load();
+    gdt_load_cpu(cpu->index);
+    interrupts_load_idt();
+    lapic_init_ap();
+    thread_init_ap();
+    lapic_timer_periodic(SMP_TICK_VECTOR, SMP_AP_TICK_HZ);
+
+    __asm__ volatile("" : : : "memory");
+    cpu->online = 1;
+    thread_idle();
+}
+
+void smp_init_bsp(void)
+{
+    cpus[0].self = &cpus[0];
+    cpus[0].index = 0;
+    cpus[0].online = 1;
+    gdt_load_cpu(0);
+}
+
+/** smp_start_ap:
+ * Runs INIT-SIPI-SIPI for one AP and waits for it to come online
+ *
+ * @return 1 if it did
+ */
+static u8int smp_start_ap(struct cpu *cpu)
+{
+    u32int base = SMP_TRAMPOLINE - (u32int) smp_trampoline_start;
+    u32int value;
+    u64int start;
+    u64int timeout;
+    u32int i;
+
+    cpu->stack = pmm_alloc_pages(THREAD_STACK_ORDER);
+    if (cpu->stack == 0) {
+        return 0;
+    }
+
+    // Parameters live in the copy, at the same offsets as in the kernel
+    __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+    *(u32int *) (base + (u32int) smp_trampoline_cr0) = value;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(value));
+    *(u32int *) (base + (u32int) smp_trampoline_cr3) = value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    *(u32int *) (base + (u32int) smp_trampoline_cr4) = value;
+    *(u32int *) (base + (u32int) smp_trampoline_stack) = cpu->stack + THREAD_STACK_SIZE;
+    *(u32int *) (base + (u32int) smp_trampoline_entry) = (u32int) smp_ap_main;
+    starting = cpu;
+    smp_mb();
+
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    smp_delay_us(SMP_INIT_DELAY_US);
+    for (i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE >> 12));
+        smp_delay_us(SMP_SIPI_DELAY_US);
+    }
+
+    timeout = div64_u32((u64int) SMP_ONLINE_TIMEOUT_US * clock_tsc_khz(), 1000, 0);
+    start = clock_cycles();
+    while (!cpu->online && clock_cycles() - start < timeout) {
+        cpu_relax();
+    }
+    if (!cpu->online) {
+        // It may still wake up later and run on this stack; leak it
+        return 0;
+    }
+    return 1;
+}
+
+u32int smp_init(void)
+{
+    const struct acpi_madt_info *madt = acpi_get_madt();
+    u32int length = (u32int) (smp_trampoline_end - smp_trampoline_start);
+    u8int *trampoline = (u8int *) SMP_TRAMPOLINE;
+    u8int self;
+    u32int i;
+
+    if (!lapic_present() || madt == 0) {
+        return cpus_online;
+    }
+    self = lapic_id();
+    cpus[0].apic_id = self;
+
+    memcpy(trampoline, smp_trampoline_start, length);
+    register_interrupt_handler(SMP_TICK_VECTOR, smp_handle_tick);
+    register_interrupt_handler(SMP_RESCHEDULE_VECTOR, smp_handle_reschedule);
+
+    for (i = 0; i < madt->cpu_count && cpus_online < SMP_MAX_CPUS; i++) {
+        struct cpu *cpu = &cpus[cpus_online];
+
+        if (madt->cpu_apic_ids[i] == self) {
+            continue;
+        }
+        cpu->self = cpu;
+        cpu->index = cpus_online;
+        cpu->apic_id = madt->cpu_apic_ids[i];
+        if (!smp_start_ap(cpu)) {
+            // A late riser would take whatever starting points at, so
+            // stop here rather than reuse the slot
+            break;
+        }
+        // Only now can other CPUs steal from or kick it
+        cpus_online++;
+    }
+    return cpus_online;
+}
+
+u32int smp_cpu_count(void)
+{
+    return cpus_online;
+}
+
+struct cpu *smp_get_cpu(u32int index)
+{
+    return &cpus[index];
+}
+
+void smp_kick(struct cpu *cpu)
+{
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_FIXED | SMP_RESCHEDULE_VECTOR);
+}
@@ -0,0 +1,135 @@
+#ifndef INCLUDE_SMP_H
+#define INCLUDE_SMP_H
+
+#include "interrupts.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "types.h"
+
+#define SMP_MAX_CPUS            8
+
+/* Physical page the application processors start in, in real mode. It is
+ * below 1 MB, which the frame allocator never hands out. */
+#define SMP_TRAMPOLINE          0x8000
+
+/* The APs get no PIT interrupts; their local APIC timer runs periodically
+ * at this rate to end time slices */
+#define SMP_AP_TICK_HZ          100
+
+/* Vectors, next to LAPIC_TIMER_VECTOR */
+#define SMP_TICK_VECTOR         0x41
+#define SMP_RESCHEDULE_VECTOR   0x42
+
+/** Per-CPU area. Each CPU's gs selects a segment whose base is its own
+ * struct cpu, so the running CPU's fields are one gs-relative load away
+ * and nothing has to ask the local APIC who we are. */
+struct cpu {
+    struct cpu *self;               /* gs:0, for taking the address */
+    u32int index;
+    u8int apic_id;
+    volatile u8int online;
+    volatile u8int need_resched;
+    volatile u32int halted;         /* in the idle loop's hlt, a word for xchg */
+
+    struct thread *current;
+    struct thread *idle;
+    struct thread *prev;            /* switched away from, on_cpu still set */
+    struct thread *zombie;          /* exited, stack freed after the switch */
+
+    /* Ready threads in FIFO order. current and idle are not on it. */
+    struct spinlock run_lock;
+    char run_lock_name[12];         /* "run_queue" and the index */
+    struct thread *run_head;
+    struct thread *run_tail;
+    volatile u32int run_count;
+    volatile u32int run_unpinned;   /* of run_count, threads others may steal */
+
+    u32int tick_hz;
+    u32int slice_left;
+    u64int switch_tsc;
+
+    u32int steals;                  /* threads taken from other CPUs */
+    u32int kicks;                   /* reschedule IPIs received */
+    u8int tick_stopped;             /* AP timer off while idle */
+    u64int tick_stop_tsc;
+    u32int tick_stops;              /* idle halts with the AP timer off */
+    u32int ticks_avoided;           /* AP ticks that did not wake the CPU */
+    u64int idle_cycles;
+    u32int stack;                   /* boot stack of an AP */
+
+    /* Hits per vector on this CPU, only written by it */
+    u32int interrupts[INTERRUPTS_DESCRIPTOR_COUNT];
+};
+
+/** cpu_read:
+ * Reads a 32-bit field of the running CPU's struct cpu with a single
+ * gs-relative load, so the value cannot belong to a CPU the thread was
+ * moved away from halfway through
+ */
+#define cpu_read(field) ({ \
+    __typeof__(((struct cpu *) 0)->field) cpu_value__; \
+    __asm__ volatile("movl %%gs:%c1, %0" \
+                     : "=r"(cpu_value__) \
+                     : "i"(__builtin_offsetof(struct cpu, field))); \
+    cpu_value__; })
+
+/** cpu_this:
+ * Returns the running CPU. Only stable while interrupts are disabled or
+ * the thread is pinned.
+ */
+ALWAYS_INLINE struct cpu *cpu_this(void)
+{
+    return cpu_read(self);
+}
+
+/** smp_init_bsp:
+ * Sets up the boot CPU's area and loads its TSS and gs. Call right after
+ * gdt_init, before anything uses the per-CPU area.
+ */
+void smp_init_bsp(void);
+
+/** smp_init:
+ * Starts every application processor listed in the MADT with
+ * INIT-SIPI-SIPI and waits for each to come online. Call after the local
+ * APIC, the I/O routing, the clock and thread_init, before interrupts are
+ * enabled.
+ *
+ * @return The number of CPUs online, the boot CPU included
+ */
+u32int smp_init(void);
+
+/** smp_cpu_count:
+ * Returns the number of CPUs online
+ */
+u32int smp_cpu_count(void);
+
+/** smp_get_cpu:
+ * Returns a CPU's area
+ *
+ * @param index 0 to SMP_MAX_CPUS - 1, 0 being the boot CPU
+ */
+struct cpu *smp_get_cpu(u32int index);
+
+/** smp_kick:
+ * Sends a reschedule IPI so a CPU sitting in hlt looks at its run queue
+ * and steals work
+ *
+ * @param cpu The CPU to wake
+ */
+void smp_kick(struct cpu *cpu);
+
+/** smp_trampoline_start, smp_trampoline_end:
+ * Bounds of the AP start-up code, copied to SMP_TRAMPOLINE. Defined in
+ * smp_trampoline.s.
+ */
+extern u8int smp_trampoline_start[];
+extern u8int smp_trampoline_end[];
+
+/* Parameters inside the trampoline, filled in before each start-up */
+extern u32int smp_trampoline_cr0[];
+extern u32int smp_trampoline_cr3[];
+extern u32int smp_trampoline_cr4[];
+extern u32int smp_trampoline_stack[];
+extern u32int smp_trampoline_entry[];
+
+#endif /* INCLUDE_SMP_H */
@@ -0,0 +1,78 @@
+; Application processor start-up code. smp_init copies everything from
+; smp_trampoline_start to smp_trampoline_end to SMP_TRAMPOLINE and sends a
+; SIPI pointing at it. The AP arrives in real mode with cs = 0x0800 and
+; ip = 0, so every address here is computed relative to that copy.
+
+TRAMPOLINE  equ 0x8000      ; SMP_TRAMPOLINE
+CODE_SEL    equ 0x08        ; GDT_KERNEL_CODE
+DATA_SEL    equ 0x10        ; GDT_KERNEL_DATA
+
+; Address of a label in the copy at TRAMPOLINE
+%define ADDR(label) (TRAMPOLINE + (label - smp_trampoline_start))
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_cr0
+global smp_trampoline_cr3
+global smp_trampoline_cr4
+global smp_trampoline_stack
+global smp_trampoline_entry
+
+section .text
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [ADDR(trampoline_gdtr)]
+    mov eax, cr0
+    or eax, 1                       ; protection on, paging still off
+    mov cr0, eax
+    jmp dword CODE_SEL:ADDR(trampoline_protected)
+
+bits 32
+trampoline_protected:
+    mov ax, DATA_SEL
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    ; Same page directory and control bits as the boot CPU
+    mov eax, [ADDR(smp_trampoline_cr4)]
+    mov cr4, eax
+    mov eax, [ADDR(smp_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, [ADDR(smp_trampoline_cr0)]
+    mov cr0, eax
+    mov esp, [ADDR(smp_trampoline_stack)]
+    xor ebp, ebp
+    mov eax, [ADDR(smp_trampoline_entry)]
+    jmp eax                         ; never returns
+
+; Flat code and data segments at the selectors the kernel uses, enough to
+; reach the kernel's own GDT
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+trampoline_gdtr:
+    dw 23
+    dd ADDR(trampoline_gdt)
+
+; Filled in by smp_init in the copy before each SIPI
+align 4
+smp_trampoline_cr0:
+    dd 0
+smp_trampoline_cr3:
+    dd 0
+smp_trampoline_cr4:
+    dd 0
+smp_trampoline_stack:
+    dd 0                            ; top of the AP's boot stack
+smp_trampoline_entry:
+    dd 0                            ; C function to jump to
+smp_trampoline_end:
@@ -0,0 +1,80 @@
+#include "spinlock.h"
+#include "atomic.h"
+#include "clock.h"
+#include "types.h"
+
+/* Defined in link.ld around the locks section */
+extern struct spinlock *const __start_locks[];
+extern struct spinlock *const __stop_locks[];
+
+volatile u8int lockstat_enabled = 0;
+
+static struct spinlock *registered[SPINLOCK_REGISTER_MAX];
+static volatile u32int registered_count = 0;
+
+/** spin_lock_contended:
+ * Spins on plain reads of owner, which stay in this CPU's cache until the
+ * holder's release invalidates it
+ */
+void spin_lock_contended(struct spinlock *lock, u32int ticket)
+{
+    u64int start = lockstat_enabled ? clock_cycles() : 0;
+
+    while (lock->owner != ticket) {
+        cpu_relax();
+    }
+    if (start != 0 && lockstat_enabled) {
+        lock->stats.contended++;
+        lock->stats.wait_cycles += clock_cycles() - start;
+    }
+}
+
+u8int spinlock_register(struct spinlock *lock)
+{
+    u32int slot = atomic_fetch_add(&registered_count, 1);
+
+    if (slot >= SPINLOCK_REGISTER_MAX) {
+        registered_count = SPINLOCK_REGISTER_MAX;
+        return 0;
+    }
+    registered[slot] = lock;
+    return 1;
+}
+
+struct spinlock *spinlock_get(u32int index)
+{
+    u32int defined = (u32int) (__stop_locks - __start_locks);
+    u32int count = registered_count;
+
+    if (index < defined) {
+        return __start_locks[index];
+    }
+    index -= defined;
+    if (count > SPINLOCK_REGISTER_MAX) {
+        count = SPINLOCK_REGISTER_MAX;
+    }
+    return index < count ? registered[index] : 0;
+}
+
+/** lockstat_set:
+ * Clears the counters before turning collection on. A hold that started
+ * while it was off is not timed, as its acquired_at is 0.
+ */
+void lockstat_set(u8int enable)
+{
+    struct spinlock *lock;
+    u32int i;
+
+    lockstat_enabled = 0;
+    if (!enable) {
+        return;
+    }
+    for (i = 0; (lock = spinlock_get(i)) != 0; i++) {
+        lock->stats.acquisitions = 0;
+        lock->stats.contended = 0;
+        lock->stats.wait_cycles = 0;
+        lock->stats.hold_cycles = 0;
+        lock->stats.hold_max = 0;
+    }
+    lockstat_enabled = 1;
+}
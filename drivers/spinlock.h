@@ -0,0 +1,155 @@
+#ifndef INCLUDE_SPINLOCK_H
+#define INCLUDE_SPINLOCK_H
+
+#include "atomic.h"
+#include "clock.h"
+#include "irq.h"
+#include "types.h"
+
+/* Locks created at run time that lockstat can list */
+#define SPINLOCK_REGISTER_MAX 16
+
+/** Contention and hold times of one lock, in TSC cycles. Only updated by
+ * the holder, and only while lockstat is on. */
+struct lock_stats {
+    u32int acquisitions;
+    u32int contended;           /* had to wait for another holder */
+    u64int wait_cycles;
+    u64int hold_cycles;
+    u32int hold_max;
+    u64int acquired_at;         /* 0 if this hold is not being timed */
+};
+
+/** A ticket lock: each CPU takes a ticket and waits until owner reaches
+ * it, so waiters get the lock in arrival order. A lock an interrupt
+ * handler also takes must be held through spin_lock_irqsave. */
+struct spinlock {
+    volatile u32int next;       /* next ticket to hand out */
+    volatile u32int owner;      /* ticket being served */
+    const char *name;           /* shown by lockstat, 0 for anonymous */
+    struct lock_stats stats;
+};
+
+#define SPINLOCK_INIT(lock_name) {0, 0, lock_name, {0, 0, 0, 0, 0, 0}}
+
+/** SPINLOCK_DEFINE:
+ * Defines a named lock and lists it for lockstat at link time, the same
+ * way TERMINAL_COMMAND registers commands. Prefix with static as needed.
+ *
+ * @param var       The variable
+ * @param lock_name Name shown by lockstat
+ */
+#define SPINLOCK_DEFINE(var, lock_name)                                 \
+    struct spinlock var = SPINLOCK_INIT(lock_name);                     \
+    static struct spinlock *const spinlock_entry_##var                  \
+    __attribute__((used, section("locks"), aligned(4))) = &var
+
+/* Set by lockstat on */
+extern volatile u8int lockstat_enabled;
+
+/** spin_lock_contended:
+ * Slow path of spin_lock: waits for the ticket and counts the wait.
+ * Defined in spinlock.c.
+ */
+void spin_lock_contended(struct spinlock *lock, u32int ticket);
+
+/** spin_lock:
+ * Takes the lock. Does not touch the interrupt flag.
+ *
+ * @param lock The lock
+ */
+ALWAYS_INLINE void spin_lock(struct spinlock *lock)
+{
+    u32int ticket = atomic_fetch_add(&lock->next, 1);
+
+    if (lock->owner != ticket) {
+        spin_lock_contended(lock, ticket);
+    }
+    if (lockstat_enabled) {
+        lock->stats.acquisitions++;
+        lock->stats.acquired_at = clock_cycles();
+    }
+}
+
+/** spin_unlock:
+ * Releases the lock by serving the next ticket. Only the holder writes
+ * owner, and x86 does not reorder stores with earlier loads or stores,
+ * so a plain store after a compiler barrier is enough.
+ *
+ * @param lock The lock
+ */
+ALWAYS_INLINE void spin_unlock(struct spinlock *lock)
+{
+    if (lock->stats.acquired_at != 0) {
+        u64int held = clock_cycles() - lock->stats.acquired_at;
+
+        lock->stats.hold_cycles += held;
+        if (held > lock->stats.hold_max) {
+            lock->stats.hold_max = held > 0xFFFFFFFF ? 0xFFFFFFFF : (u32int) held;
+        }
+        lock->stats.acquired_at = 0;
+    }
+    __asm__ volatile("" : : : "memory");
+    lock->owner = lock->owner + 1;
+}
+
+/** spin_lock_irqsave:
+ * Disables interrupts on this CPU, then takes the lock, so an interrupt
+ * handler wanting the same lock cannot spin on its own CPU's holder
+ *
+ * @param lock The lock
+ * @return The flags to pass to spin_unlock_irqrestore
+ */
+ALWAYS_INLINE u32int spin_lock_irqsave(struct spinlock *lock)
+{
+    u32int flags = irq_save();
+
+    spin_lock(lock);
+    return flags;
+}
+
+/** spin_unlock_irqrestore:
+ * Releases the lock, then restores the interrupt flag
+ *
+ * @param lock  The lock
+ * @param flags What spin_lock_irqsave returned
+ */
+ALWAYS_INLINE void spin_unlock_irqrestore(struct spinlock *lock, u32int flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+/** spin_is_locked:
+ * Returns whether someone holds the lock
+ */
+ALWAYS_INLINE u8int spin_is_locked(struct spinlock *lock)
+{
+    return lock->owner != lock->next;
+}
+
+/** spinlock_register:
+ * Lists a lock created at run time for lockstat
+ *
+ * @param lock A named lock that lives forever
+ * @return 1 if registered, 0 if the table is full
+ */
+u8int spinlock_register(struct spinlock *lock);
+
+/** spinlock_get:
+ * Returns a lock listed for lockstat: first the ones from SPINLOCK_DEFINE,
+ * then the registered ones
+ *
+ * @param index 0 upwards
+ * @return The lock, or 0 past the end
+ */
+struct spinlock *spinlock_get(u32int index);
+
+/** lockstat_set:
+ * Turns the statistics on or off. Turning them on clears them.
+ *
+ * @param enable 1 to collect statistics
+ */
+void lockstat_set(u8int enable);
+
+#endif /* INCLUDE_SPINLOCK_H */
@@ -0,0 +1,100 @@
+#include "syscall.h"
+#include "frame_buffer.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "user.h"
+#include "types.h"
+
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+
+#define CPUID_EDX_SEP     0x00000800
+
+/* Defined in user_asm.s */
+extern void sysenter_entry(void);
+
+typedef u32int (*syscall_fn)(u32int arg1, u32int arg2, u32int arg3);
+
+static u8int sysenter_ready = 0;
+
+static u32int sys_exit(u32int status, __attribute__((unused)) u32int arg2, __attribute__((unused)) u32int arg3)
+{
+    user_exit((s32int) status);
+    return 0;
+}
+
+static u32int sys_write(u32int buf, u32int len, __attribute__((unused)) u32int arg3)
+{
+    if (!user_is_address(buf, len)) {
+        return (u32int) -1;
+    }
+    fb_write((char *) buf, len);
+    return len;
+}
+
+static u32int sys_null(__attribute__((unused)) u32int arg1, __attribute__((unused)) u32int arg2, __attribute__((unused)) u32int arg3)
+{
+    return 0;
+}
+
+static const syscall_fn syscall_table[SYSCALL_COUNT] = {
+    sys_exit,
+    sys_write,
+    sys_null,
+};
+
+u32int syscall_dispatch(u32int number, u32int arg1, u32int arg2, u32int arg3)
+{
+    if (number >= SYSCALL_COUNT) {
+        return (u32int) -1;
+    }
+    return syscall_table[number](arg1, arg2, arg3);
+}
+
+/** syscall_interrupt:
+ * int 0x80: the saved registers are the arguments, and the saved eax is
+ * what the stub restores on the way out
+ */
+static void syscall_interrupt(struct cpu_state *cpu, __attribute__((unused)) u32int interrupt, __attribute__((unused)) struct stack_state *stack)
+{
+    cpu->eax = syscall_dispatch(cpu->eax, cpu->ebx, cpu->esi, cpu->edi);
+}
+
+static void syscall_write_msr(u32int msr, u32int value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+static u8int syscall_cpu_has_sep(void)
+{
+    u32int eax = 1;
+    u32int ebx;
+    u32int ecx = 0;
+    u32int edx;
+
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    // The Pentium Pro reports SEP without supporting it
+    if ((eax & 0x0FFF3FFF) < 0x633) {
+        return 0;
+    }
+    return (edx & CPUID_EDX_SEP) != 0;
+}
+
+void syscall_init(void)
+{
+    interrupts_set_gate_dpl(SYSCALL_VECTOR, 3);
+    register_interrupt_handler(SYSCALL_VECTOR, syscall_interrupt);
+
+    if (syscall_cpu_has_sep()) {
+        syscall_write_msr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+        syscall_write_msr(MSR_SYSENTER_ESP, user_kernel_stack_top());
+        syscall_write_msr(MSR_SYSENTER_EIP, (u32int) sysenter_entry);
+        sysenter_ready = 1;
+    }
+}
+
+u8int syscall_has_sysenter(void)
+{
+    return sysenter_ready;
+}
@@ -0,0 +1,73 @@
+#ifndef INCLUDE_SYSCALL_H
+#define INCLUDE_SYSCALL_H
+
+#include "types.h"
+
+/* System call numbers, passed in eax. Arguments go in ebx, esi and edi
+ * and the result comes back in eax, for both entry paths. */
+#define SYSCALL_EXIT     0      /* (status) - does not return */
+#define SYSCALL_WRITE    1      /* (buf, len) - writes to the console */
+#define SYSCALL_NULL     2      /* () - returns 0, for timing */
+#define SYSCALL_COUNT    3
+
+#define SYSCALL_VECTOR   0x80
+
+/** syscall_init:
+ * Installs the int 0x80 gate (callable from ring 3) and, if the CPU has
+ * SEP, programs this CPU's SYSENTER MSRs. Called through user_prepare
+ * on the boot CPU, the only one programs run on, before the first one
+ * runs. The APs' MSRs are left clear.
+ */
+void syscall_init(void);
+
+/** syscall_has_sysenter:
+ * Returns whether the SYSENTER fast path is set up. Call user_prepare
+ * first.
+ *
+ * @return 1 if user code may use sysenter
+ */
+u8int syscall_has_sysenter(void);
+
+/** syscall_dispatch:
+ * Common kernel side of both entry paths
+ *
+ * @return The result for eax
+ */
+u32int syscall_dispatch(u32int number, u32int arg1, u32int arg2, u32int arg3);
+
+/* User side stubs, always inlined so they are compiled into the ring 3
+ * code that uses them rather than called in kernel text */
+
+/** syscall_int80:
+ * Makes a system call through the int 0x80 gate
+ */
+ALWAYS_INLINE u32int syscall_int80(u32int number, u32int arg1, u32int arg2, u32int arg3)
+{
+    u32int result;
+    __asm__ volatile("int $0x80"
+                     : "=a"(result)
+                     : "a"(number), "b"(arg1), "S"(arg2), "D"(arg3)
+                     : "memory");
+    return result;
+}
+
+/** syscall_sysenter:
+ * Makes a system call through SYSENTER. The kernel returns with SYSEXIT
+ * to the eip in edx and the esp in ecx, so both are clobbered.
+ */
+ALWAYS_INLINE u32int syscall_sysenter(u32int number, u32int arg1, u32int arg2, u32int arg3)
+{
+    u32int result;
+    __asm__ volatile("push %%ebp\n\t"
+                     "mov %%esp, %%ecx\n\t"
+                     "mov $1f, %%edx\n\t"
+                     "sysenter\n"
+                     "1:\n\t"
+                     "pop %%ebp"
+                     : "=a"(result)
+                     : "a"(number), "b"(arg1), "S"(arg2), "D"(arg3)
+                     : "ecx", "edx", "memory");
+    return result;
+}
+
+#endif /* INCLUDE_SYSCALL_H */
@@ -1,69 +1,233 @@
 #include "terminal.h"
 #include "frame_buffer.h"
 #include "input_buffer.h"
+#include "clock.h"
+#include "math64.h"
+#include "bench.h"
+#include "interrupts.h"
+#include "deferred.h"
+#include "keyboard.h"
+#include "pmm.h"
+#include "kheap.h"
+#include "user.h"
+#include "klib.h"
+#include "vbe_console.h"
+#include "thread.h"
+#include "lapic.h"
+#include "irq.h"
+#include "acpi.h"
+#include "ioapic.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "initcall.h"
 #include "types.h"
 
-#define MAX_COMMAND_LEN 64
-#define MAX_ARGS_LEN 192
 #define PROMPT "myos> "
 
-// Command function prototypes
-void cmd_echo(char* args);
-void cmd_clear(char* args);
-void cmd_help(char* args);
-void cmd_version(char* args);
-void cmd_shutdown(char* args);
-
-// Command table
-struct command commands[] = {
-    {"echo", cmd_echo},
-    {"clear", cmd_clear},
-    {"help", cmd_help},
-    {"version", cmd_version},
-    {"shutdown", cmd_shutdown},
-    {0, 0}  // End marker
+/* Hash table size, a power of two kept at least a quarter empty */
+#define TERMINAL_HASH_SIZE 64
+#define TERMINAL_HASH_MASK (TERMINAL_HASH_SIZE - 1)
+
+/* Trie nodes for completion, one per distinct command name prefix */
+#define TERMINAL_TRIE_NODES 256
+
+/* Help column for the descriptions */
+#define HELP_COLUMN 15
+
+/* Registered commands, placed by the linker */
+extern const struct command __start_commands[];
+extern const struct command __stop_commands[];
+
+struct command_slot {
+    u32int hash;
+    const struct command* command;
+};
+
+/* Open addressing with linear probing, filled once by terminal_init */
+static struct command_slot command_table[TERMINAL_HASH_SIZE];
+static u32int command_count = 0;
+
+/* First-child/next-sibling trie, siblings sorted. Node 0 is the root, so
+ * 0 also means "no child" or "no sibling". */
+struct trie_node {
+    char c;
+    u16int child;
+    u16int sibling;
+    const struct command* command;   /* set if a name ends here */
 };
 
+static struct trie_node trie[TERMINAL_TRIE_NODES];
+static u32int trie_used = 1;
+
+static u32int terminal_complete(char* line, u32int len, u32int max_len);
+
+/** terminal_hash:
+ * FNV-1a hash of a command name
+ */
+static u32int terminal_hash(const char* name)
+{
+    u32int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (u8int) *name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** terminal_trie_insert:
+ * Adds a command name to the completion trie
+ *
+ * @return 1 on success, 0 if the trie is full
+ */
+static u8int terminal_trie_insert(const struct command* command)
+{
+    const char* name = command->name;
+    u16int node = 0;
+
+    for (; *name != '\0'; name++) {
+        u16int* link = &trie[node].child;
+
+        // Siblings are sorted, so help and completion list in order
+        while (*link != 0 && trie[*link].c < *name) {
+            link = &trie[*link].sibling;
+        }
+        if (*link == 0 || trie[*link].c != *name) {
+            if (trie_used == TERMINAL_TRIE_NODES) {
+                return 0;
+            }
+            trie[trie_used].c = *name;
+            trie[trie_used].child = 0;
+            trie[trie_used].sibling = *link;
+            trie[trie_used].command = 0;
+            *link = (u16int) trie_used++;
+        }
+        node = *link;
+    }
+    trie[node].command = command;
+    return 1;
+}
+
+/** terminal_register:
+ * Adds one command from the linker section to the hash table and trie
+ */
+static void terminal_register(const struct command* command)
+{
+    u32int hash = terminal_hash(command->name);
+    u32int i = hash & TERMINAL_HASH_MASK;
+
+    if (command_count >= TERMINAL_HASH_SIZE * 3 / 4) {
+        fb_puts("terminal: command table full, dropped ");
+        fb_puts((char*) command->name);
+        fb_putc('\n');
+        return;
+    }
+    while (command_table[i].command != 0) {
+        if (command_table[i].hash == hash &&
+            strcmp(command_table[i].command->name, command->name) == 0) {
+            fb_puts("terminal: duplicate command ");
+            fb_puts((char*) command->name);
+            fb_putc('\n');
+            return;
+        }
+        i = (i + 1) & TERMINAL_HASH_MASK;
+    }
+    if (!terminal_trie_insert(command)) {
+        fb_puts("terminal: completion trie full at ");
+        fb_puts((char*) command->name);
+        fb_putc('\n');
+    }
+    command_table[i].hash = hash;
+    command_table[i].command = command;
+    command_count++;
+}
+
 /** terminal_init:
  * Initializes the terminal
  */
 void terminal_init(void)
 {
+    const struct command* command;
+
     fb_clear();
+    if (command_count == 0) {
+        for (command = __start_commands; command < __stop_commands; command++) {
+            terminal_register(command);
+        }
+    }
+    readline_set_completion(terminal_complete);
     fb_puts("Tiny OS Terminal\n");
+    fb_put_uint(smp_cpu_count());
+    fb_puts(smp_cpu_count() == 1 ? " CPU online\n" : " CPUs online\n");
     fb_puts("Type 'help' for available commands\n\n");
 }
 
-/** terminal_parse_command:
- * Parses input into command and arguments
+/** terminal_find_command:
+ * Looks up a registered command by name through the hash table
  */
-void terminal_parse_command(char* input, char* command, char* args)
+const struct command* terminal_find_command(const char* name)
 {
-    u32int i = 0;
-    u32int j = 0;
-    
-    // Skip leading spaces
-    while (input[i] == ' ') {
-        i++;
-    }
-    
-    // Extract command
-    while (input[i] != '\0' && input[i] != ' ' && j < (MAX_COMMAND_LEN - 1)) {
-        command[j++] = input[i++];
-    }
-    command[j] = '\0';
-    
-    // Skip spaces after command
-    while (input[i] == ' ') {
-        i++;
+    u32int hash = terminal_hash(name);
+    u32int i = hash & TERMINAL_HASH_MASK;
+
+    while (command_table[i].command != 0) {
+        if (command_table[i].hash == hash &&
+            strcmp(command_table[i].command->name, name) == 0) {
+            return command_table[i].command;
+        }
+        i = (i + 1) & TERMINAL_HASH_MASK;
     }
-    
-    // Extract arguments
-    j = 0;
-    while (input[i] != '\0' && j < (MAX_ARGS_LEN - 1)) {
-        args[j++] = input[i++];
+    return 0;
+}
+
+/** terminal_tokenize:
+ * Splits a line into words in place
+ */
+s32int terminal_tokenize(char* line, char** argv, u32int max_args)
+{
+    char* in = line;
+    u32int argc = 0;
+
+    while (1) {
+        char* out;
+        char quote = 0;
+
+        // Skip spaces between words
+        while (*in == ' ') {
+            in++;
+        }
+        if (*in == '\0') {
+            return (s32int) argc;
+        }
+        if (argc == max_args) {
+            return -1;
+        }
+
+        // Compact the word down over its quotes and backslashes
+        out = in;
+        argv[argc++] = out;
+        while (*in != '\0' && (quote != 0 || *in != ' ')) {
+            if (quote != 0 && *in == quote) {
+                quote = 0;
+                in++;
+            } else if (quote == 0 && (*in == '"' || *in == '\'')) {
+                quote = *in++;
+            } else if (*in == '\\' && quote != '\'' && in[1] != '\0') {
+                in++;
+                *out++ = *in++;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        if (quote != 0) {
+            return -1;
+        }
+        // out never passes in, so the terminator cannot clobber the next word
+        if (*in != '\0') {
+            in++;
+        }
+        *out = '\0';
     }
-    args[j] = '\0';
 }
 
 /** terminal_execute_command:
@@ -71,48 +235,134 @@ void terminal_parse_command(char* input, char* command, char* args)
  */
 void terminal_execute_command(char* input)
 {
-    char command[MAX_COMMAND_LEN];
-    char args[MAX_ARGS_LEN];
-    u32int i = 0;
-    
-    // Parse command and arguments
-    terminal_parse_command(input, command, args);
-    
+    char* argv[TERMINAL_MAX_ARGS + 1];
+    const struct command* command;
+    s32int argc;
+
+    argc = terminal_tokenize(input, argv, TERMINAL_MAX_ARGS);
+    if (argc < 0) {
+        fb_puts("Unterminated quote or too many arguments\n");
+        return;
+    }
+
     // Skip empty commands
-    if (command[0] == '\0') {
+    if (argc == 0) {
         return;
     }
-    
-    // Find and execute command
-    while (commands[i].name != 0) {
-        // Simple string comparison
-        u32int j = 0;
-        u8int match = 1;
-        
-        while (commands[i].name[j] != '\0' && command[j] != '\0') {
-            if (commands[i].name[j] != command[j]) {
-                match = 0;
-                break;
-            }
-            j++;
-        }
-        
-        // Check if both strings ended at the same time
-        if (match && commands[i].name[j] == '\0' && command[j] == '\0') {
-            // Execute the command
-            commands[i].function(args);
-            return;
-        }
-        
-        i++;
+    argv[argc] = 0;
+
+    command = terminal_find_command(argv[0]);
+    if (command != 0) {
+        command->function((u32int) argc, argv);
+        return;
     }
-    
+
     // Command not found
     fb_puts("Unknown command: ");
-    fb_puts(command);
+    fb_puts(argv[0]);
     fb_puts(". Type 'help' for available commands.\n");
 }
 
+/** terminal_trie_find:
+ * Returns the trie node for a name prefix, 0 if no command starts with it
+ * (or the prefix is empty)
+ */
+static u16int terminal_trie_find(const char* prefix, u32int len)
+{
+    u16int node = 0;
+    u32int i;
+
+    for (i = 0; i < len; i++) {
+        u16int child = trie[node].child;
+
+        while (child != 0 && trie[child].c != prefix[i]) {
+            child = trie[child].sibling;
+        }
+        if (child == 0) {
+            return 0;
+        }
+        node = child;
+    }
+    return node;
+}
+
+/** terminal_trie_walk:
+ * Calls visit for every command at or below node, in name order
+ */
+static void terminal_trie_walk(u16int node, void (*visit)(const struct command*))
+{
+    u16int child;
+
+    if (trie[node].command != 0) {
+        visit(trie[node].command);
+    }
+    for (child = trie[node].child; child != 0; child = trie[child].sibling) {
+        terminal_trie_walk(child, visit);
+    }
+}
+
+/** terminal_put_candidate:
+ * Prints one completion candidate
+ */
+static void terminal_put_candidate(const struct command* command)
+{
+    fb_puts((char*) command->name);
+    fb_puts("  ");
+}
+
+/** terminal_complete:
+ * Tab completion hook for readline. Completes the command name as far as
+ * it is unambiguous; if nothing could be added, lists the candidates and
+ * redraws the line.
+ *
+ * @return The new length of the line
+ */
+static u32int terminal_complete(char* line, u32int len, u32int max_len)
+{
+    u32int start = len;
+    u32int i;
+    u16int node;
+
+    // Only the command name is completed
+    for (i = 0; i < len; i++) {
+        if (line[i] == ' ') {
+            return len;
+        }
+    }
+
+    node = terminal_trie_find(line, len);
+    if (node == 0 && len > 0) {
+        return len;
+    }
+
+    // Follow the trie while there is a single way on
+    while (len < max_len && trie[node].command == 0 &&
+           trie[node].child != 0 && trie[trie[node].child].sibling == 0) {
+        node = trie[node].child;
+        line[len++] = trie[node].c;
+    }
+    if (len < max_len && trie[node].command != 0 && trie[node].child == 0) {
+        line[len++] = ' ';
+    }
+
+    if (len != start) {
+        for (i = start; i < len; i++) {
+            fb_putc(line[i]);
+        }
+        return len;
+    }
+
+    // Ambiguous: show what could follow and redraw the prompt
+    fb_newline();
+    terminal_trie_walk(node, terminal_put_candidate);
+    fb_newline();
+    fb_puts(PROMPT);
+    for (i = 0; i < len; i++) {
+        fb_putc(line[i]);
+    }
+    return len;
+}
+
 /** terminal_run:
  * Runs the terminal main loop
  */
@@ -120,7 +370,8 @@ void terminal_run(void)
 {
     char input[256];
     s32int len;
-    
+
+    initcall_mark_prompt();
     while (1) {
         // Display prompt
         fb_puts(PROMPT);
@@ -135,67 +386,839 @@ void terminal_run(void)
             // Empty line, just show prompt again
         }
         
-        // Small delay
-        __asm__ volatile("hlt");
+        // Finish any input work queued while the command ran
+        deferred_run();
     }
 }
 
-// Command implementations
+// Command implementations, each registered with TERMINAL_COMMAND
 
 /** cmd_echo:
  * Echo command - displays the provided text
  */
-void cmd_echo(char* args)
+static void cmd_echo(u32int argc, char** argv)
 {
-    if (args[0] == '\0') {
-        fb_puts("\n");
-    } else {
-        fb_puts(args);
-        fb_puts("\n");
+    u32int i;
+
+    for (i = 1; i < argc; i++) {
+        if (i > 1) {
+            fb_putc(' ');
+        }
+        fb_puts(argv[i]);
     }
+    fb_puts("\n");
 }
+TERMINAL_COMMAND("echo", cmd_echo, "echo [text]", "Display the provided text");
 
 /** cmd_clear:
  * Clear command - clears the screen
  */
-void cmd_clear(char* args)
+static void cmd_clear(u32int argc, char** argv)
 {
-    (void)args;  // Unused parameter
+    (void)argc;  // Unused parameters
+    (void)argv;
     fb_clear();
 }
+TERMINAL_COMMAND("clear", cmd_clear, "clear", "Clear the screen");
+
+/** terminal_put_help:
+ * Prints the help line of one command
+ */
+static void terminal_put_help(const struct command* command)
+{
+    u32int width = strlen(command->usage);
+
+    fb_puts("  ");
+    fb_puts((char*) command->usage);
+    do {
+        fb_putc(' ');
+    } while (++width < HELP_COLUMN);
+    fb_puts("- ");
+    fb_puts((char*) command->help);
+    fb_putc('\n');
+}
 
 /** cmd_help:
  * Help command - shows available commands
  */
-void cmd_help(char* args)
+static void cmd_help(u32int argc, char** argv)
 {
-    (void)args;  // Unused parameter
+    (void)argc;  // Unused parameters
+    (void)argv;
     fb_puts("\nAvailable commands:\n");
-    fb_puts("  echo [text]    - Display the provided text\n");
-    fb_puts("  clear          - Clear the screen\n");
-    fb_puts("  help           - Show this help message\n");
-    fb_puts("  version        - Display OS version\n");
-    fb_puts("  shutdown       - Prepare system for shutdown\n\n");
+    terminal_trie_walk(0, terminal_put_help);
+    fb_putc('\n');
 }
+TERMINAL_COMMAND("help", cmd_help, "help", "Show this help message");
 
 /** cmd_version:
  * Version command - displays OS version
  */
-void cmd_version(char* args)
+static void cmd_version(u32int argc, char** argv)
 {
-    (void)args;  // Unused parameter
+    (void)argc;  // Unused parameters
+    (void)argv;
     fb_puts("\nTiny OS v1.0\n");
     fb_puts("Worksheet 2 Part 2 - Terminal Implementation\n");
     fb_puts("Built with keyboard input and interrupt handling\n\n");
 }
+TERMINAL_COMMAND("version", cmd_version, "version", "Display OS version");
 
 /** cmd_shutdown:
  * Shutdown command - prepares system for shutdown
  */
-void cmd_shutdown(char* args)
+static void cmd_shutdown(u32int argc, char** argv)
 {
-    (void)args;  // Unused parameter
+    (void)argc;  // Unused parameters
+    (void)argv;
     fb_puts("\nSystem shutdown requested.\n");
     fb_puts("In a real OS, this would save data and power off.\n");
     fb_puts("For now, the system will continue running.\n\n");
 }
+TERMINAL_COMMAND("shutdown", cmd_shutdown, "shutdown", "Prepare system for shutdown");
+
+/** cmd_fbstat:
+ * Fbstat command - shows how much work the shadow framebuffer saved
+ */
+static void cmd_fbstat(u32int argc, char** argv)
+{
+    const struct fb_stats *stats = fb_get_stats();
+    const struct vbe_console_mode *mode = vbe_console_get_mode();
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    fb_puts("\ncells written:     ");
+    fb_put_uint(stats->cells_written);
+    fb_puts("\ncells flushed:     ");
+    fb_put_uint(stats->cells_flushed);
+    fb_puts("\nflushes:           ");
+    fb_put_uint(stats->flushes);
+    fb_puts("\ncursor moves:      ");
+    fb_put_uint(stats->cursor_requests);
+    fb_puts("\ncursor writes:     ");
+    fb_put_uint(stats->cursor_writes);
+    fb_puts("\nport writes saved: ");
+    fb_put_uint(stats->port_writes_saved);
+    fb_puts("\nhardware scrolls:  ");
+    fb_put_uint(stats->scrolls);
+    fb_puts("\nwindow wraps:      ");
+    fb_put_uint(stats->wraps);
+    fb_puts("\nview redraws:      ");
+    fb_put_uint(stats->view_redraws);
+    if (mode != 0) {
+        const struct vbe_console_stats *vbe = vbe_console_get_stats();
+
+        fb_puts("\nvbe mode:          ");
+        fb_put_uint(mode->width);
+        fb_putc('x');
+        fb_put_uint(mode->height);
+        fb_putc('x');
+        fb_put_uint(mode->bpp);
+        fb_puts(" at ");
+        fb_put_hex(mode->phys);
+        fb_puts("\nglyphs drawn:      ");
+        fb_put_uint(vbe->glyphs_drawn);
+        fb_puts("\nglyphs skipped:    ");
+        fb_put_uint(vbe->glyphs_skipped);
+        fb_puts("\npixel scrolls:     ");
+        fb_put_uint(vbe->scrolls);
+        fb_puts("\npresents:          ");
+        fb_put_uint(vbe->presents);
+        fb_puts("\ndirty rects:       ");
+        fb_put_uint(vbe->rects);
+        fb_puts("\npixels copied:     ");
+        fb_put_uint(vbe->pixels);
+    } else {
+        fb_puts("\nvbe mode:          none, VGA text");
+    }
+    fb_puts("\n\n");
+}
+TERMINAL_COMMAND("fbstat", cmd_fbstat, "fbstat", "Show framebuffer batching and VBE console counters");
+
+/** terminal_put_padded:
+ * Writes value in decimal, zero-padded to width digits
+ */
+static void terminal_put_padded(u32int value, u32int width)
+{
+    u32int limit = 1;
+
+    while (width > 1) {
+        limit *= 10;
+        if (value < limit) {
+            fb_putc('0');
+        }
+        width--;
+    }
+    fb_put_uint(value);
+}
+
+/** cmd_uptime:
+ * Uptime command - shows the time since the clock was started
+ */
+static void cmd_uptime(u32int argc, char** argv)
+{
+    u32int ms = (u32int) div64_u32(clock_now_ns(), 1000000, 0);
+    u32int khz = clock_tsc_khz();
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    fb_puts("\nup ");
+    fb_put_uint(ms / 1000);
+    fb_putc('.');
+    terminal_put_padded(ms % 1000, 3);
+    fb_puts(" s\nticks: ");
+    fb_put_uint(clock_ticks());
+    fb_puts(" at ");
+    fb_put_uint(clock_hz());
+    fb_puts(" Hz\nTSC: ");
+    fb_put_uint(khz / 1000);
+    fb_putc('.');
+    terminal_put_padded(khz % 1000, 3);
+    fb_puts(" MHz\n\n");
+}
+TERMINAL_COMMAND("uptime", cmd_uptime, "uptime", "Show time since boot");
+
+/** cmd_bench:
+ * Bench command - runs the microbenchmark suite, optionally only the
+ * cases whose name starts with the argument
+ */
+static void cmd_bench(u32int argc, char** argv)
+{
+    bench_run(argc > 1 ? argv[1] : "");
+}
+TERMINAL_COMMAND("bench", cmd_bench, "bench [case]", "Run the microbenchmarks");
+
+/** cmd_true:
+ * True command - does nothing, used to time command dispatch
+ */
+static void cmd_true(u32int argc, char** argv)
+{
+    (void)argc;  // Unused parameters
+    (void)argv;
+}
+TERMINAL_COMMAND("true", cmd_true, "true", "Do nothing");
+
+/** cmd_trace:
+ * Trace command - turns interrupt tracing on or off, clears it, or with
+ * no argument dumps the events and the duration histogram
+ */
+static void cmd_trace(u32int argc, char** argv)
+{
+    char* arg = argc > 1 ? argv[1] : "";
+
+    if (strcmp(arg, "on") == 0) {
+        interrupts_trace_enable(1);
+    } else if (strcmp(arg, "off") == 0) {
+        interrupts_trace_enable(0);
+    } else if (strcmp(arg, "clear") == 0) {
+        interrupts_trace_clear();
+    } else if (arg[0] == '\0') {
+        interrupts_trace_dump();
+    } else {
+        fb_puts("Usage: trace [on|off|clear]\n");
+    }
+}
+TERMINAL_COMMAND("trace", cmd_trace, "trace [on|off|clear]", "Control or dump the interrupt trace");
+
+/** cmd_irqstat:
+ * Irqstat command - lists every vector that has fired with its count
+ */
+static void cmd_irqstat(u32int argc, char** argv)
+{
+    u32int vector;
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    for (vector = 0; vector < INTERRUPTS_DESCRIPTOR_COUNT; vector++) {
+        u32int count = interrupts_get_count((u8int) vector);
+        if (count == 0) {
+            continue;
+        }
+        fb_puts("vec=");
+        fb_put_uint(vector);
+        fb_puts(" count=");
+        fb_put_uint(count);
+        fb_puts(" name=");
+        fb_puts((char *) interrupts_vector_name((u8int) vector));
+        fb_putc('\n');
+    }
+}
+TERMINAL_COMMAND("irqstat", cmd_irqstat, "irqstat", "Show per-vector interrupt counts");
+
+/** terminal_put_isr_stats:
+ * Prints one line of keyboard handler timings
+ */
+static void terminal_put_isr_stats(const char* mode, const struct isr_stats* isr)
+{
+    fb_puts("kbd_isr mode=");
+    fb_puts((char*) mode);
+    fb_puts(" count=");
+    fb_put_uint(isr->count);
+    fb_puts(" avg=");
+    fb_put_uint(isr->count ? (u32int) div64_u32(isr->total_cycles, isr->count, 0) : 0);
+    fb_puts(" max=");
+    fb_put_uint(isr->max_cycles);
+    fb_puts(" unit=cycles\n");
+}
+
+/** cmd_defer:
+ * Defer command - switches keyboard/serial input processing between the
+ * deferred work queue and the interrupt handler, or shows the handler
+ * cost in both modes
+ */
+static void cmd_defer(u32int argc, char** argv)
+{
+    const struct deferred_stats* stats = deferred_get_stats();
+    char* arg = argc > 1 ? argv[1] : "";
+
+    if (strcmp(arg, "on") == 0) {
+        interrupts_set_deferred(1);
+        return;
+    } else if (strcmp(arg, "off") == 0) {
+        interrupts_set_deferred(0);
+        return;
+    } else if (arg[0] != '\0') {
+        fb_puts("Usage: defer [on|off]\n");
+        return;
+    }
+
+    fb_puts(interrupts_get_deferred() ? "deferred input: on\n" : "deferred input: off\n");
+    terminal_put_isr_stats("inline", interrupts_get_keyboard_stats(0));
+    terminal_put_isr_stats("deferred", interrupts_get_keyboard_stats(1));
+    fb_puts("work queued=");
+    fb_put_uint(stats->queued);
+    fb_puts(" run=");
+    fb_put_uint(stats->run);
+    fb_puts(" dropped=");
+    fb_put_uint(stats->dropped);
+    fb_puts(" max_depth=");
+    fb_put_uint(stats->max_depth);
+    fb_putc('\n');
+}
+TERMINAL_COMMAND("defer", cmd_defer, "defer [on|off]", "Defer input work out of the ISR, show ISR cost");
+
+/** cmd_keymap:
+ * Keymap command - lists the keyboard layouts and modifier state, or
+ * switches to the named layout
+ */
+static void cmd_keymap(u32int argc, char** argv)
+{
+    const struct keymap* current = keyboard_get_layout();
+    u8int mods = keyboard_modifiers();
+    u32int i;
+
+    if (argc > 1) {
+        if (!keyboard_set_layout(argv[1])) {
+            fb_puts("Unknown keymap: ");
+            fb_puts(argv[1]);
+            fb_putc('\n');
+        }
+        return;
+    }
+
+    for (i = 0; i < keymap_count; i++) {
+        fb_puts(&keymaps[i] == current ? "* " : "  ");
+        fb_puts((char*) keymaps[i].name);
+        fb_putc('\n');
+    }
+    fb_puts("modifiers:");
+    fb_puts((mods & KEYBOARD_MOD_SHIFT) ? " shift" : "");
+    fb_puts((mods & KEYBOARD_MOD_CAPS) ? " caps" : "");
+    fb_puts((mods & KEYBOARD_MOD_CTRL) ? " ctrl" : "");
+    fb_puts((mods & KEYBOARD_MOD_ALT) ? " alt" : "");
+    fb_puts(mods ? "\n" : " none\n");
+}
+TERMINAL_COMMAND("keymap", cmd_keymap, "keymap [name]", "List keyboard layouts or switch layout");
+
+/** cmd_meminfo:
+ * Meminfo command - shows free physical memory by block size and how
+ * fragmented it is
+ */
+static void cmd_meminfo(u32int argc, char** argv)
+{
+    const struct pmm_stats* stats = pmm_get_stats();
+    u32int largest = 0;
+    u32int order;
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    if (stats->total_frames == 0) {
+        fb_puts("No memory information from the boot loader\n");
+        return;
+    }
+
+    fb_puts("memory total=");
+    fb_put_uint(stats->total_frames * (PMM_FRAME_SIZE / 1024));
+    fb_puts(" KB free=");
+    fb_put_uint(stats->free_frames * (PMM_FRAME_SIZE / 1024));
+    fb_puts(" KB used=");
+    fb_put_uint((stats->total_frames - stats->free_frames) * (PMM_FRAME_SIZE / 1024));
+    fb_puts(" KB\n");
+
+    for (order = 0; order < PMM_ORDERS; order++) {
+        if (stats->free_blocks[order] == 0) {
+            continue;
+        }
+        largest = 1u << order;
+        fb_puts("order=");
+        fb_put_uint(order);
+        fb_puts(" size=");
+        fb_put_uint((PMM_FRAME_SIZE / 1024) << order);
+        fb_puts(" KB free_blocks=");
+        fb_put_uint(stats->free_blocks[order]);
+        fb_putc('\n');
+    }
+
+    // Share of free memory outside the largest free block
+    fb_puts("largest=");
+    fb_put_uint(largest * (PMM_FRAME_SIZE / 1024));
+    fb_puts(" KB frag=");
+    fb_put_uint(stats->free_frames ? 100 - largest * 100 / stats->free_frames : 0);
+    fb_puts("% failed_allocs=");
+    fb_put_uint(stats->failed_allocs);
+    fb_puts(" bad_frees=");
+    fb_put_uint(stats->bad_frees);
+    fb_putc('\n');
+}
+TERMINAL_COMMAND("meminfo", cmd_meminfo, "meminfo", "Show physical memory and fragmentation");
+
+/** terminal_put_class:
+ * Prints the counters of one heap size class
+ */
+static void terminal_put_class(const char* label, const struct kheap_class_stats* class_stats)
+{
+    fb_puts("class=");
+    if (label != 0) {
+        fb_puts((char*) label);
+    } else {
+        fb_put_uint(class_stats->size);
+    }
+    fb_puts(" in_use=");
+    fb_put_uint(class_stats->in_use);
+    fb_puts(" peak=");
+    fb_put_uint(class_stats->peak);
+    fb_puts(" allocs=");
+    fb_put_uint(class_stats->allocs);
+    fb_puts(" frees=");
+    fb_put_uint(class_stats->frees);
+    fb_puts(label != 0 ? " pages=" : " slabs=");
+    fb_put_uint(class_stats->slabs);
+    fb_putc('\n');
+}
+
+/** cmd_heapstat:
+ * Heapstat command - shows the kernel heap counters per size class
+ */
+static void cmd_heapstat(u32int argc, char** argv)
+{
+    const struct kheap_stats* stats = kheap_get_stats();
+    u32int i;
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    for (i = 0; i < KHEAP_CLASSES; i++) {
+        terminal_put_class(0, &stats->classes[i]);
+    }
+    terminal_put_class("large", &stats->large);
+    fb_puts("failed=");
+    fb_put_uint(stats->failed);
+    fb_puts(" bad_frees=");
+    fb_put_uint(stats->bad_frees);
+    fb_puts(" corruptions=");
+    fb_put_uint(stats->corruptions);
+    fb_puts(KHEAP_DEBUG ? " debug=on\n" : " debug=off\n");
+}
+TERMINAL_COMMAND("heapstat", cmd_heapstat, "heapstat", "Show kernel heap usage per size class");
+
+/** cmd_user:
+ * User command - runs a program in ring 3, or lists them
+ */
+static void cmd_user(u32int argc, char** argv)
+{
+    const struct user_program* program;
+    s32int status;
+
+    if (argc < 2) {
+        for (program = user_programs; program->name != 0; program++) {
+            fb_puts((char*) program->name);
+            fb_putc('\n');
+        }
+        return;
+    }
+
+    program = user_find(argv[1]);
+    if (program == 0) {
+        fb_puts("Unknown program: ");
+        fb_puts(argv[1]);
+        fb_putc('\n');
+        return;
+    }
+    status = user_run(program, argc - 1, argv + 1);
+    if (status != 0) {
+        fb_puts("exit status ");
+        if (status < 0) {
+            fb_putc('-');
+            status = -status;
+        }
+        fb_put_uint((u32int) status);
+        fb_putc('\n');
+    }
+}
+TERMINAL_COMMAND("user", cmd_user, "user [program] [args]", "List user programs or run one in ring 3");
+
+/** cmd_ps:
+ * Ps command - lists threads with their CPU time and switch counts
+ */
+static void cmd_ps(u32int argc, char** argv)
+{
+    static const char* const states[] = {"unused", "ready", "running", "blocked", "dead"};
+    u32int i;
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    for (i = 0; i < THREAD_MAX; i++) {
+        const struct thread* thread = thread_get(i);
+
+        if (thread->state == THREAD_UNUSED) {
+            continue;
+        }
+        fb_puts("id=");
+        fb_put_uint(thread->id);
+        fb_puts(" name=");
+        fb_puts((char*) thread->name);
+        fb_puts(" state=");
+        fb_puts((char*) states[thread->state]);
+        fb_puts(" cpu=");
+        fb_put_uint(thread->cpu);
+        fb_puts(thread->pinned ? " pinned" : "");
+        fb_puts(" cpu_ms=");
+        fb_put_uint((u32int) div64_u32(clock_cycles_to_ns(thread->cycles), 1000000, 0));
+        fb_puts(" switches=");
+        fb_put_uint(thread->switches);
+        fb_puts(" preempted=");
+        fb_put_uint(thread->preemptions);
+        fb_putc('\n');
+    }
+}
+TERMINAL_COMMAND("ps", cmd_ps, "ps", "List threads with CPU time and context switches");
+
+/** cmd_cpus:
+ * Cpus command - lists the CPUs with their run queues, steals, reschedule
+ * IPIs and idle time
+ */
+static void cmd_cpus(u32int argc, char** argv)
+{
+    u32int i;
+
+    (void)argc;  // Unused parameters
+    (void)argv;
+    for (i = 0; i < smp_cpu_count(); i++) {
+        const struct cpu* cpu = smp_get_cpu(i);
+
+        fb_puts("cpu=");
+        fb_put_uint(cpu->index);
+        fb_puts(" apic_id=");
+        fb_put_uint(cpu->apic_id);
+        fb_puts(" running=");
+        fb_puts((char*) cpu->current->name);
+        fb_puts(" ready=");
+        fb_put_uint(cpu->run_count);
+        fb_puts(" steals=");
+        fb_put_uint(cpu->steals);
+        fb_puts(" kicks=");
+        fb_put_uint(cpu->kicks);
+        fb_puts(" idle_ms=");
+        fb_put_uint((u32int) div64_u32(clock_cycles_to_ns(cpu->idle_cycles), 1000000, 0));
+        fb_putc('\n');
+    }
+}
+TERMINAL_COMMAND("cpus", cmd_cpus, "cpus", "List online CPUs with run queue and work-stealing counts");
+
+/** cmd_pbench:
+ * Pbench command - runs the parallel benchmark on 1 to n CPUs
+ */
+static void cmd_pbench(u32int argc, char** argv)
+{
+    u32int max = 0;
+    char* p;
+
+    if (argc > 1) {
+        for (p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+            max = max * 10 + (u32int) (*p - '0');
+        }
+    }
+    if (max == 0 || max > smp_cpu_count()) {
+        max = smp_cpu_count();
+    }
+    bench_parallel(max);
+}
+TERMINAL_COMMAND("pbench", cmd_pbench, "pbench [cpus]", "Time a CPU-bound job on 1 to n CPUs and show the speedup");
+
+/** terminal_put_ns:
+ * Prints a TSC cycle count as nanoseconds
+ */
+static void terminal_put_ns(u64int cycles)
+{
+    fb_put_uint((u32int) clock_cycles_to_ns(cycles));
+}
+
+/** cmd_lockstat:
+ * Lockstat command - turns lock statistics on (clearing them) or off, or
+ * lists each lock's acquisitions, contention and hold times
+ */
+static void cmd_lockstat(u32int argc, char** argv)
+{
+    char* arg = argc > 1 ? argv[1] : "";
+    struct spinlock* lock;
+    u32int i;
+
+    if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0) {
+        lockstat_set(arg[1] == 'n');
+    } else if (arg[0] != '\0') {
+        fb_puts("Usage: lockstat [on|off]\n");
+        return;
+    }
+    fb_puts("lockstat ");
+    fb_puts(lockstat_enabled ? "on\n" : "off\n");
+    for (i = 0; (lock = spinlock_get(i)) != 0; i++) {
+        const struct lock_stats* stats = &lock->stats;
+
+        fb_puts("lock name=");
+        fb_puts((char*) (lock->name != 0 ? lock->name : "?"));
+        fb_puts(" acquired=");
+        fb_put_uint(stats->acquisitions);
+        fb_puts(" contended=");
+        fb_put_uint(stats->contended);
+        fb_puts(" wait_avg_ns=");
+        terminal_put_ns(stats->contended ? div64_u32(stats->wait_cycles, stats->contended, 0) : 0);
+        fb_puts(" hold_avg_ns=");
+        terminal_put_ns(stats->acquisitions ? div64_u32(stats->hold_cycles, stats->acquisitions, 0) : 0);
+        fb_puts(" hold_max_ns=");
+        terminal_put_ns(stats->hold_max);
+        fb_putc('\n');
+    }
+}
+TERMINAL_COMMAND("lockstat", cmd_lockstat, "lockstat [on|off]", "Show or collect per-lock contention and hold times");
+
+/** terminal_put_us:
+ * Prints a TSC cycle count as microseconds
+ */
+static void terminal_put_us(u64int cycles)
+{
+    fb_put_uint((u32int) div64_u32(clock_cycles_to_ns(cycles), 1000, 0));
+}
+
+/** cmd_boottime:
+ * Boottime command - lists each boot phase with when it started and how
+ * long it took, counted from the first instruction of loader, then the
+ * time to the first prompt. Lazy phases show when first used, if ever.
+ */
+static void cmd_boottime(u32int argc, char** argv)
+{
+    u64int boot = initcall_boot_tsc();
+    u64int prompt = initcall_prompt_tsc();
+    u64int phases = 0;
+    const struct initcall* call;
+    u32int i;
+
+    (void)argc;
+    (void)argv;
+    for (i = 0; (call = initcall_get(i)) != 0; i++) {
+        if (i == 0) {
+            fb_puts("phase name=loader start_us=0 cycles=");
+            fb_put_uint((u32int) (call->started - boot));
+            fb_puts(" us=");
+            terminal_put_us(call->started - boot);
+            fb_putc('\n');
+        }
+        fb_puts("phase name=");
+        fb_puts((char*) call->name);
+        if (call->flags & INITCALL_LAZY) {
+            fb_puts(" lazy");
+        }
+        if (!call->done) {
+            fb_puts(" not_run\n");
+            continue;
+        }
+        if (!(call->flags & INITCALL_LAZY)) {
+            phases += call->cycles;
+        }
+        fb_puts(" start_us=");
+        terminal_put_us(call->started - boot);
+        fb_puts(" cycles=");
+        fb_put_uint((u32int) call->cycles);
+        fb_puts(" us=");
+        terminal_put_us(call->cycles);
+        fb_putc('\n');
+    }
+    fb_puts("to prompt: phases_us=");
+    terminal_put_us(phases);
+    fb_puts(" total_us=");
+    terminal_put_us(prompt - boot);
+    fb_puts(" tsc_khz=");
+    fb_put_uint(clock_tsc_khz());
+    fb_putc('\n');
+}
+TERMINAL_COMMAND("boottime", cmd_boottime, "boottime", "Show how long each boot phase took and the time to the first prompt");
+
+/** cmd_tickless:
+ * Tickless command - switches tickless idle on or off, or shows how many
+ * periodic wakeups it avoided and how late timer wakeups were
+ */
+static void cmd_tickless(u32int argc, char** argv)
+{
+    const struct clock_idle_stats* stats = clock_get_idle_stats();
+    char* arg = argc > 1 ? argv[1] : "";
+
+    if (strcmp(arg, "on") == 0) {
+        if (!clock_set_tickless(1)) {
+            fb_puts("No local APIC timer\n");
+        }
+        return;
+    } else if (strcmp(arg, "off") == 0) {
+        clock_set_tickless(0);
+        return;
+    } else if (arg[0] != '\0') {
+        fb_puts("Usage: tickless [on|off]\n");
+        return;
+    }
+
+    fb_puts(clock_get_tickless() ? "tickless idle: on timer=" : "tickless idle: off timer=");
+    fb_puts((char*) lapic_timer_mode());
+    fb_puts("\nsleeps=");
+    fb_put_uint(stats->sleeps);
+    fb_puts(" timer_wakeups=");
+    fb_put_uint(stats->timer_wakeups);
+    fb_puts(" other_wakeups=");
+    fb_put_uint(stats->other_wakeups);
+    fb_puts(" avoided_ticks=");
+    fb_put_uint((u32int) stats->avoided);
+    fb_puts("\nlatency_ns min=");
+    terminal_put_ns(stats->latency_min);
+    fb_puts(" avg=");
+    terminal_put_ns(stats->latency_count ? div64_u32(stats->latency_total, stats->latency_count, 0) : 0);
+    fb_puts(" max=");
+    terminal_put_ns(stats->latency_max);
+    fb_puts(" samples=");
+    fb_put_uint(stats->latency_count);
+    fb_puts("\nap_sleeps=");
+    fb_put_uint(stats->ap_sleeps);
+    fb_puts(" ap_avoided_ticks=");
+    fb_put_uint(stats->ap_avoided);
+    fb_putc('\n');
+}
+TERMINAL_COMMAND("tickless", cmd_tickless, "tickless [on|off]", "Tickless idle, avoided wakeups and timer latency");
+
+/** cmd_sleep:
+ * Sleep command - blocks the terminal thread on a timer and reports how
+ * long it really slept
+ */
+static void cmd_sleep(u32int argc, char** argv)
+{
+    u32int ms = 0;
+    u64int start;
+    u64int elapsed;
+    char* p;
+
+    if (argc < 2 || argv[1][0] == '\0') {
+        fb_puts("Usage: sleep <ms>\n");
+        return;
+    }
+    for (p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+        ms = ms * 10 + (u32int) (*p - '0');
+    }
+
+    start = clock_cycles();
+    thread_sleep_ms(ms);
+    elapsed = clock_cycles() - start;
+
+    fb_puts("slept_us=");
+    fb_put_uint((u32int) div64_u32(clock_cycles_to_ns(elapsed), 1000, 0));
+    fb_puts(" late_us=");
+    elapsed -= (u64int) ms * clock_tsc_khz();
+    fb_put_uint((u32int) div64_u32(clock_cycles_to_ns(elapsed), 1000, 0));
+    fb_putc('\n');
+}
+TERMINAL_COMMAND("sleep", cmd_sleep, "sleep <ms>", "Sleep on a timer and show the wakeup delay");
+
+/** terminal_put_irq_mode:
+ * Prints the EOI cost and IRQ1 latency of one interrupt controller
+ */
+static void terminal_put_irq_mode(u8int mode)
+{
+    struct irq_latency latency;
+
+    fb_puts(mode == IRQ_MODE_APIC ? "apic" : "pic");
+    fb_puts(" eoi_ns=");
+    terminal_put_ns(irq_measure_eoi(mode));
+    if (!irq_set_mode(mode)) {
+        fb_puts(" latency unavailable\n");
+        return;
+    }
+    if (!irq_measure_latency(32, &latency)) {
+        fb_puts(" keyboard controller did not respond\n");
+        return;
+    }
+    fb_puts(" irq1_latency_ns min=");
+    terminal_put_ns(latency.min);
+    fb_puts(" avg=");
+    terminal_put_ns(latency.samples ? div64_u32(latency.total, latency.samples, 0) : 0);
+    fb_puts(" max=");
+    terminal_put_ns(latency.max);
+    fb_putc('\n');
+}
+
+/** cmd_irqctl:
+ * Irqctl command - shows how IRQs are delivered, switches between the
+ * 8259s and the I/O APIC, or compares the two
+ */
+static void cmd_irqctl(u32int argc, char** argv)
+{
+    const struct acpi_madt_info* madt = acpi_get_madt();
+    char* arg = argc > 1 ? argv[1] : "";
+    u8int mode = irq_get_mode();
+    u32int irq;
+
+    if (strcmp(arg, "pic") == 0) {
+        irq_set_mode(IRQ_MODE_PIC);
+        return;
+    } else if (strcmp(arg, "apic") == 0) {
+        if (!irq_set_mode(IRQ_MODE_APIC)) {
+            fb_puts("No I/O APIC\n");
+        }
+        return;
+    } else if (strcmp(arg, "compare") == 0) {
+        terminal_put_irq_mode(IRQ_MODE_PIC);
+        terminal_put_irq_mode(IRQ_MODE_APIC);
+        irq_set_mode(mode);
+        return;
+    } else if (arg[0] != '\0') {
+        fb_puts("Usage: irqctl [pic|apic|compare]\n");
+        return;
+    }
+
+    fb_puts(mode == IRQ_MODE_APIC ? "controller=ioapic" : "controller=8259");
+    if (madt == 0) {
+        fb_puts(" madt=none\n");
+        return;
+    }
+    fb_puts(" cpus=");
+    fb_put_uint(madt->cpu_count);
+    fb_puts(" lapic=");
+    fb_put_hex(madt->lapic_address);
+    fb_puts(" ioapic=");
+    fb_put_hex(madt->ioapic_address);
+    fb_puts(" pins=");
+    fb_put_uint(ioapic_pins());
+    fb_puts(madt->has_8259 ? " 8259=yes\n" : " 8259=no\n");
+    for (irq = 0; irq < IRQ_COUNT; irq++) {
+        if (irq_gsi(irq) != irq) {
+            fb_puts("irq ");
+            fb_put_uint(irq);
+            fb_puts(" -> gsi ");
+            fb_put_uint(irq_gsi(irq));
+            fb_putc('\n');
+        }
+    }
+}
+TERMINAL_COMMAND("irqctl", cmd_irqctl, "irqctl [pic|apic|compare]", "Show or switch the IRQ controller, compare EOI cost and latency");
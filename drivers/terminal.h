@@ -3,12 +3,33 @@
 
 #include "types.h"
 
+/* Most words a command line may have, including the command name */
+#define TERMINAL_MAX_ARGS 16
+
 /** Command structure */
 struct command {
     const char* name;
-    void (*function)(char* args);
+    void (*function)(u32int argc, char** argv);
+    const char* usage;      /* name and arguments, for help */
+    const char* help;       /* one line description, for help */
 };
 
+/** TERMINAL_COMMAND:
+ * Registers a command at link time. The entry goes into the "commands"
+ * section, which the linker script gathers between __start_commands and
+ * __stop_commands, so a command can be added from any file without
+ * touching a central table.
+ *
+ * @param cmd_name     The name typed at the prompt
+ * @param cmd_function The function to run
+ * @param cmd_usage    Name and arguments shown by help
+ * @param cmd_help     Description shown by help
+ */
+#define TERMINAL_COMMAND(cmd_name, cmd_function, cmd_usage, cmd_help)   \
+    static const struct command terminal_command_##cmd_function         \
+    __attribute__((used, section("commands"), aligned(4))) =            \
+        { cmd_name, cmd_function, cmd_usage, cmd_help }
+
 /** terminal_init:
  * Initializes the terminal
  */
@@ -20,19 +41,33 @@ void terminal_init(void);
 void terminal_run(void);
 
 /** terminal_execute_command:
- * Executes a command with arguments
+ * Executes a command with arguments. The input is tokenized in place.
  *
  * @param input The input string containing command and arguments
  */
 void terminal_execute_command(char* input);
 
-/** terminal_parse_command:
- * Parses input into command and arguments
+/** terminal_tokenize:
+ * Splits a line into words in place. Words are separated by spaces; single
+ * or double quotes group spaces into a word and a backslash outside single
+ * quotes takes the next character literally. The quotes and backslashes
+ * are removed by moving the rest of the word down, so argv points into
+ * line and nothing is copied out.
+ *
+ * @param line     The line, modified in place
+ * @param argv     Receives a pointer to each word
+ * @param max_args Size of argv
+ * @return The number of words, or -1 on an unterminated quote or too many
+ *         words
+ */
+s32int terminal_tokenize(char* line, char** argv, u32int max_args);
+
+/** terminal_find_command:
+ * Looks up a registered command by name through the hash table
  *
- * @param input The input string
- * @param command Buffer to store command (must be at least 64 bytes)
- * @param args Buffer to store arguments (must be at least 192 bytes)
+ * @param name The command name
+ * @return The command, or 0 if there is none with that name
  */
-void terminal_parse_command(char* input, char* command, char* args);
+const struct command* terminal_find_command(const char* name);
 
 #endif /* INCLUDE_TERMINAL_H */
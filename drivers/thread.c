@@ -0,0 +1,636 @@
+#include "thread.h"
+#include "atomic.h"
+#include "clock.h"
+#include "irq.h"
+#include "lapic.h"
+#include "math64.h"
+#include "pmm.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "types.h"
+
+/* eflags of a new thread before thread_start runs: IF clear, bit 1 set */
+#define THREAD_INITIAL_EFLAGS 0x00000002
+
+static struct thread threads[THREAD_MAX];
+
+/* Guards slot allocation in threads and next_id */
+static SPINLOCK_DEFINE(threads_lock, "threads");
+static u32int next_id = 0;
+
+/* Set once the boot CPU has an idle thread */
+static u8int threads_ready = 0;
+
+/** thread_run_queue_push:
+ * Appends a thread to a CPU's run queue and, if that CPU is halted or
+ * another one is, kicks it so the thread does not wait for a tick.
+ * Interrupts are off.
+ */
+static void thread_run_queue_push(struct cpu *cpu, struct thread *thread)
+{
+    struct cpu *this = cpu_this();
+    u32int i;
+
+    spin_lock(&cpu->run_lock);
+    thread->state = THREAD_READY;
+    thread->cpu = cpu->index;
+    thread->next = 0;
+    if (cpu->run_tail != 0) {
+        cpu->run_tail->next = thread;
+    } else {
+        cpu->run_head = thread;
+    }
+    cpu->run_tail = thread;
+    cpu->run_count++;
+    if (!thread->pinned) {
+        cpu->run_unpinned++;
+    }
+    spin_unlock(&cpu->run_lock);
+
+    if (cpu == this) {
+        // Do not make the thread wait out the idle thread's slice
+        if (this->current == this->idle) {
+            this->need_resched = 1;
+        }
+        if (thread->pinned) {
+            return;
+        }
+        // Let a halted CPU steal it instead. Pairs with the barrier in
+        // thread_idle: either it sees the queued thread or we see halted.
+        // Clearing halted makes the next push pick another CPU.
+        smp_mb();
+        for (i = 0; i < smp_cpu_count(); i++) {
+            struct cpu *other = smp_get_cpu(i);
+
+            if (other != this && other->halted && atomic_xchg(&other->halted, 0)) {
+                smp_kick(other);
+                return;
+            }
+        }
+        return;
+    }
+    smp_mb();
+    if (cpu->halted && atomic_xchg(&cpu->halted, 0)) {
+        smp_kick(cpu);
+    }
+}
+
+/** thread_run_queue_pop:
+ * Takes the first thread off a CPU's run queue. With steal set, only
+ * threads that are not pinned are taken. Interrupts are off.
+ */
+static struct thread *thread_run_queue_pop(struct cpu *cpu, u8int steal)
+{
+    struct thread **link;
+    struct thread *prev = 0;
+    struct thread *thread;
+
+    if ((steal ? cpu->run_unpinned : cpu->run_count) == 0) {
+        return 0;
+    }
+    spin_lock(&cpu->run_lock);
+    link = &cpu->run_head;
+    while (*link != 0 && steal && (*link)->pinned) {
+        prev = *link;
+        link = &prev->next;
+    }
+    thread = *link;
+    if (thread != 0) {
+        *link = thread->next;
+        if (cpu->run_tail == thread) {
+            cpu->run_tail = prev;
+        }
+        thread->next = 0;
+        cpu->run_count--;
+        if (!thread->pinned) {
+            cpu->run_unpinned--;
+        }
+    }
+    spin_unlock(&cpu->run_lock);
+    return thread;
+}
+
+/** thread_steal:
+ * Takes a ready thread from another CPU's run queue, trying the CPUs after
+ * this one in turn so thieves spread over the victims. Interrupts are off.
+ */
+static struct thread *thread_steal(struct cpu *this)
+{
+    u32int count = smp_cpu_count();
+    u32int i;
+
+    for (i = 1; i < count; i++) {
+        struct cpu *victim = smp_get_cpu((this->index + i) % count);
+        struct thread *thread = thread_run_queue_pop(victim, 1);
+
+        if (thread != 0) {
+            this->steals++;
+            return thread;
+        }
+    }
+    return 0;
+}
+
+/** thread_stealable:
+ * Checks, without locking, whether another CPU has a thread that is not
+ * pinned waiting. Counting pinned ones would keep an idle CPU spinning on
+ * a queue it can never steal from.
+ */
+static u8int thread_stealable(struct cpu *this)
+{
+    u32int i;
+
+    for (i = 0; i < smp_cpu_count(); i++) {
+        struct cpu *other = smp_get_cpu(i);
+
+        if (other != this && other->run_unpinned > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** thread_slice_ticks:
+ * Ticks of the running CPU's timer in one time slice, at least one
+ */
+static u32int thread_slice_ticks(struct cpu *cpu)
+{
+    u32int ticks = cpu->tick_hz * THREAD_SLICE_MS / 1000;
+
+    return ticks > 0 ? ticks : 1;
+}
+
+/** thread_tick_stop:
+ * Stops an AP's periodic timer before it halts with nothing to run.
+ * smp_kick wakes it when work arrives, and only then does it need a tick
+ * to time-slice. The boot CPU's tick is left to clock_idle_enter.
+ */
+static void thread_tick_stop(struct cpu *cpu)
+{
+    if (cpu->index == 0 || cpu->tick_stopped || !clock_get_tickless()) {
+        return;
+    }
+    lapic_timer_disarm();
+    cpu->tick_stop_tsc = clock_cycles();
+    cpu->tick_stopped = 1;
+    cpu->tick_stops++;
+}
+
+/** thread_tick_start:
+ * Restarts an AP's timer stopped by thread_tick_stop and counts the ticks
+ * it did not take
+ */
+static void thread_tick_start(struct cpu *cpu)
+{
+    u64int ms;
+
+    if (!cpu->tick_stopped) {
+        return;
+    }
+    cpu->tick_stopped = 0;
+    ms = div64_u32(clock_cycles() - cpu->tick_stop_tsc, clock_tsc_khz(), 0);
+    cpu->ticks_avoided += (u32int) div64_u32(ms * cpu->tick_hz, 1000, 0);
+    lapic_timer_periodic(SMP_TICK_VECTOR, cpu->tick_hz);
+}
+
+/** thread_finish_switch:
+ * Runs on the new thread right after a switch: lets other CPUs run the
+ * thread we left, and frees the stack of one that exited, now that nobody
+ * runs on it
+ */
+static void thread_finish_switch(void)
+{
+    struct cpu *cpu = cpu_this();
+    struct thread *zombie = cpu->zombie;
+
+    if (cpu->prev != 0) {
+        __asm__ volatile("" : : : "memory");
+        cpu->prev->on_cpu = 0;
+        cpu->prev = 0;
+    }
+    if (zombie != 0) {
+        cpu->zombie = 0;
+        pmm_free_pages(zombie->stack, THREAD_STACK_ORDER);
+        zombie->state = THREAD_UNUSED;
+    }
+}
+
+/** thread_schedule:
+ * Picks the next thread, from this CPU's run queue or stolen from another,
+ * and switches to it. The running thread goes to the back of the run
+ * queue if it is still runnable. Call with interrupts disabled.
+ */
+static void thread_schedule(void)
+{
+    struct cpu *cpu = cpu_this();
+    struct thread *prev = cpu->current;
+    struct thread *next = thread_run_queue_pop(cpu, 0);
+    u64int now;
+
+    if (next == 0 && (prev == cpu->idle || prev->state != THREAD_RUNNING)) {
+        next = thread_steal(cpu);
+    }
+    if (next == 0) {
+        if (prev->state == THREAD_RUNNING) {
+            cpu->slice_left = thread_slice_ticks(cpu);
+            return;
+        }
+        next = cpu->idle;
+    }
+    if (prev == cpu->idle) {
+        prev->state = THREAD_READY;
+    } else if (prev->state == THREAD_RUNNING) {
+        thread_run_queue_push(cpu, prev);
+    } else if (prev->state == THREAD_DEAD) {
+        cpu->zombie = prev;
+    }
+    if (next == prev) {
+        prev->state = THREAD_RUNNING;
+        return;
+    }
+    if (next != cpu->idle) {
+        thread_tick_start(cpu);
+    }
+
+    // A thread just woken or stolen may still be switching out on the CPU
+    // it ran on; its saved esp is only valid once that finishes
+    while (next->on_cpu) {
+        cpu_relax();
+    }
+
+    now = clock_cycles();
+    prev->cycles += now - cpu->switch_tsc;
+    if (prev == cpu->idle) {
+        cpu->idle_cycles += now - cpu->switch_tsc;
+    }
+    cpu->switch_tsc = now;
+
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu->index;
+    next->on_cpu = 1;
+    next->switches++;
+    cpu->slice_left = thread_slice_ticks(cpu);
+    cpu->need_resched = 0;
+    cpu->current = next;
+    cpu->prev = prev;
+    thread_switch(&prev->esp, next->esp);
+
+    // Running as prev again, possibly on another CPU
+    thread_finish_switch();
+}
+
+/** thread_start:
+ * First code a new thread runs, reached through the ret in thread_switch
+ */
+static void thread_start(void)
+{
+    struct thread *self = cpu_read(current);
+
+    thread_finish_switch();
+    irq_enable();
+    self->entry(self->arg);
+    thread_exit();
+}
+
+static void thread_set_name(struct thread *thread, const char *name)
+{
+    u32int i;
+
+    for (i = 0; i < THREAD_NAME_LENGTH - 1 && name[i] != '\0'; i++) {
+        thread->name[i] = name[i];
+    }
+    thread->name[i] = '\0';
+}
+
+/** thread_alloc:
+ * Claims a free slot and gives it an id
+ */
+static struct thread *thread_alloc(const char *name)
+{
+    struct thread *thread = 0;
+    u32int i;
+
+    spin_lock(&threads_lock);
+    for (i = 0; i < THREAD_MAX; i++) {
+        if (threads[i].state == THREAD_UNUSED) {
+            thread = &threads[i];
+            thread->state = THREAD_BLOCKED;
+            thread->id = next_id++;
+            break;
+        }
+    }
+    spin_unlock(&threads_lock);
+
+    if (thread != 0) {
+        thread_set_name(thread, name);
+        thread->next = 0;
+        thread->pinned = 0;
+        thread->on_cpu = 0;
+        thread->cycles = 0;
+        thread->switches = 0;
+        thread->preemptions = 0;
+    }
+    return thread;
+}
+
+/** thread_adopt_boot_context:
+ * Makes the code running on this CPU its idle thread
+ */
+static void thread_adopt_boot_context(struct cpu *cpu, u32int tick_hz)
+{
+    static const char run_lock_prefix[] = "run_queue";
+    struct thread *idle = thread_alloc("idle");
+    u32int i;
+
+    idle->state = THREAD_RUNNING;
+    idle->stack = 0;
+    idle->cpu = cpu->index;
+    idle->pinned = 1;
+    idle->on_cpu = 1;
+    idle->switches = 1;
+    cpu->idle = idle;
+    cpu->current = idle;
+
+    // SMP_MAX_CPUS is below 10, so the index is one digit
+    for (i = 0; run_lock_prefix[i] != '\0'; i++) {
+        cpu->run_lock_name[i] = run_lock_prefix[i];
+    }
+    cpu->run_lock_name[i++] = '0' + cpu->index;
+    cpu->run_lock_name[i] = '\0';
+    cpu->run_lock.name = cpu->run_lock_name;
+    spinlock_register(&cpu->run_lock);
+
+    cpu->tick_hz = tick_hz;
+    cpu->switch_tsc = clock_cycles();
+    cpu->slice_left = thread_slice_ticks(cpu);
+}
+
+void thread_init(void)
+{
+    thread_adopt_boot_context(cpu_this(), clock_hz());
+    threads_ready = 1;
+}
+
+void thread_init_ap(void)
+{
+    thread_adopt_boot_context(cpu_this(), SMP_AP_TICK_HZ);
+}
+
+/** thread_spawn:
+ * Builds a thread's first frame and queues it on cpu
+ */
+static struct thread *thread_spawn(const char *name, void (*entry)(u32int arg), u32int arg, struct cpu *cpu, u8int pinned)
+{
+    struct thread *thread;
+    u32int *sp;
+    u32int flags;
+
+    if (!threads_ready) {
+        return 0;
+    }
+
+    flags = irq_save();
+    thread = thread_alloc(name);
+    if (thread == 0) {
+        irq_restore(flags);
+        return 0;
+    }
+    thread->stack = pmm_alloc_pages(THREAD_STACK_ORDER);
+    if (thread->stack == 0) {
+        thread->state = THREAD_UNUSED;
+        irq_restore(flags);
+        return 0;
+    }
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->pinned = pinned;
+
+    // The frame thread_switch pops, returning into thread_start
+    sp = (u32int *) (thread->stack + THREAD_STACK_SIZE);
+    *--sp = 0;                          // thread_start never returns
+    *--sp = (u32int) thread_start;
+    *--sp = 0;                          // ebp
+    *--sp = 0;                          // ebx
+    *--sp = 0;                          // esi
+    *--sp = 0;                          // edi
+    *--sp = THREAD_INITIAL_EFLAGS;
+    thread->esp = (u32int) sp;
+
+    thread_run_queue_push(cpu, thread);
+    irq_restore(flags);
+    return thread;
+}
+
+/** thread_create:
+ * Starts a kernel thread on the calling CPU
+ */
+struct thread *thread_create(const char *name, void (*entry)(u32int arg), u32int arg)
+{
+    return thread_spawn(name, entry, arg, cpu_this(), 0);
+}
+
+struct thread *thread_create_on(const char *name, void (*entry)(u32int arg), u32int arg, u32int cpu)
+{
+    if (cpu >= smp_cpu_count()) {
+        return 0;
+    }
+    return thread_spawn(name, entry, arg, smp_get_cpu(cpu), 1);
+}
+
+/** thread_current:
+ * Returns the running thread, read in one instruction so a migration
+ * cannot pair one CPU's area with another's current
+ */
+struct thread *thread_current(void)
+{
+    return cpu_read(current);
+}
+
+void thread_yield(void)
+{
+    u32int flags = irq_save();
+
+    if (threads_ready) {
+        thread_schedule();
+    }
+    irq_restore(flags);
+}
+
+void thread_exit(void)
+{
+    irq_save();
+    cpu_this()->current->state = THREAD_DEAD;
+    thread_schedule();
+    // Not reached: nothing switches back to a dead thread
+    while (1) {
+        __asm__ volatile("hlt");
+    }
+}
+
+/** thread_idle:
+ * Runs local work, steals from other CPUs, and halts until an interrupt or
+ * a reschedule IPI when there is neither
+ */
+void thread_idle(void)
+{
+    struct cpu *cpu = cpu_this();
+
+    while (1) {
+        irq_disable();
+        // Pairs with the barrier in thread_run_queue_push
+        atomic_xchg(&cpu->halted, 1);
+        if (cpu->run_count > 0 || thread_stealable(cpu)) {
+            cpu->halted = 0;
+            thread_schedule();
+            irq_enable();
+            continue;
+        }
+        // The boot CPU stops the PIT tick, an AP its own timer
+        if (cpu->index == 0) {
+            clock_idle_enter();
+        } else {
+            thread_tick_stop(cpu);
+        }
+        irq_wait();
+        cpu->halted = 0;
+    }
+}
+
+/** thread_tick:
+ * Uses up one tick of the running thread's slice
+ */
+void thread_tick(void)
+{
+    struct cpu *cpu = cpu_this();
+
+    if (cpu->current == 0) {
+        return;
+    }
+    if (cpu->slice_left > 0) {
+        cpu->slice_left--;
+    }
+    if (cpu->slice_left == 0 && cpu->run_count > 0) {
+        cpu->need_resched = 1;
+    }
+}
+
+/** thread_preempt:
+ * Switches thread at the end of an interrupt if one is due
+ */
+void thread_preempt(void)
+{
+    struct cpu *cpu = cpu_this();
+
+    if (cpu->current == 0 || !cpu->need_resched) {
+        return;
+    }
+    cpu->need_resched = 0;
+    if (cpu->current != cpu->idle) {
+        cpu->current->preemptions++;
+    }
+    thread_schedule();
+}
+
+static void thread_sleep_wake(u32int queue)
+{
+    wait_queue_wake((struct wait_queue *) queue);
+}
+
+/** thread_sleep_ms:
+ * Blocks the calling thread on a timer
+ */
+void thread_sleep_ms(u32int ms)
+{
+    struct wait_queue queue = WAIT_QUEUE_INIT;
+    struct timer timer = TIMER_INIT;
+
+    timer_start(&timer, clock_cycles() + (u64int) ms * clock_tsc_khz(), thread_sleep_wake, (u32int) &queue);
+    while (timer.pending) {
+        u32int ticket = wait_queue_prepare(&queue);
+
+        if (timer.pending) {
+            wait_queue_sleep(&queue, ticket);
+        }
+    }
+    // queue and timer live on this stack until the wake is done with them
+    while (timer.running) {
+        cpu_relax();
+    }
+}
+
+const struct thread *thread_get(u32int index)
+{
+    return &threads[index];
+}
+
+u32int wait_queue_prepare(struct wait_queue *queue)
+{
+    u32int ticket = queue->wakeups;
+
+    // Read the count before the caller reads its condition
+    smp_mb();
+    return ticket;
+}
+
+/** wait_queue_sleep:
+ * Blocks the calling thread on queue unless it was woken since ticket.
+ * Without threads, waits for the next interrupt instead and lets the
+ * caller check its condition again.
+ */
+void wait_queue_sleep(struct wait_queue *queue, u32int ticket)
+{
+    u32int flags = irq_save();
+    struct cpu *cpu = cpu_this();
+    struct thread *self = cpu->current;
+
+    if (!threads_ready || self == cpu->idle) {
+        if (queue->wakeups == ticket) {
+            irq_wait();
+        }
+        irq_restore(flags);
+        return;
+    }
+
+    spin_lock(&queue->lock);
+    if (queue->wakeups != ticket) {
+        spin_unlock(&queue->lock);
+        irq_restore(flags);
+        return;
+    }
+    self->state = THREAD_BLOCKED;
+    self->next = 0;
+    if (queue->tail != 0) {
+        queue->tail->next = self;
+    } else {
+        queue->head = self;
+    }
+    queue->tail = self;
+    spin_unlock(&queue->lock);
+
+    thread_schedule();
+    irq_restore(flags);
+}
+
+/** wait_queue_wake:
+ * Moves every thread on queue to the run queue of the CPU it last ran on
+ */
+void wait_queue_wake(struct wait_queue *queue)
+{
+    u32int flags = spin_lock_irqsave(&queue->lock);
+    struct thread *thread;
+
+    queue->wakeups++;
+    thread = queue->head;
+    queue->head = 0;
+    queue->tail = 0;
+    spin_unlock(&queue->lock);
+
+    while (thread != 0) {
+        struct thread *next = thread->next;
+
+        thread_run_queue_push(smp_get_cpu(thread->cpu), thread);
+        thread = next;
+    }
+    irq_restore(flags);
+}
@@ -0,0 +1,175 @@
+#ifndef INCLUDE_THREAD_H
+#define INCLUDE_THREAD_H
+
+#include "spinlock.h"
+#include "types.h"
+
+#define THREAD_MAX          32
+#define THREAD_NAME_LENGTH  16
+
+/* Each stack is 2^THREAD_STACK_ORDER frames from the frame allocator */
+#define THREAD_STACK_ORDER  1
+#define THREAD_STACK_SIZE   (4096 << THREAD_STACK_ORDER)
+
+/* Round-robin time slice */
+#define THREAD_SLICE_MS     10
+
+enum thread_state {
+    THREAD_UNUSED = 0,
+    THREAD_READY,       /* on a CPU's run queue */
+    THREAD_RUNNING,
+    THREAD_BLOCKED,     /* on a wait queue */
+    THREAD_DEAD         /* exited, stack not freed yet */
+};
+
+/** A kernel thread. The saved context lives on its own stack; esp is all
+ * the switch needs to find it. */
+struct thread {
+    u32int id;
+    char name[THREAD_NAME_LENGTH];
+    enum thread_state state;
+    u32int esp;
+    u32int stack;               /* base of the stack, 0 for the boot thread */
+    void (*entry)(u32int arg);
+    u32int arg;
+    struct thread *next;        /* run queue or wait queue link */
+    u32int cpu;                 /* CPU it last ran on, or is pinned to */
+    u8int pinned;               /* never moved to another CPU */
+    volatile u8int on_cpu;      /* its stack is still in use by a CPU */
+    u64int cycles;              /* TSC cycles spent running */
+    u32int switches;            /* times switched in */
+    u32int preemptions;         /* times switched out by the timer */
+};
+
+/** FIFO of threads blocked on something. wakeups counts calls to
+ * wait_queue_wake, so a sleeper can tell whether one happened between
+ * checking its condition and going to sleep, even on another CPU. */
+struct wait_queue {
+    struct thread *head;
+    struct thread *tail;
+    struct spinlock lock;
+    volatile u32int wakeups;
+};
+
+#define WAIT_QUEUE_INIT {0, 0, SPINLOCK_INIT(0), 0}
+
+/** thread_init:
+ * Turns the boot context into the idle thread. Call before creating any
+ * thread and before interrupts are enabled.
+ */
+void thread_init(void);
+
+/** thread_init_ap:
+ * Turns the boot context of an application processor into its idle
+ * thread. Called by the AP itself once its per-CPU area is loaded.
+ */
+void thread_init_ap(void);
+
+/** thread_create:
+ * Starts a kernel thread. It is queued on the calling CPU and starts with
+ * interrupts enabled; idle CPUs may steal it. Returning from entry ends
+ * it.
+ *
+ * @param name  Name shown by ps, truncated to THREAD_NAME_LENGTH - 1
+ * @param entry The thread function
+ * @param arg   Its argument
+ * @return The thread, or 0 if there is no free slot or stack
+ */
+struct thread *thread_create(const char *name, void (*entry)(u32int arg), u32int arg);
+
+/** thread_create_on:
+ * Like thread_create, but the thread only ever runs on one CPU. Threads
+ * that share state with that CPU's interrupt handlers, like the terminal,
+ * use this.
+ *
+ * @param name  Name shown by ps
+ * @param entry The thread function
+ * @param arg   Its argument
+ * @param cpu   Index of the CPU
+ * @return The thread, or 0 if there is no free slot or stack
+ */
+struct thread *thread_create_on(const char *name, void (*entry)(u32int arg), u32int arg, u32int cpu);
+
+/** thread_current:
+ * Returns the running thread
+ */
+struct thread *thread_current(void);
+
+/** thread_yield:
+ * Gives the rest of the time slice to the next ready thread
+ */
+void thread_yield(void);
+
+/** thread_exit:
+ * Ends the calling thread. Its stack is freed after the next switch.
+ */
+void thread_exit(void);
+
+/** thread_sleep_ms:
+ * Blocks the calling thread for at least ms milliseconds
+ *
+ * @param ms The time to sleep
+ */
+void thread_sleep_ms(u32int ms);
+
+/** thread_idle:
+ * Body of each CPU's idle thread: steals work from the other CPUs and
+ * halts when there is none. Never returns.
+ */
+void thread_idle(void);
+
+/** thread_tick:
+ * Called on every timer interrupt of the running CPU to use up the
+ * running thread's slice
+ */
+void thread_tick(void);
+
+/** thread_preempt:
+ * Called on the way out of every interrupt. Switches thread if the slice
+ * ran out or the handler woke a thread while the idle thread was running.
+ */
+void thread_preempt(void);
+
+/** thread_get:
+ * Returns a thread table slot, for listing
+ *
+ * @param index 0 to THREAD_MAX - 1
+ * @return The slot, whose state is THREAD_UNUSED if it is free
+ */
+const struct thread *thread_get(u32int index);
+
+/** wait_queue_prepare:
+ * Samples the queue's wakeup count. Call before checking the condition
+ * being waited for and pass the result to wait_queue_sleep.
+ *
+ * @param queue The queue about to be waited on
+ * @return The ticket for wait_queue_sleep
+ */
+u32int wait_queue_prepare(struct wait_queue *queue);
+
+/** wait_queue_sleep:
+ * Blocks the calling thread on a wait queue until wait_queue_wake. Returns
+ * at once if the queue was woken since wait_queue_prepare returned
+ * ticket, so a wakeup cannot be lost between the check and the sleep.
+ *
+ * @param queue  The queue to wait on
+ * @param ticket What wait_queue_prepare returned
+ */
+void wait_queue_sleep(struct wait_queue *queue, u32int ticket);
+
+/** wait_queue_wake:
+ * Makes every thread on a wait queue ready, each on the CPU it last ran
+ * on. Safe from interrupt handlers and from any CPU.
+ *
+ * @param queue The queue to wake
+ */
+void wait_queue_wake(struct wait_queue *queue);
+
+/** thread_switch:
+ * Saves the callee-saved registers and eflags on the current stack,
+ * stores esp in *save_esp, then loads new_esp and restores the other
+ * thread's registers. Defined in thread_asm.s.
+ */
+void thread_switch(u32int *save_esp, u32int new_esp);
+
+#endif /* INCLUDE_THREAD_H */
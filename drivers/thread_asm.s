@@ -0,0 +1,28 @@
+; Kernel thread context switch
+
+global thread_switch
+
+; thread_switch - saves the current context and resumes another thread
+; stack: [esp + 8] the esp to switch to
+;        [esp + 4] where to store the current esp
+;        [esp    ] the return address
+; The saved context is, from the top of the stack down: return address,
+; ebp, ebx, esi, edi, eflags. eax, ecx and edx are caller-saved. eflags
+; carries IF, so a thread switched out inside an interrupt handler comes
+; back with interrupts off and one that yielded gets its own state back.
+thread_switch:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushfd
+    mov [eax], esp
+    mov esp, edx
+    popfd
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
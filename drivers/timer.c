@@ -0,0 +1,93 @@
+#include "timer.h"
+#include "atomic.h"
+#include "irq.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "types.h"
+
+/* Pending timers, earliest deadline first. Threads on any CPU start timers
+ * while the boot CPU's tick runs them; timers_lock guards every access. */
+static struct timer *timers = 0;
+static SPINLOCK_DEFINE(timers_lock, "timers");
+
+/** timer_start:
+ * Inserts the timer in deadline order. A new earliest deadline kicks the
+ * boot CPU out of tickless idle, which armed its timer for the old one.
+ */
+void timer_start(struct timer *timer, u64int deadline, void (*fn)(u32int arg), u32int arg)
+{
+    u32int flags = spin_lock_irqsave(&timers_lock);
+    struct timer **link = &timers;
+    struct cpu *boot = smp_get_cpu(0);
+
+    timer->deadline = deadline;
+    timer->fn = fn;
+    timer->arg = arg;
+    while (*link != 0 && (*link)->deadline <= deadline) {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link = timer;
+    timer->pending = 1;
+    spin_unlock_irqrestore(&timers_lock, flags);
+
+    // Pairs with the barrier in thread_idle: either the boot CPU's
+    // timer_next sees this timer or we see it halted. On the boot CPU
+    // itself the interrupt that got here already ends the hlt.
+    smp_mb();
+    if (link == &timers && cpu_read(index) != 0 && boot->halted &&
+        atomic_xchg(&boot->halted, 0)) {
+        smp_kick(boot);
+    }
+}
+
+void timer_cancel(struct timer *timer)
+{
+    u32int flags = spin_lock_irqsave(&timers_lock);
+    struct timer **link = &timers;
+
+    while (*link != 0 && *link != timer) {
+        link = &(*link)->next;
+    }
+    if (*link != 0) {
+        *link = timer->next;
+        timer->pending = 0;
+    }
+    spin_unlock_irqrestore(&timers_lock, flags);
+}
+
+u8int timer_next(u64int *deadline)
+{
+    u32int flags = spin_lock_irqsave(&timers_lock);
+    u8int found = (timers != 0);
+
+    if (found) {
+        *deadline = timers->deadline;
+    }
+    spin_unlock_irqrestore(&timers_lock, flags);
+    return found;
+}
+
+/** timer_run:
+ * Pops and fires expired timers. Interrupts are off. A timer is unlinked
+ * and no longer pending before its fn runs, so a thread fn wakes cannot
+ * take it for still queued and sleep again. The lock is dropped around
+ * each fn so it may start timers itself.
+ */
+void timer_run(u64int now)
+{
+    spin_lock(&timers_lock);
+    while (timers != 0 && timers->deadline <= now) {
+        struct timer *timer = timers;
+
+        timers = timer->next;
+        timer->running = 1;
+        timer->pending = 0;
+        spin_unlock(&timers_lock);
+        timer->fn(timer->arg);
+        __asm__ volatile("" : : : "memory");
+        timer->running = 0;
+        spin_lock(&timers_lock);
+    }
+    spin_unlock(&timers_lock);
+}
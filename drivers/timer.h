@@ -0,0 +1,55 @@
+#ifndef INCLUDE_TIMER_H
+#define INCLUDE_TIMER_H
+
+#include "types.h"
+
+/** A one-shot software timer. The caller owns the storage, which must stay
+ * valid until the timer fires or is cancelled. pending is cleared under
+ * the lock before fn runs, so a thread fn wakes sees it 0. running is set
+ * while fn runs: once both read 0 the timer code is done with the timer
+ * and with whatever fn touched. Timers fire on the boot CPU. */
+struct timer {
+    u64int deadline;            /* TSC value to fire at */
+    void (*fn)(u32int arg);     /* runs in interrupt context */
+    u32int arg;
+    struct timer *next;
+    volatile u8int pending;
+    volatile u8int running;
+};
+
+#define TIMER_INIT {0, 0, 0, 0, 0, 0}
+
+/** timer_start:
+ * Queues a timer, ordered by deadline
+ *
+ * @param timer    The timer
+ * @param deadline TSC value to fire at
+ * @param fn       Called from the timer interrupt once the deadline passes
+ * @param arg      Its argument
+ */
+void timer_start(struct timer *timer, u64int deadline, void (*fn)(u32int arg), u32int arg);
+
+/** timer_cancel:
+ * Removes a timer that has not fired yet
+ *
+ * @param timer The timer
+ */
+void timer_cancel(struct timer *timer);
+
+/** timer_next:
+ * Returns the earliest pending deadline
+ *
+ * @param deadline Receives the TSC value
+ * @return 1 if a timer is pending, 0 otherwise
+ */
+u8int timer_next(u64int *deadline);
+
+/** timer_run:
+ * Fires every timer whose deadline is not after now. Called from the
+ * timer interrupts.
+ *
+ * @param now The current TSC value
+ */
+void timer_run(u64int now);
+
+#endif /* INCLUDE_TIMER_H */
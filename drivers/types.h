@@ -1,6 +1,8 @@
 #ifndef INCLUDE_TYPES_H
 #define INCLUDE_TYPES_H
 
+typedef unsigned long long u64int;
+typedef long long s64int;
 typedef unsigned int u32int;
 typedef int s32int;
 typedef unsigned short u16int;
@@ -8,6 +10,10 @@ typedef short s16int;
 typedef unsigned char u8int;
 typedef char s8int;
 
+/* For small helpers that must not cost a call. The kernel is built
+ * without optimisation, so plain inline is not enough to get rid of it. */
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
 /* Framebuffer colors */
 #define BLACK 0
 #define BLUE 1
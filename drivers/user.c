@@ -0,0 +1,120 @@
+#include "user.h"
+#include "frame_buffer.h"
+#include "gdt.h"
+#include "initcall.h"
+#include "klib.h"
+#include "paging.h"
+#include "smp.h"
+#include "syscall.h"
+#include "types.h"
+
+#define USER_KERNEL_STACK_SIZE 8192
+
+/* Stack for interrupts and system calls that arrive from ring 3. Only one
+ * program runs at a time, so one stack is enough. */
+static u8int user_kernel_stack[USER_KERNEL_STACK_SIZE] __attribute__((aligned(16)));
+
+static u8int running = 0;
+
+/** user_init:
+ * Kernel stack for ring 3 and the system call entry points of the boot
+ * CPU, the only one user_run allows. Nothing needs them until the first
+ * program runs.
+ */
+static void user_init(void)
+{
+    gdt_set_kernel_stack(user_kernel_stack_top());
+    syscall_init();
+}
+static INITCALL(90, "user", user_init, INITCALL_LAZY);
+
+void user_prepare(void)
+{
+    initcall_require(&initcall_user_init);
+}
+
+u32int user_kernel_stack_top(void)
+{
+    return (u32int) user_kernel_stack + USER_KERNEL_STACK_SIZE;
+}
+
+const struct user_program *user_find(const char *name)
+{
+    const struct user_program *program;
+
+    for (program = user_programs; program->name != 0; program++) {
+        if (strcmp(program->name, name) == 0) {
+            return program;
+        }
+    }
+    return 0;
+}
+
+u8int user_is_address(u32int addr, u32int len)
+{
+    return addr >= USER_BASE && len <= USER_SIZE && addr - USER_BASE <= USER_SIZE - len;
+}
+
+/** user_run:
+ * Builds the initial user stack and enters ring 3
+ */
+s32int user_run(const struct user_program *program, u32int argc, char **argv)
+{
+    u32int sp = USER_STACK_TOP;
+    u32int user_argv[USER_MAX_ARGS + 1];
+    u32int *stack;
+    u32int i;
+    s32int status;
+
+    // The TSS and SYSENTER stack are only set up on the boot CPU
+    if (running || cpu_read(index) != 0 || argc > USER_MAX_ARGS || !paging_user_ready()) {
+        return -1;
+    }
+    user_prepare();
+
+    // Strings first, then the argv array, then user_start's arguments
+    for (i = argc; i-- > 0;) {
+        u32int len = strlen(argv[i]) + 1;
+
+        sp -= len;
+        memcpy((void *) sp, argv[i], len);
+        user_argv[i] = sp;
+    }
+    user_argv[argc] = 0;
+    sp &= ~3u;
+    sp -= (argc + 1) * sizeof(u32int);
+    for (i = 0; i <= argc; i++) {
+        ((u32int *) sp)[i] = user_argv[i];
+    }
+
+    stack = (u32int *) sp - 4;
+    stack[0] = 0;                       // user_start never returns
+    stack[1] = (u32int) program->main;
+    stack[2] = argc;
+    stack[3] = sp;
+
+    running = 1;
+    status = user_enter((u32int) user_start, (u32int) stack);
+    running = 0;
+    return status;
+}
+
+void user_exit(s32int status)
+{
+    if (running) {
+        user_return(status);
+    }
+}
+
+/** user_kill:
+ * Reports a fault in user code and ends the program
+ */
+void user_kill(const char *reason, u32int eip)
+{
+    fb_puts("\nuser program killed: ");
+    fb_puts((char *) reason);
+    fb_puts(" at eip=");
+    fb_put_hex(eip);
+    fb_putc('\n');
+    user_exit(-1);
+}
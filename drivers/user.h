@@ -0,0 +1,96 @@
+#ifndef INCLUDE_USER_H
+#define INCLUDE_USER_H
+
+#include "types.h"
+
+/* User programs are linked into, and run from, one 4 MB page that is the
+ * only memory ring 3 can touch. Their stack grows down from its top. */
+#define USER_BASE       0x00400000
+#define USER_SIZE       0x00400000
+#define USER_STACK_TOP  (USER_BASE + USER_SIZE)
+
+#define USER_MAX_ARGS   16
+
+/** A program in the user area */
+struct user_program {
+    const char *name;
+    s32int (*main)(u32int argc, char **argv);
+};
+
+/* Defined in user_programs.c, ends with a zero entry */
+extern const struct user_program user_programs[];
+
+/** user_start:
+ * First ring 3 code run for every program: calls main and exits with its
+ * result. Defined in user_programs.c.
+ */
+void user_start(s32int (*main)(u32int argc, char **argv), u32int argc, char **argv);
+
+/** user_prepare:
+ * Sets up the boot CPU's kernel stack for user code and its system call
+ * entry points, the first time it is called. user_run calls it. Call on
+ * the boot CPU.
+ */
+void user_prepare(void);
+
+/** user_kernel_stack_top:
+ * Returns the top of the stack the kernel runs on when entered from ring 3
+ */
+u32int user_kernel_stack_top(void);
+
+/** user_find:
+ * Looks up a user program by name
+ *
+ * @param name The program name
+ * @return The program, or 0 if there is none with that name
+ */
+const struct user_program *user_find(const char *name);
+
+/** user_run:
+ * Runs a program in ring 3 until it exits. The arguments are copied onto
+ * the user stack.
+ *
+ * @param program The program
+ * @param argc    Number of arguments, including the program name
+ * @param argv    The arguments
+ * @return The exit status, or -1 if the program was killed, user mode is
+ *         not available or the caller is not on the boot CPU
+ */
+s32int user_run(const struct user_program *program, u32int argc, char **argv);
+
+/** user_exit:
+ * Ends the running user program and returns from user_run. Called by the
+ * exit system call and when user code faults.
+ *
+ * @param status The value user_run returns
+ */
+void user_exit(s32int status);
+
+/** user_kill:
+ * Reports a fault in user code and ends the program with status -1
+ *
+ * @param reason What went wrong
+ * @param eip    Where it happened
+ */
+void user_kill(const char *reason, u32int eip);
+
+/** user_is_address:
+ * Checks that [addr, addr + len) lies in the user area
+ *
+ * @return 1 if it does
+ */
+u8int user_is_address(u32int addr, u32int len);
+
+/** user_enter:
+ * Saves the kernel context and irets to ring 3. Returns when user_return
+ * is called. Defined in user_asm.s.
+ */
+s32int user_enter(u32int eip, u32int esp);
+
+/** user_return:
+ * Restores the context saved by user_enter and returns status from it.
+ * Defined in user_asm.s.
+ */
+void user_return(s32int status);
+
+#endif /* INCLUDE_USER_H */
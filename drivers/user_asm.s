@@ -0,0 +1,94 @@
+; Ring 3 entry and exit, and the SYSENTER entry point
+
+extern syscall_dispatch
+
+global user_enter
+global user_return
+global sysenter_entry
+
+USER_CODE   equ 0x1B    ; GDT_USER_CODE
+USER_DATA   equ 0x23    ; GDT_USER_DATA
+KERNEL_DATA equ 0x10    ; GDT_KERNEL_DATA
+
+section .bss
+align 4
+saved_esp:
+    resd 1              ; kernel esp saved by user_enter
+
+section .text
+
+; user_enter - saves the callee-saved registers and irets to ring 3
+; stack: [esp + 8] the user stack pointer
+;        [esp + 4] the user entry point
+;        [esp    ] the return address
+; returns the status passed to user_return
+user_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [saved_esp], esp
+    mov eax, [esp + 20]     ; entry point
+    mov ecx, [esp + 24]     ; user stack
+    cli                     ; no interrupt in ring 0 with the user gs
+    mov dx, USER_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    push dword USER_DATA    ; ss
+    push ecx                ; esp
+    pushfd
+    or dword [esp], 0x200   ; interrupts on in ring 3
+    push dword USER_CODE    ; cs
+    push eax                ; eip
+    iret
+
+; user_return - abandons the current kernel stack and returns from
+; user_enter with the given status
+; stack: [esp + 4] the status
+user_return:
+    mov eax, [esp + 4]
+    mov dx, KERNEL_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    str dx                  ; this CPU's area follows its TSS (GDT_CPU_AREA)
+    add dx, 8
+    mov gs, dx
+    mov esp, [saved_esp]
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    sti                     ; an int 0x80 exit arrives with interrupts off
+    ret
+
+; sysenter_entry - kernel side of SYSENTER. The CPU has loaded the kernel
+; cs/ss, esp from IA32_SYSENTER_ESP and cleared IF. The user stub left its
+; return eip in edx and its esp in ecx, as SYSEXIT wants them back.
+sysenter_entry:
+    push ecx                ; user esp
+    push edx                ; user eip
+    mov dx, KERNEL_DATA
+    mov ds, dx
+    mov es, dx
+    str dx                  ; this CPU's area follows its TSS (GDT_CPU_AREA)
+    add dx, 8
+    mov gs, dx
+    sti
+    push edi                ; syscall_dispatch(eax, ebx, esi, edi)
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+    cli
+    mov dx, USER_DATA
+    mov ds, dx
+    mov es, dx
+    mov gs, dx              ; SYSEXIT would leave the kernel gs usable
+    pop edx                 ; user eip
+    pop ecx                 ; user esp
+    sti                     ; takes effect after sysexit
+    sysexit
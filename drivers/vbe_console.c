@@ -0,0 +1,373 @@
+#include "vbe_console.h"
+#include "font.h"
+#include "kheap.h"
+#include "klib.h"
+#include "multiboot.h"
+#include "paging.h"
+#include "types.h"
+
+#define VBE_CELLS          (FB_WIDTH * FB_HEIGHT)
+#define VBE_BACK_PIXELS    (VBE_CONSOLE_WIDTH * VBE_CONSOLE_HEIGHT)
+
+/* Pixels of one text row of the back buffer */
+#define VBE_ROW_PIXELS     (VBE_CONSOLE_WIDTH * VBE_CELL_HEIGHT)
+
+/* The cursor is an underline over the bottom two lines of its cell */
+#define VBE_CURSOR_TOP     14
+
+/* Value in drawn[] of a cell that must be blitted whatever it holds */
+#define VBE_NOT_DRAWN      0xFFFFFFFF
+
+/* The 16 VGA text colours as 0xRRGGBB */
+static const u32int vga_rgb[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+static u8int active = 0;
+static struct vbe_console_mode mode;
+
+/* Top left pixel of the text grid on screen, and the screen pitch in
+ * pixels */
+static u32int *screen_origin;
+static u32int screen_pitch;
+
+/* Off-screen copy of the text grid, VBE_CONSOLE_WIDTH pixels per line */
+static u32int *back;
+
+/* The VGA colours in the screen's pixel format */
+static u32int palette[16];
+
+/* For every glyph row byte, the 8 pixels it covers as all ones or all
+ * zeroes. A glyph row is then bg ^ (mask & (fg ^ bg)) per pixel, with no
+ * branch on the font bits. */
+static u32int row_masks[256][FONT_WIDTH];
+
+/* Character and attribute each cell of the back buffer shows */
+static u32int drawn[VBE_CELLS];
+
+/* Columns [dirty_start, dirty_end) of each text row not yet on screen */
+static u8int dirty_start[FB_HEIGHT];
+static u8int dirty_end[FB_HEIGHT];
+
+/* Cursor cell, and whether the screen lacks it */
+static u32int cursor = VBE_NO_CURSOR;
+static u8int cursor_stale = 0;
+
+static struct vbe_console_stats stats;
+
+/** vbe_console_channel:
+ * Scales an 8-bit colour component to a field of the pixel format
+ */
+static u32int vbe_console_channel(u32int value, u8int position, u8int size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    if (size < 8) {
+        value >>= 8 - size;
+    }
+    return value << position;
+}
+
+static void vbe_console_build_tables(void)
+{
+    u32int i;
+    u32int x;
+
+    for (i = 0; i < 16; i++) {
+        palette[i] = vbe_console_channel((vga_rgb[i] >> 16) & 0xFF, mode.red_position, mode.red_size) |
+                     vbe_console_channel((vga_rgb[i] >> 8) & 0xFF, mode.green_position, mode.green_size) |
+                     vbe_console_channel(vga_rgb[i] & 0xFF, mode.blue_position, mode.blue_size);
+    }
+    for (i = 0; i < 256; i++) {
+        for (x = 0; x < FONT_WIDTH; x++) {
+            row_masks[i][x] = (i >> x) & 1 ? 0xFFFFFFFF : 0;
+        }
+    }
+}
+
+/** vbe_console_mark:
+ * Grows the dirty span of text row y to include columns [x, x + count)
+ */
+static void vbe_console_mark(u32int y, u32int x, u32int count)
+{
+    if (x < dirty_start[y]) {
+        dirty_start[y] = x;
+    }
+    if (x + count > dirty_end[y]) {
+        dirty_end[y] = x + count;
+    }
+}
+
+static void vbe_console_mark_all(void)
+{
+    u32int y;
+
+    for (y = 0; y < FB_HEIGHT; y++) {
+        dirty_start[y] = 0;
+        dirty_end[y] = FB_WIDTH;
+    }
+}
+
+u8int vbe_console_attach(const struct vbe_console_mode *new_mode, u32int *screen, u32int *buffer)
+{
+    u32int y;
+
+    if (new_mode->bpp != 32 || new_mode->pitch % 4 != 0 ||
+        new_mode->width < VBE_CONSOLE_WIDTH || new_mode->height < VBE_CONSOLE_HEIGHT ||
+        new_mode->pitch < new_mode->width * 4) {
+        return 0;
+    }
+    mode = *new_mode;
+    screen_pitch = mode.pitch / 4;
+    screen_origin = screen + (mode.height - VBE_CONSOLE_HEIGHT) / 2 * screen_pitch +
+                    (mode.width - VBE_CONSOLE_WIDTH) / 2;
+    back = buffer;
+    vbe_console_build_tables();
+
+    // Black is 0 in any format
+    for (y = 0; y < mode.height; y++) {
+        memset(screen + y * screen_pitch, 0, mode.width * 4);
+    }
+    memset(back, 0, VBE_BACK_PIXELS * 4);
+    vbe_console_invalidate();
+    for (y = 0; y < FB_HEIGHT; y++) {
+        dirty_start[y] = FB_WIDTH;
+        dirty_end[y] = 0;
+    }
+    cursor = VBE_NO_CURSOR;
+    cursor_stale = 0;
+    active = 1;
+    return 1;
+}
+
+/** vbe_console_find_mode:
+ * Fills in the framebuffer format from the multiboot information
+ *
+ * @return 1 if the loader left a direct colour linear framebuffer
+ */
+static u8int vbe_console_find_mode(const struct multiboot_info *mbi, struct vbe_console_mode *found)
+{
+    if (mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER) {
+        if (mbi->framebuffer_type != MULTIBOOT_FRAMEBUFFER_RGB ||
+            (mbi->framebuffer_addr >> 32) != 0) {
+            return 0;
+        }
+        found->phys = (u32int) mbi->framebuffer_addr;
+        found->pitch = mbi->framebuffer_pitch;
+        found->width = mbi->framebuffer_width;
+        found->height = mbi->framebuffer_height;
+        found->bpp = mbi->framebuffer_bpp;
+        found->red_position = mbi->red_field_position;
+        found->red_size = mbi->red_mask_size;
+        found->green_position = mbi->green_field_position;
+        found->green_size = mbi->green_mask_size;
+        found->blue_position = mbi->blue_field_position;
+        found->blue_size = mbi->blue_mask_size;
+        return 1;
+    }
+    if (mbi->flags & MULTIBOOT_INFO_VBE) {
+        const struct vbe_mode_info *info = (const struct vbe_mode_info *) (unsigned long) mbi->vbe_mode_info;
+
+        if (info->memory_model != VBE_MEMORY_MODEL_DIRECT || info->framebuffer == 0) {
+            return 0;
+        }
+        found->phys = info->framebuffer;
+        found->pitch = info->pitch;
+        found->width = info->width;
+        found->height = info->height;
+        found->bpp = info->bpp;
+        found->red_position = info->red_position;
+        found->red_size = info->red_mask_size;
+        found->green_position = info->green_position;
+        found->green_size = info->green_mask_size;
+        found->blue_position = info->blue_position;
+        found->blue_size = info->blue_mask_size;
+        return 1;
+    }
+    return 0;
+}
+
+u8int vbe_console_init(const struct multiboot_info *mbi)
+{
+    struct vbe_console_mode found;
+    u32int screen;
+    u32int *buffer;
+
+    if (mbi == 0 || !vbe_console_find_mode(mbi, &found)) {
+        return 0;
+    }
+    // The firmware's MTRRs decide the caching of the framebuffer
+    screen = paging_map_physical(found.phys, found.pitch * found.height, PAGING_WRITABLE);
+    if (screen == 0) {
+        return 0;
+    }
+    buffer = kmalloc(VBE_BACK_PIXELS * 4);
+    if (buffer == 0) {
+        return 0;
+    }
+    if (!vbe_console_attach(&found, (u32int *) (unsigned long) screen, buffer)) {
+        kfree(buffer);
+        return 0;
+    }
+    return 1;
+}
+
+u8int vbe_console_active(void)
+{
+    return active;
+}
+
+/** vbe_console_blit:
+ * Draws one cell into the back buffer. The attribute is read as VGA text
+ * mode does with blinking on: foreground in the low nibble, background in
+ * the next three bits.
+ */
+static void vbe_console_blit(u32int i, u32int cell)
+{
+    const u8int *glyph = font_glyph((u8int) cell);
+    u32int fg = palette[(cell >> 8) & 0x0F];
+    u32int bg = palette[(cell >> 12) & 0x07];
+    u32int diff = fg ^ bg;
+    u32int *line = back + i / FB_WIDTH * VBE_ROW_PIXELS + i % FB_WIDTH * VBE_CELL_WIDTH;
+    u32int row;
+    u32int x;
+
+    for (row = 0; row < FONT_ROWS; row++) {
+        const u32int *mask = row_masks[glyph[row]];
+
+        for (x = 0; x < FONT_WIDTH; x++) {
+            u32int pixel = bg ^ (mask[x] & diff);
+
+            line[x] = pixel;
+            line[x + VBE_CONSOLE_WIDTH] = pixel;
+        }
+        line += 2 * VBE_CONSOLE_WIDTH;
+    }
+}
+
+void vbe_console_draw(u32int i, const u16int *cells, u32int count)
+{
+    u32int k;
+
+    if (!active || i + count > VBE_CELLS) {
+        return;
+    }
+    for (k = 0; k < count; k++) {
+        if (drawn[i + k] == cells[k]) {
+            stats.glyphs_skipped++;
+            continue;
+        }
+        vbe_console_blit(i + k, cells[k]);
+        drawn[i + k] = cells[k];
+        vbe_console_mark((i + k) / FB_WIDTH, (i + k) % FB_WIDTH, 1);
+        stats.glyphs_drawn++;
+    }
+}
+
+void vbe_console_scroll(void)
+{
+    if (!active) {
+        return;
+    }
+    memmove(back, back + VBE_ROW_PIXELS, (VBE_BACK_PIXELS - VBE_ROW_PIXELS) * 4);
+    memmove(drawn, drawn + FB_WIDTH, (VBE_CELLS - FB_WIDTH) * sizeof(drawn[0]));
+    memset(&drawn[VBE_CELLS - FB_WIDTH], 0xFF, FB_WIDTH * sizeof(drawn[0]));
+    vbe_console_mark_all();
+    stats.scrolls++;
+}
+
+void vbe_console_set_cursor(u32int pos)
+{
+    if (pos == cursor) {
+        return;
+    }
+    // The back buffer never has the cursor: copying the cell erases it
+    if (cursor != VBE_NO_CURSOR) {
+        vbe_console_mark(cursor / FB_WIDTH, cursor % FB_WIDTH, 1);
+    }
+    cursor = pos < VBE_CELLS ? pos : VBE_NO_CURSOR;
+    cursor_stale = 1;
+}
+
+/** vbe_console_draw_cursor:
+ * Draws the cursor straight onto the screen in the foreground colour of
+ * the cell under it
+ */
+static void vbe_console_draw_cursor(void)
+{
+    u32int *line;
+    u32int fg;
+    u32int row;
+    u32int x;
+
+    if (cursor == VBE_NO_CURSOR) {
+        return;
+    }
+    fg = palette[drawn[cursor] == VBE_NOT_DRAWN ? FB_LIGHT_GREY : (drawn[cursor] >> 8) & 0x0F];
+    line = screen_origin + (cursor / FB_WIDTH * VBE_CELL_HEIGHT + VBE_CURSOR_TOP) * screen_pitch +
+           cursor % FB_WIDTH * VBE_CELL_WIDTH;
+    for (row = VBE_CURSOR_TOP; row < VBE_CELL_HEIGHT; row++) {
+        for (x = 0; x < VBE_CELL_WIDTH; x++) {
+            line[x] = fg;
+        }
+        line += screen_pitch;
+    }
+}
+
+void vbe_console_present(void)
+{
+    u8int copied = 0;
+    u32int y;
+
+    if (!active) {
+        return;
+    }
+    for (y = 0; y < FB_HEIGHT; y++) {
+        u32int width;
+        u32int offset;
+        u32int line;
+
+        if (dirty_start[y] >= dirty_end[y]) {
+            continue;
+        }
+        width = (dirty_end[y] - dirty_start[y]) * VBE_CELL_WIDTH;
+        offset = dirty_start[y] * VBE_CELL_WIDTH;
+        for (line = y * VBE_CELL_HEIGHT; line < (y + 1) * VBE_CELL_HEIGHT; line++) {
+            memcpy(screen_origin + line * screen_pitch + offset,
+                   back + line * VBE_CONSOLE_WIDTH + offset, width * 4);
+        }
+        if (cursor / FB_WIDTH == y && cursor % FB_WIDTH >= dirty_start[y] &&
+            cursor % FB_WIDTH < dirty_end[y]) {
+            cursor_stale = 1;
+        }
+        dirty_start[y] = FB_WIDTH;
+        dirty_end[y] = 0;
+        stats.rects++;
+        stats.pixels += width * VBE_CELL_HEIGHT;
+        copied = 1;
+    }
+    if (cursor_stale) {
+        vbe_console_draw_cursor();
+        cursor_stale = 0;
+    }
+    if (copied) {
+        stats.presents++;
+    }
+}
+
+void vbe_console_invalidate(void)
+{
+    memset(drawn, 0xFF, sizeof(drawn));
+}
+
+const struct vbe_console_mode *vbe_console_get_mode(void)
+{
+    return active ? &mode : 0;
+}
+
+const struct vbe_console_stats *vbe_console_get_stats(void)
+{
+    return &stats;
+}
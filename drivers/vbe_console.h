@@ -0,0 +1,129 @@
+#ifndef INCLUDE_VBE_CONSOLE_H
+#define INCLUDE_VBE_CONSOLE_H
+
+#include "frame_buffer.h"
+#include "types.h"
+
+struct multiboot_info;
+
+/* Character cells are 8x16 pixels: every font row is drawn twice, as in
+ * the VGA text modes */
+#define VBE_CELL_WIDTH      8
+#define VBE_CELL_HEIGHT     16
+
+/* The text grid of the frame_buffer driver in pixels, 640x400. Bigger
+ * screens show it centred on black. */
+#define VBE_CONSOLE_WIDTH   (FB_WIDTH * VBE_CELL_WIDTH)
+#define VBE_CONSOLE_HEIGHT  (FB_HEIGHT * VBE_CELL_HEIGHT)
+
+/* Mode the multiboot header asks for when built with make VBE=1 */
+#define VBE_REQUEST_WIDTH   640
+#define VBE_REQUEST_HEIGHT  480
+#define VBE_REQUEST_BPP     32
+
+/* Position passed to vbe_console_set_cursor to hide the cursor */
+#define VBE_NO_CURSOR       0xFFFFFFFF
+
+/** A linear framebuffer: 32 bits per pixel with the colour fields at the
+ * given bit positions */
+struct vbe_console_mode {
+    u32int phys;                /* physical address */
+    u32int pitch;               /* bytes per scan line */
+    u32int width;               /* in pixels */
+    u32int height;
+    u8int bpp;
+    u8int red_position;
+    u8int red_size;
+    u8int green_position;
+    u8int green_size;
+    u8int blue_position;
+    u8int blue_size;
+};
+
+/** Rendering counters */
+struct vbe_console_stats {
+    u32int glyphs_drawn;        /* cells blitted into the back buffer */
+    u32int glyphs_skipped;      /* cells that already showed the character */
+    u32int scrolls;             /* back buffer moved up a text row */
+    u32int presents;            /* vbe_console_present calls that copied */
+    u32int rects;               /* dirty rectangles copied to the screen */
+    u32int pixels;              /* pixels copied to the screen */
+};
+
+/** vbe_console_init:
+ * Takes over the linear framebuffer the boot loader set up, if it left a
+ * 32-bit direct colour mode of at least VBE_CONSOLE_WIDTH x
+ * VBE_CONSOLE_HEIGHT. Reads the multiboot framebuffer fields, or failing
+ * those the VBE mode information. Maps the framebuffer and allocates the
+ * back buffer, so call after paging_init.
+ *
+ * @param mbi The multiboot information
+ * @return 1 if the console now draws to the framebuffer
+ */
+u8int vbe_console_init(const struct multiboot_info *mbi);
+
+/** vbe_console_attach:
+ * Starts drawing to a framebuffer that is already mapped, clearing it
+ *
+ * @param mode   The framebuffer format
+ * @param screen The framebuffer, mode->height lines of mode->pitch bytes
+ * @param back   VBE_CONSOLE_WIDTH x VBE_CONSOLE_HEIGHT pixels of RAM
+ * @return 1 on success, 0 if the mode is not supported
+ */
+u8int vbe_console_attach(const struct vbe_console_mode *mode, u32int *screen, u32int *back);
+
+/** vbe_console_active:
+ * Returns whether the console draws to a framebuffer
+ */
+u8int vbe_console_active(void);
+
+/** vbe_console_draw:
+ * Renders count cells of the text grid, starting at cell i, into the back
+ * buffer. Cells that already show the same character and attribute are
+ * skipped. Changed cells are copied to the screen by vbe_console_present.
+ *
+ * @param i     First cell, row * FB_WIDTH + column
+ * @param cells Character and VGA attribute pairs, as in text memory
+ * @param count Number of cells, not past the end of the row
+ */
+void vbe_console_draw(u32int i, const u16int *cells, u32int count);
+
+/** vbe_console_scroll:
+ * Moves the back buffer up one text row. The bottom row must be drawn
+ * again before the next present.
+ */
+void vbe_console_scroll(void);
+
+/** vbe_console_set_cursor:
+ * Moves the underline cursor
+ *
+ * @param pos The cell, or VBE_NO_CURSOR
+ */
+void vbe_console_set_cursor(u32int pos);
+
+/** vbe_console_present:
+ * Copies the dirty rectangles of the back buffer to the screen and draws
+ * the cursor over them
+ */
+void vbe_console_present(void);
+
+/** vbe_console_invalidate:
+ * Forgets what every cell shows, so the next draw of each blits it
+ */
+void vbe_console_invalidate(void);
+
+/** vbe_console_get_mode:
+ * Returns the framebuffer format in use
+ *
+ * @return The mode, or 0 when not active
+ */
+const struct vbe_console_mode *vbe_console_get_mode(void);
+
+/** vbe_console_get_stats:
+ * Returns the rendering counters
+ *
+ * @return Pointer to the counters
+ */
+const struct vbe_console_stats *vbe_console_get_stats(void);
+
+#endif /* INCLUDE_VBE_CONSOLE_H */
@@ -0,0 +1,298 @@
+#include "host/host.h"
+#include "drivers/deferred.h"
+#include "drivers/input_buffer.h"
+#include "drivers/keyboard.h"
+#include "drivers/klib.h"
+#include "drivers/terminal.h"
+#include "drivers/vbe_console.h"
+#include "drivers/types.h"
+
+/* Throughput of the input path and the command parser, built for Linux by
+ * make host-bench. Each case runs a fixed amount of work and prints the
+ * rate, so runs on the same machine can be compared. */
+
+#define BENCH_SCAN_CODES    20000000
+#define BENCH_RING_BYTES    50000000
+#define BENCH_LINES         2000000
+#define BENCH_KLIB_CALLS    500000
+#define BENCH_KLIB_SIZE     4096
+#define BENCH_VBE_ROWS      200000
+#define BENCH_VBE_REDRAWS   20000
+
+/* Typing "ls -la" and Enter, with Shift around the dash: presses and
+ * releases as the keyboard sends them */
+static const u8int typing[] = {
+    0x26, 0xA6, 0x1F, 0x9F, 0x39, 0xB9,
+    0x2A, 0x0C, 0x8C, 0xAA,
+    0x26, 0xA6, 0x1E, 0x9E, 0x1C, 0x9C
+};
+
+static u32int sink = 0;
+
+/** bench_report:
+ * Prints the rate and the time per item
+ */
+static void bench_report(const char *name, u64int items, u64int ns)
+{
+    u64int per_second = ns != 0 ? items * 1000000000ull / ns : 0;
+    u64int tenths = items != 0 ? ns * 10 / items : 0;
+
+    host_printf("%-20s %11llu/s %6llu.%llu ns\n", name, (unsigned long long) per_second,
+                (unsigned long long) (tenths / 10), (unsigned long long) (tenths % 10));
+}
+
+/** bench_keyboard_work:
+ * What interrupts_keyboard_work does with a scan code, minus the echo and
+ * the scrollback keys
+ */
+static void bench_keyboard_work(u32int scan_code)
+{
+    u8int key = keyboard_process_scan_code((u8int) scan_code);
+
+    if (key != 0 && key < 0x80) {
+        input_buffer_put(key);
+    }
+}
+
+/** bench_drain:
+ * Empties the ring the way readline does, a chunk at a time
+ */
+static void bench_drain(void)
+{
+    u8int chunk[32];
+    u32int got;
+
+    while ((got = input_buffer_read(chunk, sizeof(chunk))) != 0) {
+        sink += chunk[got - 1];
+    }
+}
+
+/** bench_scan_codes:
+ * The keyboard handler with deferral off: port read, key state machine
+ * and ring, drained every 64 scan codes
+ */
+static void bench_scan_codes(void)
+{
+    u64int start = host_now_ns();
+    u32int i;
+
+    for (i = 0; i < BENCH_SCAN_CODES; i++) {
+        host_port_set(0x60, typing[i % sizeof(typing)]);
+        bench_keyboard_work(keyboard_read_scan_code());
+        if ((i & 63) == 63) {
+            bench_drain();
+        }
+    }
+    bench_report("scan_codes_inline", BENCH_SCAN_CODES, host_now_ns() - start);
+}
+
+/** bench_scan_codes_deferred:
+ * The keyboard handler with deferral on: the handler only queues the scan
+ * code and deferred_run does the rest, as readline would
+ */
+static void bench_scan_codes_deferred(void)
+{
+    u64int start = host_now_ns();
+    u32int i;
+
+    for (i = 0; i < BENCH_SCAN_CODES; i++) {
+        host_port_set(0x60, typing[i % sizeof(typing)]);
+        deferred_queue(bench_keyboard_work, keyboard_read_scan_code());
+        if ((i & 31) == 31) {
+            deferred_run();
+            bench_drain();
+        }
+    }
+    deferred_run();
+    bench_drain();
+    bench_report("scan_codes_deferred", BENCH_SCAN_CODES, host_now_ns() - start);
+}
+
+/** bench_ring:
+ * Bytes through the ring, filled then emptied in bursts of 128
+ */
+static void bench_ring(void)
+{
+    u64int start = host_now_ns();
+    u32int i;
+
+    for (i = 0; i < BENCH_RING_BYTES; i++) {
+        input_buffer_put((u8int) i);
+        if ((i & 127) == 127) {
+            bench_drain();
+        }
+    }
+    bench_drain();
+    bench_report("ring_bytes", BENCH_RING_BYTES, host_now_ns() - start);
+}
+
+/** bench_readline:
+ * Whole lines from the ring through readline
+ */
+static void bench_readline(void)
+{
+    static const char text[] = "echo 'hello world' \"again\"\n";
+    char line[64];
+    u64int start = host_now_ns();
+    u32int i;
+    u32int j;
+
+    for (i = 0; i < BENCH_LINES; i++) {
+        for (j = 0; text[j] != '\0'; j++) {
+            input_buffer_put((u8int) text[j]);
+        }
+        sink += (u32int) readline(line, sizeof(line));
+    }
+    bench_report("readline", BENCH_LINES, host_now_ns() - start);
+}
+
+/** bench_parse:
+ * Tokenizing a line and looking up its command, without running it
+ */
+static void bench_parse(void)
+{
+    static const char text[] = "keymap  'dvorak' \\\"x\\\" y z";
+    char line[sizeof(text)];
+    char* argv[TERMINAL_MAX_ARGS];
+    u64int start = host_now_ns();
+    u32int i;
+    u32int j;
+
+    for (i = 0; i < BENCH_LINES; i++) {
+        for (j = 0; j < sizeof(text); j++) {
+            line[j] = text[j];
+        }
+        if (terminal_tokenize(line, argv, TERMINAL_MAX_ARGS) > 0 &&
+            terminal_find_command(argv[0]) != 0) {
+            sink++;
+        }
+    }
+    bench_report("tokenize_lookup", BENCH_LINES, host_now_ns() - start);
+}
+
+/** bench_execute:
+ * terminal_execute_command on a command that does nothing
+ */
+static void bench_execute(void)
+{
+    static const char text[] = "true x";
+    char line[sizeof(text)];
+    u64int start = host_now_ns();
+    u32int i;
+    u32int j;
+
+    for (i = 0; i < BENCH_LINES; i++) {
+        for (j = 0; j < sizeof(text); j++) {
+            line[j] = text[j];
+        }
+        terminal_execute_command(line);
+    }
+    bench_report("execute", BENCH_LINES, host_now_ns() - start);
+}
+
+/** bench_klib:
+ * Page-sized copies, fills and string scans through one klib
+ * implementation
+ */
+static void bench_klib(u8int impl)
+{
+    static u8int src[BENCH_KLIB_SIZE] __attribute__((aligned(16)));
+    static u8int dst[BENCH_KLIB_SIZE] __attribute__((aligned(16)));
+    static const char *names[KLIB_IMPL_COUNT][3] = {
+        { "memcpy_4k_rep", "memset_4k_rep", "strlen_4k_rep" },
+        { "memcpy_4k_sse2", "memset_4k_sse2", "strlen_4k_sse2" },
+        { "memcpy_4k_erms", "memset_4k_erms", "strlen_4k_erms" }
+    };
+    u64int start;
+    u32int i;
+
+    if (!klib_select(impl)) {
+        return;
+    }
+    start = host_now_ns();
+    for (i = 0; i < BENCH_KLIB_CALLS; i++) {
+        memcpy(dst, src, BENCH_KLIB_SIZE);
+    }
+    bench_report(names[impl][0], BENCH_KLIB_CALLS, host_now_ns() - start);
+
+    start = host_now_ns();
+    for (i = 0; i < BENCH_KLIB_CALLS; i++) {
+        memset(dst, (int) i, BENCH_KLIB_SIZE);
+    }
+    bench_report(names[impl][1], BENCH_KLIB_CALLS, host_now_ns() - start);
+
+    memset(src, 'x', BENCH_KLIB_SIZE - 1);
+    src[BENCH_KLIB_SIZE - 1] = '\0';
+    start = host_now_ns();
+    for (i = 0; i < BENCH_KLIB_CALLS; i++) {
+        sink += strlen((char *) src);
+    }
+    bench_report(names[impl][2], BENCH_KLIB_CALLS, host_now_ns() - start);
+    sink += dst[i % BENCH_KLIB_SIZE];
+}
+
+/** bench_vbe:
+ * The VBE console on a 640x480 screen in RAM: glyphs blitted into the back
+ * buffer, then whole screens drawn and presented
+ */
+static void bench_vbe(void)
+{
+    static u32int screen[VBE_REQUEST_WIDTH * VBE_REQUEST_HEIGHT];
+    static u32int back[VBE_CONSOLE_WIDTH * VBE_CONSOLE_HEIGHT];
+    static u16int cells[FB_WIDTH * FB_HEIGHT];
+    struct vbe_console_mode mode = {
+        0, VBE_REQUEST_WIDTH * 4, VBE_REQUEST_WIDTH, VBE_REQUEST_HEIGHT, VBE_REQUEST_BPP,
+        16, 8, 8, 8, 0, 8
+    };
+    u64int start;
+    u32int i;
+    u32int y;
+
+    if (!vbe_console_attach(&mode, screen, back)) {
+        return;
+    }
+    for (i = 0; i < FB_WIDTH * FB_HEIGHT; i++) {
+        cells[i] = (u16int) (0x0700 | (0x21 + i % 94));
+    }
+
+    start = host_now_ns();
+    for (i = 0; i < BENCH_VBE_ROWS; i++) {
+        vbe_console_invalidate();
+        vbe_console_draw(0, cells, FB_WIDTH);
+    }
+    bench_report("glyph_blit", (u64int) BENCH_VBE_ROWS * FB_WIDTH, host_now_ns() - start);
+
+    start = host_now_ns();
+    for (i = 0; i < BENCH_VBE_REDRAWS; i++) {
+        vbe_console_invalidate();
+        for (y = 0; y < FB_HEIGHT; y++) {
+            vbe_console_draw(y * FB_WIDTH, cells + y * FB_WIDTH, FB_WIDTH);
+        }
+        vbe_console_present();
+    }
+    bench_report("redraw_full", BENCH_VBE_REDRAWS, host_now_ns() - start);
+    sink += screen[VBE_REQUEST_WIDTH * VBE_REQUEST_HEIGHT / 2];
+}
+
+int main(void)
+{
+    klib_init();
+    terminal_init();
+    host_printf("%-20s %13s %9s\n", "case", "rate", "each");
+    keyboard_set_layout("us");
+
+    bench_scan_codes();
+    bench_scan_codes_deferred();
+    bench_ring();
+    bench_readline();
+    bench_parse();
+    bench_execute();
+    bench_klib(KLIB_IMPL_REP);
+    bench_klib(KLIB_IMPL_SSE2);
+    bench_klib(KLIB_IMPL_ERMS);
+    bench_vbe();
+
+    // Keep the work from being optimised away
+    host_printf("sink=%u\n", sink);
+    return 0;
+}
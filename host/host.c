@@ -0,0 +1,49 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "host/host.h"
+
+static u32int random_state = 2463534242u;
+
+void host_printf(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    fflush(stdout);
+}
+
+void host_fatal(const char *message)
+{
+    fflush(stdout);
+    fprintf(stderr, "fatal: %s\n", message);
+    exit(2);
+}
+
+u64int host_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64int) now.tv_sec * 1000000000ull + (u64int) now.tv_nsec;
+}
+
+u32int host_random(void)
+{
+    u32int x = random_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_state = x;
+    return x;
+}
+
+void host_seed(u32int seed)
+{
+    random_state = seed;
+}
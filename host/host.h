@@ -0,0 +1,62 @@
+#ifndef INCLUDE_HOST_H
+#define INCLUDE_HOST_H
+
+#include "drivers/types.h"
+
+/* The driver sources are compiled unchanged for Linux by make host-test and
+ * make host-bench. host.c is the only file that sees the C library, so the
+ * kernel's getc and friends do not clash with it; stubs.c stands in for the
+ * hardware and for the parts of the kernel the drivers call. */
+
+/** host_printf:
+ * printf to stdout
+ */
+void host_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/** host_fatal:
+ * Prints a message to stderr and exits with status 2
+ */
+void host_fatal(const char *message) __attribute__((noreturn));
+
+/** host_now_ns:
+ * Returns CLOCK_MONOTONIC in nanoseconds
+ */
+u64int host_now_ns(void);
+
+/** host_random:
+ * xorshift32, so fuzz runs are the same on every machine
+ *
+ * @return The next pseudo-random number
+ */
+u32int host_random(void);
+
+/** host_seed:
+ * Restarts host_random from a seed, which must not be 0
+ */
+void host_seed(u32int seed);
+
+/** host_fb_output:
+ * Returns what the drivers wrote to the framebuffer since host_fb_reset,
+ * as a string. Output past the capture size is dropped.
+ */
+const char *host_fb_output(void);
+
+/** host_fb_reset:
+ * Empties the framebuffer capture
+ */
+void host_fb_reset(void);
+
+/** host_port_set:
+ * Sets the value the next inb from a port returns
+ *
+ * @param port  The I/O port
+ * @param value The byte
+ */
+void host_port_set(u16int port, u8int value);
+
+/** host_port_get:
+ * Returns the last byte written to a port with outb
+ */
+u8int host_port_get(u16int port);
+
+#endif /* INCLUDE_HOST_H */
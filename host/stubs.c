@@ -0,0 +1,389 @@
+#include "host/host.h"
+#include "drivers/acpi.h"
+#include "drivers/bench.h"
+#include "drivers/clock.h"
+#include "drivers/frame_buffer.h"
+#include "drivers/initcall.h"
+#include "drivers/interrupts.h"
+#include "drivers/io.h"
+#include "drivers/ioapic.h"
+#include "drivers/irq.h"
+#include "drivers/kheap.h"
+#include "drivers/lapic.h"
+#include "drivers/paging.h"
+#include "drivers/pmm.h"
+#include "drivers/smp.h"
+#include "drivers/spinlock.h"
+#include "drivers/thread.h"
+#include "drivers/user.h"
+#include "drivers/types.h"
+
+/* Everything the host-built drivers link against besides each other. The
+ * framebuffer and ports are simulated; the rest reports an idle machine
+ * with one CPU, enough for terminal commands not to fault if run. */
+
+#define HOST_FB_CAPTURE 65536
+
+static char fb_capture[HOST_FB_CAPTURE];
+static u32int fb_length = 0;
+static struct fb_stats fb_stats;
+
+static u8int ports[65536];
+
+/* Zeroed objects handed out by the lookups below */
+static struct clock_idle_stats idle_stats;
+static struct isr_stats isr_stats;
+static struct kheap_stats kheap_stats;
+static struct pmm_stats pmm_stats;
+static struct cpu cpu0;
+static struct thread thread_slot;
+
+const struct user_program user_programs[] = { { 0, 0 } };
+volatile u8int lockstat_enabled = 0;
+
+const char *host_fb_output(void)
+{
+    fb_capture[fb_length] = '\0';
+    return fb_capture;
+}
+
+void host_fb_reset(void)
+{
+    fb_length = 0;
+}
+
+void host_port_set(u16int port, u8int value)
+{
+    ports[port] = value;
+}
+
+u8int host_port_get(u16int port)
+{
+    return ports[port];
+}
+
+// Ports
+
+void outb(unsigned short port, unsigned char data)
+{
+    ports[port] = data;
+}
+
+unsigned char inb(unsigned short port)
+{
+    return ports[port];
+}
+
+// Framebuffer, captured as text
+
+void fb_putc(char c)
+{
+    if (fb_length < HOST_FB_CAPTURE - 1) {
+        fb_capture[fb_length++] = c;
+    }
+    fb_stats.cells_written++;
+}
+
+void fb_puts(char *str)
+{
+    while (*str != '\0') {
+        fb_putc(*str++);
+    }
+}
+
+void fb_newline(void)
+{
+    fb_putc('\n');
+}
+
+void fb_clear(void)
+{
+    fb_length = 0;
+}
+
+void fb_put_uint(unsigned int value)
+{
+    char digits[10];
+    u32int n = 0;
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        fb_putc(digits[--n]);
+    }
+}
+
+void fb_put_hex(unsigned int value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    int shift;
+
+    fb_putc('0');
+    fb_putc('x');
+    for (shift = 28; shift >= 0; shift -= 4) {
+        fb_putc(hex[(value >> shift) & 0x0F]);
+    }
+}
+
+const struct fb_stats *fb_get_stats(void)
+{
+    return &fb_stats;
+}
+
+// Threads: there is only one, so nothing can wake a sleeper
+
+u32int wait_queue_prepare(struct wait_queue *queue)
+{
+    return queue->wakeups;
+}
+
+void wait_queue_sleep(struct wait_queue *queue, u32int ticket)
+{
+    if (queue->wakeups == ticket) {
+        host_fatal("blocked waiting for input that will never come");
+    }
+}
+
+void wait_queue_wake(struct wait_queue *queue)
+{
+    queue->wakeups++;
+}
+
+void thread_sleep_ms(u32int ms)
+{
+    (void) ms;
+}
+
+const struct thread *thread_get(u32int index)
+{
+    (void) index;
+    return &thread_slot;
+}
+
+// Clock: one TSC cycle per nanosecond
+
+u64int clock_cycles_to_ns(u64int cycles)
+{
+    return cycles;
+}
+
+u64int clock_now_ns(void)
+{
+    return host_now_ns();
+}
+
+u32int clock_ticks(void)
+{
+    return 0;
+}
+
+u32int clock_hz(void)
+{
+    return CLOCK_DEFAULT_HZ;
+}
+
+u32int clock_tsc_khz(void)
+{
+    return 1000000;
+}
+
+u8int clock_set_tickless(u8int enable)
+{
+    (void) enable;
+    return 0;
+}
+
+u8int clock_get_tickless(void)
+{
+    return 0;
+}
+
+const struct clock_idle_stats *clock_get_idle_stats(void)
+{
+    return &idle_stats;
+}
+
+// The rest of the kernel, as seen by terminal commands
+
+const struct acpi_madt_info *acpi_get_madt(void)
+{
+    return 0;
+}
+
+void bench_run(char *filter)
+{
+    (void) filter;
+}
+
+void bench_parallel(u32int max_cpus)
+{
+    (void) max_cpus;
+}
+
+u32int interrupts_get_count(u8int vector)
+{
+    (void) vector;
+    return 0;
+}
+
+u8int interrupts_get_deferred(void)
+{
+    return 0;
+}
+
+void interrupts_set_deferred(u8int enable)
+{
+    (void) enable;
+}
+
+const struct isr_stats *interrupts_get_keyboard_stats(u8int deferred)
+{
+    (void) deferred;
+    return &isr_stats;
+}
+
+void interrupts_trace_enable(u8int enable)
+{
+    (void) enable;
+}
+
+void interrupts_trace_clear(void)
+{
+}
+
+void interrupts_trace_dump(void)
+{
+}
+
+const char *interrupts_vector_name(u8int vector)
+{
+    (void) vector;
+    return "?";
+}
+
+u32int ioapic_pins(void)
+{
+    return 0;
+}
+
+u8int irq_get_mode(void)
+{
+    return IRQ_MODE_PIC;
+}
+
+u8int irq_set_mode(u8int mode)
+{
+    return mode == IRQ_MODE_PIC;
+}
+
+u32int irq_gsi(u8int irq)
+{
+    return irq;
+}
+
+u32int irq_measure_eoi(u8int mode)
+{
+    (void) mode;
+    return 0;
+}
+
+u8int irq_measure_latency(u32int samples, struct irq_latency *result)
+{
+    (void) samples;
+    (void) result;
+    return 0;
+}
+
+const char *lapic_timer_mode(void)
+{
+    return "none";
+}
+
+/* There is no heap or paging: vbe_console_init fails and the tests
+ * attach the VBE console to arrays instead */
+void *kmalloc(u32int size)
+{
+    (void) size;
+    return 0;
+}
+
+void kfree(void *ptr)
+{
+    (void) ptr;
+}
+
+u32int paging_map_physical(u32int phys, u32int len, u32int flags)
+{
+    (void) phys;
+    (void) len;
+    (void) flags;
+    return 0;
+}
+
+const struct kheap_stats *kheap_get_stats(void)
+{
+    return &kheap_stats;
+}
+
+const struct pmm_stats *pmm_get_stats(void)
+{
+    return &pmm_stats;
+}
+
+u32int smp_cpu_count(void)
+{
+    return 1;
+}
+
+struct cpu *smp_get_cpu(u32int index)
+{
+    (void) index;
+    return &cpu0;
+}
+
+struct spinlock *spinlock_get(u32int index)
+{
+    (void) index;
+    return 0;
+}
+
+void lockstat_set(u8int enable)
+{
+    lockstat_enabled = enable;
+}
+
+const struct user_program *user_find(const char *name)
+{
+    (void) name;
+    return 0;
+}
+
+s32int user_run(const struct user_program *program, u32int argc, char **argv)
+{
+    (void) program;
+    (void) argc;
+    (void) argv;
+    return -1;
+}
+
+const struct initcall *initcall_get(u32int index)
+{
+    (void) index;
+    return 0;
+}
+
+u64int initcall_boot_tsc(void)
+{
+    return 0;
+}
+
+void initcall_mark_prompt(void)
+{
+}
+
+u64int initcall_prompt_tsc(void)
+{
+    return 0;
+}
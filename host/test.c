@@ -0,0 +1,980 @@
+#include "host/host.h"
+#include "drivers/deferred.h"
+#include "drivers/input_buffer.h"
+#include "drivers/keyboard.h"
+#include "drivers/font.h"
+#include "drivers/klib.h"
+#include "drivers/terminal.h"
+#include "drivers/vbe_console.h"
+#include "drivers/types.h"
+
+/* Unit tests and fuzzing of the input path and the command parser, built
+ * for Linux by make host-test */
+
+#define FUZZ_RING_OPS       1000000
+#define FUZZ_TOKENIZE_LINES 200000
+#define FUZZ_SCAN_CODES     1000000
+#define FUZZ_KLIB_CALLS     200000
+
+#define REF_MAX_ARGS 8
+#define REF_LINE     48
+
+/* Room for the longest klib case at any alignment, with guard bytes that
+ * must come through untouched on both sides */
+#define KLIB_BUFFER  4096
+#define KLIB_GUARD   64
+#define KLIB_MAX     1200
+
+/* A screen bigger than the text grid, with padding at the end of each
+ * line, so the grid is centred and the pitch matters */
+#define VBE_TEST_WIDTH  800
+#define VBE_TEST_HEIGHT 420
+#define VBE_TEST_PITCH  824
+#define VBE_TEST_ORIGIN (((VBE_TEST_HEIGHT - VBE_CONSOLE_HEIGHT) / 2) * VBE_TEST_PITCH + \
+                         (VBE_TEST_WIDTH - VBE_CONSOLE_WIDTH) / 2)
+
+/* Registered commands, placed by the linker as in the kernel */
+extern const struct command __start_commands[];
+extern const struct command __stop_commands[];
+
+static u32int checks = 0;
+static u32int failures = 0;
+
+#define CHECK(condition) test_check((condition) != 0, #condition, __FILE__, __LINE__)
+
+static void test_check(u8int ok, const char *what, const char *file, u32int line)
+{
+    checks++;
+    if (!ok) {
+        failures++;
+        host_printf("%s:%u: FAILED %s\n", file, line, what);
+    }
+}
+
+static u8int test_streq(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void test_feed(const char *text)
+{
+    while (*text != '\0') {
+        input_buffer_put((u8int) *text++);
+    }
+}
+
+static void test_drain(void)
+{
+    u8int scratch[64];
+
+    while (input_buffer_read(scratch, sizeof(scratch)) != 0) {
+    }
+}
+
+// Input ring
+
+static void test_ring_basics(void)
+{
+    u8int buf[INPUT_BUFFER_SIZE + 8];
+    u32int i;
+
+    test_drain();
+    CHECK(input_buffer_read(buf, sizeof(buf)) == 0);
+    CHECK(getc() == 0);
+    CHECK(!input_buffer_available());
+
+    for (i = 0; i < INPUT_BUFFER_SIZE; i++) {
+        CHECK(input_buffer_put((u8int) i));
+    }
+    CHECK(!input_buffer_put(0xAA));
+    CHECK(input_buffer_count() == INPUT_BUFFER_SIZE);
+    CHECK(input_buffer_read(buf, sizeof(buf)) == INPUT_BUFFER_SIZE);
+    for (i = 0; i < INPUT_BUFFER_SIZE; i++) {
+        CHECK(buf[i] == (u8int) i);
+    }
+
+    test_feed("ab\ncd\re");
+    CHECK(input_buffer_read_line(buf, sizeof(buf)) == 3 && buf[2] == '\n');
+    CHECK(input_buffer_read_line(buf, sizeof(buf)) == 3 && buf[2] == '\r');
+    CHECK(input_buffer_read_line(buf, sizeof(buf)) == 1 && buf[0] == 'e');
+    CHECK(input_buffer_count() == 0);
+}
+
+/** test_ring_fuzz:
+ * Random puts, reads and line reads against a plain array model of the
+ * ring, long enough for the indexes to wrap many times
+ */
+static void test_ring_fuzz(void)
+{
+    static u8int model[INPUT_BUFFER_SIZE];
+    u8int buf[INPUT_BUFFER_SIZE + 64];
+    u32int model_head = 0;
+    u32int model_count = 0;
+    u32int bad = 0;
+    u32int op;
+
+    test_drain();
+    host_seed(0x1234567);
+    for (op = 0; op < FUZZ_RING_OPS && bad == 0; op++) {
+        u32int r = host_random();
+        u32int want = (r >> 8) % (INPUT_BUFFER_SIZE + 32);
+
+        if ((r & 3) != 0) {
+            // Mostly puts, with plenty of line ends
+            u8int c = (u8int) ((r >> 16) % 12 == 0 ? '\n' : r >> 24);
+            u8int stored = input_buffer_put(c);
+
+            if (stored != (model_count < INPUT_BUFFER_SIZE)) {
+                bad++;
+            }
+            if (stored) {
+                model[(model_head + model_count++) % INPUT_BUFFER_SIZE] = c;
+            }
+        } else {
+            u8int line = (r >> 2) & 1;
+            u32int got = line ? input_buffer_read_line(buf, want) : input_buffer_read(buf, want);
+            u32int expect = 0;
+            u32int i;
+
+            while (expect < want && expect < model_count) {
+                u8int c = model[(model_head + expect) % INPUT_BUFFER_SIZE];
+
+                expect++;
+                if (line && (c == '\n' || c == '\r')) {
+                    break;
+                }
+            }
+            if (got != expect) {
+                bad++;
+            }
+            for (i = 0; i < got && i < expect; i++) {
+                if (buf[i] != model[(model_head + i) % INPUT_BUFFER_SIZE]) {
+                    bad++;
+                }
+            }
+            model_head = (model_head + expect) % INPUT_BUFFER_SIZE;
+            model_count -= expect;
+        }
+        if (input_buffer_count() != model_count ||
+            input_buffer_available() != (model_count != 0)) {
+            bad++;
+        }
+    }
+    CHECK(bad == 0);
+    test_drain();
+}
+
+// readline
+
+static void test_readline(void)
+{
+    char line[8];
+
+    test_drain();
+    test_feed("abc\n");
+    CHECK(readline(line, sizeof(line)) == 3 && test_streq(line, "abc"));
+
+    test_feed("ab\bc\r");
+    CHECK(readline(line, sizeof(line)) == 2 && test_streq(line, "ac"));
+
+    test_feed("\b\bx\n");
+    CHECK(readline(line, sizeof(line)) == 1 && test_streq(line, "x"));
+
+    test_feed("\n");
+    CHECK(readline(line, sizeof(line)) == 0 && line[0] == '\0');
+
+    // A full buffer returns early and leaves the rest for the next call
+    test_feed("abcdefghij\n");
+    CHECK(readline(line, sizeof(line)) == 7 && test_streq(line, "abcdefg"));
+    CHECK(readline(line, sizeof(line)) == 3 && test_streq(line, "hij"));
+
+    CHECK(readline(0, 8) == -1);
+    CHECK(readline(line, 0) == -1);
+}
+
+// Deferred work
+
+static u32int deferred_sum = 0;
+static u32int deferred_last = 0;
+static u8int deferred_in_order = 1;
+
+static void test_deferred_work(u32int arg)
+{
+    if (arg != deferred_last + 1) {
+        deferred_in_order = 0;
+    }
+    deferred_last = arg;
+    deferred_sum += arg;
+}
+
+static void test_deferred(void)
+{
+    u32int dropped = deferred_get_stats()->dropped;
+    u32int i;
+
+    deferred_run();
+    CHECK(!deferred_pending());
+    for (i = 1; i <= DEFERRED_QUEUE_SIZE; i++) {
+        CHECK(deferred_queue(test_deferred_work, i));
+    }
+    CHECK(!deferred_queue(test_deferred_work, 0));
+    CHECK(deferred_get_stats()->dropped == dropped + 1);
+    deferred_run();
+    CHECK(!deferred_pending());
+    CHECK(deferred_in_order);
+    CHECK(deferred_sum == DEFERRED_QUEUE_SIZE * (DEFERRED_QUEUE_SIZE + 1) / 2);
+}
+
+// Tokenizer and commands
+
+/** ref_tokenize:
+ * The quoting rules of terminal_tokenize written as a character-at-a-time
+ * state machine that copies words out, for differential fuzzing
+ */
+static s32int ref_tokenize(const char *line, char words[][REF_LINE], u32int max_args)
+{
+    u32int argc = 0;
+    u32int len = 0;
+    u8int in_word = 0;
+    char quote = 0;
+    u32int i;
+
+    for (i = 0; line[i] != '\0'; i++) {
+        char c = line[i];
+
+        if (quote == 0 && c == ' ') {
+            if (in_word) {
+                words[argc - 1][len] = '\0';
+                in_word = 0;
+            }
+            continue;
+        }
+        if (!in_word) {
+            if (argc == max_args) {
+                return -1;
+            }
+            argc++;
+            len = 0;
+            in_word = 1;
+        }
+        if (quote != 0 && c == quote) {
+            quote = 0;
+        } else if (quote == 0 && (c == '"' || c == '\'')) {
+            quote = c;
+        } else if (c == '\\' && quote != '\'' && line[i + 1] != '\0') {
+            words[argc - 1][len++] = line[++i];
+        } else {
+            words[argc - 1][len++] = c;
+        }
+    }
+    if (quote != 0) {
+        return -1;
+    }
+    if (in_word) {
+        words[argc - 1][len] = '\0';
+    }
+    return (s32int) argc;
+}
+
+/** test_tokenize_copy:
+ * Tokenizes a copy of text, which stays valid until the next call
+ */
+static s32int test_tokenize_copy(const char *text, char** argv, u32int max_args)
+{
+    static char line[64];
+    u32int i = 0;
+
+    do {
+        line[i] = text[i];
+    } while (text[i++] != '\0');
+    return terminal_tokenize(line, argv, max_args);
+}
+
+/** test_execute:
+ * Runs a command line and returns what it printed
+ */
+static const char* test_execute(const char *text)
+{
+    char line[64];
+    u32int i = 0;
+
+    do {
+        line[i] = text[i];
+    } while (text[i++] != '\0');
+    host_fb_reset();
+    terminal_execute_command(line);
+    return host_fb_output();
+}
+
+static void test_tokenize(void)
+{
+    char line[64] = "  echo 'a b'  \"c\\\"d\" e\\ f ''";
+    char* argv[REF_MAX_ARGS];
+
+    CHECK(terminal_tokenize(line, argv, REF_MAX_ARGS) == 5);
+    CHECK(test_streq(argv[0], "echo"));
+    CHECK(test_streq(argv[1], "a b"));
+    CHECK(test_streq(argv[2], "c\"d"));
+    CHECK(test_streq(argv[3], "e f"));
+    CHECK(test_streq(argv[4], ""));
+
+    CHECK(test_tokenize_copy("a b c", argv, 2) == -1);
+    CHECK(test_tokenize_copy("a b", argv, 2) == 2);
+    CHECK(test_tokenize_copy("a 'b", argv, 2) == -1);
+    CHECK(test_tokenize_copy("a\\", argv, 2) == 1 && test_streq(argv[0], "a\\"));
+    CHECK(test_tokenize_copy("", argv, 2) == 0);
+}
+
+static void test_tokenize_fuzz(void)
+{
+    static const char alphabet[] = "ab  \"'\\";
+    char ref_words[REF_MAX_ARGS][REF_LINE];
+    char original[REF_LINE];
+    char line[REF_LINE];
+    char* argv[REF_MAX_ARGS];
+    u32int bad = 0;
+    u32int n;
+
+    host_seed(0xC0FFEE);
+    for (n = 0; n < FUZZ_TOKENIZE_LINES && bad == 0; n++) {
+        u32int len = host_random() % (REF_LINE - 1);
+        s32int expect;
+        s32int got;
+        s32int i;
+        u32int j;
+
+        for (j = 0; j < len; j++) {
+            original[j] = alphabet[host_random() % (sizeof(alphabet) - 1)];
+            line[j] = original[j];
+        }
+        original[len] = '\0';
+        line[len] = '\0';
+
+        expect = ref_tokenize(original, ref_words, REF_MAX_ARGS);
+        got = terminal_tokenize(line, argv, REF_MAX_ARGS);
+        if (got != expect) {
+            host_printf("tokenize [%s]: got %d, expected %d\n", original, got, expect);
+            bad++;
+            continue;
+        }
+        for (i = 0; i < got; i++) {
+            // Words are compacted in place, never copied out
+            if (argv[i] < line || argv[i] >= line + len + 1 ||
+                !test_streq(argv[i], ref_words[i])) {
+                host_printf("tokenize [%s]: word %d is [%s], expected [%s]\n",
+                            original, i, argv[i], ref_words[i]);
+                bad++;
+            }
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static void test_commands(void)
+{
+    const struct command* command;
+    char input[32];
+
+    for (command = __start_commands; command < __stop_commands; command++) {
+        CHECK(terminal_find_command(command->name) == command);
+    }
+    CHECK(terminal_find_command("") == 0);
+    CHECK(terminal_find_command("ech") == 0);
+    CHECK(terminal_find_command("echoo") == 0);
+
+    CHECK(test_streq(test_execute("echo  hello 'big world'"), "hello big world\n"));
+    CHECK(test_streq(test_execute("   "), ""));
+    CHECK(test_streq(test_execute("nosuch x"),
+                     "Unknown command: nosuch. Type 'help' for available commands.\n"));
+    CHECK(test_streq(test_execute("echo \"open"),
+                     "Unterminated quote or too many arguments\n"));
+
+    // Tab completes a unique prefix through readline's hook
+    test_drain();
+    test_feed("ech\t\n");
+    host_fb_reset();
+    CHECK(readline(input, sizeof(input)) == 5 && test_streq(input, "echo "));
+    CHECK(test_streq(host_fb_output(), "o "));
+}
+
+// Keyboard
+
+static u8int test_key(u8int scan_code)
+{
+    host_port_set(0x60, scan_code);
+    return keyboard_process_scan_code(keyboard_read_scan_code());
+}
+
+/** test_keyboard_reset:
+ * Brings the key state machine back to no modifiers and Caps Lock off,
+ * whatever it was fed before
+ */
+static void test_keyboard_reset(void)
+{
+    static const u8int releases[] = {
+        0xAA, 0xB6, 0x9D, 0xE0, 0x9D, 0xB8, 0xE0, 0xB8, 0xBA
+    };
+    u32int i;
+
+    // Soak up the rest of a Pause sequence or a dangling 0xE0
+    for (i = 0; i < 5; i++) {
+        test_key(0xFF);
+    }
+    for (i = 0; i < sizeof(releases); i++) {
+        test_key(releases[i]);
+    }
+    if (keyboard_modifiers() & KEYBOARD_MOD_CAPS) {
+        test_key(KEYBOARD_CAPS_LOCK);
+        test_key(KEYBOARD_CAPS_LOCK | KEYBOARD_RELEASE);
+    }
+}
+
+static void test_keyboard(void)
+{
+    test_keyboard_reset();
+    CHECK(keyboard_set_layout("us"));
+    CHECK(!keyboard_set_layout("nosuch"));
+
+    CHECK(test_key(0x1E) == 'a');
+    CHECK(test_key(0x9E) == 0);
+    CHECK(test_key(KEYBOARD_LEFT_SHIFT) == 0);
+    CHECK(test_key(0x1E) == 'A');
+    CHECK(test_key(0x02) == '!');
+    CHECK(test_key(KEYBOARD_LEFT_SHIFT | KEYBOARD_RELEASE) == 0);
+    CHECK(test_key(0x1E) == 'a');
+
+    CHECK(test_key(KEYBOARD_CTRL) == 0);
+    CHECK(test_key(0x1E) == 1);
+    CHECK(keyboard_modifiers() == KEYBOARD_MOD_CTRL);
+    CHECK(test_key(KEYBOARD_CTRL | KEYBOARD_RELEASE) == 0);
+
+    // Caps Lock only toggles once while held, and only affects letters
+    CHECK(test_key(KEYBOARD_CAPS_LOCK) == 0);
+    CHECK(test_key(KEYBOARD_CAPS_LOCK) == 0);
+    CHECK(test_key(KEYBOARD_CAPS_LOCK | KEYBOARD_RELEASE) == 0);
+    CHECK(keyboard_modifiers() == KEYBOARD_MOD_CAPS);
+    CHECK(test_key(0x1E) == 'A');
+    CHECK(test_key(0x02) == '1');
+    CHECK(test_key(KEYBOARD_RIGHT_SHIFT) == 0);
+    CHECK(test_key(0x1E) == 'a');
+    test_keyboard_reset();
+    CHECK(keyboard_modifiers() == 0);
+
+    // Extended keys, the fake Shift around them and Pause
+    CHECK(test_key(KEYBOARD_EXTENDED) == 0);
+    CHECK(test_key(0x48) == KEYBOARD_KEY_UP);
+    CHECK(test_key(0x48) == '8');
+    CHECK(test_key(KEYBOARD_EXTENDED) == 0);
+    CHECK(test_key(KEYBOARD_LEFT_SHIFT) == 0);
+    CHECK(keyboard_modifiers() == 0);
+    CHECK(test_key(KEYBOARD_PAUSE) == 0);
+    CHECK(test_key(0x1D) == 0);
+    CHECK(test_key(0x45) == 0);
+    CHECK(test_key(0xE1) == 0);
+    CHECK(test_key(0x9D) == 0);
+    CHECK(test_key(0xC5) == 0);
+    CHECK(keyboard_modifiers() == 0);
+    CHECK(test_key(0x1E) == 'a');
+
+    CHECK(keyboard_set_layout("dvorak"));
+    CHECK(test_key(0x10) == '\'');
+    CHECK(keyboard_set_layout("us"));
+    CHECK(test_key(0x10) == 'q');
+}
+
+/** test_keyboard_fuzz:
+ * Random scan codes must never leave a modifier stuck once every modifier
+ * has been released again
+ */
+static void test_keyboard_fuzz(void)
+{
+    u32int stuck = 0;
+    u32int n;
+
+    host_seed(0xBADC0DE);
+    for (n = 0; n < FUZZ_SCAN_CODES; n++) {
+        test_key((u8int) host_random());
+        if ((n & 1023) == 1023) {
+            test_keyboard_reset();
+            if (keyboard_modifiers() != 0) {
+                stuck++;
+            }
+        }
+    }
+    CHECK(stuck == 0);
+    test_keyboard_reset();
+}
+
+// Mem/str library
+
+static u8int klib_src[KLIB_BUFFER] __attribute__((aligned(4096)));
+static u8int klib_dst[KLIB_BUFFER] __attribute__((aligned(4096)));
+static u8int klib_ref[KLIB_BUFFER];
+
+/* Lengths either side of the SSE2 cut-off and of the 16 and 64 byte steps */
+static const u32int klib_lengths[] = {
+    0, 1, 2, 3, 4, 5, 7, 15, 16, 17, 31, 63, 64, 65, 127, 128, 255, 256, 257,
+    300, 319, 320, 511, 1000, 1024, KLIB_MAX
+};
+
+#define KLIB_LENGTHS (sizeof(klib_lengths) / sizeof(klib_lengths[0]))
+
+static void test_klib_fill(u8int *buf, u32int seed)
+{
+    u32int i;
+
+    host_seed(seed);
+    for (i = 0; i < KLIB_BUFFER; i++) {
+        buf[i] = (u8int) (host_random() | 1);
+    }
+}
+
+static u8int test_klib_same(const u8int *a, const u8int *b)
+{
+    u32int i;
+
+    for (i = 0; i < KLIB_BUFFER; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static s32int test_sign(s32int value)
+{
+    return value < 0 ? -1 : value > 0;
+}
+
+/** test_klib_copies:
+ * memset, memset16, memcpy and memmove against byte loops, at every
+ * alignment of both ends and every length in klib_lengths
+ */
+static u32int test_klib_copies(void)
+{
+    u32int bad = 0;
+    u32int d;
+    u32int s;
+    u32int n;
+    u32int i;
+
+    for (d = 0; d < 16; d++) {
+        for (n = 0; n < KLIB_LENGTHS; n++) {
+            u32int len = klib_lengths[n];
+            u8int *dst = klib_dst + KLIB_GUARD + d;
+            u8int *ref = klib_ref + KLIB_GUARD + d;
+
+            test_klib_fill(klib_dst, len + d);
+            test_klib_fill(klib_ref, len + d);
+            if (memset(dst, 0xA5 + d, len) != dst) {
+                bad++;
+            }
+            for (i = 0; i < len; i++) {
+                ref[i] = (u8int) (0xA5 + d);
+            }
+            bad += !test_klib_same(klib_dst, klib_ref);
+
+            test_klib_fill(klib_dst, len + d);
+            test_klib_fill(klib_ref, len + d);
+            if ((d & 1) == 0) {
+                u16int value = (u16int) (0x0720 + d);
+
+                memset16((u16int *) dst, value, len / 2);
+                for (i = 0; i < len / 2; i++) {
+                    ref[2 * i] = (u8int) value;
+                    ref[2 * i + 1] = (u8int) (value >> 8);
+                }
+                bad += !test_klib_same(klib_dst, klib_ref);
+            }
+
+            for (s = 0; s < 16; s++) {
+                test_klib_fill(klib_src, 7 * len + s);
+                test_klib_fill(klib_dst, len + d);
+                test_klib_fill(klib_ref, len + d);
+                if (memcpy(dst, klib_src + s, len) != dst) {
+                    bad++;
+                }
+                for (i = 0; i < len; i++) {
+                    ref[i] = klib_src[s + i];
+                }
+                bad += !test_klib_same(klib_dst, klib_ref);
+            }
+        }
+    }
+
+    // Overlapping moves both ways, by every small and some large distances
+    for (n = 0; n < KLIB_LENGTHS; n++) {
+        u32int len = klib_lengths[n];
+
+        for (d = 0; d < 80; d += (d < 20 ? 1 : 13)) {
+            for (s = 0; s < 2; s++) {
+                u8int *base = klib_dst + KLIB_GUARD + (len & 15);
+                u8int *from = s ? base + d : base;
+                u8int *to = s ? base : base + d;
+
+                test_klib_fill(klib_dst, len + d);
+                for (i = 0; i < KLIB_BUFFER; i++) {
+                    klib_ref[i] = klib_dst[i];
+                }
+                for (i = 0; i < len; i++) {
+                    klib_src[i] = from[i];
+                }
+                for (i = 0; i < len; i++) {
+                    klib_ref[to - klib_dst + i] = klib_src[i];
+                }
+                if (memmove(to, from, len) != to) {
+                    bad++;
+                }
+                bad += !test_klib_same(klib_dst, klib_ref);
+            }
+        }
+    }
+    return bad;
+}
+
+/** test_klib_strings:
+ * memcmp, strlen and strcmp, including strings that run up to the end of
+ * a page where an unaligned 16-byte load would cross into the next one
+ */
+static u32int test_klib_strings(void)
+{
+    u32int bad = 0;
+    u32int n;
+    u32int a;
+    u32int at;
+
+    for (n = 0; n < KLIB_LENGTHS; n++) {
+        u32int len = klib_lengths[n];
+
+        for (a = 0; a < 16; a++) {
+            u8int *x = klib_src + KLIB_GUARD + a;
+            u8int *y = klib_dst + KLIB_GUARD + 15 - a;
+
+            test_klib_fill(klib_src, len);
+            memcpy(y, x, len + 1);
+            x[len] = '\0';
+            y[len] = '\0';
+            bad += memcmp(x, y, len) != 0;
+            bad += strlen((char *) x) != len;
+            bad += strcmp((char *) x, (char *) y) != 0;
+
+            // One byte differs, at the start, the end or somewhere between
+            for (at = 0; at < len; at += (len / 5) + 1) {
+                s32int below = x[at] < 0x80 ? -1 : 1;
+
+                // Bytes are odd, so flipping the top bit never makes a 0
+                y[at] = x[at] ^ 0x80;
+                bad += test_sign(memcmp(x, y, len)) != below;
+                bad += test_sign(memcmp(y, x, len)) != -below;
+                bad += test_sign(strcmp((char *) x, (char *) y)) != below;
+                y[at] = x[at];
+            }
+            if (len > 0) {
+                // A prefix compares below the longer string
+                y[len - 1] = '\0';
+                bad += test_sign(strcmp((char *) y, (char *) x)) != -1;
+                bad += test_sign(strcmp((char *) x, (char *) y)) != 1;
+            }
+        }
+    }
+
+    // Strings ending in the last bytes of a page
+    for (n = 1; n < 64; n++) {
+        char *x = (char *) klib_src + KLIB_BUFFER - n;
+        char *y = (char *) klib_dst + KLIB_BUFFER - 200;
+
+        test_klib_fill(klib_src, n);
+        test_klib_fill(klib_dst, n);
+        klib_src[KLIB_BUFFER - 1] = '\0';
+        memcpy(y, x, n);
+        bad += strlen(x) != n - 1;
+        bad += strcmp(x, y) != 0;
+        bad += strcmp(y, x) != 0;
+    }
+    return bad;
+}
+
+static void test_klib(void)
+{
+    u8int impl;
+
+    // Every x86-64 CPU has SSE2; ERMS is tested where the host has it
+    for (impl = KLIB_IMPL_REP; impl < KLIB_IMPL_COUNT; impl++) {
+        if (impl == KLIB_IMPL_ERMS && !klib_select(impl)) {
+            continue;
+        }
+        CHECK(klib_select(impl));
+        CHECK(test_klib_copies() == 0);
+        CHECK(test_klib_strings() == 0);
+    }
+    klib_init();
+}
+
+/** test_klib_fuzz:
+ * Random operations with random lengths and offsets, checked against
+ * byte loops, for both implementations
+ */
+static void test_klib_fuzz(void)
+{
+    u32int bad = 0;
+    u32int call;
+    u32int i;
+
+    for (call = 0; call < FUZZ_KLIB_CALLS && bad == 0; call++) {
+        u32int r;
+        u32int len;
+        u32int from;
+        u32int to;
+
+        host_seed(call + 1);
+        r = host_random();
+        len = host_random() % KLIB_MAX;
+        from = host_random() % (KLIB_BUFFER - KLIB_MAX);
+        to = host_random() % (KLIB_BUFFER - KLIB_MAX);
+        klib_select((r & 0xFF) % KLIB_IMPL_COUNT);
+        for (i = 0; i < KLIB_BUFFER; i++) {
+            klib_dst[i] = (u8int) host_random();
+            klib_ref[i] = klib_dst[i];
+        }
+        switch ((r >> 8) % 3) {
+        case 0:
+            for (i = 0; i < len; i++) {
+                klib_src[i] = klib_ref[from + i];
+            }
+            for (i = 0; i < len; i++) {
+                klib_ref[to + i] = klib_src[i];
+            }
+            memmove(klib_dst + to, klib_dst + from, len);
+            break;
+        case 1:
+            for (i = 0; i < len; i++) {
+                klib_ref[to + i] = (u8int) r;
+            }
+            memset(klib_dst + to, (int) r, len);
+            break;
+        default:
+            // memset16 takes 2-byte aligned cells only
+            to &= ~1u;
+            for (i = 0; i < len / 2; i++) {
+                klib_ref[to + 2 * i] = (u8int) r;
+                klib_ref[to + 2 * i + 1] = (u8int) (r >> 8);
+            }
+            memset16((u16int *) (klib_dst + to), (u16int) r, len / 2);
+            break;
+        }
+        bad += !test_klib_same(klib_dst, klib_ref);
+    }
+    CHECK(bad == 0);
+    klib_init();
+}
+
+// VBE console
+
+static u32int vbe_screen[VBE_TEST_PITCH * VBE_TEST_HEIGHT];
+static u32int vbe_back[VBE_CONSOLE_WIDTH * VBE_CONSOLE_HEIGHT];
+static u32int vbe_snapshot[VBE_CONSOLE_WIDTH * VBE_CONSOLE_HEIGHT];
+
+/** test_vbe_attach:
+ * Attaches the console to vbe_screen as 32-bit xRGB, or xBGR if swapped
+ */
+static u8int test_vbe_attach(u8int bpp, u32int width, u8int swapped)
+{
+    struct vbe_console_mode mode = { 0xE0000000, VBE_TEST_PITCH * 4, width, VBE_TEST_HEIGHT,
+                                     bpp, 16, 8, 8, 8, 0, 8 };
+
+    if (swapped) {
+        mode.red_position = 0;
+        mode.blue_position = 16;
+    }
+    return vbe_console_attach(&mode, vbe_screen, vbe_back);
+}
+
+/** test_vbe_pixel:
+ * Returns the screen pixel at (x, y) of the text grid
+ */
+static u32int test_vbe_pixel(u32int x, u32int y)
+{
+    return vbe_screen[VBE_TEST_ORIGIN + y * VBE_TEST_PITCH + x];
+}
+
+/** test_vbe_cell_ok:
+ * Checks a cell on screen against the font, in the given colours, with
+ * the bottom two lines in fg if the cursor is on it
+ */
+static u8int test_vbe_cell_ok(u32int i, u8int c, u32int fg, u32int bg, u8int cursor)
+{
+    const u8int *glyph = font_glyph(c);
+    u32int x0 = i % FB_WIDTH * VBE_CELL_WIDTH;
+    u32int y0 = i / FB_WIDTH * VBE_CELL_HEIGHT;
+    u32int x;
+    u32int y;
+
+    for (y = 0; y < VBE_CELL_HEIGHT; y++) {
+        for (x = 0; x < VBE_CELL_WIDTH; x++) {
+            u32int want = (glyph[y / 2] >> x) & 1 ? fg : bg;
+
+            if (cursor && y >= 14) {
+                want = fg;
+            }
+            if (test_vbe_pixel(x0 + x, y0 + y) != want) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static u32int test_vbe_count(u32int value)
+{
+    u32int count = 0;
+    u32int i;
+
+    for (i = 0; i < VBE_TEST_PITCH * VBE_TEST_HEIGHT; i++) {
+        count += vbe_screen[i] == value;
+    }
+    return count;
+}
+
+static void test_vbe_fill(u32int value)
+{
+    u32int i;
+
+    for (i = 0; i < VBE_TEST_PITCH * VBE_TEST_HEIGHT; i++) {
+        vbe_screen[i] = value;
+    }
+}
+
+/** test_vbe_rows:
+ * Draws rows [0, count) with the pattern of rows [first, first + count)
+ */
+static void test_vbe_rows(u32int first, u32int count)
+{
+    u16int cells[FB_WIDTH];
+    u32int y;
+    u32int i;
+
+    for (y = 0; y < count; y++) {
+        for (i = 0; i < FB_WIDTH; i++) {
+            cells[i] = (u16int) (('!' + first + y + i) | (((first + y) % 15 + 1) << 8));
+        }
+        vbe_console_draw(y * FB_WIDTH, cells, FB_WIDTH);
+    }
+}
+
+static void test_vbe(void)
+{
+    static const char text[] = "Tiny OS";
+    u16int cells[FB_WIDTH];
+    u16int cell = 'A' | 0x1F00;
+    const struct vbe_console_stats *stats = vbe_console_get_stats();
+    u32int presents;
+    u32int i;
+    u32int y;
+
+    CHECK(!test_vbe_attach(24, VBE_TEST_WIDTH, 0));
+    CHECK(!test_vbe_attach(32, VBE_CONSOLE_WIDTH - 8, 0));
+
+    // Attaching clears the visible part of every line, not the padding
+    test_vbe_fill(0x12345678);
+    CHECK(test_vbe_attach(32, VBE_TEST_WIDTH, 0));
+    CHECK(vbe_console_active());
+    CHECK(vbe_console_get_mode()->width == VBE_TEST_WIDTH);
+    CHECK(test_vbe_count(0x12345678) == (VBE_TEST_PITCH - VBE_TEST_WIDTH) * VBE_TEST_HEIGHT);
+
+    // One glyph, white on blue: only its rectangle reaches the screen
+    test_vbe_fill(0x12345678);
+    vbe_console_draw(2 * FB_WIDTH + 3, &cell, 1);
+    vbe_console_present();
+    CHECK(test_vbe_cell_ok(2 * FB_WIDTH + 3, 'A', 0xFFFFFF, 0x0000AA, 0));
+    CHECK(test_vbe_count(0x12345678) == VBE_TEST_PITCH * VBE_TEST_HEIGHT -
+                                         VBE_CELL_WIDTH * VBE_CELL_HEIGHT);
+
+    // Drawing it again is skipped and leaves nothing to present
+    presents = stats->presents;
+    i = stats->glyphs_skipped;
+    vbe_console_draw(2 * FB_WIDTH + 3, &cell, 1);
+    vbe_console_present();
+    CHECK(stats->glyphs_skipped == i + 1);
+    CHECK(stats->presents == presents);
+
+    // The cursor goes over the cell and comes off when it moves on
+    vbe_console_set_cursor(2 * FB_WIDTH + 3);
+    vbe_console_present();
+    CHECK(test_vbe_cell_ok(2 * FB_WIDTH + 3, 'A', 0xFFFFFF, 0x0000AA, 1));
+    vbe_console_set_cursor(VBE_NO_CURSOR);
+    vbe_console_present();
+    CHECK(test_vbe_cell_ok(2 * FB_WIDTH + 3, 'A', 0xFFFFFF, 0x0000AA, 0));
+
+    // A line of text in the default colours, black on grey
+    CHECK(test_vbe_attach(32, VBE_TEST_WIDTH, 0));
+    for (i = 0; i < sizeof(text) - 1; i++) {
+        cells[i] = (u8int) text[i] | 0xF000;
+    }
+    vbe_console_draw(FB_WIDTH, cells, sizeof(text) - 1);
+    vbe_console_present();
+    for (i = 0; i < sizeof(text) - 1; i++) {
+        CHECK(test_vbe_cell_ok(FB_WIDTH + i, text[i], 0x000000, 0xAAAAAA, 0));
+    }
+
+    // Scrolling moves the pixels as drawing the moved rows would
+    CHECK(test_vbe_attach(32, VBE_TEST_WIDTH, 0));
+    test_vbe_rows(0, FB_HEIGHT);
+    vbe_console_present();
+    vbe_console_scroll();
+    for (i = 0; i < FB_WIDTH; i++) {
+        cells[i] = 'z' | 0x0700;
+    }
+    vbe_console_draw((FB_HEIGHT - 1) * FB_WIDTH, cells, FB_WIDTH);
+    vbe_console_present();
+
+    // The moved rows are known to be on screen already
+    i = stats->glyphs_drawn;
+    test_vbe_rows(1, FB_HEIGHT - 1);
+    CHECK(stats->glyphs_drawn == i);
+
+    for (i = 0; i < VBE_CONSOLE_WIDTH * VBE_CONSOLE_HEIGHT; i++) {
+        vbe_snapshot[i] = vbe_back[i];
+    }
+    vbe_console_invalidate();
+    test_vbe_rows(1, FB_HEIGHT - 1);
+    CHECK(memcmp(vbe_snapshot, vbe_back, sizeof(vbe_back)) == 0);
+
+    // and the screen got all of it
+    y = 0;
+    for (i = 0; i < VBE_CONSOLE_WIDTH * VBE_CONSOLE_HEIGHT; i++) {
+        y += test_vbe_pixel(i % VBE_CONSOLE_WIDTH, i / VBE_CONSOLE_WIDTH) != vbe_back[i];
+    }
+    CHECK(y == 0);
+
+    // Colours follow the field positions the mode gives
+    CHECK(test_vbe_attach(32, VBE_TEST_WIDTH, 1));
+    vbe_console_draw(0, &cell, 1);
+    vbe_console_present();
+    CHECK(test_vbe_cell_ok(0, 'A', 0xFFFFFF, 0xAA0000, 0));
+}
+
+int main(void)
+{
+    klib_init();
+    terminal_init();
+
+    test_ring_basics();
+    test_ring_fuzz();
+    test_readline();
+    test_deferred();
+    test_tokenize();
+    test_tokenize_fuzz();
+    test_commands();
+    test_keyboard();
+    test_keyboard_fuzz();
+    test_klib();
+    test_klib_fuzz();
+    test_vbe();
+
+    host_printf("host-test: %u checks, %u failed\n", checks, failures);
+    return failures != 0;
+}
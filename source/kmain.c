@@ -1,23 +1,152 @@
 #include "drivers/frame_buffer.h"
 #include "drivers/interrupts.h"
-#include "drivers/hardware_interrupt_enabler.h"
 #include "drivers/terminal.h"
+#include "drivers/clock.h"
+#include "drivers/serial.h"
+#include "drivers/multiboot.h"
+#include "drivers/pmm.h"
+#include "drivers/paging.h"
+#include "drivers/gdt.h"
+#include "drivers/syscall.h"
+#include "drivers/user.h"
+#include "drivers/thread.h"
+#include "drivers/lapic.h"
+#include "drivers/irq.h"
+#include "drivers/smp.h"
+#include "drivers/initcall.h"
+#include "drivers/klib.h"
 
-/* Main kernel function called from loader.asm */
-void kmain()
+/** kmain_cmdline_has:
+ * Checks whether the kernel command line contains the given option
+ */
+static int kmain_cmdline_has(const char *cmdline, const char *option)
 {
-    /* Initialize interrupts */
-    interrupts_install_idt();
-    
-    /* Enable hardware interrupts */
-    enable_hardware_interrupts();
-    
-    /* Initialize and run terminal */
-    terminal_init();
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 0; cmdline[i] != '\0'; i++) {
+        for (j = 0; option[j] != '\0' && cmdline[i + j] == option[j]; j++) {
+        }
+        if (option[j] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* What GRUB passed to kmain, for the phases that need it */
+static struct multiboot_info *boot_mbi = 0;
+static const char *boot_cmdline = "";
+
+/** kmain_terminal:
+ * Body of the terminal thread
+ */
+static void kmain_terminal(unsigned int arg)
+{
+    (void) arg;
     terminal_run();
-    
-    /* Should never reach here */
-    while(1) {
-        __asm__ volatile("hlt");
+}
+
+/* Replace GRUB's GDT with ours, which has ring 3 segments and a TSS and
+ * per-CPU area for each CPU, and load the boot CPU's */
+static void kmain_gdt(void)
+{
+    gdt_init();
+    smp_init_bsp();
+}
+static INITCALL(10, "gdt", kmain_gdt, 0);
+
+/* Turn on SSE for the mem/str routines; the APs copy CR0 and CR4 */
+static INITCALL(12, "klib", klib_init, 0);
+
+/* Initialize interrupts */
+static INITCALL(15, "idt", interrupts_install_idt, 0);
+
+/* Hand the installed RAM to the frame allocator */
+static void kmain_pmm(void)
+{
+    pmm_init(boot_mbi);
+}
+static INITCALL(20, "pmm", kmain_pmm, 0);
+
+/* Turn on paging */
+static INITCALL(25, "paging", paging_init, 0);
+
+/* Move the console to the loader's linear framebuffer, if it set one up */
+static void kmain_console(void)
+{
+    fb_init_graphics(boot_mbi);
+}
+static INITCALL(27, "console", kmain_console, 0);
+
+/* Start the PIT tick and calibrate the TSC */
+static void kmain_clock(void)
+{
+    clock_init(CLOCK_DEFAULT_HZ);
+}
+static INITCALL(30, "clock", kmain_clock, 0);
+
+/* Idle without the periodic tick when the local APIC timer can wake us */
+static void kmain_lapic(void)
+{
+    if (lapic_init()) {
+        clock_set_tickless(1);
+    }
+}
+static INITCALL(35, "lapic", kmain_lapic, 0);
+
+/* Route IRQs through the I/O APIC if the MADT describes one */
+static void kmain_irq(void)
+{
+    irq_init();
+}
+static INITCALL(40, "irq", kmain_irq, 0);
+
+/* Mirror the console to COM1 unless booted with console=vga */
+static void kmain_serial(void)
+{
+    if (!kmain_cmdline_has(boot_cmdline, "console=vga") && serial_init()) {
+        fb_set_mirror(serial_console_putc);
+    }
+}
+static INITCALL(45, "serial", kmain_serial, 0);
+
+/* The boot context becomes the idle thread */
+static INITCALL(50, "thread", thread_init, 0);
+
+/* Start the other CPUs; each becomes an idle thread stealing work */
+static void kmain_smp(void)
+{
+    smp_init();
+}
+static INITCALL(55, "smp", kmain_smp, 0);
+
+/* The terminal shares the input path with the boot CPU's interrupt
+ * handlers, so it stays there */
+static void kmain_terminal_start(void)
+{
+    terminal_init();
+    thread_create_on("terminal", kmain_terminal, 0, 0);
+}
+static INITCALL(60, "terminal", kmain_terminal_start, 0);
+
+/* Main kernel function called from loader.asm */
+void kmain(unsigned int magic, struct multiboot_info *mbi)
+{
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        mbi = 0;
+    }
+    if (mbi != 0 && (mbi->flags & MULTIBOOT_INFO_CMDLINE)) {
+        boot_cmdline = (const char *) mbi->cmdline;
     }
+    boot_mbi = mbi;
+
+    /* Run the boot phases above, timing each for boottime */
+    initcall_run();
+
+    /* Enable hardware interrupts */
+    irq_enable();
+
+    /* Halt whenever no thread is ready */
+    thread_idle();
 }
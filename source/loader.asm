@@ -1,13 +1,26 @@
 global loader                   ; the entry symbol for ELF
+global boot_tsc                 ; TSC at the first instruction, for boottime
 
 extern kmain                    ; kmain is defined in kmain.c
 
 MAGIC_NUMBER equ 0x1BADB002     ; define the magic number constant
-FLAGS        equ 0x0            ; multiboot flags
-CHECKSUM     equ -MAGIC_NUMBER  ; calculate the checksum
+ALIGN_MODULES equ 1 << 0        ; load modules on page boundaries
+MEMINFO      equ 1 << 1         ; ask for mem_lower/mem_upper and the memory map
+%ifdef VBE_CONSOLE
+VIDEO_MODE   equ 1 << 2         ; ask for the graphics mode below (make VBE=1)
+FLAGS        equ ALIGN_MODULES | MEMINFO | VIDEO_MODE
+%else
+FLAGS        equ ALIGN_MODULES | MEMINFO    ; multiboot flags
+%endif
+CHECKSUM     equ -(MAGIC_NUMBER + FLAGS)    ; calculate the checksum
 
 KERNEL_STACK_SIZE equ 4096      ; size of stack in bytes (4KB)
 
+section .data
+align 8
+boot_tsc:                       ; written before anything else runs
+    dd 0, 0
+
 section .bss
 align 4                         ; align at 4 bytes
 kernel_stack:                   ; label points to beginning of memory
@@ -18,9 +31,21 @@ section .text                   ; start of the text (code) section
     dd MAGIC_NUMBER             ; write the magic number to the machine code,
     dd FLAGS                    ; the flags,
     dd CHECKSUM                 ; and the checksum
+%ifdef VBE_CONSOLE
+    dd 0, 0, 0, 0, 0            ; load addresses, unused without flag bit 16
+    dd 0                        ; mode type: linear framebuffer
+    dd 640, 480, 32             ; width, height and depth, VBE_REQUEST_* in vbe_console.h
+%endif
 
 loader:                         ; the loader label (defined as entry point in linker script)
+    mov ecx, eax                ; keep the multiboot magic from rdtsc
+    rdtsc                       ; time the boot from here
+    mov [boot_tsc], eax
+    mov [boot_tsc + 4], edx
+    mov eax, ecx
     mov esp, kernel_stack + KERNEL_STACK_SIZE   ; point esp to the start of the stack
+    push ebx                    ; multiboot information structure
+    push eax                    ; multiboot magic number
     call kmain                  ; call kmain function in C
 
 .loop:
@@ -0,0 +1,100 @@
+/* Programs that run in ring 3. link.ld places this file, and only this
+ * file, in the user area, so nothing here may call into the kernel except
+ * through the system call stubs. */
+
+#include "drivers/syscall.h"
+#include "drivers/user.h"
+#include "drivers/types.h"
+
+static u32int user_strlen(const char *s)
+{
+    u32int len = 0;
+
+    while (s[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+static void user_write(const char *s, u32int len)
+{
+    syscall_int80(SYSCALL_WRITE, (u32int) s, len, 0);
+}
+
+static u32int user_atoi(const char *s)
+{
+    u32int value = 0;
+
+    while (*s >= '0' && *s <= '9') {
+        value = value * 10 + (u32int) (*s - '0');
+        s++;
+    }
+    return value;
+}
+
+void user_start(s32int (*main)(u32int argc, char **argv), u32int argc, char **argv)
+{
+    s32int status = main(argc, argv);
+
+    while (1) {
+        syscall_int80(SYSCALL_EXIT, (u32int) status, 0, 0);
+    }
+}
+
+/** echo:
+ * Writes its arguments separated by spaces
+ */
+static s32int user_echo(u32int argc, char **argv)
+{
+    u32int i;
+
+    for (i = 1; i < argc; i++) {
+        if (i > 1) {
+            user_write(" ", 1);
+        }
+        user_write(argv[i], user_strlen(argv[i]));
+    }
+    user_write("\n", 1);
+    return 0;
+}
+
+/** sysnull_int80, sysnull_sysenter:
+ * Make argv[1] empty system calls through each entry path
+ */
+static s32int user_sysnull_int80(u32int argc, char **argv)
+{
+    u32int n = argc > 1 ? user_atoi(argv[1]) : 1;
+
+    while (n-- > 0) {
+        syscall_int80(SYSCALL_NULL, 0, 0, 0);
+    }
+    return 0;
+}
+
+static s32int user_sysnull_sysenter(u32int argc, char **argv)
+{
+    u32int n = argc > 1 ? user_atoi(argv[1]) : 1;
+
+    while (n-- > 0) {
+        syscall_sysenter(SYSCALL_NULL, 0, 0, 0);
+    }
+    return 0;
+}
+
+/** fault:
+ * Writes to kernel memory, which should kill the program
+ */
+static s32int user_fault(__attribute__((unused)) u32int argc, __attribute__((unused)) char **argv)
+{
+    *(volatile u32int *) 0x00100000 = 0;
+    user_write("kernel memory was writable\n", 27);
+    return 1;
+}
+
+const struct user_program user_programs[] = {
+    { "echo", user_echo },
+    { "fault", user_fault },
+    { "sysnull_int80", user_sysnull_int80 },
+    { "sysnull_sysenter", user_sysnull_sysenter },
+    { 0, 0 }
+};